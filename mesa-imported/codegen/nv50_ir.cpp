@@ -23,6 +23,7 @@
 #include "codegen/nv50_ir.h"
 #include "codegen/nv50_ir_target.h"
 #include "codegen/nv50_ir_driver.h"
+#include "util/u_compile_stats.h" // fincs-addition
 
 // fincs-edit: these are actually not needed
 //extern "C" {
@@ -582,6 +583,7 @@ void Instruction::init()
    ipa = 0;
    mask = 0;
    precise = 0;
+   mediump = 0; // fincs-addition
 
    lanes = 0xf;
 
@@ -766,6 +768,7 @@ Instruction::clone(ClonePolicy<Function>& pol, Instruction *i) const
    i->mask = mask;
    i->ftz = ftz;
    i->dnz = dnz;
+   i->mediump = mediump; // fincs-addition
    i->ipa = ipa;
    i->lanes = lanes;
    i->perPatch = perPatch;
@@ -1125,6 +1128,7 @@ Program::Program(Type type, Target *arch)
    fp64 = false;
    fp64_rcprsq = false; // fincs-addition
    int_divmod = false; // fincs-addition
+   spillLoads = spillStores = 0; // fincs-addition
 
    main = new Function(this, "MAIN", ~0);
    calls.insert(&main->call);
@@ -1245,45 +1249,65 @@ nv50_ir_generate_code(struct nv50_ir_prog_info *info)
    prog->dbgFlags = info->dbgFlags;
    prog->optLevel = info->optLevel;
 
+   // fincs-addition: compile time instrumentation of each step
+   compile_stats_begin(info->bin.sourceRep == PIPE_SHADER_IR_GLSL ? "makeFromGLSL" : "makeFromTGSI");
    switch (info->bin.sourceRep) {
    case PIPE_SHADER_IR_TGSI:
       ret = prog->makeFromTGSI(info) ? 0 : -2;
       break;
+   case PIPE_SHADER_IR_GLSL: // fincs-addition
+      ret = prog->makeFromGLSL(info) ? 0 : -2;
+      break;
    default:
       ret = -1;
       break;
    }
+   compile_stats_end();
    if (ret < 0)
       goto out;
    if (prog->dbgFlags & NV50_IR_DEBUG_VERBOSE)
       prog->print();
 
    targ->parseDriverInfo(info);
+   compile_stats_begin("legalizePreSSA");
    prog->getTarget()->runLegalizePass(prog, nv50_ir::CG_STAGE_PRE_SSA);
+   compile_stats_end();
 
+   compile_stats_begin("convertToSSA");
    prog->convertToSSA();
+   compile_stats_end();
 
    if (prog->dbgFlags & NV50_IR_DEBUG_VERBOSE)
       prog->print();
 
+   compile_stats_begin("optimizeSSA");
    prog->optimizeSSA(info->optLevel);
+   compile_stats_end();
+   compile_stats_begin("legalizeSSA");
    prog->getTarget()->runLegalizePass(prog, nv50_ir::CG_STAGE_SSA);
+   compile_stats_end();
 
    if (prog->dbgFlags & NV50_IR_DEBUG_BASIC)
       prog->print();
 
-   if (!prog->registerAllocation()) {
-      ret = -4;
+   compile_stats_begin("registerAllocation");
+   ret = prog->registerAllocation() ? 0 : -4;
+   compile_stats_end();
+   if (ret < 0)
       goto out;
-   }
+   compile_stats_begin("legalizePostRA");
    prog->getTarget()->runLegalizePass(prog, nv50_ir::CG_STAGE_POST_RA);
+   compile_stats_end();
 
+   compile_stats_begin("optimizePostRA");
    prog->optimizePostRA(info->optLevel);
+   compile_stats_end();
 
-   if (!prog->emitBinary(info)) {
-      ret = -5;
+   compile_stats_begin("emitBinary");
+   ret = prog->emitBinary(info) ? 0 : -5;
+   compile_stats_end();
+   if (ret < 0)
       goto out;
-   }
 
 out:
    INFO_DBG(prog->dbgFlags, VERBOSE, "nv50_ir_generate_code: ret = %i\n", ret);
@@ -282,6 +282,16 @@ enum operation
 #define NV50_IR_SUBOP_XMAD_H1(i) (1 << (NV50_IR_SUBOP_XMAD_H1_SHIFT + (i)))
 #define NV50_IR_SUBOP_XMAD_H1_MASK (0x3 << NV50_IR_SUBOP_XMAD_H1_SHIFT)
 
+// fincs-addition: ADD/MUL/MAD with a TYPE_F16X2 sType operate on two f16
+// values per register. The subOp holds the swizzle applied to each source;
+// a TYPE_F32 dType only writes the result of the low half, as an f32.
+#define NV50_IR_SUBOP_HALF2_H1_H0 0
+#define NV50_IR_SUBOP_HALF2_F32   1 // source is an f32, used for both halves
+#define NV50_IR_SUBOP_HALF2_H0_H0 2
+#define NV50_IR_SUBOP_HALF2_H1_H1 3
+#define NV50_IR_SUBOP_HALF2(s, swz) ((swz) << (2 * (s)))
+#define NV50_IR_SUBOP_HALF2_GET(subOp, s) (((subOp) >> (2 * (s))) & 3)
+
 enum DataType
 {
    TYPE_NONE,
@@ -297,7 +307,8 @@ enum DataType
    TYPE_F32,
    TYPE_F64,
    TYPE_B96,
-   TYPE_B128
+   TYPE_B128,
+   TYPE_F16X2 // fincs-addition: two packed f16 (GM107+ HADD2/HMUL2/HFMA2)
 };
 
 enum CondCode
@@ -914,6 +925,7 @@ public:
    unsigned mask       : 4; // for vector ops
    // prevent algebraic optimisations that aren't bit-for-bit identical
    unsigned precise    : 1;
+   unsigned mediump    : 1; // fincs-addition: may be computed at half precision
 
    int8_t postFactor; // MUL/DIV(if < 0) by 1 << postFactor
 
@@ -1286,6 +1298,7 @@ public:
    inline void add(Value *rval, int& id) { allRValues.insert(rval, id); }
 
    bool makeFromTGSI(struct nv50_ir_prog_info *);
+   bool makeFromGLSL(struct nv50_ir_prog_info *); // fincs-addition
    bool convertToSSA();
    bool optimizeSSA(int level);
    bool optimizePostRA(int level);
@@ -1315,6 +1328,7 @@ public:
    bool fp64;
    bool fp64_rcprsq; // fincs-addition
    bool int_divmod; // fincs-addition
+   uint32_t spillLoads, spillStores; // fincs-addition: counted by RA
 
    MemoryPool mem_Instruction;
    MemoryPool mem_CmpInstruction;
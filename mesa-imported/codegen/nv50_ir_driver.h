@@ -74,6 +74,16 @@ struct nv50_ir_prog_symbol
 #define NVISA_GK20A_CHIPSET    0xea
 #define NVISA_GM107_CHIPSET    0x110
 #define NVISA_GM200_CHIPSET    0x120
+#define NVISA_GM20B_CHIPSET    0x12b // fincs-addition
+
+/* fincs-addition: static statistics of the generated code */
+struct nv50_ir_code_stats
+{
+   uint32_t alu, sfu, tex, mem, flow; /* emitted instructions by class */
+   uint32_t barriers;                 /* thread barriers (BAR) */
+   uint32_t spillLoads, spillStores;  /* local memory accesses added by RA */
+   uint32_t stallCycles;              /* sum of the scheduling stall counts */
+};
 
 struct nv50_ir_prog_info
 {
@@ -93,6 +103,8 @@ struct nv50_ir_prog_info
       uint32_t *code;
       uint32_t codeSize;
       uint32_t instructions;
+      uint16_t crsDepth;  /* fincs-addition: max call-return stack entries in use */
+      struct nv50_ir_code_stats stats; /* fincs-addition */
       uint8_t sourceRep;  /* PIPE_SHADER_IR_* */
       const void *source;
       void *relocData;
@@ -179,8 +191,9 @@ struct nv50_ir_prog_info
       uint8_t globalAccess;      /* 1 for read, 2 for wr, 3 for rw */
       bool fp64;                 /* program uses fp64 math */
       bool fp64_rcprsq;          /* fincs-addition: program uses fp64 rcp/rsq */
-      bool int_divmod;           /* fincs-addition: program uses integer div/mod */
+      bool int_divmod;           /* fincs-addition: program uses emulated 64-bit integer div/mod */
       bool mul_zero_wins;        /* program wants for x*0 = 0 */
+      bool packHalfFloats;       /* fincs-addition: compute mediump math as packed f16x2 */
       bool layer_viewport_relative;
       bool nv50styleSurfaces;    /* generate gX[] access for raw buffers */
       uint16_t texBindBase;      /* base address for tex handles (nve4) */
@@ -206,6 +219,10 @@ extern "C" {
 
 extern int nv50_ir_generate_code(struct nv50_ir_prog_info *);
 
+// fincs-addition: whether a linked shader can be passed as PIPE_SHADER_IR_GLSL
+struct gl_linked_shader;
+extern bool nv50_ir_glsl_supported(const struct gl_linked_shader *);
+
 extern void nv50_ir_relocate_code(void *relocData, uint32_t *code,
                                   uint32_t codePos,
                                   uint32_t libPos,
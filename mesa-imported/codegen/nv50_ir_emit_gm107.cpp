@@ -23,6 +23,7 @@
  */
 
 #include "codegen/nv50_ir_target_gm107.h"
+#include "util/u_compile_stats.h" // fincs-addition
 
 //#define GM107_DEBUG_SCHED_DATA
 
@@ -39,6 +40,9 @@ public:
    virtual void prepareEmission(Program *);
    virtual void prepareEmission(Function *);
 
+   // fincs-addition
+   virtual int getStallCount(const Instruction *i) const { return i->sched & 0xf; }
+
    inline void setProgramType(Program::Type pType) { progType = pType; }
 
 private:
@@ -144,6 +148,9 @@ private:
    void emitFADD();
    void emitFMUL();
    void emitFFMA();
+   void emitHADD2(); // fincs-addition
+   void emitHMUL2(); // fincs-addition
+   void emitHFMA2(); // fincs-addition
    void emitMUFU();
    void emitFMNMX();
    void emitRRO();
@@ -1429,6 +1436,60 @@ CodeEmitterGM107::emitFFMA()
    emitGPR(0x00, insn->def(0));
 }
 
+// fincs-addition: packed f16x2 arithmetic (sm_53), register forms only. The
+// swizzle of each source comes from the subOp; a TYPE_F32 dType selects the
+// F32 merge mode, which writes the low half result as an f32.
+void
+CodeEmitterGM107::emitHADD2()
+{
+   assert(!insn->src(0).mod);
+
+   emitInsn (0x5d100000);
+   emitField(0x31, 2, insn->dType == TYPE_F32);
+   emitField(0x2f, 2, NV50_IR_SUBOP_HALF2_GET(insn->subOp, 0));
+   emitSAT  (0x20);
+   emitNEG  (0x1f, insn->src(1));
+   emitField(0x1c, 2, NV50_IR_SUBOP_HALF2_GET(insn->subOp, 1));
+   emitGPR  (0x14, insn->src(1));
+   emitGPR  (0x08, insn->src(0));
+   emitGPR  (0x00, insn->def(0));
+}
+
+void
+CodeEmitterGM107::emitHMUL2()
+{
+   assert(!insn->src(0).mod);
+
+   emitInsn (0x5d080000);
+   emitField(0x31, 2, insn->dType == TYPE_F32);
+   emitField(0x2f, 2, NV50_IR_SUBOP_HALF2_GET(insn->subOp, 0));
+   emitSAT  (0x20);
+   emitNEG  (0x1f, insn->src(1));
+   emitField(0x1c, 2, NV50_IR_SUBOP_HALF2_GET(insn->subOp, 1));
+   emitGPR  (0x14, insn->src(1));
+   emitGPR  (0x08, insn->src(0));
+   emitGPR  (0x00, insn->def(0));
+}
+
+void
+CodeEmitterGM107::emitHFMA2()
+{
+   assert(!insn->src(0).mod);
+
+   emitInsn (0x5d000000);
+   emitField(0x31, 2, insn->dType == TYPE_F32);
+   emitField(0x2f, 2, NV50_IR_SUBOP_HALF2_GET(insn->subOp, 0));
+   emitGPR  (0x27, insn->src(2));
+   emitField(0x23, 2, NV50_IR_SUBOP_HALF2_GET(insn->subOp, 2));
+   emitSAT  (0x20);
+   emitNEG  (0x1f, insn->src(1));
+   emitNEG  (0x1e, insn->src(2));
+   emitField(0x1c, 2, NV50_IR_SUBOP_HALF2_GET(insn->subOp, 1));
+   emitGPR  (0x14, insn->src(1));
+   emitGPR  (0x08, insn->src(0));
+   emitGPR  (0x00, insn->def(0));
+}
+
 void
 CodeEmitterGM107::emitMUFU()
 {
@@ -3524,6 +3585,9 @@ CodeEmitterGM107::emitInstruction(Instruction *i)
       break;
    case OP_ADD:
    case OP_SUB:
+      if (insn->sType == TYPE_F16X2) { // fincs-addition
+         emitHADD2();
+      } else
       if (isFloatType(insn->dType)) {
          if (insn->dType == TYPE_F64)
             emitDADD();
@@ -3534,6 +3598,9 @@ CodeEmitterGM107::emitInstruction(Instruction *i)
       }
       break;
    case OP_MUL:
+      if (insn->sType == TYPE_F16X2) { // fincs-addition
+         emitHMUL2();
+      } else
       if (isFloatType(insn->dType)) {
          if (insn->dType == TYPE_F64)
             emitDMUL();
@@ -3545,6 +3612,9 @@ CodeEmitterGM107::emitInstruction(Instruction *i)
       break;
    case OP_MAD:
    case OP_FMA:
+      if (insn->sType == TYPE_F16X2) { // fincs-addition
+         emitHFMA2();
+      } else
       if (isFloatType(insn->dType)) {
          if (insn->dType == TYPE_F64)
             emitDFMA();
@@ -3929,25 +3999,45 @@ private:
 
    inline void printSchedInfo(int, const Instruction *) const;
 
-   struct LiveBarUse {
-      LiveBarUse(Instruction *insn, Instruction *usei)
-         : insn(insn), usei(usei) { }
-      Instruction *insn;
-      Instruction *usei;
+   // fincs-edit: dependency barriers are tracked across the whole function
+   struct BarRegs {
+      uint32_t r[8];
+      uint8_t p;
+      bool c;
+
+      void add(const Value *);
+      bool test(const Value *) const;
+      void merge(const BarRegs &that)
+      {
+         for (int i = 0; i < 8; ++i)
+            r[i] |= that.r[i];
+         p |= that.p;
+         c |= that.c;
+      }
    };
 
-   struct LiveBarDef {
-      LiveBarDef(Instruction *insn, Instruction *defi)
-         : insn(insn), defi(defi) { }
-      Instruction *insn;
-      Instruction *defi;
+   struct BarState {
+      BarRegs use[6]; // wait before reading or writing (RaW/WaW)
+      BarRegs def[6]; // wait before writing (WaR)
+      uint8_t live;
+
+      void merge(const BarState &that)
+      {
+         for (int b = 0; b < 6; ++b) {
+            use[b].merge(that.use[b]);
+            def[b].merge(that.def[b]);
+         }
+         live |= that.live;
+      }
    };
 
-   bool insertBarriers(BasicBlock *);
+   std::vector<BarState> barStates; // state at the exit of each BB
 
-   bool doesInsnWriteTo(const Instruction *insn, const Value *val) const;
-   Instruction *findFirstUse(const Instruction *) const;
-   Instruction *findFirstDef(const Instruction *) const;
+   void insertBarriers(Function *);
+   void insertBarriers(BasicBlock *, BarState &, bool);
+   void waitBarrier(Instruction *, BarState &, int);
+   int allocBarrier(BarState &) const;
+   bool needWaitBarrier(const Instruction *, const BarState &, int) const;
 
    bool needRdDepBar(const Instruction *) const;
    bool needWrDepBar(const Instruction *) const;
@@ -4275,205 +4365,238 @@ SchedDataCalculatorGM107::needWrDepBar(const Instruction *insn) const
    return false;
 }
 
-// Helper function for findFirstUse() and findFirstDef()
+void
+SchedDataCalculatorGM107::BarRegs::add(const Value *v)
+{
+   int a, b;
+
+   switch (v->reg.file) {
+   case FILE_GPR:
+      if (v->reg.data.id == 255)
+         break;
+      a = v->reg.data.id;
+      b = MIN2(a + MAX2(v->reg.size / 4, 1), 255);
+      for (int i = a; i < b; ++i)
+         r[i / 32] |= 1u << (i % 32);
+      break;
+   case FILE_PREDICATE:
+      if (v->reg.data.id < 7)
+         p |= 1 << v->reg.data.id;
+      break;
+   case FILE_FLAGS:
+      c = true;
+      break;
+   default:
+      break;
+   }
+}
+
 bool
-SchedDataCalculatorGM107::doesInsnWriteTo(const Instruction *insn,
-                                          const Value *val) const
+SchedDataCalculatorGM107::BarRegs::test(const Value *v) const
 {
-   if (val->reg.file != FILE_GPR &&
-       val->reg.file != FILE_PREDICATE &&
-       val->reg.file != FILE_FLAGS)
-      return false;
+   int a, b;
 
-   for (int d = 0; insn->defExists(d); ++d) {
-      const Value* def = insn->getDef(d);
-      int minGPR = def->reg.data.id;
-      int maxGPR = minGPR + def->reg.size / 4 - 1;
+   switch (v->reg.file) {
+   case FILE_GPR:
+      if (v->reg.data.id == 255)
+         return false;
+      a = v->reg.data.id;
+      b = MIN2(a + MAX2(v->reg.size / 4, 1), 255);
+      for (int i = a; i < b; ++i)
+         if (r[i / 32] & (1u << (i % 32)))
+            return true;
+      return false;
+   case FILE_PREDICATE:
+      return v->reg.data.id < 7 && (p & (1 << v->reg.data.id));
+   case FILE_FLAGS:
+      return c;
+   default:
+      return false;
+   }
+}
 
-      if (def->reg.file != val->reg.file)
-         continue;
+// Return true when the given instruction touches a register protected by
+// the given barrier, and thus has to wait on it before being issued.
+bool
+SchedDataCalculatorGM107::needWaitBarrier(const Instruction *insn,
+                                          const BarState &state, int b) const
+{
+   const BarRegs &use = state.use[b], &def = state.def[b];
 
-      if (def->reg.file == FILE_GPR) {
-         if (val->reg.data.id + val->reg.size / 4 - 1 < minGPR ||
-             val->reg.data.id > maxGPR)
-            continue;
-         return true;
-      } else
-      if (def->reg.file == FILE_PREDICATE) {
-         if (val->reg.data.id != minGPR)
-            continue;
-         return true;
-      } else
-      if (def->reg.file == FILE_FLAGS) {
-         if (val->reg.data.id != minGPR)
-            continue;
+   for (int s = 0; insn->srcExists(s); ++s) {
+      if (use.test(insn->getSrc(s)))
          return true;
+      for (int d = 0; d < 2; ++d) {
+         const Value *ind = insn->getIndirect(s, d);
+         if (ind && use.test(ind))
+            return true;
       }
    }
 
+   for (int d = 0; insn->defExists(d); ++d)
+      if (use.test(insn->getDef(d)) || def.test(insn->getDef(d)))
+         return true;
+
    return false;
 }
 
-// Find the next instruction inside the same basic block which uses (reads or
-// writes from) the output of the given instruction in order to avoid RaW and
-// WaW hazards.
-Instruction *
-SchedDataCalculatorGM107::findFirstUse(const Instruction *bari) const
+void
+SchedDataCalculatorGM107::waitBarrier(Instruction *insn, BarState &state,
+                                      int b)
 {
-   Instruction *insn, *next;
-
-   if (!bari->defExists(0))
-      return NULL;
-
-   for (insn = bari->next; insn != NULL; insn = next) {
-      next = insn->next;
-
-      for (int s = 0; insn->srcExists(s); ++s)
-         if (doesInsnWriteTo(bari, insn->getSrc(s)))
-            return insn;
-
-      for (int d = 0; insn->defExists(d); ++d)
-         if (doesInsnWriteTo(bari, insn->getDef(d)))
-            return insn;
-   }
-   return NULL;
+   emitWtDepBar(insn, b);
+   memset(&state.use[b], 0, sizeof(state.use[b]));
+   memset(&state.def[b], 0, sizeof(state.def[b]));
+   state.live &= ~(1 << b);
 }
 
-// Find the next instruction inside the same basic block which overwrites, at
-// least, one source of the given instruction in order to avoid WaR hazards.
-Instruction *
-SchedDataCalculatorGM107::findFirstDef(const Instruction *bari) const
+int
+SchedDataCalculatorGM107::allocBarrier(BarState &state) const
 {
-   Instruction *insn, *next;
-
-   if (!bari->srcExists(0))
-      return NULL;
-
-   for (insn = bari->next; insn != NULL; insn = next) {
-      next = insn->next;
-
-      for (int s = 0; bari->srcExists(s); ++s)
-         if (doesInsnWriteTo(insn, bari->getSrc(s)))
-            return insn;
+   for (int b = 0; b < 6; ++b) {
+      if (!(state.live & (1 << b))) {
+         state.live |= 1 << b;
+         return b;
+      }
    }
-   return NULL;
+   // All barriers are in flight, share the last one. Waiting on it then
+   // waits for every instruction which has been assigned to it.
+   return 5;
 }
 
 // Dependency barriers:
-// This pass is a bit ugly and could probably be improved by performing a
-// better allocation.
-//
 // The main idea is to avoid WaR and RaW hazards by emitting read/write
 // dependency barriers using the control codes.
-bool
-SchedDataCalculatorGM107::insertBarriers(BasicBlock *bb)
+//
+// Barriers are allocated along the CFG: each BB starts from the union of the
+// barriers still in flight at the end of its (forward) predecessors, and a
+// barrier is only waited on by the first instruction which actually touches
+// one of the registers it protects. Loops wait on everything before taking
+// the back edge so that loop headers don't depend on their own body.
+void
+SchedDataCalculatorGM107::insertBarriers(BasicBlock *bb, BarState &state,
+                                         bool loop)
 {
-   std::list<LiveBarUse> live_uses;
-   std::list<LiveBarDef> live_defs;
-   Instruction *insn, *next;
-   BitSet bars(6, 1);
-   int bar_id;
-
-   for (insn = bb->getEntry(); insn != NULL; insn = next) {
-      Instruction *usei = NULL, *defi = NULL;
-      bool need_wr_bar, need_rd_bar;
-
-      next = insn->next;
-
-      // Expire old barrier uses.
-      for (std::list<LiveBarUse>::iterator it = live_uses.begin();
-           it != live_uses.end();) {
-         if (insn->serial >= it->usei->serial) {
-            int wr = getWrDepBar(it->insn);
-            emitWtDepBar(insn, wr);
-            bars.clr(wr); // free barrier
-            it = live_uses.erase(it);
-            continue;
-         }
-         ++it;
+   for (Instruction *insn = bb->getEntry(); insn; insn = insn->next) {
+      for (int b = 0; b < 6; ++b) {
+         if ((state.live & (1 << b)) && needWaitBarrier(insn, state, b))
+            waitBarrier(insn, state, b);
       }
 
-      // Expire old barrier defs.
-      for (std::list<LiveBarDef>::iterator it = live_defs.begin();
-           it != live_defs.end();) {
-         if (insn->serial >= it->defi->serial) {
-            int rd = getRdDepBar(it->insn);
-            emitWtDepBar(insn, rd);
-            bars.clr(rd); // free barrier
-            it = live_defs.erase(it);
-            continue;
-         }
-         ++it;
+      // Calls and returns leave the current function, and back edges would
+      // have to be resolved before the loop body is known.
+      if (insn->op == OP_CALL || insn->op == OP_RET ||
+          (loop && insn == bb->getExit())) {
+         for (int b = 0; b < 6; ++b)
+            if (state.live & (1 << b))
+               waitBarrier(insn, state, b);
       }
 
-      need_wr_bar = needWrDepBar(insn);
-      need_rd_bar = needRdDepBar(insn);
+      bool need_wr_bar = needWrDepBar(insn);
+      bool need_rd_bar = needRdDepBar(insn);
+      int wr = -1;
 
       if (need_wr_bar) {
-         // When the instruction requires to emit a write dependency barrier
-         // (all which write something at a variable latency), find the next
-         // instruction which reads the outputs (or writes to them, potentially
-         // completing before this insn.
-         usei = findFirstUse(insn);
-
-         // Allocate and emit a new barrier.
-         bar_id = bars.findFreeRange(1);
-         if (bar_id == -1)
-            bar_id = 5;
-         bars.set(bar_id);
-         emitWrDepBar(insn, bar_id);
-         if (usei)
-            live_uses.push_back(LiveBarUse(insn, usei));
+         // Any later read or write of the outputs must wait for completion.
+         wr = allocBarrier(state);
+         emitWrDepBar(insn, wr);
+         for (int d = 0; insn->defExists(d); ++d)
+            state.use[wr].add(insn->getDef(d));
       }
 
       if (need_rd_bar) {
-         // When the instruction requires to emit a read dependency barrier
-         // (all which read something at a variable latency), find the next
-         // instruction which will write the inputs.
-         defi = findFirstDef(insn);
+         // Any later write of the inputs must wait until they have been read.
+         // When no barrier is left, rely on the write barrier instead, which
+         // is released later but protects the same registers.
+         int rd = (wr >= 0 && state.live == 0x3f) ? wr : allocBarrier(state);
+         if (rd != wr)
+            emitRdDepBar(insn, rd);
+         for (int s = 0; insn->srcExists(s); ++s)
+            state.def[rd].add(insn->src(s).rep());
+      }
+   }
+}
 
-         if (usei && defi && usei->serial <= defi->serial)
-            continue;
+void
+SchedDataCalculatorGM107::insertBarriers(Function *func)
+{
+   const int size = func->allBBlocks.getSize();
+   std::vector<int> preds(size, 0);
+   std::vector<bool> reached(size, false);
+   std::vector<BasicBlock *> order, stack;
+   int count = 0;
 
-         // Allocate and emit a new barrier.
-         bar_id = bars.findFreeRange(1);
-         if (bar_id == -1)
-            bar_id = 5;
-         bars.set(bar_id);
-         emitRdDepBar(insn, bar_id);
-         if (defi)
-            live_defs.push_back(LiveBarDef(insn, defi));
+   // Visit the BBs in a topological order of the forward edges, so that all
+   // predecessors have been processed when a BB is entered.
+   for (IteratorRef it = func->cfg.iteratorDFS(true); !it->end(); it->next()) {
+      BasicBlock *bb = BasicBlock::get(reinterpret_cast<Graph::Node *>(it->get()));
+      reached[bb->getId()] = true;
+      ++count;
+   }
+   for (int i = 0; i < size; ++i) {
+      BasicBlock *bb = reinterpret_cast<BasicBlock *>(func->allBBlocks.get(i));
+      if (!bb || !reached[i])
+         continue;
+      for (Graph::EdgeIterator ei = bb->cfg.incident(); !ei.end(); ei.next())
+         if (ei.getType() != Graph::Edge::BACK &&
+             reached[BasicBlock::get(ei.getNode())->getId()])
+            ++preds[i];
+   }
+
+   stack.push_back(BasicBlock::get(func->cfg.getRoot()));
+   while (!stack.empty()) {
+      BasicBlock *bb = stack.back();
+      stack.pop_back();
+      order.push_back(bb);
+      for (Graph::EdgeIterator ei = bb->cfg.outgoing(); !ei.end(); ei.next()) {
+         if (ei.getType() == Graph::Edge::BACK)
+            continue;
+         BasicBlock *out = BasicBlock::get(ei.getNode());
+         if (--preds[out->getId()] == 0)
+            stack.push_back(out);
       }
    }
 
-   // Remove unnecessary barrier waits.
-   BitSet alive_bars(6, 1);
-   for (insn = bb->getEntry(); insn != NULL; insn = next) {
-      int wr, rd, wt;
+   barStates.assign(size, BarState());
 
-      next = insn->next;
+   if ((int)order.size() != count) {
+      // The edge types are inconsistent, fall back to waiting on all the
+      // barriers at the beginning of each BB.
+      for (IteratorRef it = func->cfg.iteratorCFG(); !it->end(); it->next()) {
+         BasicBlock *bb = BasicBlock::get(reinterpret_cast<Graph::Node *>(it->get()));
+         BarState state = BarState();
 
-      wr = getWrDepBar(insn);
-      rd = getRdDepBar(insn);
-      wt = getWtDepBar(insn);
+         if (bb->getEntry() && bb->cfg.incidentCount() > 0) {
+            for (int b = 0; b < 6; ++b)
+               emitWtDepBar(bb->getEntry(), b);
+         }
+         insertBarriers(bb, state, false);
+      }
+      return;
+   }
 
-      for (int idx = 0; idx < 6; ++idx) {
-         if (!(wt & (1 << idx)))
-            continue;
-         if (!alive_bars.test(idx)) {
-            insn->sched &= ~(1 << (11  + idx));
-         } else {
-            alive_bars.clr(idx);
+   for (size_t i = 0; i < order.size(); ++i) {
+      BasicBlock *bb = order[i];
+      BarState &state = barStates[bb->getId()];
+      bool loop = false;
+
+      for (Graph::EdgeIterator ei = bb->cfg.incident(); !ei.end(); ei.next()) {
+         BasicBlock *in = BasicBlock::get(ei.getNode());
+         if (ei.getType() != Graph::Edge::BACK) {
+            state.merge(barStates[in->getId()]);
+         } else
+         if (!in->getExit() && bb->getEntry()) {
+            // empty latch, nowhere to wait before the back edge
+            for (int b = 0; b < 6; ++b)
+               emitWtDepBar(bb->getEntry(), b);
          }
       }
+      for (Graph::EdgeIterator ei = bb->cfg.outgoing(); !ei.end(); ei.next())
+         if (ei.getType() == Graph::Edge::BACK)
+            loop = true;
 
-      if (wr < 6)
-         alive_bars.set(wr);
-      if (rd < 6)
-         alive_bars.set(rd);
+      insertBarriers(bb, state, loop);
    }
-
-   return true;
 }
 
 bool
@@ -4486,6 +4609,18 @@ SchedDataCalculatorGM107::visit(Function *func)
    scoreBoards.resize(func->cfg.getSize());
    for (size_t i = 0; i < scoreBoards.size(); ++i)
       scoreBoards[i].wipe();
+
+   for (int i = 0; i < insns.getSize(); ++i) {
+      /*XXX*/
+      reinterpret_cast<Instruction *>(insns.get(i))->sched = 0x7e0;
+   }
+
+   if (!debug_get_bool_option("NV50_PROG_SCHED", true))
+      return true;
+
+   // Insert read/write dependency barriers for instructions which don't
+   // operate at a fixed latency.
+   insertBarriers(func);
    return true;
 }
 
@@ -4495,18 +4630,9 @@ SchedDataCalculatorGM107::visit(BasicBlock *bb)
    Instruction *insn, *next = NULL;
    int cycle = 0;
 
-   for (Instruction *insn = bb->getEntry(); insn; insn = insn->next) {
-      /*XXX*/
-      insn->sched = 0x7e0;
-   }
-
    if (!debug_get_bool_option("NV50_PROG_SCHED", true))
       return true;
 
-   // Insert read/write dependency barriers for instructions which don't
-   // operate at a fixed latency.
-   insertBarriers(bb);
-
    score = &scoreBoards.at(bb->getId());
 
    for (Graph::EdgeIterator ei = bb->cfg.incident(); !ei.end(); ei.next()) {
@@ -4522,18 +4648,6 @@ SchedDataCalculatorGM107::visit(BasicBlock *bb)
    score->print(cycle);
 #endif
 
-   // Because barriers are allocated locally (intra-BB), we have to make sure
-   // that all produced barriers have been consumed before entering inside a
-   // new basic block. The best way is to do a global allocation pre RA but
-   // it's really more difficult, especially because of the phi nodes. Anyways,
-   // it seems like that waiting on a barrier which has already been consumed
-   // doesn't add any additional cost, it's just not elegant!
-   Instruction *start = bb->getEntry();
-   if (start && bb->cfg.incidentCount() > 0) {
-      for (int b = 0; b < 6; b++)
-         emitWtDepBar(start, b);
-   }
-
    for (insn = bb->getEntry(); insn && insn->next; insn = insn->next) {
       next = insn->next;
 
@@ -4610,6 +4724,7 @@ CodeEmitterGM107::prepareEmission(Function *func)
 {
    SchedDataCalculatorGM107 sched(targGM107);
    CodeEmitter::prepareEmission(func);
+   compile_stats_scope stats("sched"); // fincs-addition
    sched.run(func, true, true);
 }
 
@@ -0,0 +1,1124 @@
+/* fincs-addition
+ *
+ * \file nv50_ir_from_glsl.cpp
+ *
+ * Builds nv50_ir programs straight from linked GLSL IR, which skips both
+ * glsl_to_tgsi (along with ureg) and the scanning/conversion of TGSI tokens.
+ * Only a subset of vertex and fragment shaders is handled for now: a main()
+ * made of assignments, if/else and discard, operating on scalar and vector
+ * temporaries, generic vertex attributes and varyings, gl_Position, color
+ * outputs and uniform block members at constant offsets. Shaders using
+ * anything else (see nv50_ir_glsl_supported) go through TGSI as usual.
+ *
+ * The code emitted for each operation mirrors what the TGSI converter emits
+ * for the instructions glsl_to_tgsi generates for it, but the programs aren't
+ * guaranteed to come out the same after optimization: uam --compare-direct-ir
+ * compiles shaders both ways and reports the differences.
+ */
+
+#include <map>
+#include <vector>
+#include <string.h>
+
+#include "codegen/nv50_ir.h"
+#include "codegen/nv50_ir_build_util.h"
+
+#include "glsl/ir.h"
+#include "main/mtypes.h"
+
+extern "C" {
+#include "tgsi/tgsi_from_mesa.h"
+}
+
+namespace {
+
+bool
+isSupportedType(const glsl_type *type)
+{
+   if (!type->is_scalar() && !type->is_vector())
+      return false;
+
+   switch (type->base_type) {
+   case GLSL_TYPE_FLOAT:
+   case GLSL_TYPE_INT:
+   case GLSL_TYPE_UINT:
+   case GLSL_TYPE_BOOL:
+      return true;
+   default:
+      return false;
+   }
+}
+
+bool
+isSupportedVariable(const ir_variable *var, gl_shader_stage stage)
+{
+   if (!isSupportedType(var->type))
+      return false;
+
+   const int location = var->data.location;
+
+   switch (var->data.mode) {
+   case ir_var_auto:
+   case ir_var_temporary:
+      return true;
+   case ir_var_shader_in:
+      if (var->type->is_boolean() || var->data.location_frac)
+         return false;
+      if (stage == MESA_SHADER_VERTEX)
+         return location >= VERT_ATTRIB_GENERIC0 && location < VERT_ATTRIB_MAX;
+      return location >= VARYING_SLOT_VAR0 && location < VARYING_SLOT_MAX &&
+             !var->data.sample && !var->data.patch;
+   case ir_var_shader_out:
+      if (var->type->is_boolean() || var->data.location_frac)
+         return false;
+      if (stage == MESA_SHADER_VERTEX)
+         return location == VARYING_SLOT_POS ||
+                (location >= VARYING_SLOT_VAR0 && location < VARYING_SLOT_MAX &&
+                 !var->data.patch);
+      return location >= FRAG_RESULT_DATA0 && location < FRAG_RESULT_MAX &&
+             var->data.index == 0;
+   default:
+      return false;
+   }
+}
+
+bool
+isSupportedOperation(const ir_expression *expr, gl_shader_stage stage)
+{
+   switch (expr->operation) {
+   case ir_unop_bit_not:
+   case ir_unop_logic_not:
+   case ir_unop_neg:
+   case ir_unop_abs:
+   case ir_unop_sign:
+   case ir_unop_rcp:
+   case ir_unop_rsq:
+   case ir_unop_sqrt:
+   case ir_unop_exp2:
+   case ir_unop_log2:
+   case ir_unop_f2i:
+   case ir_unop_f2u:
+   case ir_unop_i2f:
+   case ir_unop_u2f:
+   case ir_unop_i2u:
+   case ir_unop_u2i:
+   case ir_unop_b2f:
+   case ir_unop_b2i:
+   case ir_unop_f2b:
+   case ir_unop_i2b:
+   case ir_unop_bitcast_i2f:
+   case ir_unop_bitcast_f2i:
+   case ir_unop_bitcast_u2f:
+   case ir_unop_bitcast_f2u:
+   case ir_unop_trunc:
+   case ir_unop_ceil:
+   case ir_unop_floor:
+   case ir_unop_fract:
+   case ir_unop_round_even:
+   case ir_unop_sin:
+   case ir_unop_cos:
+   case ir_unop_saturate:
+   case ir_binop_add:
+   case ir_binop_sub:
+   case ir_binop_mul:
+   case ir_binop_less:
+   case ir_binop_gequal:
+   case ir_binop_equal:
+   case ir_binop_nequal:
+   case ir_binop_all_equal:
+   case ir_binop_any_nequal:
+   case ir_binop_lshift:
+   case ir_binop_rshift:
+   case ir_binop_bit_and:
+   case ir_binop_bit_xor:
+   case ir_binop_bit_or:
+   case ir_binop_logic_and:
+   case ir_binop_logic_xor:
+   case ir_binop_logic_or:
+   case ir_binop_dot:
+   case ir_binop_min:
+   case ir_binop_max:
+   case ir_binop_pow:
+   case ir_triop_fma:
+   case ir_triop_lrp:
+   case ir_triop_csel:
+      return true;
+   case ir_binop_div:
+   case ir_binop_mod:
+      // Float division and modulo are lowered before code generation
+      return expr->type->base_type != GLSL_TYPE_FLOAT;
+   case ir_unop_dFdx:
+      // dFdy needs the framebuffer orientation, which TGSI gets from a state variable
+      return stage == MESA_SHADER_FRAGMENT;
+   case ir_binop_ubo_load:
+      return expr->operands[0]->as_constant() && expr->operands[1]->as_constant();
+   default:
+      return false;
+   }
+}
+
+bool
+isSupportedRvalue(ir_rvalue *ir, gl_shader_stage stage)
+{
+   if (!isSupportedType(ir->type))
+      return false;
+
+   switch (ir->ir_type) {
+   case ir_type_constant:
+      return true;
+   case ir_type_dereference_variable:
+      return isSupportedVariable(((ir_dereference_variable *)ir)->var, stage);
+   case ir_type_swizzle:
+      return isSupportedRvalue(((ir_swizzle *)ir)->val, stage);
+   case ir_type_expression: {
+      ir_expression *expr = (ir_expression *)ir;
+      if (!isSupportedOperation(expr, stage))
+         return false;
+      for (unsigned i = 0; i < expr->num_operands; ++i)
+         if (!isSupportedRvalue(expr->operands[i], stage))
+            return false;
+      return true;
+   }
+   default:
+      return false;
+   }
+}
+
+bool
+isSupportedList(exec_list *list, gl_shader_stage stage)
+{
+   foreach_in_list(ir_instruction, ir, list) {
+      switch (ir->ir_type) {
+      case ir_type_variable:
+         break;
+      case ir_type_assignment: {
+         ir_assignment *assign = (ir_assignment *)ir;
+         ir_dereference_variable *lhs = assign->lhs->as_dereference_variable();
+         if (!lhs || lhs->var->data.mode == ir_var_shader_in ||
+             !isSupportedVariable(lhs->var, stage) ||
+             !isSupportedRvalue(assign->rhs, stage))
+            return false;
+         if (assign->condition && !isSupportedRvalue(assign->condition, stage))
+            return false;
+         break;
+      }
+      case ir_type_if: {
+         ir_if *cond = (ir_if *)ir;
+         if (!isSupportedRvalue(cond->condition, stage) ||
+             !isSupportedList(&cond->then_instructions, stage) ||
+             !isSupportedList(&cond->else_instructions, stage))
+            return false;
+         break;
+      }
+      case ir_type_discard: {
+         ir_discard *discard = (ir_discard *)ir;
+         if (stage != MESA_SHADER_FRAGMENT ||
+             (discard->condition && !isSupportedRvalue(discard->condition, stage)))
+            return false;
+         break;
+      }
+      default:
+         return false;
+      }
+   }
+   return true;
+}
+
+/* Same ranking as get_rvalue_precision in st_glsl_to_tgsi.cpp, which decides
+ * whether TGSI instructions are marked as mediump.
+ */
+enum rvalue_precision {
+   rvalue_precision_none,
+   rvalue_precision_low,
+   rvalue_precision_medium,
+   rvalue_precision_high,
+};
+
+rvalue_precision
+getRvaluePrecision(ir_rvalue *ir)
+{
+   switch (ir->ir_type) {
+   case ir_type_constant:
+      return rvalue_precision_none;
+   case ir_type_dereference_variable:
+      switch (((ir_dereference_variable *)ir)->var->data.precision) {
+      case GLSL_PRECISION_LOW:
+         return rvalue_precision_low;
+      case GLSL_PRECISION_MEDIUM:
+         return rvalue_precision_medium;
+      default:
+         return rvalue_precision_high;
+      }
+   case ir_type_swizzle:
+      return getRvaluePrecision(((ir_swizzle *)ir)->val);
+   case ir_type_expression: {
+      ir_expression *expr = (ir_expression *)ir;
+      rvalue_precision precision = rvalue_precision_none;
+      for (unsigned i = 0; i < expr->num_operands; ++i) {
+         rvalue_precision opPrecision = getRvaluePrecision(expr->operands[i]);
+         if (opPrecision > precision)
+            precision = opPrecision;
+      }
+      return precision;
+   }
+   default:
+      return rvalue_precision_high;
+   }
+}
+
+using namespace nv50_ir;
+
+DataType
+getDataType(const glsl_type *type)
+{
+   switch (type->base_type) {
+   case GLSL_TYPE_FLOAT:
+      return TYPE_F32;
+   case GLSL_TYPE_INT:
+      return TYPE_S32;
+   default:
+      return TYPE_U32;
+   }
+}
+
+class Converter : public BuildUtil
+{
+public:
+   Converter(Program *, struct nv50_ir_prog_info *);
+
+   bool run();
+
+private:
+   void scanInputs();
+   void scanOutputs();
+
+   void emitList(exec_list *);
+   void emitAssignment(ir_assignment *);
+   void emitIf(ir_if *);
+   void emitDiscard(ir_discard *);
+   void exportOutputs();
+
+   // Computes the components of an rvalue given by mask into res
+   void emitRvalue(ir_rvalue *, unsigned mask, Value *res[4]);
+   void emitExpression(ir_expression *, unsigned mask, Value *res[4]);
+   Value *emitScalar(ir_rvalue *);
+
+   Value *fetchInput(const ir_variable *, int c);
+   Value *interpolate(int idx, int c);
+   uint8_t translateInterpMode(const struct nv50_ir_varying *var, operation& op);
+   Value *buildDot(Value *const src0[4], Value *const src1[4], int dim, bool mediump);
+   void insertConvergenceOps(BasicBlock *conv, BasicBlock *fork);
+
+   DataArray *getArray(const ir_variable *, int& idx);
+
+private:
+   struct nv50_ir_prog_info *info;
+   const struct gl_linked_shader *shader;
+
+   DataArray tData; // temporaries
+   DataArray oData; // outputs
+   ValueMap values;
+
+   // Like the TGSI converter, vertex outputs are exported at the end of the
+   // program, once per write and in the order they were written
+   struct VertexOutput {
+      VertexOutput(int idx, int c, Value *val) : idx(idx), c(c), val(val) { }
+      int idx, c;
+      Value *val;
+   };
+   std::vector<VertexOutput> vertexOutputs;
+
+   std::map<const ir_variable *, int> temps;
+   int8_t inputIndex[VARYING_SLOT_MAX];
+   int8_t outputIndex[VARYING_SLOT_MAX];
+
+   Value *fragCoordW; // reciprocal of gl_FragCoord.w, for perspective interpolation
+   Value *zero;
+
+   bool precise; // the assignment being emitted has a precise/invariant target
+   unsigned ifDepth;
+};
+
+Converter::Converter(Program *ir, struct nv50_ir_prog_info *info) : BuildUtil(ir),
+     info(info),
+     shader((const struct gl_linked_shader *)info->bin.source),
+     tData(this), oData(this),
+     fragCoordW(NULL),
+     precise(false),
+     ifDepth(0)
+{
+   tData.setup(0, 0, 0, 0, 4, 4, FILE_GPR, 0);
+   oData.setup(1, 0, 0, 0, 4, 4, FILE_GPR, 0);
+
+   zero = mkImm((uint32_t)0);
+
+   memset(inputIndex, -1, sizeof(inputIndex));
+   memset(outputIndex, -1, sizeof(outputIndex));
+}
+
+// Inputs are numbered the same way as in TGSI, see tgsi_translate_vertex/fragment
+void
+Converter::scanInputs()
+{
+   const struct gl_program *prog = shader->Program;
+   const unsigned numAttribs =
+      info->type == PIPE_SHADER_VERTEX ? VERT_ATTRIB_MAX : VARYING_SLOT_MAX;
+
+   for (unsigned attr = 0; attr < numAttribs; ++attr) {
+      if (!(prog->info.inputs_read & BITFIELD64_BIT(attr)))
+         continue;
+
+      const unsigned i = info->numInputs++;
+      inputIndex[attr] = i;
+
+      if (info->type == PIPE_SHADER_VERTEX) {
+         // all vertex attributes are equal
+         info->in[i].sn = TGSI_SEMANTIC_GENERIC;
+         info->in[i].si = i;
+      } else {
+         unsigned sn, si;
+         tgsi_get_gl_varying_semantic(gl_varying_slot(attr), true, &sn, &si);
+         info->in[i].id = i;
+         info->in[i].sn = sn;
+         info->in[i].si = si;
+      }
+   }
+
+   if (info->type != PIPE_SHADER_FRAGMENT)
+      return;
+
+   foreach_in_list(ir_instruction, node, shader->ir) {
+      ir_variable *var = node->as_variable();
+      if (!var || var->data.mode != ir_var_shader_in ||
+          inputIndex[var->data.location] < 0)
+         continue;
+
+      struct nv50_ir_varying *in = &info->in[inputIndex[var->data.location]];
+      switch (var->data.interpolation) {
+      case INTERP_MODE_FLAT:
+         in->flat = 1;
+         break;
+      case INTERP_MODE_NOPERSPECTIVE:
+         in->linear = 1;
+         break;
+      default:
+         break;
+      }
+      if (var->data.centroid)
+         in->centroid = 1;
+   }
+}
+
+void
+Converter::scanOutputs()
+{
+   const struct gl_program *prog = shader->Program;
+
+   for (unsigned attr = 0; attr < VARYING_SLOT_MAX; ++attr) {
+      if (!(prog->info.outputs_written & BITFIELD64_BIT(attr)))
+         continue;
+
+      const unsigned i = info->numOutputs++;
+      outputIndex[attr] = i;
+      info->out[i].id = i;
+
+      if (info->type == PIPE_SHADER_VERTEX) {
+         unsigned sn, si;
+         tgsi_get_gl_varying_semantic(gl_varying_slot(attr), true, &sn, &si);
+         info->out[i].sn = sn;
+         info->out[i].si = si;
+      } else {
+         info->out[i].sn = TGSI_SEMANTIC_COLOR;
+         info->out[i].si = attr - FRAG_RESULT_DATA0;
+         info->prop.fp.numColourResults++;
+      }
+   }
+
+   if (info->type != PIPE_SHADER_FRAGMENT)
+      return;
+
+   // Same as the properties emitted by st_translate_program
+   if (prog->info.fs.early_fragment_tests || prog->info.fs.post_depth_coverage)
+      info->prop.fp.earlyFragTests = true;
+   info->prop.fp.postDepthCoverage = prog->info.fs.post_depth_coverage;
+
+   if (prog->info.fs.depth_layout != FRAG_DEPTH_LAYOUT_NONE) {
+      info->prop.fp.hasZcullTestMask = true;
+      switch (prog->info.fs.depth_layout) {
+      case FRAG_DEPTH_LAYOUT_GREATER:
+         info->prop.fp.zcullTestMask = 0x10;
+         break;
+      case FRAG_DEPTH_LAYOUT_LESS:
+         info->prop.fp.zcullTestMask = 0x01;
+         break;
+      case FRAG_DEPTH_LAYOUT_UNCHANGED:
+         info->prop.fp.zcullTestMask = 0x00;
+         break;
+      default:
+         info->prop.fp.zcullTestMask = 0x11;
+         break;
+      }
+   }
+}
+
+Converter::DataArray *
+Converter::getArray(const ir_variable *var, int& idx)
+{
+   if (var->data.mode == ir_var_shader_out) {
+      idx = outputIndex[var->data.location];
+      return &oData;
+   }
+
+   std::map<const ir_variable *, int>::iterator it = temps.find(var);
+   if (it == temps.end())
+      it = temps.insert(std::make_pair(var, (int)temps.size())).first;
+   idx = it->second;
+   return &tData;
+}
+
+uint8_t
+Converter::translateInterpMode(const struct nv50_ir_varying *var, operation& op)
+{
+   uint8_t mode = NV50_IR_INTERP_PERSPECTIVE;
+
+   if (var->flat)
+      mode = NV50_IR_INTERP_FLAT;
+   else
+   if (var->linear)
+      mode = NV50_IR_INTERP_LINEAR;
+   else
+   if (var->sc)
+      mode = NV50_IR_INTERP_SC;
+
+   op = (mode == NV50_IR_INTERP_PERSPECTIVE || mode == NV50_IR_INTERP_SC)
+      ? OP_PINTERP : OP_LINTERP;
+
+   if (var->centroid)
+      mode |= NV50_IR_INTERP_CENTROID;
+
+   return mode;
+}
+
+Value *
+Converter::interpolate(int idx, int c)
+{
+   operation op;
+   const uint8_t mode = translateInterpMode(&info->in[idx], op);
+
+   Instruction *insn = new_Instruction(func, op, TYPE_F32);
+
+   insn->setDef(0, getScratch());
+   insn->setSrc(0, mkSymbol(FILE_SHADER_INPUT, 0, TYPE_F32,
+                            info->in[idx].slot[c] * 4));
+   if (op == OP_PINTERP)
+      insn->setSrc(1, fragCoordW);
+
+   insn->setInterpolate(mode);
+
+   bb->insertTail(insn);
+   return insn->getDef(0);
+}
+
+Value *
+Converter::fetchInput(const ir_variable *var, int c)
+{
+   const int idx = inputIndex[var->data.location];
+
+   info->in[idx].mask |= 1 << c;
+
+   if (prog->getType() == Program::TYPE_FRAGMENT)
+      return interpolate(idx, c);
+
+   Symbol *sym = mkSymbol(FILE_SHADER_INPUT, 0, TYPE_U32,
+                          info->in[idx].slot[c] * 4);
+   return mkLoad(TYPE_U32, getSSA(), sym, NULL)->getDef(0);
+}
+
+Value *
+Converter::buildDot(Value *const src0[4], Value *const src1[4], int dim, bool mediump)
+{
+   assert(dim > 0);
+
+   Value *dotp = getScratch();
+
+   Instruction *insn = mkOp2(OP_MUL, TYPE_F32, dotp, src0[0], src1[0]);
+   insn->dnz = info->io.mul_zero_wins;
+   insn->mediump = mediump;
+
+   for (int c = 1; c < dim; ++c) {
+      insn = mkOp3(OP_MAD, TYPE_F32, dotp, src0[c], src1[c], dotp);
+      insn->dnz = info->io.mul_zero_wins;
+      insn->mediump = mediump;
+   }
+   return dotp;
+}
+
+void
+Converter::insertConvergenceOps(BasicBlock *conv, BasicBlock *fork)
+{
+   FlowInstruction *join = new_FlowInstruction(func, OP_JOIN, NULL);
+   join->fixed = 1;
+   conv->insertHead(join);
+
+   assert(!fork->joinAt);
+   fork->joinAt = new_FlowInstruction(func, OP_JOINAT, conv);
+   fork->insertBefore(fork->getExit(), fork->joinAt);
+}
+
+Value *
+Converter::emitScalar(ir_rvalue *ir)
+{
+   Value *res[4];
+   emitRvalue(ir, 0x1, res);
+   return res[0];
+}
+
+void
+Converter::emitRvalue(ir_rvalue *ir, unsigned mask, Value *res[4])
+{
+   switch (ir->ir_type) {
+   case ir_type_constant: {
+      ir_constant *imm = (ir_constant *)ir;
+      for (int c = 0; c < 4; ++c) {
+         if (!(mask & (1 << c)))
+            continue;
+         if (imm->type->is_boolean())
+            res[c] = loadImm(NULL, imm->value.b[c] ? ~0U : 0U);
+         else
+            res[c] = loadImm(NULL, imm->value.u[c]);
+      }
+      break;
+   }
+   case ir_type_dereference_variable: {
+      const ir_variable *var = ((ir_dereference_variable *)ir)->var;
+      int idx;
+      for (int c = 0; c < 4; ++c) {
+         if (!(mask & (1 << c)))
+            continue;
+         if (var->data.mode == ir_var_shader_in)
+            res[c] = fetchInput(var, c);
+         else
+            res[c] = getArray(var, idx)->load(values, idx, c, NULL);
+      }
+      break;
+   }
+   case ir_type_swizzle: {
+      ir_swizzle *swz = (ir_swizzle *)ir;
+      const unsigned comp[4] = { swz->mask.x, swz->mask.y, swz->mask.z, swz->mask.w };
+      unsigned valMask = 0;
+      Value *val[4];
+      for (int c = 0; c < 4; ++c)
+         if (mask & (1 << c))
+            valMask |= 1 << comp[c];
+      emitRvalue(swz->val, valMask, val);
+      for (int c = 0; c < 4; ++c)
+         if (mask & (1 << c))
+            res[c] = val[comp[c]];
+      break;
+   }
+   case ir_type_expression:
+      emitExpression((ir_expression *)ir, mask, res);
+      break;
+   default:
+      assert(!"unsupported rvalue");
+      break;
+   }
+}
+
+void
+Converter::emitExpression(ir_expression *expr, unsigned mask, Value *res[4])
+{
+   const DataType dTy = getDataType(expr->type);
+   const DataType sTy = getDataType(expr->operands[0]->type);
+   // USEQ/USNE compare integers as unsigned
+   const DataType eqTy = sTy == TYPE_F32 ? TYPE_F32 : TYPE_U32;
+   const rvalue_precision precision = getRvaluePrecision(expr);
+   const bool mediump = !precise &&
+      (precision == rvalue_precision_low || precision == rvalue_precision_medium);
+   Value *src[3][4];
+   Instruction *geni;
+
+   if (expr->operation == ir_binop_ubo_load) {
+      // Block bindings are offset by one, like in TGSI (c[0x1] holds the uniforms)
+      const int block = expr->operands[0]->as_constant()->value.u[0] + 1;
+      const uint32_t offset = expr->operands[1]->as_constant()->value.u[0];
+      for (int c = 0; c < 4; ++c) {
+         if (!(mask & (1 << c)))
+            continue;
+         Symbol *sym = mkSymbol(FILE_MEMORY_CONST, block, TYPE_U32, offset + c * 4);
+         res[c] = mkLoadv(TYPE_U32, sym, NULL);
+         if (expr->type->is_boolean())
+            res[c] = mkCmp(OP_SET, CC_NE, TYPE_U32, getSSA(), TYPE_U32,
+                           res[c], loadImm(NULL, 0u))->getDef(0);
+      }
+      return;
+   }
+
+   // Reductions need every component of their operands
+   unsigned srcMask = mask;
+   if (expr->operation == ir_binop_dot ||
+       expr->operation == ir_binop_all_equal ||
+       expr->operation == ir_binop_any_nequal)
+      srcMask = (1 << expr->operands[0]->type->vector_elements) - 1;
+
+   // Scalar operands of vector operations apply to every component
+   for (unsigned s = 0; s < expr->num_operands; ++s) {
+      if (expr->operands[s]->type->is_scalar()) {
+         emitRvalue(expr->operands[s], srcMask ? 0x1 : 0x0, src[s]);
+         src[s][1] = src[s][2] = src[s][3] = src[s][0];
+      } else {
+         emitRvalue(expr->operands[s], srcMask, src[s]);
+      }
+   }
+
+   switch (expr->operation) {
+   case ir_binop_dot:
+      res[0] = buildDot(src[0], src[1],
+                        expr->operands[0]->type->vector_elements, mediump);
+      return;
+   case ir_binop_all_equal:
+   case ir_binop_any_nequal: {
+      // SEQ/SNE, then the components are ANDed/ORed together pairwise, like
+      // glsl_to_tgsi does. Comparing booleans against true (all) or false (any)
+      // is a no-op.
+      const bool all = expr->operation == ir_binop_all_equal;
+      const operation op = all ? OP_AND : OP_OR;
+      const CondCode cc = all ? CC_EQ : (sTy == TYPE_F32 ? CC_NEU : CC_NE);
+      const ir_constant *imm = expr->operands[1]->as_constant();
+      const bool skipCmp = expr->operands[0]->type->is_boolean() && imm &&
+                           (all ? imm->is_one() : imm->is_zero());
+      const unsigned n = expr->operands[0]->type->vector_elements;
+      Value *val[4];
+      for (unsigned c = 0; c < n; ++c)
+         val[c] = skipCmp ? src[0][c] : mkCmp(OP_SET, cc, TYPE_U32, getSSA(), eqTy,
+                                              src[0][c], src[1][c])->getDef(0);
+      if (n == 4) {
+         val[0] = mkOp2v(op, TYPE_U32, getSSA(), val[0], val[1]);
+         val[1] = mkOp2v(op, TYPE_U32, getSSA(), val[2], val[3]);
+      } else
+      if (n == 3) {
+         val[1] = mkOp2v(op, TYPE_U32, getSSA(), val[1], val[2]);
+      }
+      res[0] = n > 1 ? mkOp2v(op, TYPE_U32, getSSA(), val[0], val[1]) : val[0];
+      return;
+   }
+   default:
+      break;
+   }
+
+   for (int c = 0; c < 4; ++c) {
+      if (!(mask & (1 << c)))
+         continue;
+
+      Value *src0 = src[0][c];
+      Value *src1 = expr->num_operands > 1 ? src[1][c] : NULL;
+      Value *src2 = expr->num_operands > 2 ? src[2][c] : NULL;
+      Value *dst = getSSA();
+      Value *val0, *val1;
+
+      switch (expr->operation) {
+      // Operations which don't change the bits of their operand
+      case ir_unop_i2u:
+      case ir_unop_u2i:
+      case ir_unop_bitcast_i2f:
+      case ir_unop_bitcast_f2i:
+      case ir_unop_bitcast_u2f:
+      case ir_unop_bitcast_f2u:
+         dst = src0;
+         break;
+      case ir_unop_bit_not:
+      case ir_unop_logic_not:
+         mkOp1(OP_NOT, TYPE_U32, dst, src0);
+         break;
+      case ir_unop_neg:
+         mkOp1(OP_NEG, dTy, dst, src0);
+         break;
+      case ir_unop_abs:
+         mkOp1(OP_ABS, dTy, dst, src0);
+         break;
+      case ir_unop_sign:
+         val0 = getScratch();
+         val1 = getScratch();
+         mkCmp(OP_SET, CC_GT, sTy, val0, sTy, src0, zero);
+         mkCmp(OP_SET, CC_LT, sTy, val1, sTy, src0, zero);
+         if (sTy == TYPE_F32)
+            mkOp2(OP_SUB, TYPE_F32, dst, val0, val1);
+         else
+            mkOp2(OP_SUB, TYPE_S32, dst, val1, val0);
+         break;
+      case ir_unop_rcp:
+         mkOp1(OP_RCP, TYPE_F32, dst, src0);
+         break;
+      case ir_unop_rsq:
+         mkOp1(OP_ABS, TYPE_F32, dst, src0);
+         mkOp1(OP_RSQ, TYPE_F32, dst, dst);
+         break;
+      case ir_unop_sqrt:
+         mkOp1(OP_SQRT, TYPE_F32, dst, src0);
+         break;
+      case ir_unop_exp2:
+         mkOp1(OP_EX2, TYPE_F32, dst, src0);
+         break;
+      case ir_unop_log2:
+         mkOp1(OP_LG2, TYPE_F32, dst, src0);
+         break;
+      case ir_unop_sin:
+      case ir_unop_cos:
+         mkOp1(OP_PRESIN, TYPE_F32, dst, src0);
+         mkOp1(expr->operation == ir_unop_sin ? OP_SIN : OP_COS, TYPE_F32, dst, dst);
+         break;
+      case ir_unop_f2i:
+      case ir_unop_f2u:
+         mkCvt(OP_CVT, dTy, dst, TYPE_F32, src0)->rnd = ROUND_Z;
+         break;
+      case ir_unop_i2f:
+      case ir_unop_u2f:
+         mkCvt(OP_CVT, TYPE_F32, dst, sTy, src0);
+         break;
+      case ir_unop_b2f:
+         mkOp2(OP_AND, TYPE_U32, dst, src0, mkImm(1.0f));
+         break;
+      case ir_unop_b2i:
+         mkOp2(OP_AND, TYPE_U32, dst, src0, mkImm(1));
+         break;
+      case ir_unop_f2b:
+         mkCmp(OP_SET, CC_NEU, TYPE_U32, dst, TYPE_F32, src0, loadImm(NULL, 0u));
+         break;
+      case ir_unop_i2b:
+         mkCmp(OP_SET, CC_NE, TYPE_U32, dst, TYPE_U32, src0, loadImm(NULL, 0u));
+         break;
+      case ir_unop_trunc:
+         mkOp1(OP_TRUNC, TYPE_F32, dst, src0);
+         break;
+      case ir_unop_ceil:
+         mkOp1(OP_CEIL, TYPE_F32, dst, src0);
+         break;
+      case ir_unop_floor:
+         mkOp1(OP_FLOOR, TYPE_F32, dst, src0);
+         break;
+      case ir_unop_fract:
+         val0 = getScratch();
+         mkOp1(OP_FLOOR, TYPE_F32, val0, src0);
+         mkOp2(OP_SUB, TYPE_F32, dst, src0, val0);
+         break;
+      case ir_unop_round_even:
+         mkCvt(OP_CVT, TYPE_F32, dst, TYPE_F32, src0)->rnd = ROUND_NI;
+         break;
+      case ir_unop_saturate:
+         mkOp1(OP_SAT, TYPE_F32, dst, src0);
+         break;
+      case ir_unop_dFdx:
+         mkOp1(OP_DFDX, TYPE_F32, dst, src0);
+         break;
+      case ir_binop_less:
+         mkCmp(OP_SET, CC_LT, TYPE_U32, dst, sTy, src0, src1);
+         break;
+      case ir_binop_gequal:
+         mkCmp(OP_SET, CC_GE, TYPE_U32, dst, sTy, src0, src1);
+         break;
+      case ir_binop_equal:
+         mkCmp(OP_SET, CC_EQ, TYPE_U32, dst, eqTy, src0, src1);
+         break;
+      case ir_binop_nequal:
+         mkCmp(OP_SET, sTy == TYPE_F32 ? CC_NEU : CC_NE, TYPE_U32, dst, eqTy, src0, src1);
+         break;
+      case ir_binop_add:
+      case ir_binop_sub:
+      case ir_binop_mul:
+      case ir_binop_div:
+      case ir_binop_mod:
+      case ir_binop_min:
+      case ir_binop_max:
+      case ir_binop_pow:
+      case ir_binop_lshift:
+      case ir_binop_rshift:
+      case ir_binop_bit_and:
+      case ir_binop_bit_xor:
+      case ir_binop_bit_or:
+      case ir_binop_logic_and:
+      case ir_binop_logic_xor:
+      case ir_binop_logic_or: {
+         operation op;
+         DataType ty = dTy;
+         switch (expr->operation) {
+         case ir_binop_add: op = OP_ADD; break;
+         case ir_binop_sub: op = OP_SUB; break;
+         case ir_binop_mul: op = OP_MUL; break;
+         case ir_binop_div: op = OP_DIV; break;
+         case ir_binop_mod: op = OP_MOD; break;
+         case ir_binop_min: op = OP_MIN; break;
+         case ir_binop_max: op = OP_MAX; break;
+         case ir_binop_pow: op = OP_POW; break;
+         case ir_binop_lshift: op = OP_SHL; break;
+         case ir_binop_rshift: op = OP_SHR; break;
+         case ir_binop_bit_and:
+         case ir_binop_logic_and: op = OP_AND; break;
+         case ir_binop_bit_xor:
+         case ir_binop_logic_xor: op = OP_XOR; break;
+         default: op = OP_OR; break;
+         }
+         // UADD/UMUL/SHL/AND/OR/XOR operate on unsigned values
+         if (op != OP_DIV && op != OP_MOD && op != OP_MIN && op != OP_MAX &&
+             op != OP_SHR && ty == TYPE_S32)
+            ty = TYPE_U32;
+         geni = mkOp2(op, ty, dst, src0, src1);
+         if (op == OP_MUL && ty == TYPE_F32)
+            geni->dnz = info->io.mul_zero_wins;
+         geni->precise = precise;
+         geni->mediump = mediump && ty == TYPE_F32;
+         break;
+      }
+      case ir_triop_fma:
+         geni = mkOp3(OP_FMA, TYPE_F32, dst, src0, src1, src2);
+         geni->dnz = info->io.mul_zero_wins;
+         geni->precise = precise;
+         geni->mediump = mediump;
+         break;
+      case ir_triop_lrp:
+         // LRP dst, src2, src1, src0 (the weight comes first in TGSI)
+         mkOp3(OP_MAD, TYPE_F32, dst,
+               mkOp2v(OP_SUB, TYPE_F32, getSSA(), src1, src0), src2, src0)
+            ->dnz = info->io.mul_zero_wins;
+         break;
+      case ir_triop_csel:
+         // UCMP
+         if (src1 == src2)
+            dst = src1;
+         else
+            mkCmp(OP_SLCT, CC_NE, TYPE_U32, dst, TYPE_U32, src1, src2, src0);
+         break;
+      default:
+         assert(!"unsupported expression");
+         break;
+      }
+
+      res[c] = dst;
+   }
+}
+
+void
+Converter::emitAssignment(ir_assignment *assign)
+{
+   const ir_variable *var = assign->lhs->variable_referenced();
+   const unsigned writeMask = assign->write_mask;
+   Value *rhs[4], *cond = NULL;
+   int idx;
+
+   precise = var->data.precise || var->data.invariant;
+
+   // The components of the right-hand side go to the enabled components of
+   // the left-hand side, in order
+   emitRvalue(assign->rhs, (1 << util_bitcount(writeMask)) - 1, rhs);
+   if (assign->condition)
+      cond = emitScalar(assign->condition);
+
+   DataArray *array = getArray(var, idx);
+   for (int c = 0, k = 0; c < 4; ++c) {
+      if (!(writeMask & (1 << c)))
+         continue;
+      Value *dst = array->acquire(values, idx, c);
+      if (cond)
+         mkCmp(OP_SLCT, CC_NE, TYPE_U32, dst, TYPE_U32, rhs[k++], dst, cond);
+      else
+         mkMov(dst, rhs[k++]);
+      if (var->data.mode == ir_var_shader_out) {
+         info->out[idx].mask |= 1 << c;
+         if (prog->getType() == Program::TYPE_VERTEX)
+            vertexOutputs.push_back(VertexOutput(idx, c, mkMov(getScratch(), dst)->getDef(0)));
+      }
+   }
+
+   precise = false;
+}
+
+// Same control flow as IF/ELSE/ENDIF in the TGSI converter
+void
+Converter::emitIf(ir_if *ir)
+{
+   Value *cond = emitScalar(ir->condition);
+   BasicBlock *forkBB = bb;
+   BasicBlock *prevBB = bb;
+   BasicBlock *ifBB = new BasicBlock(func);
+
+   bb->cfg.attach(&ifBB->cfg, Graph::Edge::TREE);
+   mkFlow(OP_BRA, NULL, CC_NOT_P, cond)->setType(TYPE_U32);
+
+   setPosition(ifBB, true);
+   ++ifDepth;
+   emitList(&ir->then_instructions);
+
+   if (!ir->else_instructions.is_empty()) {
+      BasicBlock *elseBB = new BasicBlock(func);
+
+      forkBB->cfg.attach(&elseBB->cfg, Graph::Edge::TREE);
+      prevBB = bb;
+
+      forkBB->getExit()->asFlow()->target.bb = elseBB;
+      if (!bb->isTerminated())
+         mkFlow(OP_BRA, NULL, CC_ALWAYS, NULL);
+
+      setPosition(elseBB, true);
+      emitList(&ir->else_instructions);
+   }
+   --ifDepth;
+
+   BasicBlock *convBB = new BasicBlock(func);
+
+   if (!bb->isTerminated()) {
+      if (prevBB->getExit()->op == OP_BRA && ifDepth < 6)
+         insertConvergenceOps(convBB, forkBB);
+      mkFlow(OP_BRA, convBB, CC_ALWAYS, NULL);
+      bb->cfg.attach(&convBB->cfg, Graph::Edge::FORWARD);
+   }
+
+   if (prevBB->getExit()->op == OP_BRA) {
+      prevBB->cfg.attach(&convBB->cfg, Graph::Edge::FORWARD);
+      prevBB->getExit()->asFlow()->target.bb = convBB;
+   }
+   setPosition(convBB, true);
+}
+
+void
+Converter::emitDiscard(ir_discard *ir)
+{
+   info->prop.fp.usesDiscard = true;
+
+   if (!ir->condition) {
+      mkOp(OP_DISCARD, TYPE_NONE, NULL);
+      return;
+   }
+
+   Value *pred = new_LValue(func, FILE_PREDICATE);
+   mkCmp(OP_SET, CC_NE, TYPE_U32, pred, TYPE_U32, emitScalar(ir->condition), zero);
+   mkOp(OP_DISCARD, TYPE_NONE, NULL)->setPredicate(CC_P, pred);
+}
+
+void
+Converter::emitList(exec_list *list)
+{
+   foreach_in_list(ir_instruction, ir, list) {
+      switch (ir->ir_type) {
+      case ir_type_assignment:
+         emitAssignment((ir_assignment *)ir);
+         break;
+      case ir_type_if:
+         emitIf((ir_if *)ir);
+         break;
+      case ir_type_discard:
+         emitDiscard((ir_discard *)ir);
+         break;
+      default:
+         break;
+      }
+   }
+}
+
+void
+Converter::exportOutputs()
+{
+   if (prog->getType() == Program::TYPE_VERTEX) {
+      for (size_t i = 0; i < vertexOutputs.size(); ++i) {
+         const VertexOutput &output = vertexOutputs[i];
+         Symbol *sym = mkSymbol(FILE_SHADER_OUTPUT, 0, TYPE_U32,
+                                info->out[output.idx].slot[output.c] * 4);
+         mkStore(OP_EXPORT, TYPE_U32, sym, NULL, output.val);
+      }
+      return;
+   }
+
+   for (unsigned int i = 0; i < info->numOutputs; ++i) {
+      for (unsigned int c = 0; c < 4; ++c) {
+         if (!oData.exists(values, i, c))
+            continue;
+         Symbol *sym = mkSymbol(FILE_SHADER_OUTPUT, 0, TYPE_F32,
+                                info->out[i].slot[c] * 4);
+         Value *val = oData.load(values, i, c, NULL);
+         mkStore(OP_EXPORT, TYPE_F32, sym, NULL, val);
+      }
+   }
+}
+
+bool
+Converter::run()
+{
+   info->io.viewportId = -1;
+
+   scanInputs();
+   scanOutputs();
+   if (info->assignSlots(info))
+      return false;
+
+   BasicBlock *entry = new BasicBlock(prog->main);
+   BasicBlock *leave = new BasicBlock(prog->main);
+
+   prog->main->setEntry(entry);
+   prog->main->setExit(leave);
+
+   setPosition(entry, true);
+
+   if (prog->getType() == Program::TYPE_FRAGMENT) {
+      Symbol *sv = mkSysVal(SV_POSITION, 3);
+      fragCoordW = mkOp1v(OP_RDSV, TYPE_F32, getSSA(), sv);
+      mkOp1(OP_RCP, TYPE_F32, fragCoordW, fragCoordW);
+   }
+
+   foreach_in_list(ir_instruction, node, shader->ir) {
+      ir_function *f = node->as_function();
+      if (!f || strcmp(f->name, "main") != 0)
+         continue;
+      foreach_in_list(ir_function_signature, sig, &f->signatures)
+         if (sig->is_defined)
+            emitList(&sig->body);
+   }
+
+   // attach and generate epilogue code
+   BasicBlock *epilogue = BasicBlock::get(func->cfgExit);
+   bb->cfg.attach(&epilogue->cfg, Graph::Edge::TREE);
+   setPosition(epilogue, true);
+   exportOutputs();
+   mkOp(OP_EXIT, TYPE_NONE, NULL)->terminator = 1;
+
+   return true;
+}
+
+} // unnamed namespace
+
+bool
+nv50_ir_glsl_supported(const struct gl_linked_shader *shader)
+{
+   const gl_shader_stage stage = shader->Stage;
+   bool hasMain = false;
+
+   if (stage != MESA_SHADER_VERTEX && stage != MESA_SHADER_FRAGMENT)
+      return false;
+
+   foreach_in_list(ir_instruction, node, shader->ir) {
+      if (node->ir_type == ir_type_variable)
+         continue; // only the variables which are actually used matter
+      ir_function *f = node->as_function();
+      if (!f)
+         return false;
+      foreach_in_list(ir_function_signature, sig, &f->signatures) {
+         if (!sig->is_defined)
+            continue;
+         if (strcmp(f->name, "main") != 0 || !isSupportedList(&sig->body, stage))
+            return false;
+         hasMain = true;
+      }
+   }
+
+   return hasMain;
+}
+
+namespace nv50_ir {
+
+bool
+Program::makeFromGLSL(struct nv50_ir_prog_info *info)
+{
+   tlsSize = info->bin.tlsSpace;
+
+   Converter builder(this, info);
+   return builder.run();
+}
+
+} // namespace nv50_ir
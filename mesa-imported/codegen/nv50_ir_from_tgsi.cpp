@@ -241,6 +241,7 @@ public:
    inline uint getLabel() { return insn->Label.Label; }
 
    unsigned getSaturate() const { return insn->Instruction.Saturate; }
+   bool isMediump() const { return insn->Instruction.Mediump; } // fincs-addition
 
    void print() const
    {
@@ -2307,14 +2308,16 @@ Converter::buildDot(int dim)
    Value *src0 = fetchSrc(0, 0), *src1 = fetchSrc(1, 0);
    Value *dotp = getScratch();
 
-   mkOp2(OP_MUL, TYPE_F32, dotp, src0, src1)
-      ->dnz = info->io.mul_zero_wins;
+   Instruction *insn = mkOp2(OP_MUL, TYPE_F32, dotp, src0, src1);
+   insn->dnz = info->io.mul_zero_wins;
+   insn->mediump = tgsi.isMediump(); // fincs-addition
 
    for (int c = 1; c < dim; ++c) {
       src0 = fetchSrc(0, c);
       src1 = fetchSrc(1, c);
-      mkOp3(OP_MAD, TYPE_F32, dotp, src0, src1, dotp)
-         ->dnz = info->io.mul_zero_wins;
+      insn = mkOp3(OP_MAD, TYPE_F32, dotp, src0, src1, dotp);
+      insn->dnz = info->io.mul_zero_wins;
+      insn->mediump = tgsi.isMediump(); // fincs-addition
    }
    return dotp;
 }
@@ -3313,6 +3316,7 @@ Converter::handleInstruction(const struct tgsi_full_instruction *insn)
          if (op == OP_MUL && dstTy == TYPE_F32)
             geni->dnz = info->io.mul_zero_wins;
          geni->precise = insn->Instruction.Precise;
+         geni->mediump = tgsi.isMediump() && dstTy == TYPE_F32; // fincs-addition
       }
       break;
    case TGSI_OPCODE_MAD:
@@ -3326,6 +3330,7 @@ Converter::handleInstruction(const struct tgsi_full_instruction *insn)
          if (dstTy == TYPE_F32)
             geni->dnz = info->io.mul_zero_wins;
          geni->precise = insn->Instruction.Precise;
+         geni->mediump = tgsi.isMediump() && dstTy == TYPE_F32; // fincs-addition
       }
       break;
    case TGSI_OPCODE_MOV:
@@ -64,6 +64,7 @@ static inline unsigned int typeSizeof(DataType ty)
    case TYPE_F32:
    case TYPE_U32:
    case TYPE_S32:
+   case TYPE_F16X2: // fincs-addition
       return 4;
    case TYPE_F64:
    case TYPE_U64:
@@ -88,6 +89,7 @@ static inline unsigned int typeSizeofLog2(DataType ty)
    case TYPE_F32:
    case TYPE_U32:
    case TYPE_S32:
+   case TYPE_F16X2: // fincs-addition
       return 2;
    case TYPE_F64:
    case TYPE_U64:
@@ -121,7 +123,7 @@ static inline DataType typeOfSize(unsigned int size,
 
 static inline bool isFloatType(DataType ty)
 {
-   return (ty >= TYPE_F16 && ty <= TYPE_F64);
+   return (ty >= TYPE_F16 && ty <= TYPE_F64) || ty == TYPE_F16X2; // fincs-edit
 }
 
 static inline bool isSignedIntType(DataType ty)
@@ -27,6 +27,8 @@
 #include "codegen/nv50_ir_target_nvc0.h"
 #include "codegen/nv50_ir_lowering_gm107.h"
 
+#include "util/half_float.h" // fincs-addition
+
 #include <limits>
 
 namespace nv50_ir {
@@ -76,6 +78,127 @@ GM107LegalizeSSA::handleLOAD(Instruction *i)
    i->op = OP_MOV;
 }
 
+Value *
+GM107LegalizeSSA::getXMADSrc(Value *v)
+{
+   if (v->reg.file == FILE_GPR)
+      return v;
+   return bld.mkMov(bld.getSSA(), v)->getDef(0);
+}
+
+// High 32 bits of the unsigned product of a and b, from 16 bit halves:
+//   t0 = al * bl
+//   t1 = al * bh + (t0 >> 16)
+//   t2 = ah * bl + (t1 & 0xffff)
+//   t3 = ah * bh + (t1 >> 16)
+//   hi = t3 + (t2 >> 16)
+// None of the intermediate sums can overflow.
+Value *
+GM107LegalizeSSA::emitMULHigh(Value *a, Value *b)
+{
+   ImmediateValue *imm = b->asImm();
+   Value *bl = b, *bh = b;
+   uint16_t h1 = NV50_IR_SUBOP_XMAD_H1(1);
+   Value *t[4];
+
+   if (imm) {
+      bl = bld.mkImm(imm->reg.data.u32 & 0xffff);
+      bh = bld.mkImm(imm->reg.data.u32 >> 16);
+      h1 = 0;
+   }
+
+   t[0] = bld.mkOp3v(OP_XMAD, TYPE_U32, bld.getSSA(), a, bl, bld.mkImm(0));
+   for (int n = 1; n < 4; ++n)
+      t[n] = bld.getSSA();
+   bld.mkOp3(OP_XMAD, TYPE_U32, t[1], a, bh, t[0])->subOp =
+      NV50_IR_SUBOP_XMAD_CHI | h1;
+   bld.mkOp3(OP_XMAD, TYPE_U32, t[2], a, bl, t[1])->subOp =
+      NV50_IR_SUBOP_XMAD_CLO | NV50_IR_SUBOP_XMAD_H1(0);
+   bld.mkOp3(OP_XMAD, TYPE_U32, t[3], a, bh, t[1])->subOp =
+      NV50_IR_SUBOP_XMAD_CHI | NV50_IR_SUBOP_XMAD_H1(0) | h1;
+
+   Value *hi = bld.getSSA();
+   bld.mkOp3(OP_XMAD, TYPE_U32, hi, t[2], bld.mkImm(1), t[3])->subOp =
+      NV50_IR_SUBOP_XMAD_H1(0);
+   return hi;
+}
+
+// 32-bit integer multiplications are much faster with XMAD than with IMUL.
+// LateAlgebraicOpt already converts the plain ones, this takes care of the
+// high multiplications (used for division) and of the multiplications
+// created during legalization.
+void
+GM107LegalizeSSA::handleMUL(Instruction *i)
+{
+   if (isFloatType(i->dType) || typeSizeof(i->dType) != 4)
+      return;
+   if (i->getPredicate() || i->usesFlags() || i->flagsDef >= 0)
+      return;
+   for (int s = 0; i->srcExists(s); ++s)
+      if (i->src(s).mod)
+         return;
+
+   bld.setPosition(i, false);
+
+   Value *a = i->getSrc(0);
+   Value *b = i->getSrc(1);
+   if (a->reg.file != FILE_GPR && b->reg.file == FILE_GPR)
+      std::swap(a, b);
+   a = getXMADSrc(a);
+
+   if (i->subOp == NV50_IR_SUBOP_MUL_HIGH) {
+      if (!b->asImm())
+         b = getXMADSrc(b);
+      Value *hi = emitMULHigh(a, b);
+
+      if (isSignedType(i->dType)) {
+         // mulhs(a, b) = mulhu(a, b) - (a < 0 ? b : 0) - (b < 0 ? a : 0)
+         Value *sign = bld.mkOp2v(OP_SHR, TYPE_S32, bld.getSSA(), a, bld.mkImm(31));
+         Value *fix = bld.mkOp2v(OP_AND, TYPE_U32, bld.getSSA(), sign, b);
+         hi = bld.mkOp2v(OP_SUB, TYPE_U32, bld.getSSA(), hi, fix);
+         if (b->asImm()) {
+            if (b->asImm()->reg.data.s32 < 0)
+               hi = bld.mkOp2v(OP_SUB, TYPE_U32, bld.getSSA(), hi, a);
+         } else {
+            sign = bld.mkOp2v(OP_SHR, TYPE_S32, bld.getSSA(), b, bld.mkImm(31));
+            fix = bld.mkOp2v(OP_AND, TYPE_U32, bld.getSSA(), sign, a);
+            hi = bld.mkOp2v(OP_SUB, TYPE_U32, bld.getSSA(), hi, fix);
+         }
+      }
+
+      if (i->op == OP_MAD) {
+         i->op = OP_ADD;
+         i->subOp = 0;
+         i->setSrc(0, hi);
+         i->setSrc(1, i->getSrc(2));
+         i->setSrc(2, NULL);
+      } else {
+         i->def(0).replace(hi, false);
+         delete_Instruction(prog, i);
+      }
+      return;
+   }
+   if (i->subOp)
+      return;
+
+   // Same sequence as LateAlgebraicOpt::handleMULMAD
+   b = getXMADSrc(b);
+   Value *c = i->op == OP_MUL ? bld.mkImm(0) : getXMADSrc(i->getSrc(2));
+   Value *tmp0 = bld.getSSA();
+   Value *tmp1 = bld.getSSA();
+
+   bld.mkOp3(OP_XMAD, TYPE_U32, tmp0, b, a, c);
+   bld.mkOp3(OP_XMAD, TYPE_U32, tmp1, b, a, bld.mkImm(0))->subOp =
+      NV50_IR_SUBOP_XMAD_MRG | NV50_IR_SUBOP_XMAD_H1(1);
+
+   i->op = OP_XMAD;
+   i->setSrc(0, b);
+   i->setSrc(1, tmp1);
+   i->setSrc(2, tmp0);
+   i->subOp = NV50_IR_SUBOP_XMAD_PSL | NV50_IR_SUBOP_XMAD_CBCC;
+   i->subOp |= NV50_IR_SUBOP_XMAD_H1(0) | NV50_IR_SUBOP_XMAD_H1(1);
+}
+
 bool
 GM107LegalizeSSA::visit(Instruction *i)
 {
@@ -86,12 +209,454 @@ GM107LegalizeSSA::visit(Instruction *i)
    case OP_LOAD:
       handleLOAD(i);
       break;
+   case OP_MUL:
+   case OP_MAD:
+      handleMUL(i);
+      break;
    default:
       break;
    }
    return true;
 }
 
+// fincs-addition
+// =============================================================================
+
+static bool
+isSameValue(const Value *a, const Value *b)
+{
+   if (a == b)
+      return true;
+   if (a->reg.file != b->reg.file || a->reg.file == FILE_GPR)
+      return false;
+   return a->equals(b);
+}
+
+static uint32_t
+getHalfImm(const Value *v)
+{
+   return _mesa_float_to_half(v->asImm()->reg.data.f32);
+}
+
+// Instructions needed to get an f32 operand into both halves of a register.
+static int
+getConversionCost(const Value *v)
+{
+   return v->reg.file == FILE_MEMORY_CONST ? 2 : 1;
+}
+
+// Fills in the operands of a candidate instruction, with the negations moved
+// to where the packed instructions can apply them (second and third source).
+bool
+GM107HalfFloatPacking::getOperands(Instruction *i, Operands& ops) const
+{
+   int n;
+
+   switch (i->op) {
+   case OP_ADD:
+   case OP_MUL:
+      n = 2;
+      break;
+   case OP_MAD:
+   case OP_FMA:
+      n = 3;
+      break;
+   default:
+      return false;
+   }
+
+   if (!i->mediump || i->precise || i->dnz || i->postFactor || i->subOp)
+      return false;
+   if (i->dType != TYPE_F32 || i->sType != TYPE_F32 || i->rnd != ROUND_N)
+      return false;
+   if (i->getPredicate() || i->flagsDef >= 0 || i->flagsSrc >= 0)
+      return false;
+   if (i->defExists(1) || i->def(0).getFile() != FILE_GPR)
+      return false;
+
+   for (int s = 0; s < 3; ++s) {
+      ops.src[s] = NULL;
+      ops.neg[s] = false;
+      if (s >= n)
+         continue;
+      if (i->src(s).mod & Modifier(~NV50_IR_MOD_NEG))
+         return false;
+      switch (i->src(s).getFile()) {
+      case FILE_GPR:
+      case FILE_IMMEDIATE:
+         break;
+      case FILE_MEMORY_CONST:
+         if (i->src(s).isIndirect(0))
+            return false;
+         break;
+      default:
+         return false;
+      }
+      ops.src[s] = i->getSrc(s);
+      ops.neg[s] = i->src(s).mod.neg();
+   }
+
+   if (i->op == OP_ADD) {
+      if (ops.neg[0] && ops.neg[1])
+         return false;
+      if (ops.neg[0]) {
+         std::swap(ops.src[0], ops.src[1]);
+         std::swap(ops.neg[0], ops.neg[1]);
+      }
+   } else {
+      ops.neg[1] ^= ops.neg[0];
+      ops.neg[0] = false;
+   }
+   return true;
+}
+
+bool
+GM107HalfFloatPacking::isCompatible(const Pair& pair) const
+{
+   const Instruction *a = pair.insn[0], *b = pair.insn[1];
+
+   if (a->op != b->op || a->saturate != b->saturate)
+      return false;
+   for (int s = 0; s < 3; ++s)
+      if (pair.ops[0].neg[s] != pair.ops[1].neg[s])
+         return false;
+   return true;
+}
+
+const GM107HalfFloatPacking::Pair *
+GM107HalfFloatPacking::getPair(const Value *v, int& lane) const
+{
+   std::map<const Value *, int>::const_iterator it = lanes.find(v);
+   if (it == lanes.end())
+      return NULL;
+   lane = it->second & 1;
+   return &pairs[it->second >> 1];
+}
+
+// Number of sources that can be read without any packing instruction.
+int
+GM107HalfFloatPacking::getAffinity(const Pair& pair) const
+{
+   int affinity = 0;
+
+   for (int s = 0; s < 3 && pair.ops[0].src[s]; ++s) {
+      const Value *v0 = pair.ops[0].src[s], *v1 = pair.ops[1].src[s];
+      int l0, l1;
+      const Pair *p0 = getPair(v0, l0), *p1 = getPair(v1, l1);
+
+      if (isSameValue(v0, v1) || (p0 && p0 == p1 && l0 < l1))
+         affinity++;
+   }
+   return affinity;
+}
+
+// Instructions needed to pack the operands of source s of a pair, see
+// getPackedSource. Operands already packed for another pair are free.
+int
+GM107HalfFloatPacking::getSourceCost(const Pair& pair, int s,
+                                     std::set<SourceKey>& packed) const
+{
+   const Value *v0 = pair.ops[0].src[s], *v1 = pair.ops[1].src[s];
+   int l0, l1;
+   const Pair *p0 = getPair(v0, l0), *p1 = getPair(v1, l1);
+
+   if (!packed.insert(SourceKey(v0, v1)).second)
+      return 0;
+
+   if (isSameValue(v0, v1))
+      return (p0 || v0->reg.file == FILE_GPR) ? 0 : 1;
+   if (p0 && p0 == p1 && l0 < l1)
+      return 0;
+   if (p0 && p1)
+      return 1;
+   if (v0->reg.file == FILE_IMMEDIATE && v1->reg.file == FILE_IMMEDIATE)
+      return 1;
+   return 1 + (p0 ? 0 : getConversionCost(v0)) +
+              (p1 ? 0 : getConversionCost(v1));
+}
+
+// Instructions needed to extract the results read by unpaired instructions.
+int
+GM107HalfFloatPacking::getExtractCost(const Pair& pair) const
+{
+   int cost = 0;
+
+   for (int l = 0; l < 2; ++l) {
+      Value *def = pair.insn[l]->getDef(0);
+      for (Value::UseIterator it = def->uses.begin(); it != def->uses.end(); ++it) {
+         Instruction *user = (*it)->getInsn();
+         if (!user->defExists(0) || !lanes.count(user->getDef(0))) {
+            cost++;
+            break;
+         }
+      }
+   }
+   return cost;
+}
+
+int
+GM107HalfFloatPacking::findGroup(int p)
+{
+   while (pairs[p].group != p) {
+      pairs[p].group = pairs[pairs[p].group].group;
+      p = pairs[p].group;
+   }
+   return p;
+}
+
+Value *
+GM107HalfFloatPacking::getGPR(Value *v)
+{
+   if (v->reg.file == FILE_GPR)
+      return v;
+   return bld.mkMov(bld.getSSA(), v)->getDef(0);
+}
+
+// Returns a register with v in one of its halves.
+Value *
+GM107HalfFloatPacking::getHalf(Value *v, int& lane)
+{
+   const Pair *p = getPair(v, lane);
+   if (p) {
+      assert(p->packed);
+      return p->packed;
+   }
+
+   lane = 0;
+   if (v->reg.file == FILE_IMMEDIATE) {
+      uint32_t h = getHalfImm(v);
+      return bld.mkMov(bld.getSSA(), bld.mkImm(h << 16 | h))->getDef(0);
+   }
+
+   Value *res = bld.getSSA();
+   Instruction *cvt = bld.mkOp2(OP_ADD, TYPE_F16X2, res, getGPR(v), bld.mkImm(0.0f));
+   cvt->sType = TYPE_F16X2;
+   cvt->subOp = NV50_IR_SUBOP_HALF2(0, NV50_IR_SUBOP_HALF2_F32);
+   cvt->src(1).mod = Modifier(NV50_IR_MOD_NEG);
+   return res;
+}
+
+// Returns the register holding the operands of source s of a pair, along with
+// the swizzle to read them with. Packed operands are reused by later pairs.
+Value *
+GM107HalfFloatPacking::getPackedSource(const Pair& pair, int s, int& swz)
+{
+   Value *v0 = pair.ops[0].src[s], *v1 = pair.ops[1].src[s];
+   std::map<SourceKey, std::pair<Value *, int> >::iterator it =
+      packedSources.find(SourceKey(v0, v1));
+   if (it != packedSources.end()) {
+      swz = it->second.second;
+      return it->second.first;
+   }
+
+   Value *res = packSource(v0, v1, swz);
+   packedSources[SourceKey(v0, v1)] = std::make_pair(res, swz);
+   return res;
+}
+
+Value *
+GM107HalfFloatPacking::packSource(Value *v0, Value *v1, int& swz)
+{
+   int l0, l1;
+   const Pair *p0 = getPair(v0, l0), *p1 = getPair(v1, l1);
+
+   swz = NV50_IR_SUBOP_HALF2_H1_H0;
+
+   if (isSameValue(v0, v1)) {
+      if (p0) {
+         swz = l0 ? NV50_IR_SUBOP_HALF2_H1_H1 : NV50_IR_SUBOP_HALF2_H0_H0;
+         return p0->packed;
+      }
+      swz = NV50_IR_SUBOP_HALF2_F32;
+      return getGPR(v0);
+   }
+   if (p0 && p0 == p1 && l0 < l1)
+      return p0->packed;
+   if (v0->reg.file == FILE_IMMEDIATE && v1->reg.file == FILE_IMMEDIATE)
+      return bld.mkMov(bld.getSSA(),
+                       bld.mkImm(getHalfImm(v1) << 16 | getHalfImm(v0)))->getDef(0);
+
+   Value *h0 = getHalf(v0, l0);
+   Value *h1 = getHalf(v1, l1);
+   uint32_t sel = (2 * l0) | (2 * l0 + 1) << 4 |
+                  (4 + 2 * l1) << 8 | (5 + 2 * l1) << 12;
+   return bld.mkOp3v(OP_PERMT, TYPE_U32, bld.getSSA(), h0, bld.mkImm(sel), h1);
+}
+
+// Computes both instructions of a pair where the later one was, then gets
+// their results back as f32 for the instructions which are not paired.
+void
+GM107HalfFloatPacking::emitPair(Pair& pair)
+{
+   Instruction *insn = pair.insn[1];
+   Value *src[3] = { NULL, NULL, NULL };
+   int swz[3] = { 0, 0, 0 };
+
+   bld.setPosition(insn, false);
+   for (int s = 0; s < 3 && pair.ops[1].src[s]; ++s)
+      src[s] = getPackedSource(pair, s, swz[s]);
+
+   pair.packed = bld.getSSA();
+   Instruction *packed = src[2] ?
+      bld.mkOp3(insn->op, TYPE_F16X2, pair.packed, src[0], src[1], src[2]) :
+      bld.mkOp2(insn->op, TYPE_F16X2, pair.packed, src[0], src[1]);
+   packed->sType = TYPE_F16X2;
+   packed->saturate = insn->saturate;
+   for (int s = 0; s < 3 && src[s]; ++s) {
+      packed->subOp |= NV50_IR_SUBOP_HALF2(s, swz[s]);
+      if (pair.ops[1].neg[s])
+         packed->src(s).mod = Modifier(NV50_IR_MOD_NEG);
+   }
+
+   bld.setPosition(packed, true);
+   for (int l = 0; l < 2; ++l) {
+      Value *def = pair.insn[l]->getDef(0);
+      std::vector<ValueRef *> refs;
+
+      for (Value::UseIterator it = def->uses.begin(); it != def->uses.end(); ++it) {
+         Instruction *user = (*it)->getInsn();
+         if (!user->defExists(0) || !lanes.count(user->getDef(0)))
+            refs.push_back(*it);
+      }
+      if (refs.empty())
+         continue;
+
+      Value *res = bld.getSSA();
+      Instruction *ext = bld.mkOp2(OP_ADD, TYPE_F32, res, pair.packed, bld.mkImm(0.0f));
+      ext->sType = TYPE_F16X2;
+      ext->subOp = NV50_IR_SUBOP_HALF2(0, l ? NV50_IR_SUBOP_HALF2_H1_H1
+                                            : NV50_IR_SUBOP_HALF2_H0_H0);
+      ext->src(1).mod = Modifier(NV50_IR_MOD_NEG);
+      for (size_t r = 0; r < refs.size(); ++r)
+         refs[r]->set(res);
+   }
+}
+
+bool
+GM107HalfFloatPacking::visit(Function *fn)
+{
+   bld.setProgram(fn->getProgram());
+   return true;
+}
+
+bool
+GM107HalfFloatPacking::visit(BasicBlock *bb)
+{
+   struct Candidate
+   {
+      Instruction *insn;
+      Operands ops;
+      int firstUse; // position of the first instruction reading the result
+   };
+   std::map<const Instruction *, int> pos;
+   std::vector<Candidate> open;
+   int n = 0;
+
+   pairs.clear();
+   lanes.clear();
+   packedSources.clear();
+
+   for (Instruction *i = bb->getEntry(); i; i = i->next)
+      pos[i] = n++;
+
+   // Pair each candidate with one of the recent unpaired ones, which must
+   // not have its result read before the candidate (the pair is computed at
+   // the later instruction). Prefer the one whose operands are the easiest
+   // to pack, then the closest one.
+   for (Instruction *i = bb->getEntry(); i; i = i->next) {
+      Pair pair;
+      if (!getOperands(i, pair.ops[1]))
+         continue;
+      pair.insn[1] = i;
+
+      const int p = pos[i];
+      int best = -1, bestAffinity = -1;
+      for (int k = (int)open.size() - 1; k >= 0 && k >= (int)open.size() - 32; --k) {
+         if (open[k].firstUse <= p)
+            continue;
+         pair.insn[0] = open[k].insn;
+         pair.ops[0] = open[k].ops;
+         if (!isCompatible(pair))
+            continue;
+         int affinity = getAffinity(pair);
+         if (affinity > bestAffinity) {
+            best = k;
+            bestAffinity = affinity;
+         }
+      }
+
+      if (best < 0) {
+         Candidate c;
+         c.insn = i;
+         c.ops = pair.ops[1];
+         c.firstUse = std::numeric_limits<int>::max();
+         Value *def = i->getDef(0);
+         for (Value::UseIterator it = def->uses.begin(); it != def->uses.end(); ++it) {
+            std::map<const Instruction *, int>::const_iterator u = pos.find((*it)->getInsn());
+            if (u != pos.end() && u->second > p && u->second < c.firstUse)
+               c.firstUse = u->second;
+         }
+         open.push_back(c);
+         continue;
+      }
+
+      pair.insn[0] = open[best].insn;
+      pair.ops[0] = open[best].ops;
+      pair.group = pairs.size();
+      pair.packed = NULL;
+      lanes[pair.insn[0]->getDef(0)] = 2 * pair.group;
+      lanes[pair.insn[1]->getDef(0)] = 2 * pair.group + 1;
+      pairs.push_back(pair);
+      open.erase(open.begin() + best);
+   }
+
+   if (pairs.empty())
+      return true;
+
+   // Pairs reading each other's results form groups, evaluated as a whole:
+   // each pair saves an instruction, but packing operands and extracting
+   // results for unpaired instructions costs some.
+   for (size_t p = 0; p < pairs.size(); ++p) {
+      for (int l = 0; l < 2; ++l) {
+         for (int s = 0; s < 3 && pairs[p].ops[l].src[s]; ++s) {
+            int lane;
+            const Pair *src = getPair(pairs[p].ops[l].src[s], lane);
+            if (src)
+               pairs[findGroup(src - &pairs[0])].group = findGroup(p);
+         }
+      }
+   }
+
+   std::vector<int> benefit(pairs.size(), 0);
+   std::vector<std::set<SourceKey> > packed(pairs.size());
+   for (size_t p = 0; p < pairs.size(); ++p) {
+      const int group = findGroup(p);
+      benefit[group] += 1 - getExtractCost(pairs[p]);
+      for (int s = 0; s < 3 && pairs[p].ops[1].src[s]; ++s)
+         benefit[group] -= getSourceCost(pairs[p], s, packed[group]);
+   }
+
+   for (size_t p = 0; p < pairs.size(); ++p) {
+      if (benefit[findGroup(p)] > 0)
+         continue;
+      lanes.erase(pairs[p].insn[0]->getDef(0));
+      lanes.erase(pairs[p].insn[1]->getDef(0));
+   }
+
+   std::vector<Instruction *> dead;
+   for (size_t p = 0; p < pairs.size(); ++p) {
+      if (benefit[findGroup(p)] <= 0)
+         continue;
+      emitPair(pairs[p]);
+      dead.push_back(pairs[p].insn[0]);
+      dead.push_back(pairs[p].insn[1]);
+   }
+   for (size_t d = 0; d < dead.size(); ++d)
+      delete_Instruction(prog, dead[d]);
+
+   return true;
+}
+
 bool
 GM107LoweringPass::handleManualTXD(TexInstruction *i)
 {
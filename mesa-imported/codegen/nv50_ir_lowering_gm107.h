@@ -1,5 +1,8 @@
 #include "codegen/nv50_ir_lowering_nvc0.h"
 
+#include <map> // fincs-addition
+#include <set> // fincs-addition
+
 namespace nv50_ir {
 
 class GM107LoweringPass : public NVC0LoweringPass
@@ -23,6 +26,58 @@ private:
 
    void handlePFETCH(Instruction *);
    void handleLOAD(Instruction *);
+   void handleMUL(Instruction *);
+
+   Value *getXMADSrc(Value *);
+   Value *emitMULHigh(Value *a, Value *b);
+};
+
+// fincs-addition
+// Pairs independent mediump float ADD/MUL/MAD of a basic block and computes
+// each pair with a single HADD2/HMUL2/HFMA2, one f16 value per half register.
+// Packing the operands and extracting results used by other instructions
+// costs extra instructions, so pairs are only kept when the chains they form
+// save more instructions than they add.
+class GM107HalfFloatPacking : public Pass
+{
+private:
+   struct Operands
+   {
+      Value *src[3];
+      bool neg[3];
+   };
+
+   typedef std::pair<const Value *, const Value *> SourceKey;
+
+   struct Pair
+   {
+      Instruction *insn[2]; // insn[1] comes later, the pair is computed there
+      Operands ops[2];
+      int group; // pairs exchanging values, kept or dropped together
+      Value *packed;
+   };
+
+   virtual bool visit(Function *);
+   virtual bool visit(BasicBlock *);
+
+   bool getOperands(Instruction *, Operands&) const;
+   bool isCompatible(const Pair&) const;
+   const Pair *getPair(const Value *, int& lane) const;
+   int getAffinity(const Pair&) const;
+   int getSourceCost(const Pair&, int s, std::set<SourceKey>& packed) const;
+   int getExtractCost(const Pair&) const;
+   int findGroup(int);
+
+   Value *getGPR(Value *);
+   Value *getHalf(Value *, int& lane);
+   Value *getPackedSource(const Pair&, int s, int& swz);
+   Value *packSource(Value *, Value *, int& swz);
+   void emitPair(Pair&);
+
+   BuildUtil bld;
+   std::vector<Pair> pairs;
+   std::map<const Value *, int> lanes; // def -> 2 * pair index + lane
+   std::map<SourceKey, std::pair<Value *, int> > packedSources; // with swizzle
 };
 
 } // namespace nv50_ir
@@ -61,6 +61,52 @@ NVC0LegalizeSSA::emulateIDIVMOD(DataType dt, Value *dst, Value *src0, Value *src
       bld.mkCvt(OP_TRUNC, intTypeToSigned(dt), dst, flttype, tmp0)->src(0).mod = NV50_IR_MOD_NEG;
 }
 
+// Exact unsigned 32-bit division, writing the quotient to q and/or the
+// remainder to r. The float reciprocal of the divisor is scaled to slightly
+// less than 2^32 / b, so that it never overestimates even with the error of
+// RCP, and refined with one Newton-Raphson step in fixed point. The quotient
+// estimate computed from it is at most 2 too small, which two correction
+// steps on the remainder take care of.
+void
+NVC0LegalizeSSA::emitUDIVMOD(Value *q, Value *r, Value *a, Value *b)
+{
+   Instruction *mul;
+   Value *x, *e, *quot, *rem, *ge;
+
+   x = bld.mkCvt(OP_CVT, TYPE_F32, bld.getSSA(), TYPE_U32, b)->getDef(0);
+   x = bld.mkOp1v(OP_RCP, TYPE_F32, bld.getSSA(), x);
+   x = bld.mkOp2v(OP_MUL, TYPE_F32, bld.getSSA(), x,
+                  bld.loadImm(NULL, 4294965248.0f));
+   x = bld.mkCvt(OP_CVT, TYPE_U32, bld.getSSA(), TYPE_F32, x)->getDef(0);
+   x->getInsn()->rnd = ROUND_Z;
+
+   // x += mulhi(x, -(x * b))
+   e = bld.mkOp2v(OP_MUL, TYPE_U32, bld.getSSA(), x, b);
+   e = bld.mkOp1v(OP_NEG, TYPE_S32, bld.getSSA(), e);
+   mul = bld.mkOp2(OP_MUL, TYPE_U32, bld.getSSA(), x, e);
+   mul->subOp = NV50_IR_SUBOP_MUL_HIGH;
+   x = bld.mkOp2v(OP_ADD, TYPE_U32, bld.getSSA(), x, mul->getDef(0));
+
+   mul = bld.mkOp2(OP_MUL, TYPE_U32, bld.getSSA(), a, x);
+   mul->subOp = NV50_IR_SUBOP_MUL_HIGH;
+   quot = mul->getDef(0);
+   rem = bld.mkOp2v(OP_MUL, TYPE_U32, bld.getSSA(), quot, b);
+   rem = bld.mkOp2v(OP_SUB, TYPE_U32, bld.getSSA(), a, rem);
+
+   // SET yields ~0 when true: if (rem >= b) { quot += 1; rem -= b; }
+   for (int n = 0; n < 2; ++n) {
+      const bool last = n == 1;
+      ge = bld.getSSA();
+      bld.mkCmp(OP_SET, CC_GE, TYPE_U32, ge, TYPE_U32, rem, b);
+      if (q)
+         quot = bld.mkOp2v(OP_SUB, TYPE_U32, last ? q : bld.getSSA(), quot, ge);
+      if (r || !last) {
+         Value *sub = bld.mkOp2v(OP_AND, TYPE_U32, bld.getSSA(), b, ge);
+         rem = bld.mkOp2v(OP_SUB, TYPE_U32, last ? r : bld.getSSA(), rem, sub);
+      }
+   }
+}
+
 void
 NVC0LegalizeSSA::handleDIV(Instruction *i)
 {
@@ -105,19 +151,52 @@ NVC0LegalizeSSA::handleDIV(Instruction *i)
    delete_Instruction(prog, i);
 #endif
 
-   prog->int_divmod = true;
    bld.setPosition(i, false);
-   switch (i->op) {
-   default:
-   case OP_DIV:
-      emulateIDIVMOD(i->dType, i->getDef(0), i->getSrc(0), i->getSrc(1), false);
-      break;
-   case OP_MOD: {
-      LValue *tmp = bld.getSSA(typeSizeof(i->dType));
-      emulateIDIVMOD(i->dType, tmp, i->getSrc(0), i->getSrc(1), true);
-      bld.mkOp3(OP_FMA, i->dType, i->getDef(0), tmp, i->getSrc(1), i->getSrc(0));
-      break;
+
+   if (typeSizeof(i->dType) == 8) {
+      prog->int_divmod = true;
+      switch (i->op) {
+      default:
+      case OP_DIV:
+         emulateIDIVMOD(i->dType, i->getDef(0), i->getSrc(0), i->getSrc(1), false);
+         break;
+      case OP_MOD: {
+         LValue *tmp = bld.getSSA(typeSizeof(i->dType));
+         emulateIDIVMOD(i->dType, tmp, i->getSrc(0), i->getSrc(1), true);
+         bld.mkOp3(OP_FMA, i->dType, i->getDef(0), tmp, i->getSrc(1), i->getSrc(0));
+         break;
+      }
+      }
+      delete_Instruction(prog, i);
+      return;
+   }
+
+   const bool isSigned = isSignedType(i->dType);
+   Value *a = i->getSrc(0);
+   Value *b = i->getSrc(1);
+   Value *q = NULL, *r = NULL;
+
+   // Signed division works on the magnitudes, the sign is restored afterwards
+   if (isSigned) {
+      a = bld.mkOp1v(OP_ABS, TYPE_S32, bld.getSSA(), a);
+      b = bld.mkOp1v(OP_ABS, TYPE_S32, bld.getSSA(), b);
    }
+   if (i->op == OP_DIV)
+      q = isSigned ? bld.getSSA() : i->getDef(0);
+   else
+      r = isSigned ? bld.getSSA() : i->getDef(0);
+
+   emitUDIVMOD(q, r, a, b);
+
+   if (isSigned) {
+      // The quotient is negative if the operands have different signs, the
+      // remainder has the sign of the dividend: x = (x ^ s) - s
+      Value *res = q ? q : r;
+      Value *sign = q ? bld.mkOp2v(OP_XOR, TYPE_U32, bld.getSSA(),
+                                   i->getSrc(0), i->getSrc(1)) : i->getSrc(0);
+      sign = bld.mkOp2v(OP_SHR, TYPE_S32, bld.getSSA(), sign, bld.mkImm(31));
+      res = bld.mkOp2v(OP_XOR, TYPE_U32, bld.getSSA(), res, sign);
+      bld.mkOp2(OP_SUB, TYPE_S32, i->getDef(0), res, sign);
    }
    delete_Instruction(prog, i);
 }
@@ -62,6 +62,7 @@ private:
 
    // we want to insert calls to the builtin library only after optimization
    void emulateIDIVMOD(DataType dt, Value *dst, Value *src0, Value *src1, bool negate); // fincs-edit
+   void emitUDIVMOD(Value *q, Value *r, Value *a, Value *b);
    void handleDIV(Instruction *); // integer division, modulus
    void handleRCPRSQLib(Instruction *, Value *[]);
    void handleRCPRSQ(Instruction *); // double precision float recip/rsqrt
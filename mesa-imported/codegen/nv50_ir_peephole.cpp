@@ -27,6 +27,9 @@
 extern "C" {
 #include "util/u_math.h"
 }
+#include "util/u_compile_stats.h" // fincs-addition
+
+#include <set> // fincs-addition
 
 namespace nv50_ir {
 
@@ -1226,6 +1229,26 @@ ConstantFolding::opnd(Instruction *i, ImmediateValue &imm0, int s)
       if (imm0.reg.data.s32 == -1) {
          i->op = OP_NEG;
          i->setSrc(1, NULL);
+      } else
+      if (util_is_power_of_two_or_zero(abs(imm0.reg.data.s32))) {
+         // Bias negative dividends by |d| - 1, so that the arithmetic shift
+         // rounds towards zero.
+         const int32_t d = imm0.reg.data.s32;
+         const int l = util_logbase2(static_cast<unsigned>(abs(d)));
+         Value *tA;
+         tA = bld.mkOp2v(OP_SHR, TYPE_S32, bld.getSSA(), i->getSrc(0),
+                         bld.mkImm(31));
+         tA = bld.mkOp2v(OP_SHR, TYPE_U32, bld.getSSA(), tA, bld.mkImm(32 - l));
+         tA = bld.mkOp2v(OP_ADD, TYPE_U32, bld.getSSA(), i->getSrc(0), tA);
+         if (d < 0) {
+            tA = bld.mkOp2v(OP_SHR, TYPE_S32, bld.getSSA(), tA, bld.mkImm(l));
+            newi = bld.mkOp1(OP_NEG, TYPE_S32, i->getDef(0), tA);
+         } else {
+            newi = bld.mkOp2(OP_SHR, TYPE_S32, i->getDef(0), tA, bld.mkImm(l));
+         }
+
+         delete_Instruction(prog, i);
+         deleted = true;
       } else {
          LValue *tA, *tB;
          LValue *tD;
@@ -1893,6 +1916,7 @@ AlgebraicOpt::tryADDToMADOrSAD(Instruction *add, operation toOp)
    add->op = toOp;
    add->subOp = src->getInsn()->subOp; // potentially mul-high
    add->dnz = src->getInsn()->dnz;
+   add->mediump &= src->getInsn()->mediump; // fincs-addition
    add->dType = src->getInsn()->dType; // sign matters for imad hi
    add->sType = src->getInsn()->sType;
 
@@ -3843,6 +3867,339 @@ LocalCSE::visit(BasicBlock *bb)
 
 // =============================================================================
 
+// fincs-addition: Instructions whose result only depends on their sources, and
+// which can be executed anywhere without side effects.
+static bool
+isPureInstruction(const Instruction *i)
+{
+   if (i->fixed || i->isPredicated() || !i->defExists(0))
+      return false;
+
+   switch (Target::getOpClass(i->op)) {
+   case OPCLASS_ARITH:
+   case OPCLASS_SHIFT:
+   case OPCLASS_SFU:
+   case OPCLASS_LOGIC:
+   case OPCLASS_COMPARE:
+   case OPCLASS_CONVERT:
+   case OPCLASS_VECTOR:
+   case OPCLASS_BITFIELD:
+      return true;
+   case OPCLASS_MOVE:
+      // immediates are cheaper to rematerialize than to keep live
+      return i->src(0).getFile() != FILE_IMMEDIATE;
+   case OPCLASS_PSEUDO:
+      return i->op == OP_SPLIT || i->op == OP_MERGE;
+   case OPCLASS_LOAD:
+      return i->op == OP_LOAD && i->src(0).getFile() == FILE_MEMORY_CONST;
+   default:
+      return i->op == OP_RDSV;
+   }
+}
+
+// Global value numbering. Walks the dominator tree built for SSA construction
+// and replaces pure computations, constant buffer loads and system value reads
+// with an equal instruction from a dominating position.
+class GlobalValueNumbering : public Pass
+{
+private:
+   virtual bool visit(Function *);
+
+   bool isAvailable(const Instruction *, const Instruction *) const;
+   bool tryReplace(Instruction *, Instruction *);
+
+   std::vector<Instruction *> ops[OP_LAST + 1];
+};
+
+// The instructions are visited in dominator tree pre-order, so an earlier
+// serial in another block is only usable if that block dominates this one.
+bool
+GlobalValueNumbering::isAvailable(const Instruction *ik,
+                                  const Instruction *i) const
+{
+   if (ik == i || ik->serial >= i->serial || !isPureInstruction(ik))
+      return false;
+   return ik->bb == i->bb || i->bb->dominatedBy(ik->bb);
+}
+
+bool
+GlobalValueNumbering::tryReplace(Instruction *i, Instruction *ik)
+{
+   if (!i->isResultEqual(ik))
+      return false;
+
+   ik->precise |= i->precise;
+   ik->mediump &= i->mediump;
+   for (int d = 0; i->defExists(d); ++d)
+      i->def(d).replace(ik->getDef(d), false);
+   delete_Instruction(prog, i);
+   return true;
+}
+
+bool
+GlobalValueNumbering::visit(Function *fn)
+{
+   if (!fn->domTree || !fn->domTree->getRoot())
+      return true;
+
+   int serial = 0;
+   for (IteratorRef it = fn->domTree->iteratorDFS(true); !it->end(); it->next()) {
+      BasicBlock *bb = BasicBlock::get(reinterpret_cast<Graph::Node *>(it->get()));
+      for (Instruction *i = bb->getFirst(); i; i = i->next)
+         i->serial = serial++;
+   }
+
+   for (IteratorRef it = fn->domTree->iteratorDFS(true); !it->end(); it->next()) {
+      BasicBlock *bb = BasicBlock::get(reinterpret_cast<Graph::Node *>(it->get()));
+      Instruction *next;
+
+      for (Instruction *i = bb->getEntry(); i; i = next) {
+         Value *src = NULL;
+         bool replaced = false;
+
+         next = i->next;
+         if (!isPureInstruction(i))
+            continue;
+
+         // Any equal instruction has to use the same values, so only the
+         // users of the least used source need to be looked at.
+         for (int s = 0; i->srcExists(s); ++s)
+            if (i->getSrc(s)->asLValue())
+               if (!src || i->getSrc(s)->refCount() < src->refCount())
+                  src = i->getSrc(s);
+
+         if (src) {
+            for (Value::UseIterator u = src->uses.begin();
+                 u != src->uses.end(); ++u) {
+               Instruction *ik = (*u)->getInsn();
+               if (ik && isAvailable(ik, i) && tryReplace(i, ik)) {
+                  replaced = true;
+                  break;
+               }
+            }
+         } else {
+            std::vector<Instruction *> &list = ops[i->op];
+            for (size_t n = 0; n < list.size(); ++n) {
+               if (isAvailable(list[n], i) && tryReplace(i, list[n])) {
+                  replaced = true;
+                  break;
+               }
+            }
+            if (!replaced)
+               list.push_back(i);
+         }
+      }
+   }
+
+   for (unsigned int n = 0; n <= OP_LAST; ++n)
+      ops[n].clear();
+   return true;
+}
+
+// =============================================================================
+
+// fincs-addition: Loop-invariant code motion. Pure instructions whose sources
+// are all defined outside of a loop are moved to the block that enters it, as
+// long as the registers kept live across the loop still fit in the file.
+class LoopInvariantMotion : public Pass
+{
+private:
+   struct Loop
+   {
+      BasicBlock *header;
+      BasicBlock *preheader;
+      std::vector<BasicBlock *> blocks; // in CFG order
+      std::vector<bool> member;
+   };
+
+   virtual bool visit(Function *);
+
+   bool findLoop(BasicBlock *header, Loop &);
+   bool isInvariant(const Loop &, const Instruction *) const;
+   int getPressure(const Loop &) const;
+   void hoist(Loop &);
+
+   std::vector<BasicBlock *> order;
+   int limit;
+};
+
+static inline int
+getRegUnits(const Value *v)
+{
+   return (v->reg.size + 3) / 4;
+}
+
+bool
+LoopInvariantMotion::findLoop(BasicBlock *header, Loop &loop)
+{
+   std::vector<BasicBlock *> work;
+
+   loop.header = header;
+   loop.preheader = NULL;
+   loop.member.assign(func->allBBlocks.getSize(), false);
+   loop.member[header->getId()] = true;
+
+   for (Graph::EdgeIterator ei = header->cfg.incident(); !ei.end(); ei.next()) {
+      BasicBlock *in = BasicBlock::get(ei.getNode());
+      if (ei.getType() == Graph::Edge::BACK) {
+         if (!in->dominatedBy(header))
+            return false;
+         work.push_back(in);
+      } else {
+         // only loops with a single entry that can take more code
+         if (loop.preheader || in->cfg.outgoingCount() != 1)
+            return false;
+         loop.preheader = in;
+      }
+   }
+   if (!loop.preheader)
+      return false;
+
+   while (!work.empty()) {
+      BasicBlock *bb = work.back();
+      work.pop_back();
+      if (loop.member[bb->getId()])
+         continue;
+      loop.member[bb->getId()] = true;
+      for (Graph::EdgeIterator ei = bb->cfg.incident(); !ei.end(); ei.next())
+         work.push_back(BasicBlock::get(ei.getNode()));
+   }
+   if (loop.member[loop.preheader->getId()])
+      return false;
+
+   for (size_t n = 0; n < order.size(); ++n)
+      if (loop.member[order[n]->getId()])
+         loop.blocks.push_back(order[n]);
+   return true;
+}
+
+bool
+LoopInvariantMotion::isInvariant(const Loop &loop, const Instruction *i) const
+{
+   if (i->op == OP_PHI || !isPureInstruction(i))
+      return false;
+   for (int d = 0; i->defExists(d); ++d)
+      if (i->getDef(d)->reg.file != FILE_GPR)
+         return false;
+   for (int s = 0; i->srcExists(s); ++s) {
+      const Instruction *def = i->getSrc(s)->getInsn();
+      if (i->getSrc(s)->asLValue() && def && loop.member[def->bb->getId()])
+         return false;
+   }
+   return true;
+}
+
+// Rough estimate of the number of registers needed inside the loop: values
+// coming from outside are live throughout, to which the peak number of
+// values defined and used within a single block is added.
+int
+LoopInvariantMotion::getPressure(const Loop &loop) const
+{
+   std::set<const Value *> through;
+   int peak = 0;
+
+   for (size_t b = 0; b < loop.blocks.size(); ++b) {
+      std::set<const Value *> live;
+      int units = 0;
+
+      for (Instruction *i = loop.blocks[b]->getExit(); i; i = i->prev) {
+         for (int d = 0; i->defExists(d); ++d)
+            if (live.erase(i->getDef(d)))
+               units -= getRegUnits(i->getDef(d));
+         for (int s = 0; i->srcExists(s); ++s) {
+            Value *v = i->getSrc(s);
+            if (!v->asLValue() || v->reg.file != FILE_GPR)
+               continue;
+            const Instruction *def = v->getInsn();
+            if (!def || !loop.member[def->bb->getId()] || def->op == OP_PHI)
+               through.insert(v);
+            else
+            if (live.insert(v).second)
+               units += getRegUnits(v);
+         }
+         peak = MAX2(peak, units);
+      }
+   }
+
+   for (std::set<const Value *>::iterator it = through.begin();
+        it != through.end(); ++it)
+      peak += getRegUnits(*it);
+   return peak;
+}
+
+void
+LoopInvariantMotion::hoist(Loop &loop)
+{
+   int pressure = getPressure(loop);
+
+   // Keep the moved code ahead of the flow instructions ending the block.
+   Instruction *term = loop.preheader->getExit();
+   while (term && term->asFlow() && term->prev && term->prev->asFlow())
+      term = term->prev;
+   if (term && !term->asFlow())
+      term = NULL;
+
+   for (size_t b = 0; b < loop.blocks.size(); ++b) {
+      Instruction *next;
+      for (Instruction *i = loop.blocks[b]->getEntry(); i; i = next) {
+         next = i->next;
+         if (!isInvariant(loop, i))
+            continue;
+
+         int units = 0;
+         for (int d = 0; i->defExists(d); ++d)
+            units += getRegUnits(i->getDef(d));
+         if (pressure + units > limit)
+            return;
+         pressure += units;
+
+         i->bb->remove(i);
+         if (term)
+            loop.preheader->insertBefore(term, i);
+         else
+            loop.preheader->insertTail(i);
+      }
+   }
+}
+
+bool
+LoopInvariantMotion::visit(Function *fn)
+{
+   std::vector<Loop> loops;
+
+   // leave some room for what the estimate does not account for
+   limit = prog->getTarget()->getFileSize(FILE_GPR) - 16;
+
+   order.clear();
+   for (IteratorRef it = fn->cfg.iteratorCFG(); !it->end(); it->next())
+      order.push_back(BasicBlock::get(reinterpret_cast<Graph::Node *>(it->get())));
+
+   for (size_t n = 0; n < order.size(); ++n) {
+      for (Graph::EdgeIterator ei = order[n]->cfg.incident(); !ei.end(); ei.next()) {
+         if (ei.getType() != Graph::Edge::BACK)
+            continue;
+         loops.push_back(Loop());
+         if (!findLoop(order[n], loops.back()))
+            loops.pop_back();
+         break;
+      }
+   }
+
+   // Inner loops first, so that their invariants can move further out.
+   for (size_t n = 0; n < loops.size(); ++n) {
+      size_t inner = n;
+      for (size_t k = n + 1; k < loops.size(); ++k)
+         if (loops[k].blocks.size() < loops[inner].blocks.size())
+            inner = k;
+      std::swap(loops[n], loops[inner]);
+      hoist(loops[n]);
+   }
+
+   return true;
+}
+
+// =============================================================================
+
 // Remove computations of unused values.
 class DeadCodeElim : public Pass
 {
@@ -4053,6 +4410,7 @@ PostRADualIssue::visit(BasicBlock *bb)
    if (level >= (l)) {                          \
       if (dbgFlags & NV50_IR_DEBUG_VERBOSE)     \
          INFO("PEEPHOLE: %s\n", #n);            \
+      compile_stats_scope stats(#n);            \
       n pass;                                   \
       if (!pass.f(this))                        \
          return false;                          \
@@ -4065,6 +4423,7 @@ Program::optimizeSSA(int level)
    RUN_PASS(1, CopyPropagation, run);
    RUN_PASS(1, MergeSplits, run);
    RUN_PASS(2, GlobalCSE, run);
+   RUN_PASS(2, GlobalValueNumbering, run); // fincs-addition
    RUN_PASS(1, LocalCSE, run);
    RUN_PASS(2, AlgebraicOpt, run);
    RUN_PASS(2, ModifierFolding, run); // before load propagation -> less checks
@@ -4075,6 +4434,7 @@ Program::optimizeSSA(int level)
    RUN_PASS(1, IndirectPropagation, run);
    RUN_PASS(2, MemoryOpt, run);
    RUN_PASS(2, LocalCSE, run);
+   RUN_PASS(2, LoopInvariantMotion, run); // fincs-addition
    RUN_PASS(0, DeadCodeElim, buryAll);
 
    return true;
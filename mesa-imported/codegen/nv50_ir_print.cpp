@@ -254,7 +254,8 @@ static const char *DataTypeStr[] =
    "u32", "s32",
    "u64", "s64",
    "f16", "f32", "f64",
-   "b96", "b128"
+   "b96", "b128",
+   "f16x2" // fincs-addition
 };
 
 static const char *RoundModeStr[] =
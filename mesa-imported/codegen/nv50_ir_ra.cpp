@@ -24,6 +24,7 @@
 #include "codegen/nv50_ir_target.h"
 
 #include <algorithm>
+#include <deque> // fincs-addition
 #include <stack>
 #include <limits>
 #if __cplusplus >= 201103L
@@ -306,23 +307,19 @@ public:
    Value *offsetSlot(Value *, const LValue *);
    inline int32_t getStackSize() const { return stackSize; }
 
+   Instruction *getRematDef(const LValue *) const; // fincs-addition
+
 private:
    Function *func;
 
-   struct SpillSlot
-   {
-      Interval occup;
-      std::list<Value *> residents; // needed to recalculate occup
-      Symbol *sym;
-      int32_t offset;
-      inline uint8_t size() const { return sym->reg.size; }
-   };
-   std::list<SpillSlot> slots;
+   // fincs-edit: occupancy of each 4-byte word of the stack above stackBase
+   std::deque<Interval> occup;
    int32_t stackSize;
    int32_t stackBase;
 
    LValue *unspill(Instruction *usei, LValue *, Value *slot);
    void spill(Instruction *defi, Value *slot, LValue *);
+   void rematerialize(Instruction *defi, LValue *); // fincs-addition
 };
 
 void
@@ -784,8 +781,8 @@ private:
 
    inline void checkInterference(const RIG_Node *, Graph::EdgeIterator&);
 
-   inline void insertOrderedTail(std::list<RIG_Node *>&, RIG_Node *);
-   void checkList(std::list<RIG_Node *>&);
+   static inline bool beginsBefore(const RIG_Node *, const RIG_Node *);
+   void checkList(std::vector<RIG_Node *>&);
 
 private:
    std::stack<uint32_t> stack;
@@ -1176,11 +1173,11 @@ GCRA::~GCRA()
 }
 
 void
-GCRA::checkList(std::list<RIG_Node *>& lst)
+GCRA::checkList(std::vector<RIG_Node *>& lst)
 {
    GCRA::RIG_Node *prev = NULL;
 
-   for (std::list<RIG_Node *>::iterator it = lst.begin();
+   for (std::vector<RIG_Node *>::iterator it = lst.begin();
         it != lst.end();
         ++it) {
       assert((*it)->getValue()->join == (*it)->getValue());
@@ -1190,56 +1187,78 @@ GCRA::checkList(std::list<RIG_Node *>& lst)
    }
 }
 
-void
-GCRA::insertOrderedTail(std::list<RIG_Node *>& list, RIG_Node *node)
+bool
+GCRA::beginsBefore(const RIG_Node *a, const RIG_Node *b)
 {
-   if (node->livei.isEmpty())
-      return;
-   // only the intervals of joined values don't necessarily arrive in order
-   std::list<RIG_Node *>::iterator prev, it;
-   for (it = list.end(); it != list.begin(); it = prev) {
-      prev = it;
-      --prev;
-      if ((*prev)->livei.begin() <= node->livei.begin())
-         break;
-   }
-   list.insert(it, node);
+   return a->livei.begin() < b->livei.begin();
 }
 
+// Interference is found by sweeping over the live intervals sorted by start
+// position, keeping a separate set of active (not yet ended) values for each
+// register file, since values from different files never interfere. Each
+// active value remembers how far its ranges have been consumed by the sweep,
+// so that values with many ranges (e.g. live across loops) aren't rescanned
+// from the start every time.
+//
+// NOTE: The order in which edges are added determines the order in which
+// simplify() visits them, and thus the final coloring. Values are sorted
+// stably, and the active sets are kept in the order the values were reached,
+// so that the edges are the same (and come in the same order) as with a plain
+// scan over all the preceding values.
 void
 GCRA::buildRIG(ArrayList& insns)
 {
-   std::list<RIG_Node *> values, active;
+   struct ActiveValue {
+      RIG_Node *node;
+      Interval::Position pos;
+   };
+   std::vector<RIG_Node *> values;
+   std::vector<ActiveValue> active[DATA_FILE_COUNT];
+
+   values.reserve(nodeCount);
 
    for (std::deque<ValueDef>::iterator it = func->ins.begin();
         it != func->ins.end(); ++it)
-      insertOrderedTail(values, getNode(it->get()->asLValue()));
+      values.push_back(getNode(it->get()->asLValue()));
 
    for (int i = 0; i < insns.getSize(); ++i) {
       Instruction *insn = reinterpret_cast<Instruction *>(insns.get(i));
       for (int d = 0; insn->defExists(d); ++d)
          if (insn->getDef(d)->rep() == insn->getDef(d))
-            insertOrderedTail(values, getNode(insn->getDef(d)->asLValue()));
+            values.push_back(getNode(insn->getDef(d)->asLValue()));
    }
-   checkList(values);
 
-   while (!values.empty()) {
-      RIG_Node *cur = values.front();
+   unsigned int n = 0;
+   for (unsigned int i = 0; i < values.size(); ++i)
+      if (!values[i]->livei.isEmpty())
+         values[n++] = values[i];
+   values.resize(n);
+
+   // only the intervals of joined values don't necessarily arrive in order
+   std::stable_sort(values.begin(), values.end(), beginsBefore);
+   checkList(values);
 
-      for (std::list<RIG_Node *>::iterator it = active.begin();
-           it != active.end();) {
-         RIG_Node *node = *it;
+   for (std::vector<RIG_Node *>::iterator it = values.begin();
+        it != values.end(); ++it) {
+      RIG_Node *cur = *it;
+      std::vector<ActiveValue>& act = active[cur->f];
+      const int begin = cur->livei.begin();
 
-         if (node->livei.end() <= cur->livei.begin()) {
-            it = active.erase(it);
-         } else {
-            if (node->f == cur->f && node->livei.overlaps(cur->livei))
-               cur->addInterference(node);
-            ++it;
-         }
+      // drop the values that ended before the current one starts, while
+      // preserving the order of the others
+      n = 0;
+      for (unsigned int i = 0; i < act.size(); ++i) {
+         ActiveValue a = act[i];
+         if (a.node->livei.end() <= begin)
+            continue;
+         if (a.node->livei.overlaps(cur->livei, a.pos))
+            cur->addInterference(a.node);
+         act[n++] = a;
       }
-      values.pop_front();
-      active.push_back(cur);
+      act.resize(n);
+
+      ActiveValue a = { cur, cur->livei.first() };
+      act.push_back(a);
    }
 }
 
@@ -1451,7 +1470,7 @@ GCRA::selectRegisters()
          INFO_DBG(prog->dbgFlags, REG_ALLOC, "must spill: %%%i (size %u)\n",
                   lval->id, lval->reg.size);
          Symbol *slot = NULL;
-         if (lval->reg.file == FILE_GPR)
+         if (lval->reg.file == FILE_GPR && !spill.getRematDef(lval)) // fincs-edit
             slot = spill.assignSlot(node->livei, lval->reg.size);
          mustSpill.push_back(ValuePair(lval, slot));
       }
@@ -1589,54 +1608,41 @@ GCRA::cleanup(const bool success)
    lo[1].next = lo[1].prev = &lo[1];
 }
 
+// fincs-edit: look slots up through the occupancy of each stack word, so that
+// space from earlier spills of this round is reused as soon as it is free.
 Symbol *
 SpillCodeInserter::assignSlot(const Interval &livei, const unsigned int size)
 {
-   SpillSlot slot;
-   int32_t offsetBase = stackSize;
-   int32_t offset;
-   std::list<SpillSlot>::iterator pos = slots.end(), it = slots.begin();
+   const int words = size / 4;
+   int32_t offset = stackBase;
 
-   if (offsetBase % size)
-      offsetBase += size - (offsetBase % size);
+   if (offset % size)
+      offset += size - (offset % size);
 
-   slot.sym = NULL;
+   for (; offset < stackSize; offset += size) {
+      const int w = (offset - stackBase) / 4;
+      int i;
 
-   for (offset = offsetBase; offset < stackSize; offset += size) {
-      const int32_t entryEnd = offset + size;
-      while (it != slots.end() && it->offset < offset)
-         ++it;
-      if (it == slots.end()) // no slots left
-         break;
-      std::list<SpillSlot>::iterator bgn = it;
-
-      while (it != slots.end() && it->offset < entryEnd) {
-         it->occup.print();
-         if (it->occup.overlaps(livei))
+      for (i = 0; i < words && w + i < (int)occup.size(); ++i)
+         if (occup[w + i].overlaps(livei))
             break;
-         ++it;
-      }
-      if (it == slots.end() || it->offset >= entryEnd) {
-         // fits
-         for (; bgn != slots.end() && bgn->offset < entryEnd; ++bgn) {
-            bgn->occup.insert(livei);
-            if (bgn->size() == size)
-               slot.sym = bgn->sym;
-         }
+      if (i == words || w + i >= (int)occup.size())
          break;
-      }
-   }
-   if (!slot.sym) {
-      stackSize = offset + size;
-      slot.offset = offset;
-      slot.sym = new_Symbol(func->getProgram(), FILE_MEMORY_LOCAL);
-      if (!func->stackPtr)
-         offset += func->tlsBase;
-      slot.sym->setAddress(NULL, offset);
-      slot.sym->reg.size = size;
-      slots.insert(pos, slot)->occup.insert(livei);
    }
-   return slot.sym;
+
+   const int w = (offset - stackBase) / 4;
+   if ((int)occup.size() < w + words)
+      occup.resize(w + words);
+   for (int i = 0; i < words; ++i)
+      occup[w + i].insert(livei);
+   stackSize = MAX2(stackSize, offset + (int32_t)size);
+
+   Symbol *sym = new_Symbol(func->getProgram(), FILE_MEMORY_LOCAL);
+   if (!func->stackPtr)
+      offset += func->tlsBase;
+   sym->setAddress(NULL, offset);
+   sym->reg.size = size;
+   return sym;
 }
 
 Value *
@@ -1662,6 +1668,7 @@ SpillCodeInserter::spill(Instruction *defi, Value *slot, LValue *lval)
    Instruction *st;
    if (slot->reg.file == FILE_MEMORY_LOCAL) {
       lval->noSpill = 1;
+      func->getProgram()->spillStores += ty != TYPE_B96 ? 1 : 3; // fincs-addition
       if (ty != TYPE_B96) {
          st = new_Instruction(func, OP_STORE, ty);
          st->setSrc(0, slot);
@@ -1704,6 +1711,7 @@ SpillCodeInserter::unspill(Instruction *usei, LValue *lval, Value *slot)
    Instruction *ld;
    if (slot->reg.file == FILE_MEMORY_LOCAL) {
       lval->noSpill = 1;
+      func->getProgram()->spillLoads += ty != TYPE_B96 ? 1 : 3; // fincs-addition
       if (ty != TYPE_B96) {
          ld = new_Instruction(func, OP_LOAD, ty);
       } else {
@@ -1745,6 +1753,99 @@ value_cmp(ValueRef *a, ValueRef *b) {
    return ai->serial < bi->serial;
 }
 
+// fincs-addition: Return the instruction defining lval if it can simply be
+// executed again in front of each use instead of going through local memory:
+// immediates, constant buffer loads, invariant system values and arithmetic
+// on those.
+Instruction *
+SpillCodeInserter::getRematDef(const LValue *lval) const
+{
+   if (lval->reg.file != FILE_GPR || lval->compound || lval->defs.size() != 1)
+      return NULL;
+
+   Instruction *defi = lval->defs.front()->getInsn();
+   if (!defi || defi->isPseudo() || defi->fixed || defi->getPredicate() ||
+       defi->defExists(1) || defi->getDef(0) != lval ||
+       defi->flagsDef >= 0 || defi->flagsSrc >= 0)
+      return NULL;
+
+   for (Value::UseCIterator it = lval->uses.begin(); it != lval->uses.end();
+        ++it)
+      if ((*it)->getInsn()->isPseudo())
+         return NULL;
+
+   switch (defi->op) {
+   case OP_RDSV:
+      switch (defi->getSrc(0)->reg.data.sv.sv) {
+      case SV_TID:
+      case SV_CTAID:
+      case SV_NTID:
+      case SV_NCTAID:
+      case SV_LANEID:
+         return defi;
+      default:
+         return NULL;
+      }
+   case OP_MOV:
+   case OP_LOAD:
+   case OP_ADD:
+   case OP_SUB:
+   case OP_MUL:
+   case OP_MAD:
+   case OP_SHL:
+   case OP_SHR:
+   case OP_AND:
+   case OP_OR:
+   case OP_XOR:
+      break;
+   default:
+      return NULL;
+   }
+   if (defi->op == OP_LOAD && defi->src(0).getFile() != FILE_MEMORY_CONST)
+      return NULL;
+
+   for (int s = 0; defi->srcExists(s); ++s) {
+      if (defi->src(s).isIndirect(0) || defi->src(s).isIndirect(1))
+         return NULL;
+      if (defi->src(s).getFile() != FILE_IMMEDIATE &&
+          defi->src(s).getFile() != FILE_MEMORY_CONST)
+         return NULL;
+   }
+   return defi;
+}
+
+// fincs-addition: Replace the definition of a spilled value by copies of it
+// placed right before its uses.
+void
+SpillCodeInserter::rematerialize(Instruction *defi, LValue *lval)
+{
+   std::vector<ValueRef *> refs(lval->uses.begin(), lval->uses.end());
+   std::sort(refs.begin(), refs.end(), value_cmp);
+   Instruction *last = NULL;
+   LValue *tmp = NULL;
+
+   for (std::vector<ValueRef *>::const_iterator it = refs.begin();
+        it != refs.end(); ++it) {
+      ValueRef *u = *it;
+      Instruction *usei = u->getInsn();
+
+      if (!last || (usei != last->next && usei != last)) {
+         DeepClonePolicy<Function> pol(func);
+
+         tmp = cloneShallow(func, lval);
+         tmp->noSpill = 1;
+         for (int s = 0; defi->srcExists(s); ++s)
+            pol.set(defi->getSrc(s), defi->getSrc(s));
+         pol.set(defi->getDef(0), static_cast<Value *>(tmp));
+         usei->bb->insertBefore(usei, defi->clone(pol));
+      }
+      last = usei;
+      u->set(tmp);
+   }
+
+   delete_Instruction(func->getProgram(), defi);
+}
+
 // For each value that is to be spilled, go through all its definitions.
 // A value can have multiple definitions if it has been coalesced before.
 // For each definition, first go through all its uses and insert an unspill
@@ -1762,6 +1863,14 @@ SpillCodeInserter::run(const std::list<ValuePair>& lst)
       LValue *lval = it->first->asLValue();
       Symbol *mem = it->second ? it->second->asSym() : NULL;
 
+      // fincs-addition: GPR values without a slot get recomputed at each use
+      if (!mem && lval->reg.file == FILE_GPR) {
+         Instruction *defi = getRematDef(lval);
+         assert(defi);
+         rematerialize(defi, lval);
+         continue;
+      }
+
       // Keep track of which instructions to delete later. Deleting them
       // inside the loop is unsafe since a single instruction may have
       // multiple destinations that all need to be spilled (like OP_SPLIT).
@@ -1822,7 +1931,7 @@ SpillCodeInserter::run(const std::list<ValuePair>& lst)
    // TODO: We're not trying to reuse old slots in a potential next iteration.
    //  We have to update the slots' livei intervals to be able to do that.
    stackBase = stackSize;
-   slots.clear();
+   occup.clear();
    return true;
 }
 
@@ -0,0 +1,576 @@
+#include "codegen/nv50_ir_sched_gm107.h"
+
+#include <algorithm>
+#include <limits.h>
+
+namespace nv50_ir {
+
+// Estimated result latencies of variable latency instructions, which the
+// target only describes as needing a barrier.
+#define SCHED_LATENCY_CONST   24 // constant buffer and attribute loads
+#define SCHED_LATENCY_MEMORY 128 // global, local and shared memory
+#define SCHED_LATENCY_TEXTURE 96
+
+// Maxwell SMs have 64K registers, allocated to warps in blocks of 256, and
+// can keep at most 64 warps resident.
+static inline int
+getResidentWarps(int regs)
+{
+   return MIN2(64, 2048 / MAX2((regs + 7) & ~7, 8));
+}
+
+bool
+GM107PreRAScheduler::isRegionBoundary(const Instruction *insn) const
+{
+   if (insn->fixed)
+      return true;
+
+   switch (Target::getOpClass(insn->op)) {
+   case OPCLASS_FLOW:
+   case OPCLASS_CONTROL:
+      return true;
+   default:
+      break;
+   }
+   if (insn->op == OP_NOP || insn->op == OP_TEXBAR || insn->op == OP_WRSV)
+      return true;
+
+   // Dependencies are tracked through SSA values, anything else (like values
+   // bound to a specific register) must keep its position.
+   for (int d = 0; insn->defExists(d); ++d) {
+      const LValue *lval = insn->getDef(d)->asLValue();
+      if (lval && (lval->fixedReg || lval->reg.data.id >= 0 ||
+                   lval->defs.size() > 1))
+         return true;
+   }
+   for (int s = 0; insn->srcExists(s); ++s) {
+      const LValue *lval = insn->getSrc(s)->asLValue();
+      if (lval && (lval->fixedReg || lval->reg.data.id >= 0 ||
+                   lval->defs.size() > 1))
+         return true;
+   }
+   return false;
+}
+
+bool
+GM107PreRAScheduler::hasSideEffects(const Instruction *insn) const
+{
+   switch (insn->op) {
+   case OP_SUSTB:
+   case OP_SUSTP:
+   case OP_SUREDB:
+   case OP_SUREDP:
+      return true;
+   default:
+      break;
+   }
+   const OpClass cl = Target::getOpClass(insn->op);
+   return cl == OPCLASS_STORE || cl == OPCLASS_ATOMIC;
+}
+
+// Textures, constant buffers and shader inputs can't be written by the shader
+// itself, so reads from them don't need to be ordered against stores.
+bool
+GM107PreRAScheduler::readsMutableMemory(const Instruction *insn) const
+{
+   if (insn->op == OP_SULDB || insn->op == OP_SULDP)
+      return true;
+
+   for (int s = 0; insn->srcExists(s); ++s) {
+      switch (insn->src(s).getFile()) {
+      case FILE_MEMORY_BUFFER:
+      case FILE_MEMORY_GLOBAL:
+      case FILE_MEMORY_SHARED:
+      case FILE_MEMORY_LOCAL:
+      case FILE_SHADER_OUTPUT:
+         return true;
+      default:
+         break;
+      }
+   }
+   return false;
+}
+
+int
+GM107PreRAScheduler::getLatency(const Instruction *insn) const
+{
+   switch (insn->op) {
+   case OP_UNION:
+   case OP_SPLIT:
+   case OP_MERGE:
+   case OP_CONSTRAINT:
+      return 0;
+   default:
+      break;
+   }
+
+   switch (Target::getOpClass(insn->op)) {
+   case OPCLASS_TEXTURE:
+   case OPCLASS_SURFACE:
+      return SCHED_LATENCY_TEXTURE;
+   case OPCLASS_LOAD:
+   case OPCLASS_ATOMIC:
+      if (insn->src(0).getFile() == FILE_MEMORY_CONST ||
+          insn->src(0).getFile() == FILE_SHADER_INPUT)
+         return SCHED_LATENCY_CONST;
+      return SCHED_LATENCY_MEMORY;
+   default:
+      return targ->getLatency(insn);
+   }
+}
+
+void
+GM107PreRAScheduler::markLiveOut(int id, BasicBlock *bb,
+                                 const BasicBlock *defBB)
+{
+   if (liveOutMark[bb->getId()] == id)
+      return;
+   liveOutMark[bb->getId()] = id;
+   liveOut[bb->getId()].push_back(id);
+   if (bb != defBB)
+      markLiveIn(id, bb, defBB);
+}
+
+void
+GM107PreRAScheduler::markLiveIn(int id, BasicBlock *bb,
+                                const BasicBlock *defBB)
+{
+   std::vector<BasicBlock *> stack(1, bb);
+
+   while (!stack.empty()) {
+      bb = stack.back();
+      stack.pop_back();
+      if (liveInMark[bb->getId()] == id)
+         continue;
+      liveInMark[bb->getId()] = id;
+      liveIn[bb->getId()].push_back(id);
+
+      for (Graph::EdgeIterator ei = bb->cfg.incident(); !ei.end(); ei.next()) {
+         BasicBlock *in = BasicBlock::get(ei.getNode());
+         if (liveOutMark[in->getId()] == id)
+            continue;
+         liveOutMark[in->getId()] = id;
+         liveOut[in->getId()].push_back(id);
+         if (in != defBB)
+            stack.push_back(in);
+      }
+   }
+}
+
+// SSA liveness of GPR values, found by walking up the CFG from each use until
+// reaching the definition.
+void
+GM107PreRAScheduler::buildLiveSets()
+{
+   const int bbCount = func->allBBlocks.getSize();
+
+   liveIn.assign(bbCount, std::vector<int>());
+   liveOut.assign(bbCount, std::vector<int>());
+   liveInMark.assign(bbCount, -1);
+   liveOutMark.assign(bbCount, -1);
+
+   for (int id = 0; id < func->allLValues.getSize(); ++id) {
+      LValue *lval = func->getLValue(id);
+      if (!lval || lval->reg.file != FILE_GPR)
+         continue;
+      const Instruction *def = lval->getUniqueInsn();
+      const BasicBlock *defBB = def ? def->bb : NULL;
+
+      for (Value::UseIterator it = lval->uses.begin();
+           it != lval->uses.end(); ++it) {
+         Instruction *insn = (*it)->getInsn();
+         if (!insn->bb)
+            continue;
+         if (insn->op != OP_PHI) {
+            if (insn->bb != defBB)
+               markLiveIn(id, insn->bb, defBB);
+            continue;
+         }
+         // phi->src(j) stems from the j-th incoming block
+         Graph::EdgeIterator ei = insn->bb->cfg.incident();
+         for (int s = 0; insn->srcExists(s) && !ei.end(); ++s, ei.next()) {
+            if (&insn->src(s) == *it)
+               markLiveOut(id, BasicBlock::get(ei.getNode()), defBB);
+         }
+      }
+   }
+
+   BasicBlock *exit = BasicBlock::get(func->cfgExit);
+   for (std::deque<ValueRef>::iterator it = func->outs.begin();
+        it != func->outs.end(); ++it) {
+      const LValue *lval = it->get()->asLValue();
+      if (!lval || lval->reg.file != FILE_GPR)
+         continue;
+      const Instruction *def = lval->getUniqueInsn();
+      markLiveOut(lval->id, exit, def ? def->bb : NULL);
+   }
+}
+
+int
+GM107PreRAScheduler::getSlot(const LValue *lval)
+{
+   if (slotOf[lval->id] < 0) {
+      Slot slot;
+      slot.id = lval->id;
+      slot.size = MAX2(lval->reg.size / 4, 1);
+      slot.remaining = 0;
+      slot.live = false;
+      slot.liveOut = false;
+      slotOf[lval->id] = slots.size();
+      slots.push_back(slot);
+   }
+   return slotOf[lval->id];
+}
+
+// Builds the nodes of all the non-phi instructions in the block, and sets the
+// pressure to what is live at its start.
+void
+GM107PreRAScheduler::beginBlock(BasicBlock *bb)
+{
+   nodes.clear();
+   slots.clear();
+   pressure = 0;
+
+   for (Instruction *i = bb->getEntry(); i; i = i->next) {
+      Node node;
+      node.insn = i;
+      node.numPreds = 0;
+      node.height = 0;
+      node.fixed = isRegionBoundary(i);
+
+      for (int s = 0; i->srcExists(s); ++s) {
+         const LValue *lval = i->getSrc(s)->asLValue();
+         if (!lval || lval->reg.file != FILE_GPR)
+            continue;
+         const int slot = getSlot(lval);
+         if (std::find(node.uses.begin(), node.uses.end(), slot) !=
+             node.uses.end())
+            continue;
+         node.uses.push_back(slot);
+         ++slots[slot].remaining;
+      }
+      for (int d = 0; i->defExists(d); ++d) {
+         const LValue *lval = i->getDef(d)->asLValue();
+         if (lval && lval->reg.file == FILE_GPR)
+            node.defs.push_back(getSlot(lval));
+      }
+      nodes.push_back(node);
+   }
+
+   const std::vector<int>& in = liveIn[bb->getId()];
+   const std::vector<int>& out = liveOut[bb->getId()];
+   for (size_t k = 0; k < out.size(); ++k)
+      if (slotOf[out[k]] >= 0)
+         slots[slotOf[out[k]]].liveOut = true;
+   for (size_t k = 0; k < in.size(); ++k) {
+      const LValue *lval = func->getLValue(in[k]);
+      if (slotOf[in[k]] >= 0)
+         slots[slotOf[in[k]]].live = true;
+      pressure += MAX2(lval->reg.size / 4, 1);
+   }
+
+   for (Instruction *phi = bb->getPhi(); phi && phi->op == OP_PHI;
+        phi = phi->next) {
+      const LValue *lval = phi->getDef(0)->asLValue();
+      if (!lval || lval->reg.file != FILE_GPR || slotOf[lval->id] < 0)
+         continue;
+      Slot& slot = slots[slotOf[lval->id]];
+      if (slot.remaining || slot.liveOut) {
+         slot.live = true;
+         pressure += slot.size;
+      }
+   }
+}
+
+void
+GM107PreRAScheduler::endBlock()
+{
+   for (size_t k = 0; k < slots.size(); ++k)
+      slotOf[slots[k].id] = -1;
+}
+
+int
+GM107PreRAScheduler::getPressureDelta(const Node& node) const
+{
+   int delta = 0;
+   for (size_t k = 0; k < node.uses.size(); ++k) {
+      const Slot& slot = slots[node.uses[k]];
+      if (slot.live && slot.remaining == 1 && !slot.liveOut)
+         delta -= slot.size;
+   }
+   for (size_t k = 0; k < node.defs.size(); ++k) {
+      const Slot& slot = slots[node.defs[k]];
+      if (!slot.live && (slot.remaining || slot.liveOut))
+         delta += slot.size;
+   }
+   return delta;
+}
+
+void
+GM107PreRAScheduler::issue(const Node& node)
+{
+   for (size_t k = 0; k < node.uses.size(); ++k) {
+      Slot& slot = slots[node.uses[k]];
+      if (!--slot.remaining && slot.live && !slot.liveOut) {
+         slot.live = false;
+         pressure -= slot.size;
+      }
+   }
+   for (size_t k = 0; k < node.defs.size(); ++k) {
+      Slot& slot = slots[node.defs[k]];
+      if (!slot.live && (slot.remaining || slot.liveOut)) {
+         slot.live = true;
+         pressure += slot.size;
+      }
+   }
+}
+
+void
+GM107PreRAScheduler::buildDependencies(int begin, int end)
+{
+   int lastSideEffect = -1;
+   std::vector<int> mutableReads;
+
+   for (int n = begin; n < end; ++n)
+      nodeOf[nodes[n].insn->id] = n;
+
+   for (int n = begin; n < end; ++n) {
+      Node& node = nodes[n];
+      const Instruction *insn = node.insn;
+
+      for (int s = 0; insn->srcExists(s); ++s) {
+         const LValue *lval = insn->getSrc(s)->asLValue();
+         if (!lval)
+            continue;
+         const Instruction *def = lval->getUniqueInsn();
+         if (!def || nodeOf[def->id] < 0)
+            continue;
+         Edge edge;
+         edge.node = n;
+         edge.latency = getLatency(def);
+         nodes[nodeOf[def->id]].succs.push_back(edge);
+         ++node.numPreds;
+      }
+
+      const bool write = hasSideEffects(insn);
+      std::vector<int> memPreds;
+      if (write)
+         memPreds.swap(mutableReads);
+      if ((write || readsMutableMemory(insn)) && lastSideEffect >= 0)
+         memPreds.push_back(lastSideEffect);
+      for (size_t k = 0; k < memPreds.size(); ++k) {
+         Edge edge;
+         edge.node = n;
+         edge.latency = 0;
+         nodes[memPreds[k]].succs.push_back(edge);
+         ++node.numPreds;
+      }
+      if (write)
+         lastSideEffect = n;
+      else
+      if (readsMutableMemory(insn))
+         mutableReads.push_back(n);
+   }
+
+   for (int n = begin; n < end; ++n)
+      nodeOf[nodes[n].insn->id] = -1;
+
+   // critical path length to the end of the region, taking into account that
+   // results might be used beyond it
+   for (int n = end - 1; n >= begin; --n) {
+      Node& node = nodes[n];
+      node.height = node.insn->defExists(0) ? getLatency(node.insn) : 0;
+      for (size_t k = 0; k < node.succs.size(); ++k) {
+         const Edge& edge = node.succs[k];
+         node.height = MAX2(node.height,
+                            edge.latency + nodes[edge.node].height);
+      }
+   }
+}
+
+// Plain list scheduling: among the instructions whose operands are ready,
+// issue the one with the longest critical path. Once this would go past the
+// threshold, issue the one which increases the pressure the least instead.
+// Returns the maximum pressure reached.
+int
+GM107PreRAScheduler::schedule(int begin, int end, int threshold,
+                              std::vector<int>& order)
+{
+   std::vector<int> numPreds(end - begin), earliest(end - begin, 0);
+   std::vector<int> ready;
+   int cycle = 0;
+   int maxPressure = pressure;
+
+   for (int n = begin; n < end; ++n) {
+      numPreds[n - begin] = nodes[n].numPreds;
+      if (!nodes[n].numPreds)
+         ready.push_back(n);
+   }
+
+   order.clear();
+   while (!ready.empty()) {
+      int first = INT_MAX;
+      for (size_t k = 0; k < ready.size(); ++k)
+         first = MIN2(first, earliest[ready[k] - begin]);
+      cycle = MAX2(cycle, first);
+
+      size_t best = 0;
+      for (size_t k = 1; k < ready.size(); ++k) {
+         const bool availA = earliest[ready[k] - begin] <= cycle;
+         const bool availB = earliest[ready[best] - begin] <= cycle;
+         const Node& a = nodes[ready[k]];
+         const Node& b = nodes[ready[best]];
+         if (availA != availB) {
+            if (availA)
+               best = k;
+         } else
+         if (a.height != b.height) {
+            if (a.height > b.height)
+               best = k;
+         } else
+         if (ready[k] < ready[best]) {
+            best = k;
+         }
+      }
+
+      if (pressure + getPressureDelta(nodes[ready[best]]) > threshold) {
+         int bestDelta = INT_MAX;
+         for (size_t k = 0; k < ready.size(); ++k) {
+            const int delta = MIN2(getPressureDelta(nodes[ready[k]]), 0);
+            if (delta < bestDelta ||
+                (delta == bestDelta && ready[k] < ready[best])) {
+               bestDelta = delta;
+               best = k;
+            }
+         }
+      }
+
+      const int n = ready[best];
+      ready[best] = ready.back();
+      ready.pop_back();
+
+      const Node& node = nodes[n];
+      const int issued = MAX2(cycle, earliest[n - begin]);
+      cycle = issued + 1;
+      issue(node);
+      maxPressure = MAX2(maxPressure, pressure);
+      order.push_back(n);
+
+      for (size_t k = 0; k < node.succs.size(); ++k) {
+         const Edge& edge = node.succs[k];
+         earliest[edge.node - begin] = MAX2(earliest[edge.node - begin],
+                                            issued + edge.latency);
+         if (!--numPreds[edge.node - begin])
+            ready.push_back(edge.node);
+      }
+   }
+   assert((int)order.size() == end - begin);
+
+   return maxPressure;
+}
+
+void
+GM107PreRAScheduler::scheduleRegion(BasicBlock *bb, int begin, int end)
+{
+   std::vector<int> order;
+
+   if (end - begin > 1) {
+      const std::vector<Slot> saved(slots);
+      const int savedPressure = pressure;
+      int threshold = pressureLimit;
+      bool fits = false;
+
+      buildDependencies(begin, end);
+
+      // Switch to minimizing the pressure earlier each time the schedule
+      // doesn't fit, since long-lived values may already have been hoisted
+      // by the time the limit is reached.
+      for (int attempt = 0; attempt < 4 && !fits; ++attempt) {
+         fits = schedule(begin, end, threshold, order) <= pressureLimit;
+         slots = saved;
+         pressure = savedPressure;
+         threshold -= MAX2((pressureLimit - savedPressure) / 4, 1);
+      }
+
+      bool changed = false;
+      for (int k = 0; k < end - begin; ++k)
+         changed = changed || order[k] != begin + k;
+      if (!fits || !changed)
+         order.clear();
+   }
+
+   if (order.empty()) {
+      for (int n = begin; n < end; ++n)
+         issue(nodes[n]);
+      return;
+   }
+
+   Instruction *next = end < (int)nodes.size() ? nodes[end].insn : NULL;
+   for (int n = begin; n < end; ++n)
+      bb->remove(nodes[n].insn);
+   for (size_t k = 0; k < order.size(); ++k) {
+      Instruction *insn = nodes[order[k]].insn;
+      if (next)
+         bb->insertBefore(next, insn);
+      else
+         bb->insertTail(insn);
+      issue(nodes[order[k]]);
+   }
+}
+
+bool
+GM107PreRAScheduler::visit(Function *fn)
+{
+   slotOf.assign(fn->allLValues.getSize(), -1);
+   nodeOf.assign(fn->allInsns.getSize(), -1);
+   buildLiveSets();
+
+   // estimate the register usage of the unscheduled program
+   int maxPressure = 0;
+   for (ArrayList::Iterator bi = fn->allBBlocks.iterator(); !bi.end();
+        bi.next()) {
+      BasicBlock *bb = BasicBlock::get(bi);
+      beginBlock(bb);
+      maxPressure = MAX2(maxPressure, pressure);
+      for (size_t n = 0; n < nodes.size(); ++n) {
+         issue(nodes[n]);
+         maxPressure = MAX2(maxPressure, pressure);
+      }
+      endBlock();
+   }
+
+   // Allow growing up to the next occupancy step, minus some room for the
+   // fragmentation caused by vector operands, which the estimate ignores.
+   const int maxRegs = targ->getFileSize(FILE_GPR);
+   const int warps = getResidentWarps(maxPressure);
+   int regs = maxPressure;
+   while (regs < maxRegs && getResidentWarps(regs + 1) == warps)
+      ++regs;
+   pressureLimit = MAX2(maxPressure, regs - regs / 8);
+
+   return true;
+}
+
+bool
+GM107PreRAScheduler::visit(BasicBlock *bb)
+{
+   if (bb->getInsnCount() < 3)
+      return true;
+
+   beginBlock(bb);
+   int begin = 0;
+   for (int n = 0; n <= (int)nodes.size(); ++n) {
+      if (n < (int)nodes.size() && !nodes[n].fixed)
+         continue;
+      scheduleRegion(bb, begin, n);
+      if (n < (int)nodes.size())
+         issue(nodes[n]);
+      begin = n + 1;
+   }
+   endBlock();
+
+   return true;
+}
+
+} // namespace nv50_ir
+
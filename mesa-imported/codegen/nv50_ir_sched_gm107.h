@@ -0,0 +1,94 @@
+#ifndef __NV50_IR_SCHED_GM107_H__
+#define __NV50_IR_SCHED_GM107_H__
+
+#include "codegen/nv50_ir.h"
+#include "codegen/nv50_ir_target.h"
+
+namespace nv50_ir {
+
+// Latency-driven list scheduler, run on SSA form right before register
+// allocation. Instructions are reordered within regions of a basic block
+// delimited by control flow, barriers and other instructions which must stay
+// in place, so that texture fetches and memory loads are issued as early as
+// possible and independent arithmetic fills their latency.
+//
+// Hoisting loads lengthens live ranges, so the register pressure is tracked
+// while scheduling: the pass never lets a region exceed the number of
+// registers that still gives the same occupancy as the original program.
+class GM107PreRAScheduler : public Pass
+{
+public:
+   GM107PreRAScheduler(const Target *targ) : targ(targ) { }
+
+private:
+   struct Edge
+   {
+      int node;
+      int latency;
+   };
+
+   struct Node
+   {
+      Instruction *insn;
+      std::vector<Edge> succs;
+      std::vector<int> uses; // GPR slots read, each listed once
+      std::vector<int> defs; // GPR slots written
+      int numPreds;
+      int height;
+      bool fixed; // starts a new scheduling region
+   };
+
+   // State of a GPR value referenced in the current basic block
+   struct Slot
+   {
+      int id;
+      int size; // in 32 bit units
+      int remaining; // number of instructions left to read it in this block
+      bool live;
+      bool liveOut;
+   };
+
+   virtual bool visit(Function *);
+   virtual bool visit(BasicBlock *);
+
+   void buildLiveSets();
+   void markLiveIn(int id, BasicBlock *, const BasicBlock *defBB);
+   void markLiveOut(int id, BasicBlock *, const BasicBlock *defBB);
+
+   void beginBlock(BasicBlock *);
+   void endBlock();
+   int getSlot(const LValue *);
+
+   bool isRegionBoundary(const Instruction *) const;
+   bool hasSideEffects(const Instruction *) const;
+   bool readsMutableMemory(const Instruction *) const;
+   int getLatency(const Instruction *) const;
+
+   void buildDependencies(int begin, int end);
+   int getPressureDelta(const Node&) const;
+   void issue(const Node&);
+   int schedule(int begin, int end, int threshold, std::vector<int>& order);
+   void scheduleRegion(BasicBlock *, int begin, int end);
+
+private:
+   const Target *targ;
+
+   int pressureLimit;
+
+   // per-function liveness of GPR values, indexed by basic block id
+   std::vector<std::vector<int> > liveIn;
+   std::vector<std::vector<int> > liveOut;
+   std::vector<int> liveInMark;
+   std::vector<int> liveOutMark;
+
+   // per-block state
+   std::vector<Node> nodes;
+   std::vector<Slot> slots;
+   std::vector<int> slotOf; // value id -> slot, -1 if not referenced
+   std::vector<int> nodeOf; // instruction id -> node, -1 if not in region
+   int pressure;
+};
+
+} // namespace nv50_ir
+
+#endif // __NV50_IR_SCHED_GM107_H__
@@ -23,6 +23,8 @@
 #include "codegen/nv50_ir.h"
 #include "codegen/nv50_ir_target.h"
 
+#include <map> // fincs-addition
+
 namespace nv50_ir {
 
 const uint8_t Target::operationSrcNr[] =
@@ -366,6 +368,129 @@ Program::emitSymbolTable(struct nv50_ir_prog_info *info)
    info->bin.numSyms = n;
 }
 
+// fincs-addition: Determine the maximum number of call-return stack entries
+// (SSY/PBK/PCNT/PRET/CAL tokens) that can be live at once within a function,
+// including the entries pushed by its callees. The stack contents are tracked
+// per basic block until they stop changing; back edges are ignored since each
+// loop iteration pops what it pushed, and merging paths keep the deeper stack.
+static unsigned int
+getCallReturnStackDepth(Function *fn, std::map<Function *, unsigned int> &depths)
+{
+   std::map<Function *, unsigned int>::iterator it = depths.find(fn);
+   if (it != depths.end())
+      return it->second;
+   depths[fn] = 0; // recursion is not supported by the hardware stack anyway
+
+   std::map<BasicBlock *, std::vector<operation> > stacks;
+   unsigned int maxDepth = 0;
+   unsigned int rounds = 0;
+   bool changed;
+
+   // Without back edges the CFG is acyclic, so this settles after at most
+   // one round per block; the bound only guards against stale edge types.
+   do {
+      changed = false;
+      for (IteratorRef ci = fn->cfg.iteratorCFG(); !ci->end(); ci->next()) {
+         BasicBlock *bb = BasicBlock::get(reinterpret_cast<Graph::Node *>(ci->get()));
+         std::vector<operation> stack = stacks[bb];
+
+         for (Instruction *i = bb->getEntry(); i; i = i->next) {
+            operation token = OP_NOP;
+            unsigned int inner = 0;
+
+            switch (i->op) {
+            case OP_JOINAT:
+            case OP_PREBREAK:
+            case OP_PRECONT:
+            case OP_PRERET:
+               stack.push_back(i->op);
+               break;
+            case OP_CALL:
+               if (i->asFlow()->builtin)
+                  inner = 1; // the library routines use at most one SSY level
+               else if (!i->asFlow()->indirect && i->asFlow()->target.fn)
+                  inner = getCallReturnStackDepth(i->asFlow()->target.fn, depths);
+               maxDepth = MAX2(maxDepth, stack.size() + 1 + inner);
+               break;
+            case OP_JOIN:
+               token = OP_JOINAT;
+               break;
+            case OP_BREAK:
+               token = OP_PREBREAK;
+               break;
+            case OP_CONT:
+               token = OP_PRECONT;
+               break;
+            case OP_RET:
+               token = OP_PRERET;
+               break;
+            default:
+               break;
+            }
+            maxDepth = MAX2(maxDepth, stack.size());
+
+            // A token is consumed together with everything pushed above it.
+            // Predicated pops leave the fall-through path untouched, and if
+            // the token cannot be found the stack is left as is.
+            if (token != OP_NOP && !i->getPredicate()) {
+               for (size_t n = stack.size(); n > 0; --n) {
+                  if (stack[n - 1] == token) {
+                     stack.resize(n - 1);
+                     break;
+                  }
+               }
+            }
+         }
+
+         for (Graph::EdgeIterator ei = bb->cfg.outgoing(); !ei.end(); ei.next()) {
+            if (ei.getType() == Graph::Edge::BACK)
+               continue;
+            std::vector<operation> &next = stacks[BasicBlock::get(ei.getNode())];
+            if (stack.size() > next.size()) {
+               next = stack;
+               changed = true;
+            }
+         }
+      }
+   } while (changed && ++rounds < fn->cfg.getSize());
+
+   depths[fn] = maxDepth;
+   return maxDepth;
+}
+
+// fincs-addition: Accounts an emitted instruction in the code statistics
+static void
+countInstruction(struct nv50_ir_code_stats *stats, const CodeEmitter *emit,
+                 const Instruction *i)
+{
+   switch (Target::getOpClass(i->op)) {
+   case OPCLASS_PSEUDO:
+      return;
+   case OPCLASS_SFU:
+      stats->sfu++;
+      break;
+   case OPCLASS_TEXTURE:
+   case OPCLASS_SURFACE:
+      stats->tex++;
+      break;
+   case OPCLASS_LOAD:
+   case OPCLASS_STORE:
+   case OPCLASS_ATOMIC:
+      stats->mem++;
+      break;
+   case OPCLASS_FLOW:
+   case OPCLASS_CONTROL:
+      stats->flow++;
+      break;
+   default:
+      stats->alu++;
+      break;
+   }
+   if (i->op == OP_BAR)
+      stats->barriers++;
+   stats->stallCycles += emit->getStallCount(i);
+}
+
 bool
 Program::emitBinary(struct nv50_ir_prog_info *info)
 {
@@ -385,6 +510,7 @@ Program::emitBinary(struct nv50_ir_prog_info *info)
       return false;
    emit->setCodeLocation(code, binSize);
    info->bin.instructions = 0;
+   memset(&info->bin.stats, 0, sizeof(info->bin.stats)); // fincs-addition
 
    for (ArrayList::Iterator fi = allFuncs.iterator(); !fi.end(); fi.next()) {
       Function *fn = reinterpret_cast<Function *>(fi.get());
@@ -395,6 +521,7 @@ Program::emitBinary(struct nv50_ir_prog_info *info)
          for (Instruction *i = fn->bbArray[b]->getEntry(); i; i = i->next) {
             emit->emitInstruction(i);
             info->bin.instructions++;
+            countInstruction(&info->bin.stats, emit, i); // fincs-addition
             if ((typeSizeof(i->sType) == 8 || typeSizeof(i->dType) == 8) &&
                 (isFloatType(i->sType) || isFloatType(i->dType)))
                info->io.fp64 = true;
@@ -403,6 +530,10 @@ Program::emitBinary(struct nv50_ir_prog_info *info)
    }
    info->io.fp64 |= fp64;
    info->io.fp64_rcprsq = fp64_rcprsq;
+   std::map<Function *, unsigned int> crsDepths; // fincs-addition
+   info->bin.crsDepth = getCallReturnStackDepth(main, crsDepths); // fincs-addition
+   info->bin.stats.spillLoads = spillLoads; // fincs-addition
+   info->bin.stats.spillStores = spillStores; // fincs-addition
    info->io.int_divmod = int_divmod;
    info->bin.relocData = emit->getRelocInfo();
    info->bin.fixupData = emit->getFixupInfo();
@@ -118,6 +118,9 @@ public:
    virtual void prepareEmission(Function *);
    virtual void prepareEmission(BasicBlock *);
 
+   // fincs-addition: cycles the instruction stalls issue for, if scheduled
+   virtual int getStallCount(const Instruction *) const { return 0; }
+
    void printBinary() const;
 
 protected:
@@ -23,6 +23,8 @@
 
 #include "codegen/nv50_ir_target_gm107.h"
 #include "codegen/nv50_ir_lowering_gm107.h"
+#include "codegen/nv50_ir_sched_gm107.h"
+#include "util/u_compile_stats.h"
 
 namespace nv50_ir {
 
@@ -331,6 +333,7 @@ TargetGM107::getLatency(const Instruction *insn) const
    case OP_MUL:
    case OP_NOT:
    case OP_OR:
+   case OP_PERMT: // fincs-addition
    case OP_PREEX2:
    case OP_PRESIN:
    case OP_QUADOP:
@@ -462,7 +465,22 @@ TargetGM107::runLegalizePass(Program *prog, CGStage stage) const
    } else
    if (stage == CG_STAGE_SSA) {
       GM107LegalizeSSA pass;
-      return pass.run(prog, false, true);
+      if (!pass.run(prog, false, true))
+         return false;
+      // fincs-addition
+      if (prog->driver->io.packHalfFloats && prog->optLevel >= 1 &&
+          getChipset() >= NVISA_GM20B_CHIPSET) {
+         compile_stats_scope stats("GM107HalfFloatPacking");
+         GM107HalfFloatPacking pack;
+         if (!pack.run(prog, false, true))
+            return false;
+      }
+      if (prog->optLevel >= 2) {
+         compile_stats_scope stats("GM107PreRAScheduler");
+         GM107PreRAScheduler sched(this);
+         return sched.run(prog, false, true);
+      }
+      return true;
    }
    return false;
 }
@@ -186,6 +186,28 @@ bool Interval::overlaps(const Interval &that) const
    return false;
 }
 
+bool Interval::overlaps(const Interval &that, Position &pos) const
+{
+   const int bgn = that.begin();
+
+   while (pos && pos->end <= bgn)
+      pos = pos->next;
+
+   const Range *a = pos;
+   const Range *b = that.head;
+
+   while (a && b) {
+      if (b->bgn < a->end &&
+          b->end > a->bgn)
+         return true;
+      if (a->end <= b->bgn)
+         a = a->next;
+      else
+         b = b->next;
+   }
+   return false;
+}
+
 void Interval::insert(const Interval &that)
 {
    for (Range *r = that.head; r; r = r->next)
@@ -437,6 +437,17 @@ public:
    bool overlaps(const Interval&) const;
    bool contains(int pos) const;
 
+private:
+   class Range;
+
+public:
+   // Cursor for repeated overlap tests against intervals with increasing
+   // begin(): ranges that end before the tested interval begins are skipped
+   // once and for all, instead of being walked again on every test.
+   typedef const Range *Position;
+   inline Position first() const { return head; }
+   bool overlaps(const Interval&, Position&) const;
+
    inline int extent() const { return end() - begin(); }
    int length() const;
 
@@ -4006,6 +4006,11 @@ apply_type_qualifier_to_variable(const struct ast_type_qualifier *qual,
    if (state->es_shader) {
       var->data.precision =
          select_gles_precision(qual->precision, var->type, state, loc);
+   } else if (precision_qualifier_allowed(var->type)) {
+      /* fincs-edit: keep explicit qualifiers anyway, as a hint that the
+       * variable may be operated on at half precision.
+       */
+      var->data.precision = qual->precision;
    }
 
    if (qual->flags.q.patch)
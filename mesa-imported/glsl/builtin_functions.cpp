@@ -83,6 +83,7 @@
 #include <math.h>
 #include "builtin_functions.h"
 #include "util/hash_table.h"
+#include <atomic> // fincs-addition
 
 #define M_PIf   ((float) M_PI)
 #define M_PI_2f ((float) M_PI_2)
@@ -733,9 +734,18 @@ public:
 private:
    void *mem_ctx;
 
+   /* fincs-addition: index of every signature by name and parameter types,
+    * for resolving exact matches without walking the signature lists.
+    */
+   struct hash_table *signature_index;
+
    void create_shader();
    void create_intrinsics();
    void create_builtins();
+   void index_function(ir_function *f);
+   ir_function_signature *find_exact(_mesa_glsl_parse_state *state,
+                                     const char *name,
+                                     exec_list *actual_parameters);
 
    /**
     * IR builder helpers:
@@ -1082,6 +1092,38 @@ enum image_function_flags {
 
 } /* anonymous namespace */
 
+/* fincs-addition: key of builtin_builder::signature_index */
+struct signature_key {
+   const char *name;
+   unsigned num_params;
+   const glsl_type *const *params;
+};
+
+struct signature_index_entry {
+   ir_function_signature *sig;
+   signature_index_entry *next; /* same key, in declaration order */
+};
+
+static uint32_t
+signature_key_hash(const void *data)
+{
+   const signature_key *key = (const signature_key *) data;
+   uint32_t hash = _mesa_hash_string(key->name);
+   return _mesa_fnv32_1a_accumulate_block(hash, key->params,
+                                          key->num_params * sizeof(key->params[0]));
+}
+
+static bool
+signature_key_equals(const void *a, const void *b)
+{
+   const signature_key *key_a = (const signature_key *) a;
+   const signature_key *key_b = (const signature_key *) b;
+   return key_a->num_params == key_b->num_params &&
+          memcmp(key_a->params, key_b->params,
+                 key_a->num_params * sizeof(key_a->params[0])) == 0 &&
+          strcmp(key_a->name, key_b->name) == 0;
+}
+
 /**
  * Core builtin_builder functionality:
  *  @{
@@ -1090,6 +1132,7 @@ builtin_builder::builtin_builder()
    : shader(NULL)
 {
    mem_ctx = NULL;
+   signature_index = NULL;
 }
 
 builtin_builder::~builtin_builder()
@@ -1110,18 +1153,85 @@ builtin_builder::find(_mesa_glsl_parse_state *state,
     */
    state->uses_builtin_functions = true;
 
+   /* fincs-addition: most calls match a signature exactly */
+   ir_function_signature *sig = find_exact(state, name, actual_parameters);
+   if (sig != NULL)
+      return sig;
+
    ir_function *f = shader->symbols->get_function(name);
    if (f == NULL)
       return NULL;
 
-   ir_function_signature *sig =
-      f->matching_signature(state, actual_parameters, true);
+   sig = f->matching_signature(state, actual_parameters, true);
    if (sig == NULL)
       return NULL;
 
    return sig;
 }
 
+/* fincs-addition */
+ir_function_signature *
+builtin_builder::find_exact(_mesa_glsl_parse_state *state,
+                            const char *name, exec_list *actual_parameters)
+{
+   const glsl_type *params[16];
+   signature_key key = { name, 0, params };
+
+   foreach_in_list(ir_instruction, actual, actual_parameters) {
+      if (key.num_params == ARRAY_SIZE(params))
+         return NULL;
+
+      /* Function declarations look up their parameter variables */
+      ir_variable *var = actual->as_variable();
+      params[key.num_params++] = var ? var->type : ((ir_rvalue *) actual)->type;
+   }
+
+   hash_entry *entry = _mesa_hash_table_search(signature_index, &key);
+   if (entry == NULL)
+      return NULL;
+
+   for (signature_index_entry *e = (signature_index_entry *) entry->data;
+        e != NULL; e = e->next) {
+      if (e->sig->is_builtin_available(state))
+         return e->sig;
+   }
+
+   return NULL;
+}
+
+/* fincs-addition */
+void
+builtin_builder::index_function(ir_function *f)
+{
+   foreach_in_list(ir_function_signature, sig, &f->signatures) {
+      unsigned num_params = sig->parameters.length();
+      const glsl_type **params =
+         ralloc_array(mem_ctx, const glsl_type *, num_params);
+      unsigned i = 0;
+      foreach_in_list(ir_variable, param, &sig->parameters)
+         params[i++] = param->type;
+
+      signature_key *key = ralloc(mem_ctx, signature_key);
+      key->name = f->name;
+      key->num_params = num_params;
+      key->params = params;
+
+      signature_index_entry *e = ralloc(mem_ctx, signature_index_entry);
+      e->sig = sig;
+      e->next = NULL;
+
+      hash_entry *entry = _mesa_hash_table_search(signature_index, key);
+      if (entry == NULL) {
+         _mesa_hash_table_insert(signature_index, key, e);
+      } else {
+         signature_index_entry *last = (signature_index_entry *) entry->data;
+         while (last->next != NULL)
+            last = last->next;
+         last->next = e;
+      }
+   }
+}
+
 void
 builtin_builder::initialize()
 {
@@ -1130,6 +1240,8 @@ builtin_builder::initialize()
       return;
 
    mem_ctx = ralloc_context(NULL);
+   signature_index = _mesa_hash_table_create(mem_ctx, signature_key_hash,
+                                             signature_key_equals);
    create_shader();
    create_intrinsics();
    create_builtins();
@@ -1140,6 +1252,7 @@ builtin_builder::release()
 {
    ralloc_free(mem_ctx);
    mem_ctx = NULL;
+   signature_index = NULL;
 
    ralloc_free(shader);
    shader = NULL;
@@ -3507,7 +3620,8 @@ builtin_builder::add_function(const char *name, ...)
    }
    va_end(ap);
 
-   shader->symbols->add_function(f);
+   if (shader->symbols->add_function(f))
+      index_function(f); // fincs-addition
 }
 
 void
@@ -3565,7 +3679,8 @@ builtin_builder::add_image_function(const char *name,
                                  num_arguments, flags, intrinsic_id));
    }
 
-   shader->symbols->add_function(f);
+   if (shader->symbols->add_function(f))
+      index_function(f); // fincs-addition
 }
 
 void
@@ -6448,6 +6563,12 @@ builtin_builder::_vote(const char *intrinsic_name,
 static builtin_builder builtins;
 static mtx_t builtins_lock = _MTX_INITIALIZER_NP;
 
+/* fincs-edit: the module is never modified once built, so lookups don't take
+ * builtins_lock. Callers keep it alive while compiling (it is only released
+ * when nothing else can be using it).
+ */
+static std::atomic<bool> builtins_ready;
+
 /**
  * External API (exposing the built-in module to the rest of the compiler):
  *  @{
@@ -6455,8 +6576,12 @@ static mtx_t builtins_lock = _MTX_INITIALIZER_NP;
 void
 _mesa_glsl_initialize_builtin_functions()
 {
+   if (builtins_ready.load(std::memory_order_acquire))
+      return;
+
    mtx_lock(&builtins_lock);
    builtins.initialize();
+   builtins_ready.store(true, std::memory_order_release);
    mtx_unlock(&builtins_lock);
 }
 
@@ -6464,6 +6589,7 @@ void
 _mesa_glsl_release_builtin_functions()
 {
    mtx_lock(&builtins_lock);
+   builtins_ready.store(false, std::memory_order_relaxed);
    builtins.release();
    mtx_unlock(&builtins_lock);
 }
@@ -6472,32 +6598,21 @@ ir_function_signature *
 _mesa_glsl_find_builtin_function(_mesa_glsl_parse_state *state,
                                  const char *name, exec_list *actual_parameters)
 {
-   ir_function_signature *s;
-   mtx_lock(&builtins_lock);
-   s = builtins.find(state, name, actual_parameters);
-   mtx_unlock(&builtins_lock);
-
-   return s;
+   return builtins.find(state, name, actual_parameters);
 }
 
 bool
 _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
 {
-   ir_function *f;
-   bool ret = false;
-   mtx_lock(&builtins_lock);
-   f = builtins.shader->symbols->get_function(name);
+   ir_function *f = builtins.shader->symbols->get_function(name);
    if (f != NULL) {
       foreach_in_list(ir_function_signature, sig, &f->signatures) {
-         if (sig->is_builtin_available(state)) {
-            ret = true;
-            break;
-         }
+         if (sig->is_builtin_available(state))
+            return true;
       }
    }
-   mtx_unlock(&builtins_lock);
 
-   return ret;
+   return false;
 }
 
 gl_shader *
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <ctype.h> // fincs-addition
 
 #include "glsl/glcpp/glcpp.h" // fincs-edit
 #include "main/mtypes.h"
@@ -1350,6 +1351,86 @@ add_builtin_define(glcpp_parser_t *parser, const char *name, int value)
    _define_object_macro(parser, NULL, name, list);
 }
 
+/* fincs-addition: Defines a macro given as NAME or NAME=VALUE (the value
+ * defaulting to 1), like the -D option of C compilers. The value is split into
+ * the tokens that matter to #if expressions and token pasting; any other
+ * character is kept as is.
+ */
+static char *
+_linear_strndup(glcpp_parser_t *parser, const char *str, size_t len)
+{
+   char *ret = linear_alloc_child(parser->linalloc, len + 1);
+   memcpy(ret, str, len);
+   ret[len] = '\0';
+   return ret;
+}
+
+void
+glcpp_parser_add_define(glcpp_parser_t *parser, const char *define)
+{
+   static const struct {
+      char str[3];
+      int type;
+   } two_char_ops[] = {
+      { "<<", LEFT_SHIFT }, { ">>", RIGHT_SHIFT }, { "<=", LESS_OR_EQUAL },
+      { ">=", GREATER_OR_EQUAL }, { "==", EQUAL }, { "!=", NOT_EQUAL },
+      { "&&", AND }, { "||", OR }, { "##", PASTE }, { "++", PLUS_PLUS },
+      { "--", MINUS_MINUS },
+   };
+   const char *value = strchr(define, '=');
+   size_t name_len = value ? (size_t)(value - define) : strlen(define);
+   token_list_t *list = _token_list_create(parser);
+   YYLTYPE loc;
+
+   if (!value) {
+      _token_list_append(parser, list, _token_create_ival(parser, INTEGER, 1));
+   } else {
+      const char *p = value + 1;
+      while (*p) {
+         const char *start = p;
+         token_t *tok = NULL;
+         unsigned i;
+
+         if (*p == ' ' || *p == '\t') {
+            while (*p == ' ' || *p == '\t')
+               p++;
+            tok = _token_create_ival(parser, SPACE, SPACE);
+         } else if (*p == '_' || isalnum((unsigned char)*p)) {
+            int type = isdigit((unsigned char)*p) ? INTEGER_STRING : IDENTIFIER;
+            while (*p == '_' || isalnum((unsigned char)*p))
+               p++;
+            tok = _token_create_str(parser, type,
+                                    _linear_strndup(parser, start, p - start));
+         } else {
+            for (i = 0; i < ARRAY_SIZE(two_char_ops); i++) {
+               if (strncmp(p, two_char_ops[i].str, 2) == 0) {
+                  tok = _token_create_ival(parser, two_char_ops[i].type,
+                                           two_char_ops[i].type);
+                  p += 2;
+                  break;
+               }
+            }
+            if (!tok && strchr("[](){}.&*+-~!/%<>^|;,=", *p)) {
+               tok = _token_create_ival(parser, *p, *p);
+               p++;
+            } else if (!tok) {
+               p++;
+               tok = _token_create_str(parser, OTHER,
+                                       _linear_strndup(parser, start, 1));
+            }
+         }
+         _token_list_append(parser, list, tok);
+      }
+   }
+
+   /* Errors (such as redefining a builtin macro) are reported at the start
+    * of the shader */
+   memset(&loc, 0, sizeof(loc));
+   loc.first_line = loc.last_line = 1;
+   _define_object_macro(parser, &loc, _linear_strndup(parser, define, name_len),
+                        list);
+}
+
 /* Initial output buffer size, 4096 minus ralloc() overhead. It was selected
  * to minimize total amount of allocated memory during shader-db run.
  */
@@ -241,6 +241,10 @@ glcpp_parser_destroy (glcpp_parser_t *parser);
 void
 glcpp_parser_resolve_implicit_version(glcpp_parser_t *parser);
 
+/* fincs-addition */
+void
+glcpp_parser_add_define(glcpp_parser_t *parser, const char *define);
+
 int
 glcpp_preprocess(void *ralloc_ctx, const char **shader, char **info_log,
 		 glcpp_extension_iterator extensions, void *state,
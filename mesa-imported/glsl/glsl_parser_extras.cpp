@@ -32,6 +32,7 @@
 #include "main/shaderobj.h"
 #include "util/u_atomic.h" /* for p_atomic_cmpxchg */
 #include "util/ralloc.h"
+#include "util/u_compile_stats.h" // fincs-addition
 //#include "util/disk_cache.h" // fincs-edit
 //#include "util/mesa-sha1.h" // fincs-edit
 #include "ast.h"
@@ -1958,6 +1959,12 @@ add_builtin_defines(struct _mesa_glsl_parse_state *state,
    unsigned gl_version = state->ctx->Extensions.Version;
    gl_api api = state->ctx->API;
 
+   // fincs-addition: macros predefined by the user (-D)
+   if (state->user_defines) {
+      for (const char *const *define = state->user_defines; *define; define++)
+         glcpp_parser_add_define(data, *define);
+   }
+
    if (gl_version != 0xff) {
       unsigned i;
       for (i = 0; i < state->num_supported_versions; i++) {
@@ -2099,15 +2106,19 @@ _mesa_glsl_compile_shader(struct gl_context *ctx, struct gl_shader *shader,
 
    struct _mesa_glsl_parse_state *state =
       new(shader) _mesa_glsl_parse_state(ctx, shader->Stage, shader);
+   state->user_defines = shader->Defines; // fincs-addition
 
    if (ctx->Const.GenerateTemporaryNames)
       (void) p_atomic_cmpxchg(&ir_variable::temporaries_allocate_names,
                               false, true);
 
+   compile_stats_begin("glcpp"); // fincs-addition
    state->error = glcpp_preprocess(state, &source, &state->info_log,
                                    add_builtin_defines, state, ctx);
+   compile_stats_end();
 
    if (!state->error) {
+     compile_stats_scope stats("parse"); // fincs-addition
      _mesa_glsl_lexer_ctor(state, source);
      _mesa_glsl_parse(state);
      _mesa_glsl_lexer_dtor(state);
@@ -2123,8 +2134,18 @@ _mesa_glsl_compile_shader(struct gl_context *ctx, struct gl_shader *shader,
 
    ralloc_free(shader->ir);
    shader->ir = new(shader) exec_list;
-   if (!state->error && !state->translation_unit.is_empty())
+   if (!state->error && !state->translation_unit.is_empty()) {
+      compile_stats_scope stats("ast_to_hir"); // fincs-addition
       _mesa_ast_to_hir(shader->ir, state);
+   }
+
+   /* fincs-addition: fold the uniforms specialized by the caller before
+    * optimizing, so that everything depending on them gets simplified.
+    */
+   if (!state->error && shader->Specializations) {
+      compile_stats_scope stats("specialize_uniforms");
+      do_specialize_uniforms(shader->ir, shader->Specializations, state);
+   }
 
    if (!state->error) {
       validate_ir_tree(shader->ir);
@@ -2150,6 +2171,7 @@ _mesa_glsl_compile_shader(struct gl_context *ctx, struct gl_shader *shader,
    if (!state->error && !shader->ir->is_empty()) {
       assign_subroutine_indexes(state);
       lower_subroutine(shader->ir, state);
+      compile_stats_scope stats("optimize"); // fincs-addition
       opt_shader_and_create_symbol_table(ctx, state->symbols, shader);
    }
 
@@ -2173,6 +2195,34 @@ _mesa_glsl_compile_shader(struct gl_context *ctx, struct gl_shader *shader,
    */
 }
 
+/**
+ * Run only the preprocessor on the shader source, exactly like
+ * _mesa_glsl_compile_shader would (fincs-edit: used by uam to compute
+ * shader cache keys).
+ *
+ * Returns the preprocessed source (allocated from \c mem_ctx), or NULL if
+ * preprocessing failed. Errors are reported when the shader is compiled.
+ */
+char *
+_mesa_glsl_preprocess_shader(struct gl_context *ctx, struct gl_shader *shader,
+                             void *mem_ctx)
+{
+   const char *source = shader->Source;
+
+   struct _mesa_glsl_parse_state *state =
+      new(mem_ctx) _mesa_glsl_parse_state(ctx, shader->Stage, mem_ctx);
+   state->user_defines = shader->Defines;
+
+   state->error = glcpp_preprocess(state, &source, &state->info_log,
+                                   add_builtin_defines, state, ctx);
+
+   char *result = state->error ? NULL : ralloc_strdup(mem_ctx, source);
+
+   delete state->symbols;
+   ralloc_free(state);
+   return result;
+}
+
 } /* extern "C" */
 /**
  * Do the set of common optimizations passes
@@ -2201,8 +2251,10 @@ do_common_optimization(exec_list *ir, bool linked,
 {
    const bool debug = false;
    GLboolean progress = GL_FALSE;
+   compile_stats_scope stats("do_common_optimization"); // fincs-addition
 
 #define OPT(PASS, ...) do {                                             \
+      compile_stats_scope pass_stats(#PASS); /* fincs-addition */       \
       if (debug) {                                                      \
          fprintf(stderr, "START GLSL optimization %s\n", #PASS);        \
          const bool opt_progress = PASS(__VA_ARGS__);                   \
@@ -2261,6 +2313,7 @@ do_common_optimization(exec_list *ir, bool linked,
    OPT(optimize_redundant_jumps, ir);
 
    if (options->MaxUnrollIterations) {
+      compile_stats_scope unroll_stats("unroll_loops"); // fincs-addition
       loop_state *ls = analyze_loop_variables(ir);
       if (ls->loop_found) {
          bool loop_progress = unroll_loops(ir, ls, options);
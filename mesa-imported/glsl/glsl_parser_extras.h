@@ -362,6 +362,9 @@ struct _mesa_glsl_parse_state {
 
    struct gl_context *const ctx;
    void *scanner;
+
+   /** NULL-terminated list of NAME[=VALUE] macros to predefine (fincs-addition) */
+   const char *const *user_defines;
    exec_list translation_unit;
    glsl_symbol_table *symbols;
 
@@ -999,6 +1002,9 @@ extern int glcpp_preprocess(void *ctx, const char **shader, char **info_log,
                             struct _mesa_glsl_parse_state *state,
                             struct gl_context *gl_ctx);
 
+extern void glcpp_parser_add_define(struct glcpp_parser *parser,
+                                    const char *define); // fincs-addition
+
 extern void _mesa_destroy_shader_compiler(void);
 extern void _mesa_destroy_shader_compiler_caches(void);
 
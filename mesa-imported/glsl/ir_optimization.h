@@ -97,6 +97,9 @@ bool do_common_optimization(exec_list *ir, bool linked,
 bool ir_constant_fold(ir_rvalue **rvalue);
 
 bool do_rebalance_tree(exec_list *instructions);
+bool do_specialize_uniforms(exec_list *instructions,
+                            const char *const *specializations,
+                            struct _mesa_glsl_parse_state *state); // fincs-addition
 bool do_algebraic(exec_list *instructions, bool native_integers,
                   const struct gl_shader_compiler_options *options);
 bool opt_conditional_discard(exec_list *instructions);
@@ -24,14 +24,11 @@
 #include "link_uniform_block_active_visitor.h"
 #include "program.h"
 #include "linker_util.h"
-
-static bool g_isGlslcBinding = false;
-void set_is_glslc_binding(bool offset) {
-   g_isGlslcBinding = offset;
-}
+#include "main/mtypes.h"
 
 static link_uniform_block_active *
-process_block(void *mem_ctx, struct hash_table *ht, ir_variable *var)
+process_block(void *mem_ctx, struct hash_table *ht, ir_variable *var,
+              const struct gl_shader_program *prog)
 {
    const hash_entry *const existing_block =
       _mesa_hash_table_search(ht, var->get_interface_type()->name);
@@ -54,7 +51,7 @@ process_block(void *mem_ctx, struct hash_table *ht, ir_variable *var)
 
       if (var->data.explicit_binding) {
          b->has_binding = true;
-         b->binding = var->data.binding + int(g_isGlslcBinding);
+         b->binding = var->data.binding + int(prog->IsGlslcBinding);
       } else {
          b->has_binding = false;
          b->binding = 0;
@@ -177,7 +174,7 @@ link_uniform_block_active_visitor::visit(ir_variable *var)
 
    /* Process the block.  Bail if there was an error. */
    link_uniform_block_active *const b =
-      process_block(this->mem_ctx, this->ht, var);
+      process_block(this->mem_ctx, this->ht, var, this->prog);
    if (b == NULL) {
       linker_error(this->prog,
                    "uniform block `%s' has mismatching definitions",
@@ -242,7 +239,7 @@ link_uniform_block_active_visitor::visit_enter(ir_dereference_array *ir)
 
    /* Process the block.  Bail if there was an error. */
    link_uniform_block_active *const b =
-      process_block(this->mem_ctx, this->ht, var);
+      process_block(this->mem_ctx, this->ht, var, this->prog);
    if (b == NULL) {
       linker_error(prog,
                    "uniform block `%s' has mismatching definitions",
@@ -280,7 +277,7 @@ link_uniform_block_active_visitor::visit(ir_dereference_variable *ir)
 
    /* Process the block.  Bail if there was an error. */
    link_uniform_block_active *const b =
-      process_block(this->mem_ctx, this->ht, var);
+      process_block(this->mem_ctx, this->ht, var, this->prog);
    if (b == NULL) {
       linker_error(this->prog,
                    "uniform block `%s' has mismatching definitions",
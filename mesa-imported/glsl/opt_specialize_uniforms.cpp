@@ -0,0 +1,256 @@
+/* fincs-addition
+ *
+ * \file opt_specialize_uniforms.cpp
+ *
+ * Replaces uniforms by constant values supplied along with the shader, so
+ * that the optimizations which follow (constant propagation, if
+ * simplification, loop unrolling, dead code elimination...) can get rid of
+ * everything that depends on them.
+ *
+ * Specializations are given as "name=value" strings. The name is that of a
+ * uniform, "struct.member" for a member of a uniform structure, and either
+ * "Block.member", "instance.member" or just "member" for a member of a uniform
+ * block. The value is a comma separated list with one entry per component
+ * (column-major for matrices); a single entry is replicated to all the
+ * components of a vector. Specializations that don't match any uniform of the
+ * shader are ignored, so that the same list can be used for several stages.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "ir_rvalue_visitor.h"
+#include "ir_optimization.h"
+#include "glsl_parser_extras.h"
+#include "compiler/glsl_types.h"
+#include "util/hash_table.h"
+
+namespace {
+
+class ir_specialize_uniforms_visitor : public ir_rvalue_visitor {
+public:
+   ir_specialize_uniforms_visitor(const char *const *specializations,
+                                  _mesa_glsl_parse_state *state)
+      : progress(false), specializations(specializations), state(state)
+   {
+      mem_ctx = ralloc_context(NULL);
+      constants = _mesa_pointer_hash_table_create(mem_ctx);
+   }
+
+   ~ir_specialize_uniforms_visitor()
+   {
+      ralloc_free(mem_ctx);
+   }
+
+   virtual void handle_rvalue(ir_rvalue **rvalue);
+
+   bool progress;
+
+private:
+   const char *find_value(const char *name, const char *field) const;
+   ir_constant *get_constant(const char *value, const char *name,
+                             const char *field, const glsl_type *type);
+
+   const char *const *specializations;
+   _mesa_glsl_parse_state *state;
+   void *mem_ctx;
+
+   /** Parsed values, indexed by value string (NULL if invalid) */
+   struct hash_table *constants;
+};
+
+} /* anonymous namespace */
+
+/**
+ * Returns the value given for name (or name.field), if any. Later
+ * specializations override earlier ones.
+ */
+const char *
+ir_specialize_uniforms_visitor::find_value(const char *name,
+                                           const char *field) const
+{
+   const size_t name_len = strlen(name);
+   const size_t field_len = field ? strlen(field) : 0;
+   const char *value = NULL;
+
+   for (const char *const *spec = specializations; *spec; spec++) {
+      const char *s = *spec;
+      if (strncmp(s, name, name_len) != 0)
+         continue;
+      s += name_len;
+
+      if (field) {
+         if (*s != '.' || strncmp(s + 1, field, field_len) != 0)
+            continue;
+         s += 1 + field_len;
+      }
+
+      if (*s == '=')
+         value = s + 1;
+   }
+
+   return value;
+}
+
+static bool
+parse_component(const char **str, glsl_base_type base_type,
+                ir_constant_data *data, unsigned i)
+{
+   const char *s = *str;
+   char *end = NULL;
+
+   while (*s == ' ')
+      s++;
+
+   switch (base_type) {
+   case GLSL_TYPE_FLOAT:
+      data->f[i] = strtof(s, &end);
+      break;
+   case GLSL_TYPE_DOUBLE:
+      data->d[i] = strtod(s, &end);
+      break;
+   case GLSL_TYPE_INT:
+      data->i[i] = strtol(s, &end, 0);
+      break;
+   case GLSL_TYPE_UINT:
+      data->u[i] = strtoul(s, &end, 0);
+      break;
+   case GLSL_TYPE_INT64:
+      data->i64[i] = strtoll(s, &end, 0);
+      break;
+   case GLSL_TYPE_UINT64:
+      data->u64[i] = strtoull(s, &end, 0);
+      break;
+   case GLSL_TYPE_BOOL:
+      if (strncmp(s, "true", 4) == 0) {
+         data->b[i] = true;
+         end = (char *) s + 4;
+      } else if (strncmp(s, "false", 5) == 0) {
+         data->b[i] = false;
+         end = (char *) s + 5;
+      } else {
+         data->b[i] = strtol(s, &end, 0) != 0;
+      }
+      break;
+   default:
+      return false;
+   }
+
+   if (end == s)
+      return false;
+
+   while (*end == ' ')
+      end++;
+   *str = end;
+   return true;
+}
+
+ir_constant *
+ir_specialize_uniforms_visitor::get_constant(const char *value,
+                                             const char *name,
+                                             const char *field,
+                                             const glsl_type *type)
+{
+   struct hash_entry *entry = _mesa_hash_table_search(constants, value);
+   if (entry)
+      return (ir_constant *) entry->data;
+
+   ir_constant_data data;
+   memset(&data, 0, sizeof(data));
+
+   const unsigned components = type->components();
+   unsigned count = 0;
+   bool valid = !type->is_array() &&
+                (type->is_numeric() || type->is_boolean());
+
+   for (const char *s = value; valid && *s != '\0'; count++) {
+      valid = count < components &&
+              parse_component(&s, type->base_type, &data, count);
+      if (valid && *s == ',')
+         valid = *++s != '\0';
+      else if (valid)
+         valid = *s == '\0';
+   }
+
+   if (valid && count == 1 && type->is_vector()) {
+      for (unsigned i = 1; i < components; i++) {
+         const char *s = value;
+         parse_component(&s, type->base_type, &data, i);
+      }
+      count = components;
+   }
+
+   ir_constant *c = NULL;
+   if (valid && count == components) {
+      c = new(mem_ctx) ir_constant(type, &data);
+   } else {
+      YYLTYPE loc;
+      memset(&loc, 0, sizeof(loc));
+      _mesa_glsl_error(&loc, state,
+                       "invalid specialization of uniform `%s%s%s' "
+                       "of type %s: `%s'", name, field ? "." : "",
+                       field ? field : "", type->name, value);
+   }
+
+   _mesa_hash_table_insert(constants, value, c);
+   return c;
+}
+
+void
+ir_specialize_uniforms_visitor::handle_rvalue(ir_rvalue **rvalue)
+{
+   if (*rvalue == NULL)
+      return;
+
+   ir_variable *var = NULL;
+   const char *name = NULL, *field = NULL, *value = NULL;
+
+   if (ir_dereference_variable *deref = (*rvalue)->as_dereference_variable()) {
+      var = deref->var;
+      if (var->data.mode != ir_var_uniform || var->is_interface_instance())
+         return;
+
+      name = var->name;
+      value = find_value(name, NULL);
+      if (!value && var->is_in_buffer_block()) {
+         /* Member of a uniform block without an instance name */
+         name = var->get_interface_type()->name;
+         field = var->name;
+         value = find_value(name, field);
+      }
+   } else if (ir_dereference_record *deref = (*rvalue)->as_dereference_record()) {
+      ir_dereference_variable *record = deref->record->as_dereference_variable();
+      if (!record || record->var->data.mode != ir_var_uniform)
+         return;
+
+      var = record->var;
+      name = var->name;
+      field = record->type->fields.structure[deref->field_idx].name;
+      value = find_value(name, field);
+      if (!value && var->is_interface_instance()) {
+         name = var->get_interface_type()->name;
+         value = find_value(name, field);
+      }
+   }
+
+   if (!value)
+      return;
+
+   ir_constant *c = get_constant(value, name, field, (*rvalue)->type);
+   if (!c)
+      return;
+
+   *rvalue = c->clone(ralloc_parent(*rvalue), NULL);
+   progress = true;
+}
+
+bool
+do_specialize_uniforms(exec_list *instructions,
+                       const char *const *specializations,
+                       struct _mesa_glsl_parse_state *state)
+{
+   ir_specialize_uniforms_visitor v(specializations, state);
+   v.run(instructions);
+   return v.progress;
+}
@@ -37,6 +37,10 @@ extern void
 _mesa_glsl_compile_shader(struct gl_context *ctx, struct gl_shader *shader,
 			  bool dump_ast, bool dump_hir, bool force_recompile);
 
+extern char *
+_mesa_glsl_preprocess_shader(struct gl_context *ctx, struct gl_shader *shader,
+                             void *mem_ctx);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -2604,6 +2604,8 @@ struct gl_shader
    unsigned SourceChecksum;       /**< for debug/logging purposes */
 #endif
    const GLchar *Source;  /**< Source code string */
+   const char *const *Defines; /**< NULL-terminated list of NAME[=VALUE] macros to predefine (fincs-addition) */
+   const char *const *Specializations; /**< NULL-terminated list of NAME=VALUE uniform values (fincs-addition) */
 
    const GLchar *FallbackSource;  /**< Fallback string used by on-disk cache*/
 
@@ -2962,6 +2964,18 @@ struct gl_shader_program
     */
    GLboolean SeparateShader;
 
+   /**
+    * Whether explicit block bindings follow the GLSLC binding scheme, i.e.
+    * they are offset by one compared to deko3d bindings.
+    */
+   bool IsGlslcBinding;
+
+   /**
+    * Whether linked shaders supported by nv50_ir_glsl_supported keep their
+    * GLSL IR for the codegen instead of being translated to TGSI.
+    */
+   bool DirectIr;
+
    GLuint NumShaders;          /**< number of attached shaders */
    struct gl_shader **Shaders; /**< List of attached the shaders */
 
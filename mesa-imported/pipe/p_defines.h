@@ -960,6 +960,7 @@ enum pipe_shader_ir
    PIPE_SHADER_IR_TGSI = 0,
    PIPE_SHADER_IR_NATIVE,
    PIPE_SHADER_IR_NIR,
+   PIPE_SHADER_IR_GLSL, // fincs-addition: linked GLSL IR (struct gl_linked_shader)
 };
 
 /**
@@ -642,7 +642,7 @@ struct tgsi_instruction
    unsigned Texture    : 1;
    unsigned Memory     : 1;
    unsigned Precise    : 1;
-   unsigned Padding    : 1;
+   unsigned Mediump    : 1;  /* BOOL, may be computed at half precision */ // fincs-edit
 };
 
 /*
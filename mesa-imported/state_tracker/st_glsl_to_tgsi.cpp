@@ -53,6 +53,7 @@
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "st_glsl_types.h"
+#include "codegen/nv50_ir_driver.h" // fincs-addition
 //#include "st_program.h" // fincs-edit
 #include "program/program.h" // fincs-edit
 //#include "st_mesa_to_tgsi.h" // fincs-edit
@@ -212,6 +213,69 @@ static unsigned is_precise(const ir_variable *ir)
    return ir->data.precise || ir->data.invariant;
 }
 
+// fincs-addition
+/* Precision an rvalue is computed at according to the GLSL ES rules, that is
+ * the highest precision among its operands. Values without precision (such
+ * as constants) are ranked below lowp, and values of unknown precision
+ * (compiler temporaries, calls...) are assumed to be highp.
+ */
+enum rvalue_precision {
+   rvalue_precision_none,
+   rvalue_precision_low,
+   rvalue_precision_medium,
+   rvalue_precision_high,
+};
+
+static rvalue_precision
+variable_precision(unsigned precision)
+{
+   switch (precision) {
+   case GLSL_PRECISION_LOW:
+      return rvalue_precision_low;
+   case GLSL_PRECISION_MEDIUM:
+      return rvalue_precision_medium;
+   default:
+      return rvalue_precision_high;
+   }
+}
+
+static rvalue_precision
+get_rvalue_precision(ir_rvalue *ir)
+{
+   switch (ir->ir_type) {
+   case ir_type_constant:
+      return rvalue_precision_none;
+   case ir_type_dereference_variable:
+      return variable_precision(((ir_dereference_variable *)ir)->var->data.precision);
+   case ir_type_dereference_array:
+      return get_rvalue_precision(((ir_dereference_array *)ir)->array);
+   case ir_type_dereference_record: {
+      ir_dereference_record *deref = (ir_dereference_record *)ir;
+      const glsl_struct_field *field =
+         &deref->record->type->fields.structure[deref->field_idx];
+      if (field->precision != GLSL_PRECISION_NONE)
+         return variable_precision(field->precision);
+      return get_rvalue_precision(deref->record);
+   }
+   case ir_type_swizzle:
+      return get_rvalue_precision(((ir_swizzle *)ir)->val);
+   case ir_type_texture:
+      return get_rvalue_precision(((ir_texture *)ir)->sampler);
+   case ir_type_expression: {
+      ir_expression *expr = (ir_expression *)ir;
+      rvalue_precision precision = rvalue_precision_none;
+      for (unsigned i = 0; i < expr->num_operands; i++) {
+         rvalue_precision op_precision = get_rvalue_precision(expr->operands[i]);
+         if (op_precision > precision)
+            precision = op_precision;
+      }
+      return precision;
+   }
+   default:
+      return rvalue_precision_high;
+   }
+}
+
 class variable_storage {
    DECLARE_RZALLOC_CXX_OPERATORS(variable_storage)
 
@@ -336,6 +400,7 @@ public:
    bool image_wr[PIPE_MAX_SHADER_IMAGES];
    bool indirect_addr_consts;
    int wpos_transform_const;
+   int in_array; /**< Nesting depth of array constants being visited */
 
    bool native_integers;
    bool have_sqrt;
@@ -345,6 +410,12 @@ public:
    bool precise;
    bool need_uarl;
 
+   /* fincs-addition: whether the instructions emitted for an expression may
+    * be computed at half precision (cached for the last expression seen) */
+   bool is_mediump(ir_instruction *ir);
+   ir_instruction *mediump_ir;
+   bool mediump_ir_result;
+
    variable_storage *find_variable_storage(ir_variable *var);
 
    int add_constant(gl_register_file file, gl_constant_value values[8],
@@ -491,6 +562,12 @@ public:
    void print_stats();
 
    void *mem_ctx;
+   /**
+    * fincs-addition: linear arena for the glsl_to_tgsi instructions and their
+    * texture offsets only. The GLSL IR they are generated from stays in ralloc
+    * contexts, since the IR passes rely on ralloc_parent and ralloc_steal.
+    */
+   void *lin_ctx;
 };
 
 static st_dst_reg address_reg = st_dst_reg(PROGRAM_ADDRESS, WRITEMASK_X,
@@ -530,13 +607,31 @@ swizzle_for_size(int size)
 }
 
 
+// fincs-addition
+bool
+glsl_to_tgsi_visitor::is_mediump(ir_instruction *ir)
+{
+   if (!ir || ir->ir_type != ir_type_expression)
+      return false;
+
+   if (ir != mediump_ir) {
+      rvalue_precision precision = get_rvalue_precision((ir_rvalue *)ir);
+      mediump_ir = ir;
+      mediump_ir_result = precision == rvalue_precision_low ||
+                          precision == rvalue_precision_medium;
+   }
+
+   return mediump_ir_result;
+}
+
+
 glsl_to_tgsi_instruction *
 glsl_to_tgsi_visitor::emit_asm(ir_instruction *ir, enum tgsi_opcode op,
                                st_dst_reg dst, st_dst_reg dst1,
                                st_src_reg src0, st_src_reg src1,
                                st_src_reg src2, st_src_reg src3)
 {
-   glsl_to_tgsi_instruction *inst = new(mem_ctx) glsl_to_tgsi_instruction();
+   glsl_to_tgsi_instruction *inst = new(lin_ctx) glsl_to_tgsi_instruction();
    int num_reladdr = 0, i, j;
    bool dst_is_64bit[2];
 
@@ -573,6 +668,7 @@ glsl_to_tgsi_visitor::emit_asm(ir_instruction *ir, enum tgsi_opcode op,
 
    inst->op = op;
    inst->precise = this->precise;
+   inst->mediump = !this->precise && is_mediump(ir); // fincs-addition
    inst->info = tgsi_get_opcode_info(op);
    inst->dst[0] = dst;
    inst->dst[1] = dst1;
@@ -701,7 +797,7 @@ glsl_to_tgsi_visitor::emit_asm(ir_instruction *ir, enum tgsi_opcode op,
             dinst = inst;
          } else {
             /* create a new instructions for subsequent attempts */
-            dinst = new(mem_ctx) glsl_to_tgsi_instruction();
+            dinst = new(lin_ctx) glsl_to_tgsi_instruction();
             *dinst = *inst;
             dinst->next = NULL;
             dinst->prev = NULL;
@@ -3251,6 +3347,7 @@ glsl_to_tgsi_visitor::visit(ir_assignment *ir)
       inst = (glsl_to_tgsi_instruction *)this->instructions.get_tail();
       new_inst = emit_asm(ir, inst->op, l, inst->src[0], inst->src[1], inst->src[2], inst->src[3]);
       new_inst->saturate = inst->saturate;
+      new_inst->mediump = inst->mediump; // fincs-addition
       new_inst->resource = inst->resource;
       inst->dead_mask = inst->dst[0].writemask;
    } else {
@@ -3268,7 +3365,6 @@ glsl_to_tgsi_visitor::visit(ir_constant *ir)
    gl_constant_value *values = (gl_constant_value *) stack_vals;
    GLenum gl_type = GL_NONE;
    unsigned int i, elements;
-   static int in_array = 0;
    gl_register_file file = in_array ? PROGRAM_CONSTANT : PROGRAM_IMMEDIATE;
 
    /* Unfortunately, 4 floats is all we can get into
@@ -4630,8 +4726,9 @@ glsl_to_tgsi_visitor::visit(ir_texture *ir)
 
    if (ir->offset) {
       if (!inst->tex_offsets)
-         inst->tex_offsets = rzalloc_array(inst, st_src_reg,
-                                           MAX_GLSL_TEXTURE_OFFSET);
+         inst->tex_offsets = (st_src_reg *)
+            linear_zalloc_child(lin_ctx, sizeof(st_src_reg) *
+                                         MAX_GLSL_TEXTURE_OFFSET);
 
       for (i = 0; i < MAX_GLSL_TEXTURE_OFFSET &&
                   offset[i].file != PROGRAM_UNDEFINED; i++)
@@ -4750,12 +4847,16 @@ glsl_to_tgsi_visitor::glsl_to_tgsi_visitor()
    images_used = 0;
    indirect_addr_consts = false;
    wpos_transform_const = -1;
+   in_array = 0;
    native_integers = false;
    mem_ctx = ralloc_context(NULL);
+   lin_ctx = linear_alloc_parent(mem_ctx, 0);
    ctx = NULL;
    prog = NULL;
    precise = 0;
    need_uarl = false;
+   mediump_ir = NULL; // fincs-addition
+   mediump_ir_result = false; // fincs-addition
    shader_program = NULL;
    shader = NULL;
    options = NULL;
@@ -5514,8 +5615,10 @@ glsl_to_tgsi_visitor::eliminate_dead_code(void)
          continue;
 
       if ((inst->dst[0].writemask & ~inst->dead_mask) == 0) {
+         /* fincs-edit: instructions live in lin_ctx and can't be freed
+          * individually.
+          */
          inst->remove();
-         delete inst;
          removed++;
       } else {
          if (glsl_base_type_is_64bit(inst->dst[0].type)) {
@@ -5537,7 +5640,7 @@ glsl_to_tgsi_visitor::eliminate_dead_code(void)
 void
 glsl_to_tgsi_visitor::merge_two_dsts(void)
 {
-   /* We never delete inst, but we may delete its successor. */
+   /* We never remove inst, but we may remove its successor. */
    foreach_in_list(glsl_to_tgsi_instruction, inst, &this->instructions) {
       glsl_to_tgsi_instruction *inst2;
       unsigned defined;
@@ -5580,8 +5683,7 @@ glsl_to_tgsi_visitor::merge_two_dsts(void)
       }
 
       inst->dst[defined ^ 1] = inst2->dst[defined ^ 1];
-      inst2->remove();
-      delete inst2;
+      inst2->remove(); // fincs-edit: freed with lin_ctx
    }
 }
 
@@ -7115,8 +7217,11 @@ st_translate_program(
 
    /* Emit each instruction in turn:
     */
-   foreach_in_list(glsl_to_tgsi_instruction, inst, &program->instructions)
+   foreach_in_list(glsl_to_tgsi_instruction, inst, &program->instructions) {
+      ureg_set_mediump(ureg, inst->mediump); // fincs-addition
       compile_tgsi_instruction(t, inst);
+   }
+   ureg_set_mediump(ureg, FALSE); // fincs-addition
 
    /* Set the next shader stage hint for VS and TES. */
    switch (procType) {
@@ -7357,6 +7462,41 @@ get_mesa_program_tgsi(struct gl_context *ctx,
    return prog;
 }
 
+/* fincs-addition: Same as get_mesa_program_tgsi, for shaders whose GLSL IR
+ * is passed as is to the codegen (see nv50_ir_glsl_supported). The IR is
+ * kept, and only the program data the codegen and the frontend need is set.
+ */
+static struct gl_program *
+get_mesa_program_direct(struct gl_context *ctx,
+                        struct gl_shader_program *shader_program,
+                        struct gl_linked_shader *shader)
+{
+   struct gl_program *prog;
+
+   validate_ir_tree(shader->ir);
+
+   prog = shader->Program;
+
+   prog->Parameters = _mesa_new_parameter_list();
+   _mesa_generate_parameters_list_for_uniforms(ctx, shader_program, shader,
+                                               prog->Parameters);
+
+   /* Remove reads from output registers. */
+   lower_output_reads(shader->Stage, shader->ir);
+
+   do_set_program_inouts(shader->ir, prog, shader->Stage);
+   _mesa_copy_linked_program_data(shader_program, shader);
+
+   _mesa_reserve_parameter_storage(prog->Parameters, 8);
+   _mesa_associate_uniform_storage(ctx, shader_program, prog);
+   if (!shader_program->data->LinkStatus) {
+      _mesa_reference_program(ctx, &shader->Program, NULL);
+      return NULL;
+   }
+
+   return prog;
+}
+
 /* See if there are unsupported control flow statements. */
 class ir_control_flow_info_visitor : public ir_hierarchical_visitor {
 private:
@@ -7576,6 +7716,12 @@ st_link_shader(struct gl_context *ctx, struct gl_shader_program *prog)
       if (shader == NULL)
          continue;
 
+      // fincs-addition: skip glsl_to_tgsi for shaders the codegen can take as is
+      if (prog->DirectIr && nv50_ir_glsl_supported(shader)) {
+         get_mesa_program_direct(ctx, prog, shader);
+         continue;
+      }
+
       //struct gl_program *linked_prog = // fincs-edit
          get_mesa_program_tgsi(ctx, prog, shader);
       //st_set_prog_affected_state_flags(linked_prog); // fincs-edit
@@ -123,7 +123,8 @@ std::ostream& operator << (std::ostream& os, const st_dst_reg& reg);
 
 class glsl_to_tgsi_instruction : public exec_node {
 public:
-   DECLARE_RALLOC_CXX_OPERATORS(glsl_to_tgsi_instruction)
+   /* fincs-edit: allocated from the linear arena of glsl_to_tgsi_visitor */
+   DECLARE_LINEAR_ALLOC_CXX_OPERATORS(glsl_to_tgsi_instruction)
 
    st_dst_reg dst[2];
    st_src_reg src[4];
@@ -135,6 +136,7 @@ public:
 
    enum tgsi_opcode op:10; /**< TGSI opcode */
    unsigned precise:1;
+   unsigned mediump:1; // fincs-addition
    unsigned saturate:1;
    unsigned is_64bit_expanded:1;
    unsigned sampler_base:5;
@@ -655,7 +655,7 @@ tgsi_default_instruction( void )
    instruction.Texture = 0;
    instruction.Memory = 0;
    instruction.Precise = 0;
-   instruction.Padding = 0;
+   instruction.Mediump = 0; // fincs-edit
 
    return instruction;
 }
@@ -1074,6 +1074,7 @@ tgsi_build_full_instruction(
                                          full_inst->Instruction.NumDstRegs,
                                          full_inst->Instruction.NumSrcRegs,
                                          header);
+   instruction->Mediump = full_inst->Instruction.Mediump; // fincs-addition
 
    if (full_inst->Instruction.Label) {
       struct tgsi_instruction_label *instruction_label;
@@ -588,6 +588,11 @@ iter_instruction(
       TXT( "_PRECISE" );
    }
 
+   // fincs-addition
+   if (inst->Instruction.Mediump) {
+      TXT( "_MEDIUMP" );
+   }
+
    for (i = 0; i < inst->Instruction.NumDstRegs; i++) {
       const struct tgsi_full_dst_register *dst = &inst->Dst[i];
 
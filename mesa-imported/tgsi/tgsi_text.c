@@ -999,6 +999,7 @@ static boolean
 match_inst(const char **pcur,
            unsigned *saturate,
            unsigned *precise,
+           unsigned *mediump, // fincs-addition
            const struct tgsi_opcode_info *info)
 {
    const char *cur = *pcur;
@@ -1009,6 +1010,7 @@ match_inst(const char **pcur,
       *pcur = cur;
       *saturate = 0;
       *precise = 0;
+      *mediump = 0; // fincs-addition
       return TRUE;
    }
 
@@ -1024,6 +1026,12 @@ match_inst(const char **pcur,
          *precise = 1;
       }
 
+      // fincs-addition
+      if (str_match_no_case(&cur, "_MEDIUMP")) {
+         *pcur = cur;
+         *mediump = 1;
+      }
+
       if (!is_digit_alpha_underscore(cur))
          return TRUE;
    }
@@ -1039,6 +1047,7 @@ parse_instruction(
    int i;
    uint saturate = 0;
    uint precise = 0;
+   uint mediump = 0; // fincs-addition
    const struct tgsi_opcode_info *info;
    struct tgsi_full_instruction inst;
    const char *cur;
@@ -1053,7 +1062,7 @@ parse_instruction(
       cur = ctx->cur;
 
       info = tgsi_get_opcode_info( i );
-      if (match_inst(&cur, &saturate, &precise, info)) {
+      if (match_inst(&cur, &saturate, &precise, &mediump, info)) {
          if (info->num_dst + info->num_src + info->is_tex == 0) {
             ctx->cur = cur;
             break;
@@ -1075,6 +1084,7 @@ parse_instruction(
    inst.Instruction.Opcode = i;
    inst.Instruction.Saturate = saturate;
    inst.Instruction.Precise = precise;
+   inst.Instruction.Mediump = mediump; // fincs-addition
    inst.Instruction.NumDstRegs = info->num_dst;
    inst.Instruction.NumSrcRegs = info->num_src;
 
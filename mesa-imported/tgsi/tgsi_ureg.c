@@ -203,6 +203,8 @@ struct ureg_program
    struct ureg_tokens domain[2];
 
    bool use_memory[TGSI_MEMORY_TYPE_COUNT];
+
+   boolean mediump; // fincs-addition
 };
 
 static union tgsi_any_token error_tokens[32];
@@ -1270,6 +1272,7 @@ ureg_emit_insn(struct ureg_program *ureg,
    out[0].insn.Opcode = opcode;
    out[0].insn.Saturate = saturate;
    out[0].insn.Precise = precise;
+   out[0].insn.Mediump = ureg->mediump; // fincs-addition
    out[0].insn.NumDstRegs = num_dst;
    out[0].insn.NumSrcRegs = num_src;
 
@@ -1316,6 +1319,13 @@ ureg_get_instruction_number( struct ureg_program *ureg )
    return ureg->nr_instructions;
 }
 
+// fincs-addition
+void
+ureg_set_mediump( struct ureg_program *ureg, boolean mediump )
+{
+   ureg->mediump = mediump;
+}
+
 /* Patch a given label (expressed as a token number) to point to a
  * given instruction (expressed as an instruction number).
  */
@@ -535,6 +535,14 @@ unsigned
 ureg_get_instruction_number( struct ureg_program *ureg );
 
 
+// fincs-addition
+/* Marks the instructions emitted from now on as allowed to be computed at
+ * half precision (or not).
+ */
+void
+ureg_set_mediump( struct ureg_program *ureg, boolean mediump );
+
+
 /* Patch a given label (expressed as a token number) to point to a
  * given instruction (expressed as an instruction number).
  *
@@ -0,0 +1,30 @@
+/* fincs-addition: compile time instrumentation hooks, implemented by uam
+ * (see source/compile_stats.cpp).
+ */
+
+#ifndef U_COMPILE_STATS_H
+#define U_COMPILE_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Mark the beginning and the end of a compilation phase on the calling
+ * thread. Phases nest, and are only recorded while statistics are being
+ * collected; otherwise these calls do nothing. The name must be a string
+ * that outlives the compilation (normally a literal).
+ */
+void compile_stats_begin(const char *phase);
+void compile_stats_end(void);
+
+#ifdef __cplusplus
+}
+
+struct compile_stats_scope
+{
+   compile_stats_scope(const char *phase) { compile_stats_begin(phase); }
+   ~compile_stats_scope() { compile_stats_end(); }
+};
+#endif
+
+#endif /* U_COMPILE_STATS_H */
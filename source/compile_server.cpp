@@ -0,0 +1,613 @@
+#include <errno.h>
+#include <signal.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "compile_server.h"
+
+// Compiles a GLSL shader again with the opposite direct IR setting, and reports
+// how the programs generated through TGSI and directly from the GLSL IR compare
+static void CompareDirectIr(const CompileRequest& req, const DekoCompiler& compiler, const char* const* defines, const char* const* specializations)
+{
+	DekoCompiler other{req.stages[0], req.optLevel, req.isGlslcBinding};
+	other.SetDefines(defines);
+	other.SetSpecializations(specializations);
+	other.SetEarlyFragTestsInference(req.inferEarlyFragTests, false);
+	other.SetHalfFloatPacking(req.packHalfFloats);
+	other.SetExactCrsSize(req.exactCrsSize);
+	other.SetDirectIr(!req.directIr);
+
+	diag_list messages;
+	diag_list* prevList = diag_set_list(&messages);
+	bool succeeded = other.CompileGlsl(req.sources[0].c_str());
+	diag_set_list(prevList);
+
+	if (!succeeded)
+	{
+		diag_report(diag_severity_error, "compilation with%s direct IR failed", req.directIr ? "out" : "");
+		return;
+	}
+
+	const DekoCompiler& direct = req.directIr ? compiler : other;
+	const DekoCompiler& tgsi = req.directIr ? other : compiler;
+	if (!direct.UsesDirectIr())
+	{
+		diag_report(diag_severity_note, "direct IR: not supported by this shader, both programs were compiled through TGSI");
+		return;
+	}
+
+	bool headersMatch = direct.HeadersMatch(tgsi);
+	if (headersMatch && direct.CodeMatches(tgsi))
+	{
+		diag_report(diag_severity_note, "direct IR: headers and code are identical to the ones compiled through TGSI");
+		return;
+	}
+
+	shader_stats directStats, tgsiStats;
+	direct.GetShaderStats(directStats);
+	tgsi.GetShaderStats(tgsiStats);
+	auto numInstrs = [](const shader_stats& stats)
+	{
+		return stats.code.alu + stats.code.sfu + stats.code.tex + stats.code.mem + stats.code.flow;
+	};
+	diag_report(headersMatch ? diag_severity_note : diag_severity_warning,
+		"direct IR: %s from the ones compiled through TGSI (%u instructions, %u GPRs, %u stall cycles vs. %u, %u, %u)",
+		headersMatch ? "code differs" : "headers differ", numInstrs(directStats), directStats.num_gprs, directStats.code.stallCycles,
+		numInstrs(tgsiStats), tgsiStats.num_gprs, tgsiStats.code.stallCycles);
+}
+
+void RunCompileRequest(const CompileRequest& req, CompileResponse& resp, DekoShaderCache* cache)
+{
+	auto fillResult = [&](const DekoCompiler& compiler)
+	{
+		resp.results.emplace_back();
+		CompileResult& result = resp.results.back();
+		auto wants = [&](uam_output output) { return (req.outputMask & (1U << output)) != 0; };
+
+		compiler.GetDkshProgram(result.program);
+		compiler.GetShaderStats(result.stats);
+		if (wants(UAM_OUTPUT_DKSH))
+			compiler.WriteDksh(result.outputs[UAM_OUTPUT_DKSH]);
+		if (wants(UAM_OUTPUT_NVN_CONTROL))
+			compiler.WriteNvnControl(result.outputs[UAM_OUTPUT_NVN_CONTROL]);
+		if (wants(UAM_OUTPUT_NVN_GPU_PROGRAM))
+			compiler.WriteNvnGpuProgram(result.outputs[UAM_OUTPUT_NVN_GPU_PROGRAM]);
+		if (wants(UAM_OUTPUT_EPICSH))
+			compiler.WriteEpicShader(result.outputs[UAM_OUTPUT_EPICSH]);
+		if (wants(UAM_OUTPUT_RAW))
+			compiler.WriteRawCode(result.outputs[UAM_OUTPUT_RAW]);
+		if (wants(UAM_OUTPUT_TGSI))
+			compiler.WriteTgsi(result.outputs[UAM_OUTPUT_TGSI]);
+	};
+
+	auto toList = [](const std::vector<std::string>& strings)
+	{
+		std::vector<const char*> list;
+		for (auto& str : strings)
+			list.push_back(str.c_str());
+		list.push_back(nullptr);
+		return list;
+	};
+	auto defines = toList(req.defines);
+	auto specializations = toList(req.specializations);
+
+	resp.results.clear();
+	if (req.isPipeline)
+	{
+		std::vector<const char*> sources;
+		for (auto& source : req.sources)
+			sources.push_back(source.c_str());
+
+		DekoPipelineCompiler pipeline{req.optLevel, req.isGlslcBinding};
+		pipeline.SetDefines(defines.data());
+		pipeline.SetSpecializations(specializations.data());
+		pipeline.SetEarlyFragTestsInference(req.inferEarlyFragTests, req.reportEarlyFragTests);
+		pipeline.SetHalfFloatPacking(req.packHalfFloats);
+		pipeline.SetExactCrsSize(req.exactCrsSize);
+		pipeline.SetDirectIr(req.directIr);
+		resp.succeeded = pipeline.Compile(sources.data(), req.stages.data(), sources.size());
+		if (resp.succeeded)
+			for (auto stage : req.stages)
+				fillResult(*pipeline.GetStage(stage));
+		return;
+	}
+
+	DekoCompiler compiler{req.stages[0], req.optLevel, req.isGlslcBinding};
+	compiler.SetDefines(defines.data());
+	compiler.SetSpecializations(specializations.data());
+	compiler.SetEarlyFragTestsInference(req.inferEarlyFragTests, req.reportEarlyFragTests);
+	compiler.SetHalfFloatPacking(req.packHalfFloats);
+	compiler.SetExactCrsSize(req.exactCrsSize);
+	compiler.SetDirectIr(req.directIr);
+	if (req.isTgsi)
+		resp.succeeded = compiler.CompileTgsi(req.sources[0].c_str());
+	else
+	{
+		// Compiled programs don't keep their TGSI code, so only the frontend output is cached if it's needed.
+		// Comparisons need to know which path actually generated the code, which cached programs don't record.
+		if (!req.compareDirectIr)
+			compiler.SetCache(cache, !(req.outputMask & (1U << UAM_OUTPUT_TGSI)));
+		resp.succeeded = compiler.CompileGlsl(req.sources[0].c_str());
+		if (resp.succeeded && req.compareDirectIr)
+			CompareDirectIr(req, compiler, defines.data(), specializations.data());
+	}
+	if (resp.succeeded)
+		fillResult(compiler);
+}
+
+#ifdef _WIN32
+
+bool RunCompileServer(const char* socketPath, DekoShaderCache* cache)
+{
+	fprintf(stderr, "The compile server is not supported on this platform\n");
+	return false;
+}
+
+bool SendCompileRequest(const char* socketPath, const CompileRequest& req, CompileResponse& resp)
+{
+	fprintf(stderr, "The compile server is not supported on this platform\n");
+	return false;
+}
+
+#else
+
+namespace
+{
+	// Every message is a 32-bit size followed by the payload, which starts with a
+	// magic and the protocol version. Bump the version whenever the format changes.
+	constexpr uint32_t s_requestMagic  = UINT32_C(0x51534D55); // UMSQ
+	constexpr uint32_t s_responseMagic = UINT32_C(0x52534D55); // UMSR
+	constexpr uint32_t s_protocolVersion = 9;
+	constexpr uint32_t s_maxMessageSize = UINT32_C(1) << 30;
+
+	enum
+	{
+		RequestFlag_GlslcBinding = 1U << 0,
+		RequestFlag_Pipeline     = 1U << 1,
+		RequestFlag_Tgsi         = 1U << 2,
+		RequestFlag_EarlyFragTestsInference   = 1U << 3,
+		RequestFlag_EarlyFragTestsReport      = 1U << 4,
+		RequestFlag_HalfFloatPacking          = 1U << 5,
+		RequestFlag_ExactCrsSize              = 1U << 6,
+		RequestFlag_DirectIr                  = 1U << 7,
+		RequestFlag_CompareDirectIr           = 1U << 8,
+	};
+
+	class MessageWriter
+	{
+		DekoBuffer& m_buf;
+
+	public:
+		MessageWriter(DekoBuffer& buf) : m_buf{buf} { }
+
+		void PutBytes(const void* data, size_t size)
+		{
+			const uint8_t* bytes = (const uint8_t*)data;
+			m_buf.insert(m_buf.end(), bytes, bytes + size);
+		}
+
+		void Put32(uint32_t value) { PutBytes(&value, sizeof(value)); }
+
+		void PutBuffer(const void* data, size_t size)
+		{
+			Put32(size);
+			PutBytes(data, size);
+		}
+
+		void PutBuffer(const DekoBuffer& buf) { PutBuffer(buf.data(), buf.size()); }
+		void PutString(const std::string& str) { PutBuffer(str.data(), str.size()); }
+	};
+
+	// Reading past the end of the message sets the error flag instead of failing
+	// each call, so that the result only has to be checked once at the end.
+	class MessageReader
+	{
+		const uint8_t* m_pos;
+		const uint8_t* m_end;
+		bool m_ok;
+
+	public:
+		MessageReader(const DekoBuffer& buf) : m_pos{buf.data()}, m_end{buf.data() + buf.size()}, m_ok{true} { }
+
+		bool IsOk() const { return m_ok; }
+		bool IsAtEnd() const { return m_pos == m_end; }
+
+		const uint8_t* GetBytes(size_t size)
+		{
+			if (!m_ok || size_t(m_end - m_pos) < size)
+			{
+				m_ok = false;
+				return nullptr;
+			}
+			const uint8_t* data = m_pos;
+			m_pos += size;
+			return data;
+		}
+
+		uint32_t Get32()
+		{
+			uint32_t value = 0;
+			if (const uint8_t* data = GetBytes(sizeof(value)))
+				memcpy(&value, data, sizeof(value));
+			return value;
+		}
+
+		template <typename T>
+		void GetBuffer(T& out)
+		{
+			uint32_t size = Get32();
+			const uint8_t* data = GetBytes(size);
+			if (data)
+				out.assign(data, data + size);
+			else
+				out.clear();
+		}
+	};
+
+	bool WriteAll(int fd, const void* data, size_t size)
+	{
+		const uint8_t* bytes = (const uint8_t*)data;
+		while (size)
+		{
+			ssize_t ret = write(fd, bytes, size);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				return false;
+			bytes += ret;
+			size -= ret;
+		}
+		return true;
+	}
+
+	bool ReadAll(int fd, void* data, size_t size)
+	{
+		uint8_t* bytes = (uint8_t*)data;
+		while (size)
+		{
+			ssize_t ret = read(fd, bytes, size);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				return false;
+			bytes += ret;
+			size -= ret;
+		}
+		return true;
+	}
+
+	bool SendMessage(int fd, const DekoBuffer& msg)
+	{
+		uint32_t size = msg.size();
+		return WriteAll(fd, &size, sizeof(size)) && WriteAll(fd, msg.data(), msg.size());
+	}
+
+	bool ReceiveMessage(int fd, DekoBuffer& msg)
+	{
+		uint32_t size;
+		if (!ReadAll(fd, &size, sizeof(size)) || size > s_maxMessageSize)
+			return false;
+		msg.resize(size);
+		return ReadAll(fd, msg.data(), size);
+	}
+
+	void WriteRequest(DekoBuffer& out, const CompileRequest& req)
+	{
+		MessageWriter w{out};
+		w.Put32(s_requestMagic);
+		w.Put32(s_protocolVersion);
+		w.Put32((req.isGlslcBinding ? RequestFlag_GlslcBinding : 0) |
+			(req.isPipeline ? RequestFlag_Pipeline : 0) | (req.isTgsi ? RequestFlag_Tgsi : 0) |
+			(req.inferEarlyFragTests ? RequestFlag_EarlyFragTestsInference : 0) |
+			(req.reportEarlyFragTests ? RequestFlag_EarlyFragTestsReport : 0) |
+			(req.packHalfFloats ? RequestFlag_HalfFloatPacking : 0) |
+			(req.exactCrsSize ? RequestFlag_ExactCrsSize : 0) |
+			(req.directIr ? RequestFlag_DirectIr : 0) |
+			(req.compareDirectIr ? RequestFlag_CompareDirectIr : 0));
+		w.Put32(req.optLevel);
+		w.Put32(req.outputMask);
+		w.Put32(req.sources.size());
+		for (size_t i = 0; i < req.sources.size(); i ++)
+		{
+			w.Put32(req.stages[i]);
+			w.PutString(req.sources[i]);
+		}
+		w.Put32(req.defines.size());
+		for (auto& define : req.defines)
+			w.PutString(define);
+		w.Put32(req.specializations.size());
+		for (auto& spec : req.specializations)
+			w.PutString(spec);
+	}
+
+	bool ReadRequest(const DekoBuffer& in, CompileRequest& req)
+	{
+		MessageReader r{in};
+		if (r.Get32() != s_requestMagic || r.Get32() != s_protocolVersion)
+			return false;
+
+		uint32_t flags = r.Get32();
+		req.isGlslcBinding = (flags & RequestFlag_GlslcBinding) != 0;
+		req.isPipeline = (flags & RequestFlag_Pipeline) != 0;
+		req.isTgsi = (flags & RequestFlag_Tgsi) != 0;
+		req.inferEarlyFragTests = (flags & RequestFlag_EarlyFragTestsInference) != 0;
+		req.reportEarlyFragTests = (flags & RequestFlag_EarlyFragTestsReport) != 0;
+		req.packHalfFloats = (flags & RequestFlag_HalfFloatPacking) != 0;
+		req.exactCrsSize = (flags & RequestFlag_ExactCrsSize) != 0;
+		req.directIr = (flags & RequestFlag_DirectIr) != 0;
+		req.compareDirectIr = (flags & RequestFlag_CompareDirectIr) != 0;
+		req.optLevel = int(r.Get32());
+		req.outputMask = r.Get32();
+
+		uint32_t count = r.Get32();
+		if (!count || (!req.isPipeline && count != 1) || (req.isPipeline && (req.isTgsi || count > pipeline_stage_compute + 1)))
+			return false;
+		req.sources.resize(count);
+		req.stages.resize(count);
+		for (uint32_t i = 0; r.IsOk() && i < count; i ++)
+		{
+			uint32_t stage = r.Get32();
+			if (stage > pipeline_stage_compute)
+				return false;
+			req.stages[i] = pipeline_stage(stage);
+			r.GetBuffer(req.sources[i]);
+		}
+		uint32_t numDefines = r.Get32();
+		for (uint32_t i = 0; r.IsOk() && i < numDefines; i ++)
+		{
+			req.defines.emplace_back();
+			r.GetBuffer(req.defines.back());
+		}
+		uint32_t numSpecializations = r.Get32();
+		for (uint32_t i = 0; r.IsOk() && i < numSpecializations; i ++)
+		{
+			req.specializations.emplace_back();
+			r.GetBuffer(req.specializations.back());
+		}
+		return r.IsOk() && r.IsAtEnd();
+	}
+
+	void WriteResponse(DekoBuffer& out, const CompileResponse& resp)
+	{
+		MessageWriter w{out};
+		w.Put32(s_responseMagic);
+		w.Put32(s_protocolVersion);
+		w.Put32(resp.succeeded);
+
+		w.Put32(resp.messages.size());
+		for (auto& msg : resp.messages)
+		{
+			w.Put32(msg.severity);
+			w.Put32(msg.source);
+			w.Put32(msg.line);
+			w.Put32(msg.column);
+			w.PutString(msg.text);
+		}
+
+		w.Put32(resp.results.size());
+		for (auto& result : resp.results)
+		{
+			w.PutBytes(&result.program.hdr, sizeof(result.program.hdr));
+			w.PutBytes(&result.stats, sizeof(result.stats));
+			w.PutBuffer(result.program.code);
+			w.PutBuffer(result.program.data);
+			for (auto& output : result.outputs)
+				w.PutBuffer(output);
+		}
+	}
+
+	bool ReadResponse(const DekoBuffer& in, CompileResponse& resp)
+	{
+		MessageReader r{in};
+		if (r.Get32() != s_responseMagic || r.Get32() != s_protocolVersion)
+			return false;
+		resp.succeeded = r.Get32() != 0;
+
+		uint32_t numMessages = r.Get32();
+		for (uint32_t i = 0; r.IsOk() && i < numMessages; i ++)
+		{
+			diag_message msg;
+			uint32_t severity = r.Get32();
+			msg.severity = severity <= diag_severity_note ? diag_severity(severity) : diag_severity_error;
+			msg.source = int(r.Get32());
+			msg.line = int(r.Get32());
+			msg.column = int(r.Get32());
+			r.GetBuffer(msg.text);
+			resp.messages.push_back(std::move(msg));
+		}
+
+		uint32_t numResults = r.Get32();
+		for (uint32_t i = 0; r.IsOk() && i < numResults; i ++)
+		{
+			resp.results.emplace_back();
+			CompileResult& result = resp.results.back();
+			if (const uint8_t* hdr = r.GetBytes(sizeof(result.program.hdr)))
+				memcpy(&result.program.hdr, hdr, sizeof(result.program.hdr));
+			if (const uint8_t* stats = r.GetBytes(sizeof(result.stats)))
+				memcpy(&result.stats, stats, sizeof(result.stats));
+			r.GetBuffer(result.program.code);
+			r.GetBuffer(result.program.data);
+			for (auto& output : result.outputs)
+				r.GetBuffer(output);
+		}
+		return r.IsOk() && r.IsAtEnd();
+	}
+
+	bool MakeSocketAddress(const char* socketPath, sockaddr_un& addr)
+	{
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(socketPath) >= sizeof(addr.sun_path))
+		{
+			fprintf(stderr, "Compile server socket path is too long: %s\n", socketPath);
+			return false;
+		}
+		strcpy(addr.sun_path, socketPath);
+		return true;
+	}
+
+	int ConnectToServer(const sockaddr_un& addr)
+	{
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+		{
+			int err = errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		return fd;
+	}
+
+	volatile sig_atomic_t s_quitRequested;
+
+	// Connections being served, each one by a detached thread
+	std::mutex s_activeLock;
+	std::condition_variable s_activeIdle;
+	unsigned s_numActive;
+
+	void OnQuitSignal(int)
+	{
+		s_quitRequested = 1;
+	}
+
+	void ServeConnection(int fd, DekoShaderCache* cache)
+	{
+		DekoBuffer msg;
+		if (ReceiveMessage(fd, msg))
+		{
+			CompileRequest req;
+			CompileResponse resp;
+			if (ReadRequest(msg, req))
+			{
+				diag_set_list(&resp.messages);
+				RunCompileRequest(req, resp, cache);
+				diag_set_list(nullptr);
+			}
+			else
+				resp.messages.push_back({ diag_severity_error, -1, -1, -1, "malformed compile request (is the client a different version of uam?)" });
+
+			msg.clear();
+			WriteResponse(msg, resp);
+			SendMessage(fd, msg);
+		}
+		close(fd);
+	}
+}
+
+bool RunCompileServer(const char* socketPath, DekoShaderCache* cache)
+{
+	sockaddr_un addr;
+	if (!MakeSocketAddress(socketPath, addr))
+		return false;
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0)
+	{
+		fprintf(stderr, "Could not create compile server socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	int ret = bind(listenFd, (const sockaddr*)&addr, sizeof(addr));
+	if (ret < 0 && errno == EADDRINUSE)
+	{
+		// Take over the socket file if it was left behind by a server that is gone
+		int fd = ConnectToServer(addr);
+		if (fd >= 0)
+		{
+			close(fd);
+			close(listenFd);
+			fprintf(stderr, "A compile server is already listening on %s\n", socketPath);
+			return false;
+		}
+		unlink(socketPath);
+		ret = bind(listenFd, (const sockaddr*)&addr, sizeof(addr));
+	}
+	if (ret < 0 || listen(listenFd, SOMAXCONN) < 0)
+	{
+		fprintf(stderr, "Could not listen on %s: %s\n", socketPath, strerror(errno));
+		close(listenFd);
+		return false;
+	}
+
+	// No SA_RESTART, so that accept gets interrupted
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = OnQuitSignal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("Compile server listening on %s\n", socketPath);
+	fflush(stdout);
+
+	while (!s_quitRequested)
+	{
+		int fd = accept(listenFd, nullptr, nullptr);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "Compile server stopped: %s\n", strerror(errno));
+			break;
+		}
+
+		std::lock_guard<std::mutex> guard(s_activeLock);
+		s_numActive++;
+		std::thread([fd, cache]()
+		{
+			ServeConnection(fd, cache);
+			std::lock_guard<std::mutex> guard(s_activeLock);
+			if (!--s_numActive)
+				s_activeIdle.notify_all();
+		}).detach();
+	}
+
+	close(listenFd);
+	unlink(socketPath);
+
+	// Let the requests in flight complete, since they may be using the cache
+	std::unique_lock<std::mutex> guard(s_activeLock);
+	s_activeIdle.wait(guard, []() { return s_numActive == 0; });
+	return true;
+}
+
+bool SendCompileRequest(const char* socketPath, const CompileRequest& req, CompileResponse& resp)
+{
+	sockaddr_un addr;
+	if (!MakeSocketAddress(socketPath, addr))
+		return false;
+
+	int fd = ConnectToServer(addr);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Could not connect to compile server at %s: %s\n", socketPath, strerror(errno));
+		return false;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	DekoBuffer msg;
+	WriteRequest(msg, req);
+	bool rc = SendMessage(fd, msg) && ReceiveMessage(fd, msg);
+	close(fd);
+
+	if (!rc || !ReadResponse(msg, resp))
+	{
+		fprintf(stderr, "Invalid response from compile server at %s\n", socketPath);
+		return false;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "compiler_iface.h"
+#include "uam.h"
+
+// A compilation, as performed either locally or by a compile server (see --server).
+// Unless compiling a pipeline, there must be exactly one source.
+struct CompileRequest
+{
+	std::vector<std::string> sources;
+	std::vector<pipeline_stage> stages;
+	std::vector<std::string> defines; // NAME[=VALUE] macros to predefine
+	std::vector<std::string> specializations; // NAME=VALUE uniforms to replace by constants
+	unsigned outputMask = 0; // Output images to produce, as a bitmask of (1 << uam_output)
+	int optLevel = 3;
+	bool isGlslcBinding = false;
+	bool isPipeline = false;
+	bool isTgsi = false;     // The source contains TGSI code instead of GLSL
+	bool inferEarlyFragTests = false;
+	bool reportEarlyFragTests = false;
+	bool packHalfFloats = false;
+	bool exactCrsSize = false;
+	bool directIr = false;
+	bool compareDirectIr = false; // Also compile with the other directIr setting and report the differences
+};
+
+struct CompileResult
+{
+	DkshProgram program;
+	DekoBuffer outputs[UAM_OUTPUT_COUNT];
+	shader_stats stats;
+};
+
+struct CompileResponse
+{
+	bool succeeded = false;
+	diag_list messages;                // Only filled in for remote compilations
+	std::vector<CompileResult> results; // One per source, if compilation succeeded
+};
+
+// Compiles in this process. Diagnostics go wherever diag_set_list directs them.
+void RunCompileRequest(const CompileRequest& req, CompileResponse& resp, DekoShaderCache* cache);
+
+// Listens on a local socket and compiles the requests sent by clients, each one in a
+// separate thread, until interrupted (SIGINT/SIGTERM). The frontend should be kept
+// initialized by the caller for the lifetime of the server.
+bool RunCompileServer(const char* socketPath, DekoShaderCache* cache);
+
+// Has the server listening on the specified socket compile the request.
+// Returns false (after printing why) if the server could not be reached.
+bool SendCompileRequest(const char* socketPath, const CompileRequest& req, CompileResponse& resp);
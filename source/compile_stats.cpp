@@ -0,0 +1,163 @@
+#include <string.h>
+#include <chrono>
+#include <string>
+
+#include "compile_stats.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace
+{
+	thread_local compile_stats* s_stats;
+
+	double GetTimeMs()
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	int64_t GetHeapUsage()
+	{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+		struct mallinfo2 mi = mallinfo2();
+		return int64_t(mi.uordblks + mi.hblkhd);
+#elif defined(__GLIBC__)
+		struct mallinfo mi = mallinfo();
+		return int64_t(unsigned(mi.uordblks)) + int64_t(unsigned(mi.hblkhd));
+#else
+		return -1;
+#endif
+	}
+
+	// Updates the peak usage of all the phases in progress
+	int64_t SampleHeap(compile_stats& stats)
+	{
+		int64_t mem = GetHeapUsage();
+		for (auto& fr : stats.stack)
+			if (mem > fr.peak_mem)
+				fr.peak_mem = mem;
+		return mem;
+	}
+
+	int FindPhase(compile_stats& stats, int parent, const char* name)
+	{
+		auto matches = [&](int i) { return stats.phases[i].name == name || strcmp(stats.phases[i].name, name) == 0; };
+		if (parent >= 0)
+		{
+			for (int i : stats.phases[parent].children)
+				if (matches(i))
+					return i;
+		}
+		else
+		{
+			for (size_t i = 0; i < stats.phases.size(); i ++)
+				if (stats.phases[i].parent < 0 && matches(int(i)))
+					return int(i);
+		}
+
+		compile_phase phase = {};
+		phase.name = name;
+		phase.parent = parent;
+		phase.peak_mem = -1;
+		stats.phases.push_back(phase);
+		int id = int(stats.phases.size()) - 1;
+		if (parent >= 0)
+			stats.phases[parent].children.push_back(id);
+		return id;
+	}
+
+	std::string GetPhasePath(const compile_stats& stats, int id)
+	{
+		std::string path = stats.phases[id].name;
+		for (int p = stats.phases[id].parent; p >= 0; p = stats.phases[p].parent)
+			path = std::string(stats.phases[p].name) + "/" + path;
+		return path;
+	}
+
+	void PrintPhase(FILE* f, const compile_stats& stats, int id, int depth)
+	{
+		const compile_phase& phase = stats.phases[id];
+		int width = 40 - 2*depth;
+		fprintf(f, "%*s%-*s %10.3f ms %6u", 2*depth, "", width > 0 ? width : 0, phase.name, phase.ms, phase.count);
+		if (phase.peak_mem >= 0)
+			fprintf(f, " %10.1f KiB", phase.peak_mem / 1024.0);
+		fprintf(f, "\n");
+		for (int child : phase.children)
+			PrintPhase(f, stats, child, depth+1);
+	}
+}
+
+void compile_stats_set(compile_stats* stats)
+{
+	s_stats = stats;
+}
+
+void compile_stats_begin(const char* phase)
+{
+	compile_stats* stats = s_stats;
+	if (!stats)
+		return;
+
+	int64_t mem = SampleHeap(*stats);
+	compile_stats::frame fr;
+	fr.phase = FindPhase(*stats, stats->stack.empty() ? -1 : stats->stack.back().phase, phase);
+	fr.start_mem = fr.peak_mem = mem;
+	fr.start = GetTimeMs();
+	stats->stack.push_back(fr);
+}
+
+void compile_stats_end(void)
+{
+	compile_stats* stats = s_stats;
+	if (!stats || stats->stack.empty())
+		return;
+
+	double end = GetTimeMs();
+	SampleHeap(*stats);
+	compile_stats::frame fr = stats->stack.back();
+	stats->stack.pop_back();
+
+	compile_phase& phase = stats->phases[fr.phase];
+	phase.count ++;
+	phase.ms += end - fr.start;
+	if (fr.start_mem >= 0 && fr.peak_mem - fr.start_mem > phase.peak_mem)
+		phase.peak_mem = fr.peak_mem - fr.start_mem;
+}
+
+void compile_stats_print(FILE* f, const compile_stats& stats)
+{
+	fprintf(f, "%-40s %13s %6s %14s\n", "Phase", "Time", "Count", "Peak memory");
+	for (size_t i = 0; i < stats.phases.size(); i ++)
+		if (stats.phases[i].parent < 0)
+			PrintPhase(f, stats, int(i), 0);
+}
+
+void compile_stats_write_json_string(FILE* f, const char* str)
+{
+	fputc('"', f);
+	for (; *str; str ++)
+	{
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+void compile_stats_write_json(FILE* f, const compile_stats& stats, int indent)
+{
+	fprintf(f, "[");
+	for (size_t i = 0; i < stats.phases.size(); i ++)
+	{
+		const compile_phase& phase = stats.phases[i];
+		fprintf(f, "%s\n%*s{ \"path\": ", i ? "," : "", indent+2, "");
+		compile_stats_write_json_string(f, GetPhasePath(stats, int(i)).c_str());
+		fprintf(f, ", \"count\": %u, \"ms\": %.4f, \"peak_mem\": %lld }", phase.count, phase.ms, (long long)phase.peak_mem);
+	}
+	fprintf(f, "\n%*s]", indent, "");
+}
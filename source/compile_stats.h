@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "util/u_compile_stats.h"
+
+// Statistics of a compilation phase, merged over all the times it ran inside the same parent phase
+struct compile_phase
+{
+	const char* name;
+	int parent;             // index of the parent phase, -1 for top level phases
+	unsigned count;         // number of times the phase ran
+	double ms;              // total wall time
+	int64_t peak_mem;       // peak heap usage above the usage at the start of the phase, -1 if unknown
+	std::vector<int> children;
+};
+
+// Per-phase compile time and memory statistics, recorded for a thread while installed with
+// compile_stats_set. Heap usage is sampled at phase boundaries, from the allocator of the
+// main thread; it is only meaningful when a single compilation runs at a time.
+struct compile_stats
+{
+	struct frame
+	{
+		int phase;
+		double start;
+		int64_t start_mem, peak_mem;
+	};
+
+	std::vector<compile_phase> phases; // parents always come before their children
+	std::vector<frame> stack;
+};
+
+void compile_stats_set(compile_stats* stats);
+
+// Human readable report, with phases indented under their parents
+void compile_stats_print(FILE* f, const compile_stats& stats);
+
+// Writes the phases as a JSON array of objects with the path of the phase (its name, prefixed
+// by the names of its parents separated by '/'), count, ms and peak_mem
+void compile_stats_write_json(FILE* f, const compile_stats& stats, int indent);
+void compile_stats_write_json_string(FILE* f, const char* str);
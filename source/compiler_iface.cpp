@@ -1,30 +1,244 @@
 #include "compiler_iface.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <link.h>
+#else
+#include <dlfcn.h>
+#endif
+
 namespace
 {
 	constexpr unsigned s_shaderStartOffset = 0x80 - sizeof(NvShaderHeader);
 
+	// Call-return stack geometry. Each SSY/PBK/PCNT/PRET/CAL token takes up one
+	// entry per warp; the first few entries live on-chip. Compute shaders keep
+	// backing storage for every entry in use; other stages only get it past the
+	// on-chip part. The entry size and on-chip depth are estimates which haven't
+	// been measured on hardware, so they are only used when the exact size is
+	// requested: otherwise compute shaders get the 2KB nouveau reserves, and
+	// other stages none.
+	constexpr unsigned s_crsEntrySize = 16;
+	constexpr unsigned s_crsOnChipEntries = 16;
+	constexpr unsigned s_crsComputeDefaultSize = 0x800;
+
 	template <typename T>
 	constexpr T Align256(T x)
 	{
 		return (x + 0xFF) &~ 0xFF;
 	}
 
-	void FileWritePadding(FILE* f, uint32_t req, uint32_t dummy = 0)
+	template <typename T>
+	constexpr T Align512(T x)
+	{
+		return (x + 0x1FF) &~ 0x1FF;
+	}
+
+	void BufWrite(DekoBuffer& buf, const void* data, size_t size)
+	{
+		const uint8_t* bytes = (const uint8_t*)data;
+		buf.insert(buf.end(), bytes, bytes + size);
+	}
+
+	void BufWritePadding(DekoBuffer& buf, uint32_t req)
+	{
+		buf.resize(buf.size() + req, 0);
+	}
+
+	void SaveFile(const char* path, const DekoBuffer& buf)
+	{
+		FILE* f = fopen(path, "wb");
+		if (f)
+		{
+			fwrite(buf.data(), 1, buf.size(), f);
+			fclose(f);
+		}
+	}
+
+	// Finds the executable or shared library holding the compiler, along with the
+	// build ID computed by the linker when the module has one (GNU build ID note)
+	bool GetCompilerModule(std::string& path, std::vector<uint8_t>& linkerBuildId)
+	{
+#ifdef _WIN32
+		HMODULE module;
+		char buf[MAX_PATH];
+		if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+			(LPCSTR)&GetCompilerModule, &module))
+			return false;
+		DWORD len = GetModuleFileNameA(module, buf, sizeof(buf));
+		if (!len || len >= sizeof(buf))
+			return false;
+		path = buf;
+		return true;
+#elif defined(__linux__)
+		// dladdr would return argv[0] for the executable, which isn't necessarily a usable path
+		struct Search
+		{
+			uintptr_t addr;
+			std::string& path;
+			std::vector<uint8_t>& buildId;
+			bool found;
+		};
+		Search search = { uintptr_t(&GetCompilerModule), path, linkerBuildId, false };
+		dl_iterate_phdr([](dl_phdr_info* info, size_t, void* data) -> int
+		{
+			Search& search = *(Search*)data;
+			for (unsigned i = 0; !search.found && i < info->dlpi_phnum; i ++)
+			{
+				const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+				uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+				search.found = phdr.p_type == PT_LOAD && search.addr >= start && search.addr - start < phdr.p_memsz;
+			}
+			if (!search.found)
+				return 0;
+
+			search.path = *info->dlpi_name ? info->dlpi_name : "/proc/self/exe";
+			for (unsigned i = 0; i < info->dlpi_phnum; i ++)
+			{
+				const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+				if (phdr.p_type != PT_NOTE)
+					continue;
+				const uint8_t* note = (const uint8_t*)(info->dlpi_addr + phdr.p_vaddr);
+				const uint8_t* end = note + phdr.p_memsz;
+				while (note + sizeof(ElfW(Nhdr)) <= end)
+				{
+					const ElfW(Nhdr)* nhdr = (const ElfW(Nhdr)*)note;
+					const uint8_t* name = note + sizeof(ElfW(Nhdr));
+					const uint8_t* desc = name + ((nhdr->n_namesz + 3) &~ 3);
+					if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0 && desc + nhdr->n_descsz <= end)
+					{
+						search.buildId.assign(desc, desc + nhdr->n_descsz);
+						return 1;
+					}
+					note = desc + ((nhdr->n_descsz + 3) &~ 3);
+				}
+			}
+			return 1;
+		}, &search);
+		return search.found;
+#else
+		Dl_info info;
+		if (!dladdr((void*)&GetCompilerModule, &info) || !info.dli_fname || !*info.dli_fname)
+			return false;
+		path = info.dli_fname;
+		return true;
+#endif
+	}
+
+	// Identifies the compiler build, so that cache entries produced by any other build
+	// are never used, whichever part of the compiler (frontend, code generator...) was
+	// rebuilt: this is the linker's build ID, or else a hash of the whole module. If
+	// the module can't be read, the build time of this file is used instead.
+	const uint8_t* GetBuildId()
+	{
+		static uint8_t s_buildId[SHA1_DIGEST_LENGTH];
+		static bool s_init = []()
+		{
+			sha1_ctx ctx;
+			sha1_init(&ctx);
+			sha1_update(&ctx, PACKAGE_STRING, sizeof(PACKAGE_STRING));
+
+			std::string path;
+			std::vector<uint8_t> buf;
+			FILE* f = nullptr;
+			if (GetCompilerModule(path, buf) && buf.empty())
+				f = fopen(path.c_str(), "rb");
+			if (!buf.empty())
+				sha1_update(&ctx, buf.data(), buf.size());
+			else if (f)
+			{
+				buf.resize(0x10000);
+				size_t size;
+				while ((size = fread(buf.data(), 1, buf.size(), f)) > 0)
+					sha1_update(&ctx, buf.data(), size);
+				fclose(f);
+			}
+			else
+			{
+				static const char s_buildTime[] = __DATE__ " " __TIME__;
+				sha1_update(&ctx, s_buildTime, sizeof(s_buildTime));
+			}
+			sha1_final(&ctx, s_buildId);
+			return true;
+		}();
+		(void)s_init;
+		return s_buildId;
+	}
+
+	// Bump this whenever the layout or the meaning of cached data changes
+	constexpr uint32_t s_cacheEntryVersion = 5;
+
+	// Compiled program as stored in the shader cache, followed by code and constbuf data
+	struct CacheEntryHeader
+	{
+		uint32_t version;
+		uint32_t code_sz;
+		uint32_t data_sz;
+		uint32_t num_colour_results;
+		uint8_t writes_depth;
+		uint8_t fp64_rcprsq;
+		uint8_t int_divmod;
+		uint8_t early_frag_tests_blockers;
+		uint8_t early_frag_tests_inferred;
+		DkshProgramHeader dkph;
+		NvShaderHeader nvsh;
+		nv50_ir_code_stats code_stats;
+	};
+
+	// Bump this whenever the layout or the meaning of cached frontend output changes
+	constexpr uint32_t s_frontendEntryVersion = 2;
+
+	// Frontend output as stored in the shader cache, followed by TGSI tokens and constbuf data
+	struct FrontendEntryHeader
 	{
-		while (req >= sizeof(dummy))
+		uint32_t version;
+		uint32_t num_tokens;
+		uint32_t data_sz;
+		uint32_t shared_sz;
+		int8_t vtx_in_locations[PIPE_MAX_ATTRIBS];
+	};
+
+	// Parses a "uam <name> <values...>" comment found at the beginning of TGSI code in
+	// text form; these carry the frontend output that isn't part of TGSI (see WriteTgsi)
+	bool ParseTgsiComment(const std::string& line, std::string& name, std::vector<uint32_t>& values)
+	{
+		char buf[32];
+		int pos = 0;
+		if (sscanf(line.c_str(), " uam %31s %n", buf, &pos) != 1)
+			return false;
+
+		name = buf;
+		values.clear();
+		const char* p = line.c_str() + pos;
+		for (;;)
 		{
-			fwrite(&dummy, 1, sizeof(dummy), f);
-			req -= sizeof(dummy);
+			char* end;
+			unsigned long value = strtoul(p, &end, 0);
+			if (end == p)
+				break;
+			values.push_back(uint32_t(value));
+			p = end;
 		}
-		if (req)
-			fwrite(&dummy, 1, req, f);
+		return true;
 	}
 
-	void FileAlign256(FILE* f)
+	// Skips whitespace and the comments preceding TGSI code in text form
+	const char* SkipTgsiComments(const char* tgsi, std::vector<std::string>* comments = nullptr)
 	{
-		long pos = ftell(f);
-		FileWritePadding(f, Align256(pos) - pos);
+		for (;;)
+		{
+			tgsi += strspn(tgsi, " \t\r\n");
+			if (*tgsi != '#')
+				return tgsi;
+
+			const char* end = tgsi + strcspn(tgsi, "\n");
+			if (comments)
+				comments->emplace_back(tgsi + 1, end);
+			tgsi = end;
+		}
 	}
 }
 
@@ -92,7 +306,7 @@ nvc0_vp_assign_input_slots(struct nv50_ir_prog_info *info)
 {
 	unsigned i, c;
 
-	int8_t const* in_locations = glsl_program_vertex_get_in_locations((glsl_program)info->driverPriv);
+	int8_t const* in_locations = (int8_t const*)info->driverPriv;
 
 	for (i = 0; i < info->numInputs; ++i) {
 		switch (info->in[i].sn) {
@@ -201,8 +415,9 @@ nvc0_program_assign_varying_slots(struct nv50_ir_prog_info *info)
 }
 
 DekoCompiler::DekoCompiler(pipeline_stage stage, int optLevel, bool isGlslcBinding) :
-	m_stage{stage}, m_glsl{}, m_tgsi{}, m_tgsiNumTokens{}, m_info{}, m_code{}, m_codeSize{},
-	m_data{}, m_dataSize{}, m_isGlslcBinding{isGlslcBinding}, m_nvsh{}, m_dkph{}
+	m_stage{stage}, m_glsl{}, m_tgsi{}, m_tgsiNumTokens{}, m_glslIr{}, m_info{}, m_code{}, m_codeSize{},
+	m_data{}, m_dataSize{}, m_isGlslcBinding{isGlslcBinding}, m_ownsGlsl{}, m_cache{}, m_cacheBinary{true}, m_cachedData{}, m_defines{}, m_specializations{},
+	m_inferEarlyFragTests{}, m_reportEarlyFragTests{}, m_earlyFragTestsBlockers{}, m_earlyFragTestsInferred{}, m_exactCrsSize{}, m_directIr{}, m_vtxInLocations{}, m_sharedSize{}, m_nvsh{}, m_dkph{}
 {
 	m_nvsh.version = 3;
 	m_nvsh.sass_version = 3;
@@ -279,47 +494,379 @@ DekoCompiler::DekoCompiler(pipeline_stage stage, int optLevel, bool isGlslcBindi
 	m_info.assignSlots = nvc0_program_assign_varying_slots;
 
 	glsl_frontend_init();
-
-	// Sorry, I'm lazy
-	// ubo binding offset + 1
-	set_is_glslc_binding(isGlslcBinding);
 }
 
 DekoCompiler::~DekoCompiler()
 {
-	if (m_glsl)
+	if (m_glsl && m_ownsGlsl)
 		glsl_program_free(m_glsl);
 
+	// Release the buffers allocated by nv50_ir_generate_code
+	free(m_info.bin.code);
+	free(m_info.bin.relocData);
+	free(m_info.bin.fixupData);
+	free(m_info.bin.syms);
+	free(m_cachedData);
+
 	glsl_frontend_exit();
 }
 
 bool DekoCompiler::CompileGlsl(const char* glsl)
 {
-	m_glsl = glsl_program_create(glsl, m_stage);
-	if (!m_glsl) return false;
+	DekoShaderCache::Key key, frontendKey;
+	bool useCache = m_cache && ComputeCacheKeys(glsl, key, frontendKey);
+	if (useCache && m_cacheBinary && LoadFromCache(key))
+	{
+		ReportWarnings();
+		ReportEarlyFragTests();
+		return true;
+	}
+
+	if (!useCache || !LoadFrontendFromCache(frontendKey))
+	{
+		compile_stats_begin("frontend");
+		m_glsl = glsl_program_create(glsl, m_stage, m_isGlslcBinding, m_directIr, m_defines, m_specializations);
+		compile_stats_end();
+		if (!m_glsl) return false;
+		m_ownsGlsl = true;
+
+		LoadFrontendOutput();
+		if (useCache)
+			StoreFrontendToCache(frontendKey);
+	}
+
+	if (!GenerateCode())
+		return false;
+
+	if (useCache && m_cacheBinary)
+		StoreToCache(key);
+	return true;
+}
+
+bool DekoCompiler::CompileLinkedGlsl(glsl_program prg)
+{
+	m_glsl = prg;
+	m_ownsGlsl = false;
+	LoadFrontendOutput();
+	return GenerateCode();
+}
+
+bool DekoCompiler::CompileTgsi(const char* tgsi)
+{
+	// Inputs of vertex shaders use the location matching their index, unless specified otherwise
+	for (unsigned i = 0; i < PIPE_MAX_ATTRIBS; i ++)
+		m_vtxInLocations[i] = i;
 
-	m_tgsi = glsl_program_get_tokens(m_glsl, m_tgsiNumTokens);
-	m_info.bin.source = m_tgsi;
-	m_info.bin.smemSize = glsl_program_compute_get_shared_size(m_glsl); // Total size of glsl shared variables. (translation process doesn't actually need this, but for the sake of consistency with nouveau, we keep this value here too)
-	m_info.driverPriv = m_glsl;
+	std::vector<std::string> comments;
+	tgsi = SkipTgsiComments(tgsi, &comments);
+	for (auto& comment : comments)
+	{
+		std::string name;
+		std::vector<uint32_t> values;
+		if (!ParseTgsiComment(comment, name, values))
+			continue;
+
+		if (name == "vtx_in_locations")
+		{
+			for (size_t i = 0; i < values.size() && i < PIPE_MAX_ATTRIBS; i ++)
+				m_vtxInLocations[i] = int8_t(values[i]);
+		}
+		else if (name == "shared_size" && !values.empty())
+			m_sharedSize = values[0];
+		else if (name == "constbuf")
+		{
+			size_t pos = m_ownedData.size();
+			m_ownedData.resize(pos + 4*values.size());
+			memcpy(&m_ownedData[pos], values.data(), 4*values.size());
+		}
+	}
+
+	// The token count is unknown until the code is parsed, so retry with larger buffers
+	bool parsed = false;
+	m_ownedTgsi.resize(strlen(tgsi) + 0x100);
+	for (unsigned i = 0; i < 4 && !parsed; i ++)
+	{
+		if (i)
+			m_ownedTgsi.resize(2*m_ownedTgsi.size());
+		parsed = tgsi_text_translate(tgsi, m_ownedTgsi.data(), m_ownedTgsi.size());
+	}
+	if (!parsed)
+	{
+		diag_report(diag_severity_error, "failed to parse TGSI code");
+		return false;
+	}
+	if (tgsi_get_processor_type(m_ownedTgsi.data()) != m_info.type)
+	{
+		diag_report(diag_severity_error, "TGSI code is for a different pipeline stage");
+		return false;
+	}
+
+	m_ownedTgsi.resize(tgsi_num_tokens(m_ownedTgsi.data()));
+	m_tgsi = m_ownedTgsi.data();
+	m_tgsiNumTokens = m_ownedTgsi.size();
+	m_data = m_ownedData.empty() ? nullptr : m_ownedData.data();
+	m_dataSize = m_ownedData.size();
+	return GenerateCode();
+}
+
+bool DekoCompiler::GetTgsiStage(const char* tgsi, pipeline_stage& stage)
+{
+	static const struct { const char* name; pipeline_stage stage; } s_processors[] =
+	{
+		{ "VERT",      pipeline_stage_vertex },
+		{ "TESS_CTRL", pipeline_stage_tess_ctrl },
+		{ "TESS_EVAL", pipeline_stage_tess_eval },
+		{ "GEOM",      pipeline_stage_geometry },
+		{ "FRAG",      pipeline_stage_fragment },
+		{ "COMP",      pipeline_stage_compute },
+	};
+
+	tgsi = SkipTgsiComments(tgsi);
+	size_t len = strcspn(tgsi, " \t\r\n");
+	for (auto& proc : s_processors)
+	{
+		if (len == strlen(proc.name) && strncmp(tgsi, proc.name, len) == 0)
+		{
+			stage = proc.stage;
+			return true;
+		}
+	}
+	return false;
+}
+
+void DekoCompiler::LoadFrontendOutput()
+{
+	m_tgsi = glsl_program_get_tokens(m_glsl, m_stage, m_tgsiNumTokens);
+	m_glslIr = glsl_program_get_direct_ir(m_glsl, m_stage);
+	m_data = glsl_program_get_constant_buffer(m_glsl, m_stage, m_dataSize);
+	m_sharedSize = glsl_program_compute_get_shared_size(m_glsl);
+
+	int8_t const* in_locations = glsl_program_vertex_get_in_locations(m_glsl);
+	if (in_locations)
+		memcpy(m_vtxInLocations, in_locations, sizeof(m_vtxInLocations));
+	else
+		memset(m_vtxInLocations, -1, sizeof(m_vtxInLocations));
+}
+
+bool DekoCompiler::GenerateCode()
+{
+	if (m_glslIr)
+	{
+		m_info.bin.sourceRep = PIPE_SHADER_IR_GLSL;
+		m_info.bin.source = m_glslIr;
+	}
+	else
+	{
+		m_info.bin.sourceRep = PIPE_SHADER_IR_TGSI;
+		m_info.bin.source = m_tgsi;
+	}
+	m_info.bin.smemSize = m_sharedSize; // Total size of glsl shared variables. (translation process doesn't actually need this, but for the sake of consistency with nouveau, we keep this value here too)
+	m_info.driverPriv = m_vtxInLocations;
+	compile_stats_begin("codegen");
 	int ret = nv50_ir_generate_code(&m_info);
+	compile_stats_end();
 	if (ret < 0)
 	{
-		fprintf(stderr, "Error compiling program: %d\n", ret);
+		diag_report(diag_severity_error, "Error compiling program: %d", ret);
 		return false;
 	}
 
-	if (m_info.io.fp64_rcprsq)
-		fprintf(stderr, "warning: program uses 64-bit floating point reciprocal/square root, for which only a rough approximation with 20 bits of mantissa is supported by hardware\n");
-	if (m_info.io.int_divmod)
-		fprintf(stderr, "warning: program uses non-constant integer division/modulo, which is unsupported by hardware; floating point emulation with resulting loss of precision has been applied\n");
+	ReportWarnings();
 
-	m_data = glsl_program_get_constant_buffer(m_glsl, m_dataSize);
 	RetrieveAndPadCode();
 	GenerateHeaders();
+	ReportEarlyFragTests();
+	return true;
+}
+
+void DekoCompiler::ReportWarnings() const
+{
+	if (m_info.io.fp64_rcprsq)
+		diag_report(diag_severity_warning, "program uses 64-bit floating point reciprocal/square root, for which only a rough approximation with 20 bits of mantissa is supported by hardware");
+	if (m_info.io.int_divmod)
+		diag_report(diag_severity_warning, "program uses non-constant 64-bit integer division/modulo, which is unsupported by hardware; floating point emulation with resulting loss of precision has been applied");
+}
+
+void DekoCompiler::ReportEarlyFragTests() const
+{
+	if (!m_reportEarlyFragTests || m_stage != pipeline_stage_fragment)
+		return;
+
+	if (m_dkph.frag.early_fragment_tests)
+	{
+		if (m_earlyFragTestsInferred)
+			diag_report(diag_severity_note, "early fragment tests enabled (inferred, incorrect if drawn with alpha test or alpha to coverage)");
+		else
+			diag_report(diag_severity_note, "early fragment tests enabled");
+		return;
+	}
+
+	static const char* const s_reasons[] =
+	{
+		"discards fragments",
+		"writes gl_FragDepth",
+		"writes gl_SampleMask",
+		"stores to buffers or images",
+	};
+
+	std::string reasons;
+	for (unsigned i = 0; i < sizeof(s_reasons)/sizeof(s_reasons[0]); i ++)
+	{
+		if (m_earlyFragTestsBlockers & (1U << i))
+		{
+			reasons += reasons.empty() ? "program " : ", ";
+			reasons += s_reasons[i];
+		}
+	}
+	if (reasons.empty())
+		reasons = "inference disabled (it would be safe unless drawn with alpha test or alpha to coverage)";
+	diag_report(diag_severity_note, "early fragment tests not enabled: %s", reasons.c_str());
+}
+
+bool DekoCompiler::ComputeCacheKeys(const char* glsl, DekoShaderCache::Key& key, DekoShaderCache::Key& frontendKey) const
+{
+	std::string source;
+	if (!glsl_preprocess(glsl, m_stage, m_defines, source))
+		return false; // Let the actual compilation report the errors
+
+	// Any change to the compiler binary may change the generated code, so it is part of the key
+	const uint8_t* buildId = GetBuildId();
+	auto computeKey = [&](const void* params, size_t paramsSize, DekoShaderCache::Key& out)
+	{
+		sha1_ctx ctx;
+		sha1_init(&ctx);
+		sha1_update(&ctx, buildId, SHA1_DIGEST_LENGTH);
+		sha1_update(&ctx, params, paramsSize);
+		sha1_update(&ctx, source.data(), source.size());
+		// Specialized uniforms aren't reflected by the preprocessed source
+		if (m_specializations)
+			for (auto* spec = m_specializations; *spec; spec ++)
+				sha1_update(&ctx, *spec, strlen(*spec) + 1);
+		sha1_final(&ctx, out.hash);
+	};
+
+	const uint32_t params[] = { s_cacheEntryVersion, uint32_t(m_stage), uint32_t(m_info.optLevel), m_isGlslcBinding, m_inferEarlyFragTests, m_info.io.packHalfFloats, m_exactCrsSize, m_directIr };
+	computeKey(params, sizeof(params), key);
+
+	// The frontend output doesn't depend on the backend options
+	static const char s_frontendTag[] = "tgsi";
+	const uint32_t frontendParams[] = { s_frontendEntryVersion, uint32_t(m_stage), m_isGlslcBinding, m_directIr };
+	uint8_t frontendBuf[sizeof(s_frontendTag) + sizeof(frontendParams)];
+	memcpy(frontendBuf, s_frontendTag, sizeof(s_frontendTag));
+	memcpy(frontendBuf + sizeof(s_frontendTag), frontendParams, sizeof(frontendParams));
+	computeKey(frontendBuf, sizeof(frontendBuf), frontendKey);
+	return true;
+}
+
+bool DekoCompiler::LoadFromCache(const DekoShaderCache::Key& key)
+{
+	std::vector<uint8_t> entry;
+	if (!m_cache->Load(key, entry))
+		return false;
+
+	CacheEntryHeader hdr;
+	if (entry.size() < sizeof(hdr))
+		return false;
+	memcpy(&hdr, entry.data(), sizeof(hdr));
+	if (hdr.version != s_cacheEntryVersion || entry.size() != sizeof(hdr) + hdr.code_sz + hdr.data_sz)
+		return false;
+
+	m_info.bin.code = (uint32_t*)malloc(hdr.code_sz);
+	m_cachedData = hdr.data_sz ? malloc(hdr.data_sz) : nullptr;
+	memcpy(m_info.bin.code, &entry[sizeof(hdr)], hdr.code_sz);
+	if (hdr.data_sz)
+		memcpy(m_cachedData, &entry[sizeof(hdr) + hdr.code_sz], hdr.data_sz);
+
+	m_code = m_info.bin.code;
+	m_codeSize = hdr.code_sz;
+	m_data = m_cachedData;
+	m_dataSize = hdr.data_sz;
+	m_dkph = hdr.dkph;
+	m_nvsh = hdr.nvsh;
+	m_info.prop.fp.numColourResults = hdr.num_colour_results;
+	m_earlyFragTestsBlockers = hdr.early_frag_tests_blockers;
+	m_earlyFragTestsInferred = hdr.early_frag_tests_inferred;
+	m_info.prop.fp.writesDepth = hdr.writes_depth;
+	m_info.io.fp64_rcprsq = hdr.fp64_rcprsq;
+	m_info.io.int_divmod = hdr.int_divmod;
+	m_info.bin.stats = hdr.code_stats;
+	return true;
+}
+
+void DekoCompiler::StoreToCache(const DekoShaderCache::Key& key) const
+{
+	CacheEntryHeader hdr = {};
+	hdr.version            = s_cacheEntryVersion;
+	hdr.code_sz            = m_codeSize;
+	hdr.data_sz            = m_dataSize;
+	hdr.num_colour_results = m_info.prop.fp.numColourResults;
+	hdr.writes_depth       = m_info.prop.fp.writesDepth;
+	hdr.fp64_rcprsq        = m_info.io.fp64_rcprsq;
+	hdr.int_divmod         = m_info.io.int_divmod;
+	hdr.early_frag_tests_blockers = m_earlyFragTestsBlockers;
+	hdr.early_frag_tests_inferred = m_earlyFragTestsInferred;
+	hdr.dkph               = m_dkph;
+	hdr.nvsh               = m_nvsh;
+	hdr.code_stats         = m_info.bin.stats;
+
+	std::vector<uint8_t> entry(sizeof(hdr) + m_codeSize + m_dataSize);
+	memcpy(&entry[0], &hdr, sizeof(hdr));
+	memcpy(&entry[sizeof(hdr)], m_code, m_codeSize);
+	if (m_dataSize)
+		memcpy(&entry[sizeof(hdr) + m_codeSize], m_data, m_dataSize);
+
+	m_cache->Store(key, entry.data(), entry.size());
+}
+
+bool DekoCompiler::LoadFrontendFromCache(const DekoShaderCache::Key& key)
+{
+	std::vector<uint8_t> entry;
+	if (!m_cache->Load(key, entry))
+		return false;
+
+	FrontendEntryHeader hdr;
+	if (entry.size() < sizeof(hdr))
+		return false;
+	memcpy(&hdr, entry.data(), sizeof(hdr));
+	size_t tokensSize = hdr.num_tokens * sizeof(tgsi_token);
+	if (hdr.version != s_frontendEntryVersion || !hdr.num_tokens || entry.size() != sizeof(hdr) + tokensSize + hdr.data_sz)
+		return false;
+
+	m_ownedTgsi.resize(hdr.num_tokens);
+	memcpy(m_ownedTgsi.data(), &entry[sizeof(hdr)], tokensSize);
+	m_ownedData.assign(entry.begin() + sizeof(hdr) + tokensSize, entry.end());
+
+	m_tgsi = m_ownedTgsi.data();
+	m_tgsiNumTokens = hdr.num_tokens;
+	m_data = m_ownedData.empty() ? nullptr : m_ownedData.data();
+	m_dataSize = hdr.data_sz;
+	m_sharedSize = hdr.shared_sz;
+	memcpy(m_vtxInLocations, hdr.vtx_in_locations, sizeof(m_vtxInLocations));
 	return true;
 }
 
+void DekoCompiler::StoreFrontendToCache(const DekoShaderCache::Key& key) const
+{
+	if (!m_tgsi)
+		return;
+
+	FrontendEntryHeader hdr = {};
+	hdr.version    = s_frontendEntryVersion;
+	hdr.num_tokens = m_tgsiNumTokens;
+	hdr.data_sz    = m_dataSize;
+	hdr.shared_sz  = m_sharedSize;
+	memcpy(hdr.vtx_in_locations, m_vtxInLocations, sizeof(hdr.vtx_in_locations));
+
+	size_t tokensSize = m_tgsiNumTokens * sizeof(tgsi_token);
+	std::vector<uint8_t> entry(sizeof(hdr) + tokensSize + m_dataSize);
+	memcpy(&entry[0], &hdr, sizeof(hdr));
+	memcpy(&entry[sizeof(hdr)], m_tgsi, tokensSize);
+	if (m_dataSize)
+		memcpy(&entry[sizeof(hdr) + tokensSize], m_data, m_dataSize);
+
+	m_cache->Store(key, entry.data(), entry.size());
+}
+
 void DekoCompiler::RetrieveAndPadCode()
 {
 	uint32_t numInsns = m_info.bin.codeSize/8;
@@ -368,7 +915,14 @@ void DekoCompiler::GenerateHeaders()
 
 	unsigned local_pos_sz = (m_info.bin.tlsSpace + 0xF) &~ 0xF; // 16-byte aligned
 	unsigned local_neg_sz = 0;
-	unsigned crs_sz       = m_stage == pipeline_stage_compute ? 0x800 : 0; // 512-byte aligned; TODO: Proper logic
+	unsigned crs_sz       = m_stage == pipeline_stage_compute ? s_crsComputeDefaultSize : 0;
+	if (m_exactCrsSize)
+	{
+		unsigned crs_entries = m_info.bin.crsDepth;
+		if (m_stage != pipeline_stage_compute)
+			crs_entries = crs_entries > s_crsOnChipEntries ? crs_entries - s_crsOnChipEntries : 0;
+		crs_sz = Align512(crs_entries * s_crsEntrySize); // 512-byte aligned
+	}
 
 	m_dkph.per_warp_scratch_sz = (local_pos_sz + local_neg_sz) * 32 + crs_sz;
 
@@ -451,9 +1005,22 @@ void DekoCompiler::GenerateHeaders()
 			if (m_info.prop.fp.writesDepth)
 				m_nvsh.ps.omap_depth = 1;
 
+			// Early fragment tests, unless the shader depends on late ones
+			//-----------------------------------------------------------------
+			m_earlyFragTestsBlockers = 0;
+			if (m_info.prop.fp.usesDiscard)
+				m_earlyFragTestsBlockers |= EarlyFragTestsBlocker_Discard;
+			if (m_info.prop.fp.writesDepth)
+				m_earlyFragTestsBlockers |= EarlyFragTestsBlocker_WritesDepth;
+			if (m_info.io.sampleMask < PIPE_MAX_SHADER_OUTPUTS)
+				m_earlyFragTestsBlockers |= EarlyFragTestsBlocker_WritesSampleMask;
+			if (m_info.io.globalAccess & 2)
+				m_earlyFragTestsBlockers |= EarlyFragTestsBlocker_StoresMemory;
+			m_earlyFragTestsInferred = !m_info.prop.fp.earlyFragTests && m_inferEarlyFragTests && !m_earlyFragTestsBlockers;
+			m_dkph.frag.early_fragment_tests  = m_info.prop.fp.earlyFragTests || m_earlyFragTestsInferred;
+
 			// Miscellaneous
 			//-----------------------------------------------------------------
-			m_dkph.frag.early_fragment_tests  = m_info.prop.fp.earlyFragTests;
 			m_dkph.frag.post_depth_coverage   = m_info.prop.fp.postDepthCoverage;
 			m_dkph.frag.per_sample_invocation = m_info.prop.fp.persampleInvocation;
 			m_dkph.frag.param_65b             = m_info.prop.fp.hasZcullTestMask ? m_info.prop.fp.zcullTestMask : (m_info.prop.fp.writesDepth ? 0x11 : 0x00);
@@ -626,61 +1193,137 @@ void DekoCompiler::GenerateHeaders()
 	}
 }
 
-void DekoCompiler::OutputDksh(const char* dkshFile)
+void DekoCompiler::GetDkshProgram(DkshProgram& out) const
 {
-	DkshHeader hdr = {};
-	hdr.magic        = DKSH_MAGIC;
-	hdr.header_sz    = sizeof(DkshHeader);
-	hdr.control_sz   = Align256(sizeof(DkshHeader) + sizeof(DkshProgramHeader));
-	hdr.code_sz      = Align256((m_stage != pipeline_stage_compute ? 0x80 : 0x00) + m_codeSize) + Align256(m_dataSize);
-	hdr.programs_off = sizeof(DkshHeader);
-	hdr.num_programs = 1;
+	out.hdr = m_dkph;
+	out.hdr.constbuf1_off = 0;
 
-	FILE* f = fopen(dkshFile, "wb");
-	if (f)
+	out.code.clear();
+	if (m_stage != pipeline_stage_compute)
 	{
-		fwrite(&hdr, 1, sizeof(hdr), f);
-		fwrite(&m_dkph, 1, sizeof(m_dkph), f);
-		FileAlign256(f);
+		static const char s_padding[s_shaderStartOffset] = "lol nvidia why did you make us waste space here";
+		BufWrite(out.code, s_padding, sizeof(s_padding));
+		BufWrite(out.code, &m_nvsh, sizeof(m_nvsh));
+	}
+	BufWrite(out.code, m_code, m_codeSize);
 
-		if (m_stage != pipeline_stage_compute)
-		{
-			static const char s_padding[s_shaderStartOffset] = "lol nvidia why did you make us waste space here";
-			fwrite(s_padding, 1, sizeof(s_padding), f);
-			fwrite(&m_nvsh, 1, sizeof(m_nvsh), f);
-		}
+	out.data.clear();
+	if (m_dataSize)
+		BufWrite(out.data, m_data, m_dataSize);
+}
+
+void DekoCompiler::GetShaderStats(shader_stats& out) const
+{
+	out = {};
+	out.stage = m_stage;
+	out.code = m_info.bin.stats;
+	out.num_gprs = m_dkph.num_gprs;
+	out.scratch_sz = m_dkph.per_warp_scratch_sz;
+	if (m_stage == pipeline_stage_compute)
+	{
+		out.local_mem_sz = m_dkph.comp.local_pos_mem_sz + m_dkph.comp.local_neg_mem_sz;
+		out.crs_sz = m_dkph.comp.crs_sz;
+		out.shared_mem_sz = m_dkph.comp.shared_mem_sz;
+		out.block_threads = m_dkph.comp.block_dims[0] * m_dkph.comp.block_dims[1] * m_dkph.comp.block_dims[2];
+	}
+	else
+	{
+		out.local_mem_sz = m_nvsh.sh_local_mem_lo_sz + m_nvsh.sh_local_mem_hi_sz;
+		out.crs_sz = m_nvsh.sh_local_mem_crs_sz;
+	}
+}
+
+bool DekoCompiler::HeadersMatch(const DekoCompiler& other) const
+{
+	return memcmp(&m_nvsh, &other.m_nvsh, sizeof(m_nvsh)) == 0 && memcmp(&m_dkph, &other.m_dkph, sizeof(m_dkph)) == 0;
+}
+
+bool DekoCompiler::CodeMatches(const DekoCompiler& other) const
+{
+	return m_codeSize == other.m_codeSize && memcmp(m_code, other.m_code, m_codeSize) == 0;
+}
 
-		fwrite(m_code, 1, m_codeSize, f);
-		FileAlign256(f);
+void DekoCompiler::WriteDksh(DekoBuffer& out) const
+{
+	DkshProgram prog;
+	GetDkshProgram(prog);
+
+	DkshModuleBuilder module;
+	module.AddProgram(prog);
+	module.Write(out);
+}
 
-		if (m_dataSize)
+void DekoCompiler::WriteRawCode(DekoBuffer& out) const
+{
+	BufWrite(out, m_code, m_codeSize);
+}
+
+bool DekoCompiler::WriteTgsi(DekoBuffer& out) const
+{
+	if (!m_tgsi)
+		return false;
+
+	// The frontend output that isn't part of TGSI is written as comments understood by CompileTgsi
+	std::string meta;
+	char tmp[16];
+	if (m_stage == pipeline_stage_vertex)
+	{
+		meta += "# uam vtx_in_locations";
+		for (auto location : m_vtxInLocations)
 		{
-			fwrite(m_data, 1, m_dataSize, f);
-			FileAlign256(f);
+			snprintf(tmp, sizeof(tmp), " %d", location);
+			meta += tmp;
 		}
-
-		fclose(f);
+		meta += "\n";
+	}
+	if (m_sharedSize)
+	{
+		snprintf(tmp, sizeof(tmp), "%u", m_sharedSize);
+		meta += std::string("# uam shared_size ") + tmp + "\n";
+	}
+	for (uint32_t i = 0; i < m_dataSize/4; i ++)
+	{
+		uint32_t word;
+		memcpy(&word, (const uint8_t*)m_data + 4*i, 4);
+		snprintf(tmp, sizeof(tmp), " 0x%08x", word);
+		meta += (i % 8) ? tmp : std::string("# uam constbuf") + tmp;
+		if ((i % 8) == 7 || i+1 == m_dataSize/4)
+			meta += "\n";
 	}
+	BufWrite(out, meta.data(), meta.size());
+
+	std::vector<char> str(0x10000);
+	while (!tgsi_dump_str(m_tgsi, TGSI_DUMP_FLOAT_AS_HEX, str.data(), str.size()))
+		str.resize(2*str.size());
+
+	BufWrite(out, str.data(), strlen(str.data()));
+	return true;
+}
+
+void DekoCompiler::OutputDksh(const char* dkshFile)
+{
+	DekoBuffer buf;
+	WriteDksh(buf);
+	SaveFile(dkshFile, buf);
 }
 
 void DekoCompiler::OutputRawCode(const char* rawFile)
 {
-	FILE* f = fopen(rawFile, "wb");
-	if (f)
-	{
-		fwrite(m_code, 1, m_codeSize, f);
-		fclose(f);
-	}
+	DekoBuffer buf;
+	WriteRawCode(buf);
+	SaveFile(rawFile, buf);
 }
 
 void DekoCompiler::OutputTgsi(const char* tgsiFile)
 {
-	FILE* f = fopen(tgsiFile, "w");
-	if (f)
+	DekoBuffer buf;
+	if (!WriteTgsi(buf))
 	{
-		tgsi_dump_to_file(m_tgsi, TGSI_DUMP_FLOAT_AS_HEX, f);
-		fclose(f);
+		fprintf(stderr, "TGSI code is not available for %s\n", tgsiFile);
+		return;
 	}
+
+	SaveFile(tgsiFile, buf);
 }
 
 GPUProgramHeader DekoCompiler::CreateGpuHeader() const 
@@ -748,45 +1391,37 @@ NVNshaderControl DekoCompiler::CreateControlHeader() const
 	return control;
 }
 
-void DekoCompiler::OutputNvnBinary(const char* controlFile, const char* gpuProgramFile)
+void DekoCompiler::WriteNvnControl(DekoBuffer& out) const
+{
+	auto control = CreateControlHeader();
+	BufWrite(out, &control, sizeof(control));
+}
+
+void DekoCompiler::WriteNvnGpuProgram(DekoBuffer& out) const
 {
 	auto control = CreateControlHeader();
 	auto gpuHeader = CreateGpuHeader();
 
-	// Write control section
-	FILE* cf = fopen(controlFile, "wb");
-	if (cf) {
-		fwrite(&control, 1, sizeof(control), cf);
-		fclose(cf);
-	}
-
-	// Write GPU program binary  
-	FILE* gf = fopen(gpuProgramFile, "wb");
-	if (gf) {
-		// Write header
-		fwrite(&gpuHeader, 1, sizeof(gpuHeader), gf);
-		
-		// Write code
-		fwrite(m_code, 1, m_codeSize, gf);
-		
-		// Align to next section
-		FileWritePadding(gf, Align256(0x30 + 0x50 + m_codeSize) - (0x30 + 0x50 + m_codeSize));
-
-		// Write constants if present
-		if (m_dataSize) {
-			fwrite(m_data, 1, m_dataSize, gf);
-			// Align entire file
-			FileWritePadding(gf, Align256(control.mShaderSize) - control.mShaderSize);
-		}
+	// Write header
+	BufWrite(out, &gpuHeader, sizeof(gpuHeader));
 
-		fclose(gf);
+	// Write code
+	BufWrite(out, m_code, m_codeSize);
+
+	// Align to next section
+	BufWritePadding(out, Align256(0x30 + 0x50 + m_codeSize) - (0x30 + 0x50 + m_codeSize));
+
+	// Write constants if present
+	if (m_dataSize) {
+		BufWrite(out, m_data, m_dataSize);
+		// Align entire file
+		BufWritePadding(out, Align256(control.mShaderSize) - control.mShaderSize);
 	}
 }
 
-void DekoCompiler::OutputEpicShader(const char* epicshFile)
+void DekoCompiler::WriteEpicShader(DekoBuffer& out) const
 {
 	auto control = CreateControlHeader();
-	auto gpuHeader = CreateGpuHeader();
 
 	// Calculate total data size (GPU program section)
 	uint64_t dataSize = control.mShaderSize;  // Already includes all padding
@@ -794,31 +1429,76 @@ void DekoCompiler::OutputEpicShader(const char* epicshFile)
 	// Calculate control size
 	uint64_t controlSize = sizeof(control);
 
-	FILE* f = fopen(epicshFile, "wb");
-	if (f) {
-		// Write data size
-		fwrite(&dataSize, 1, sizeof(dataSize), f);
-
-		// Write GPU program data
-		fwrite(&gpuHeader, 1, sizeof(gpuHeader), f);
-		fwrite(m_code, 1, m_codeSize, f);
-		
-		// Align to next section
-		FileWritePadding(f, Align256(0x30 + 0x50 + m_codeSize) - (0x30 + 0x50 + m_codeSize));
-
-		// Write constants if present
-		if (m_dataSize) {
-			fwrite(m_data, 1, m_dataSize, f);
-			// Align entire file
-			FileWritePadding(f, Align256(control.mShaderSize) - control.mShaderSize);
-		}
+	// Write data size
+	BufWrite(out, &dataSize, sizeof(dataSize));
+
+	// Write GPU program data
+	WriteNvnGpuProgram(out);
+
+	// Write control size
+	BufWrite(out, &controlSize, sizeof(controlSize));
+
+	// Write control data
+	BufWrite(out, &control, sizeof(control));
+}
+
+void DekoCompiler::OutputNvnBinary(const char* controlFile, const char* gpuProgramFile)
+{
+	DekoBuffer buf;
 
-		// Write control size
-		fwrite(&controlSize, 1, sizeof(controlSize), f);
+	// Write control section
+	WriteNvnControl(buf);
+	SaveFile(controlFile, buf);
+
+	// Write GPU program binary
+	buf.clear();
+	WriteNvnGpuProgram(buf);
+	SaveFile(gpuProgramFile, buf);
+}
 
-		// Write control data
-		fwrite(&control, 1, sizeof(control), f);
+void DekoCompiler::OutputEpicShader(const char* epicshFile)
+{
+	DekoBuffer buf;
+	WriteEpicShader(buf);
+	SaveFile(epicshFile, buf);
+}
 
-		fclose(f);
+DekoPipelineCompiler::DekoPipelineCompiler(int optLevel, bool isGlslcBinding) :
+	m_glsl{}, m_stages{}, m_optLevel{optLevel}, m_isGlslcBinding{isGlslcBinding}, m_defines{}, m_specializations{},
+	m_inferEarlyFragTests{}, m_reportEarlyFragTests{}, m_packHalfFloats{}, m_exactCrsSize{}, m_directIr{}
+{
+	glsl_frontend_init();
+}
+
+DekoPipelineCompiler::~DekoPipelineCompiler()
+{
+	// The stages reference the linked program, so they need to be destroyed first
+	for (auto* stage : m_stages)
+		delete stage;
+	if (m_glsl)
+		glsl_program_free(m_glsl);
+
+	glsl_frontend_exit();
+}
+
+bool DekoPipelineCompiler::Compile(const char* const sources[], const pipeline_stage stages[], unsigned count)
+{
+	compile_stats_begin("frontend");
+	m_glsl = glsl_program_create_pipeline(sources, stages, count, m_isGlslcBinding, m_directIr, m_defines, m_specializations);
+	compile_stats_end();
+	if (!m_glsl) return false;
+
+	for (unsigned i = 0; i < count; i ++)
+	{
+		DekoCompiler* compiler = new DekoCompiler{stages[i], m_optLevel, m_isGlslcBinding};
+		m_stages[stages[i]] = compiler;
+		compiler->SetEarlyFragTestsInference(m_inferEarlyFragTests, m_reportEarlyFragTests);
+		compiler->SetHalfFloatPacking(m_packHalfFloats);
+		compiler->SetExactCrsSize(m_exactCrsSize);
+		compiler->SetDirectIr(m_directIr);
+		if (!compiler->CompileLinkedGlsl(m_glsl))
+			return false;
 	}
+
+	return true;
 }
@@ -3,9 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 
 #include "tgsi/tgsi_text.h"
 #include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
 
 #include "codegen/nv50_ir_driver.h"
 
@@ -14,8 +16,21 @@
 #include "nv_attributes.h"
 #include "nv_shader_header.h"
 #include "nvn_control.h"
-#include "dksh.h"
-#include "glsl/link_uniform_block_active_visitor.h"
+#include "dksh_module.h"
+#include "shader_cache.h"
+#include "diagnostics.h"
+#include "compile_stats.h"
+#include "shader_stats.h"
+
+// Reasons for which it is not safe to run the depth/stencil tests of a fragment shader
+// before the shader (see DekoCompiler::SetEarlyFragTestsInference)
+enum EarlyFragTestsBlocker
+{
+	EarlyFragTestsBlocker_Discard          = 1U << 0,
+	EarlyFragTestsBlocker_WritesDepth      = 1U << 1,
+	EarlyFragTestsBlocker_WritesSampleMask = 1U << 2,
+	EarlyFragTestsBlocker_StoresMemory     = 1U << 3,
+};
 
 class DekoCompiler
 {
@@ -23,18 +38,49 @@ class DekoCompiler
 	glsl_program m_glsl;
 	const struct tgsi_token* m_tgsi;
 	unsigned int m_tgsiNumTokens;
+	const struct gl_linked_shader* m_glslIr; // Passed as is to the codegen instead of m_tgsi
 	nv50_ir_prog_info m_info;
 	void* m_code;
 	uint32_t m_codeSize;
 	void* m_data;
 	uint32_t m_dataSize;
 	bool m_isGlslcBinding;
+	bool m_ownsGlsl;
+	DekoShaderCache* m_cache;
+	bool m_cacheBinary;
+	void* m_cachedData;
+	const char* const* m_defines;
+	const char* const* m_specializations;
+	bool m_inferEarlyFragTests;
+	bool m_reportEarlyFragTests;
+	unsigned m_earlyFragTestsBlockers;
+	bool m_earlyFragTestsInferred; // Enabled by inference rather than declared by the shader
+	bool m_exactCrsSize;
+	bool m_directIr;
+
+	// Output of the frontend, used by code generation. When it doesn't come from
+	// m_glsl (i.e. it was loaded from the cache or from TGSI code), the tokens and
+	// the constbuf data are owned by the following buffers.
+	std::vector<tgsi_token> m_ownedTgsi;
+	std::vector<uint8_t> m_ownedData;
+	int8_t m_vtxInLocations[PIPE_MAX_ATTRIBS];
+	unsigned m_sharedSize;
 
 	NvShaderHeader m_nvsh;
 	DkshProgramHeader m_dkph;
 
+	void LoadFrontendOutput();
+	bool GenerateCode();
 	void RetrieveAndPadCode();
 	void GenerateHeaders();
+	void ReportWarnings() const;
+	void ReportEarlyFragTests() const;
+
+	bool ComputeCacheKeys(const char* glsl, DekoShaderCache::Key& key, DekoShaderCache::Key& frontendKey) const;
+	bool LoadFromCache(const DekoShaderCache::Key& key);
+	void StoreToCache(const DekoShaderCache::Key& key) const;
+	bool LoadFrontendFromCache(const DekoShaderCache::Key& key);
+	void StoreFrontendToCache(const DekoShaderCache::Key& key) const;
 
 	GPUProgramHeader CreateGpuHeader() const;
 	NVNshaderControl CreateControlHeader() const;
@@ -43,10 +89,116 @@ public:
 	DekoCompiler(pipeline_stage stage, int optLevel = 3, bool isGlslcBinding = false);
 	~DekoCompiler();
 
+	// Compiled programs are looked up in (and stored to) the specified cache, along with
+	// the output of the frontend (TGSI code), which only depends on the source, stage and
+	// binding scheme. Note that TGSI code is not available for programs retrieved from the
+	// cache; with cacheBinary set to false, only the frontend output is cached.
+	void SetCache(DekoShaderCache* cache, bool cacheBinary = true) { m_cache = cache; m_cacheBinary = cacheBinary; }
+
+	// Macros predefined when compiling GLSL, as a NULL-terminated list of NAME[=VALUE]
+	// strings which must stay valid until compilation is done.
+	void SetDefines(const char* const* defines) { m_defines = defines; }
+
+	// Uniforms (or members of uniform blocks) replaced by constants when compiling GLSL,
+	// as a NULL-terminated list of NAME=VALUE strings with the same lifetime requirements.
+	void SetSpecializations(const char* const* specializations) { m_specializations = specializations; }
+
+	// Fragment shaders which neither discard fragments, write depth or the sample mask, nor
+	// store to memory (buffers, images, atomics) behave the same whether the depth/stencil
+	// tests run before or after them, so with inference enabled, early fragment tests are
+	// forced for them even if not declared by the shader. This is off by default, since it
+	// is only correct if the shader isn't drawn with alpha test or alpha to coverage, which
+	// is draw-time state that can't be seen here. With report set, a note telling whether
+	// early fragment tests are enabled (and if not, why) is reported.
+	void SetEarlyFragTestsInference(bool infer, bool report = false) { m_inferEarlyFragTests = infer; m_reportEarlyFragTests = report; }
+
+	// Computes pairs of independent mediump float additions and multiplications with a
+	// single packed half precision instruction (HADD2/HMUL2/HFMA2). Off by default.
+	void SetHalfFloatPacking(bool pack) { m_info.io.packHalfFloats = pack; }
+
+	// Sizes the call-return stack of compute shaders after their actual control flow
+	// nesting, even below the 2KB reserved otherwise. The size of the entries hasn't been
+	// validated on hardware, so this is off by default.
+	void SetExactCrsSize(bool exact) { m_exactCrsSize = exact; }
+
+	// Generates code straight from the GLSL IR for vertex and fragment shaders that only
+	// use the subset of GLSL supported by nv50_ir_glsl_supported, skipping TGSI; other
+	// shaders still go through TGSI. TGSI code is not available for the former. Off by
+	// default.
+	void SetDirectIr(bool direct) { m_directIr = direct; }
+
+	pipeline_stage GetStage() const { return m_stage; }
+
+	// Whether the code was generated straight from the GLSL IR (see SetDirectIr)
+	bool UsesDirectIr() const { return m_glslIr != nullptr; }
+
 	bool CompileGlsl(const char* glsl);
+
+	// Generates code for TGSI code in text form, such as written by WriteTgsi.
+	// The cache is not used in this case.
+	bool CompileTgsi(const char* tgsi);
+
+	// Deduces the stage of TGSI code in text form from its header
+	static bool GetTgsiStage(const char* tgsi, pipeline_stage& stage);
+
+	// Generates code for this stage of a program created by glsl_program_create_pipeline,
+	// which must outlive the compiler. The cache is not used in this case.
+	bool CompileLinkedGlsl(glsl_program prg);
+
+	void GetDkshProgram(DkshProgram& out) const;
+
+	// Static statistics of the generated code, also available for cached programs
+	void GetShaderStats(shader_stats& out) const;
+
+	// Compare the program headers (shader program header and deko3d program header),
+	// or the code, with the ones generated by another compiler
+	bool HeadersMatch(const DekoCompiler& other) const;
+	bool CodeMatches(const DekoCompiler& other) const;
+
+	// The following append the corresponding output image to the specified buffer
+	void WriteDksh(DekoBuffer& out) const;
+	void WriteRawCode(DekoBuffer& out) const;
+	bool WriteTgsi(DekoBuffer& out) const;
+	void WriteNvnControl(DekoBuffer& out) const;
+	void WriteNvnGpuProgram(DekoBuffer& out) const;
+	void WriteEpicShader(DekoBuffer& out) const;
+
 	void OutputDksh(const char* dkshFile);
 	void OutputRawCode(const char* rawFile);
 	void OutputTgsi(const char* tgsiFile);
 	void OutputNvnBinary(const char* controlFile, const char* gpuProgramFile);
 	void OutputEpicShader(const char* epicshFile);
 };
+
+// Compiles several stages of a graphics pipeline, linking them together as a whole.
+// Outputs of a stage that are not read by the next one are eliminated, and the
+// remaining varyings are packed; each stage is still emitted as a separate program.
+class DekoPipelineCompiler
+{
+	glsl_program m_glsl;
+	DekoCompiler* m_stages[pipeline_stage_compute];
+	int m_optLevel;
+	bool m_isGlslcBinding;
+	const char* const* m_defines;
+	const char* const* m_specializations;
+	bool m_inferEarlyFragTests;
+	bool m_reportEarlyFragTests;
+	bool m_packHalfFloats;
+	bool m_exactCrsSize;
+	bool m_directIr;
+
+public:
+	DekoPipelineCompiler(int optLevel = 3, bool isGlslcBinding = false);
+	~DekoPipelineCompiler();
+
+	// See DekoCompiler::SetDefines; the same macros are defined in every stage
+	void SetDefines(const char* const* defines) { m_defines = defines; }
+	void SetSpecializations(const char* const* specializations) { m_specializations = specializations; }
+	void SetEarlyFragTestsInference(bool infer, bool report = false) { m_inferEarlyFragTests = infer; m_reportEarlyFragTests = report; }
+	void SetHalfFloatPacking(bool pack) { m_packHalfFloats = pack; }
+	void SetExactCrsSize(bool exact) { m_exactCrsSize = exact; }
+	void SetDirectIr(bool direct) { m_directIr = direct; }
+
+	bool Compile(const char* const sources[], const pipeline_stage stages[], unsigned count);
+	DekoCompiler* GetStage(pipeline_stage stage) const { return m_stages[stage]; }
+};
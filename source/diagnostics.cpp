@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "diagnostics.h"
+
+namespace
+{
+	thread_local diag_list* s_diagList;
+
+	// Parses the header of a message in a mesa info log, which looks like one of these:
+	//   0:12(5): error: ...
+	//   0:12(5): preprocessor warning: ...
+	//   error: ...
+	// Returns the start of the actual message text, or NULL if the line doesn't start a new message.
+	const char* ParseLogHeader(const char* line, diag_message& msg)
+	{
+		unsigned source, lineNo, column;
+		int pos = 0;
+		msg.source = msg.line = msg.column = -1;
+		if (sscanf(line, "%u:%u(%u): %n", &source, &lineNo, &column, &pos) == 3 && pos)
+		{
+			msg.source = source;
+			msg.line = lineNo;
+			msg.column = column;
+			line += pos;
+			if (strncmp(line, "preprocessor ", 13) == 0)
+				line += 13;
+		}
+
+		if (strncmp(line, "error: ", 7) == 0)
+		{
+			msg.severity = diag_severity_error;
+			return line + 7;
+		}
+		if (strncmp(line, "warning: ", 9) == 0)
+		{
+			msg.severity = diag_severity_warning;
+			return line + 9;
+		}
+		return NULL;
+	}
+}
+
+diag_list* diag_set_list(diag_list* list)
+{
+	diag_list* prev = s_diagList;
+	s_diagList = list;
+	return prev;
+}
+
+const char* diag_severity_name(diag_severity severity)
+{
+	switch (severity)
+	{
+		case diag_severity_error:   return "error";
+		case diag_severity_warning: return "warning";
+		default:                    return "note";
+	}
+}
+
+void diag_report(diag_severity severity, const char* fmt, ...)
+{
+	char buf[1024];
+	va_list va;
+	va_start(va, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, va);
+	va_end(va);
+
+	if (!s_diagList)
+	{
+		fprintf(stderr, "%s: %s\n", diag_severity_name(severity), buf);
+		return;
+	}
+
+	diag_message msg;
+	msg.severity = severity;
+	msg.source = msg.line = msg.column = -1;
+	msg.text = buf;
+	s_diagList->push_back(std::move(msg));
+}
+
+void diag_report_log(const char* summary, const char* log)
+{
+	if (!s_diagList)
+	{
+		if (summary)
+		{
+			fprintf(stderr, "%s\n", summary);
+			if (log && log[0])
+				fprintf(stderr, "%s\n", log);
+		}
+		return;
+	}
+
+	bool hasErrors = false, inMessage = false;
+	while (log && *log)
+	{
+		const char* end = strchr(log, '\n');
+		size_t len = end ? end - log : strlen(log);
+		std::string line{log, len};
+		log = end ? end + 1 : log + len;
+
+		diag_message msg;
+		if (const char* text = ParseLogHeader(line.c_str(), msg))
+		{
+			msg.text = text;
+			hasErrors = hasErrors || msg.severity == diag_severity_error;
+			inMessage = true;
+			s_diagList->push_back(std::move(msg));
+		}
+		else if (inMessage && !line.empty())
+		{
+			// Continuation of a multi-line message
+			s_diagList->back().text += '\n';
+			s_diagList->back().text += line;
+		}
+	}
+
+	// Make sure failures are always reported as an error, even if the log didn't contain any
+	if (summary && !hasErrors)
+		diag_report(diag_severity_error, "%s", summary);
+}
+
+void diag_print(FILE* f, const diag_list& list)
+{
+	for (auto& msg : list)
+	{
+		if (msg.source >= 0)
+			fprintf(f, "%d:%d(%d): ", msg.source, msg.line, msg.column);
+		fprintf(f, "%s: %s\n", diag_severity_name(msg.severity), msg.text.c_str());
+	}
+}
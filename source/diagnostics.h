@@ -0,0 +1,37 @@
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+enum diag_severity
+{
+	diag_severity_error,
+	diag_severity_warning,
+	diag_severity_note,
+};
+
+struct diag_message
+{
+	diag_severity severity;
+	int source, line, column; // -1 if the message does not refer to a source location
+	std::string text;
+};
+
+typedef std::vector<diag_message> diag_list;
+
+// Diagnostics are printed to stderr, unless a list was installed for the calling
+// thread, in which case they are appended to it instead. Returns the list that was
+// installed before.
+diag_list* diag_set_list(diag_list* list);
+
+void diag_report(diag_severity severity, const char* fmt, ...);
+
+const char* diag_severity_name(diag_severity severity);
+
+// Reports the info log of the GLSL compiler or linker. If summary is NULL, the log
+// belongs to a successful compilation, and its contents (warnings) are only
+// reported when diagnostics are being collected in a list.
+void diag_report_log(const char* summary, const char* log);
+
+// Prints collected diagnostics, in the same format as mesa info logs.
+void diag_print(FILE* f, const diag_list& list);
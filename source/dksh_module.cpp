@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "dksh_module.h"
+
+namespace
+{
+	template <typename T>
+	constexpr T Align256(T x)
+	{
+		return (x + 0xFF) &~ 0xFF;
+	}
+}
+
+uint32_t DkshModuleBuilder::AddBlob(const DekoBuffer& blob)
+{
+	for (auto& b : m_blobs)
+		if (b.size == blob.size() && memcmp(&m_code[b.offset], blob.data(), b.size) == 0)
+			return b.offset;
+
+	Blob b;
+	b.offset = m_code.size();
+	b.size = blob.size();
+	m_blobs.push_back(b);
+
+	m_code.insert(m_code.end(), blob.begin(), blob.end());
+	m_code.resize(Align256(m_code.size()), 0);
+	return b.offset;
+}
+
+void DkshModuleBuilder::AddProgram(const DkshProgram& prog)
+{
+	DkshProgramHeader hdr = prog.hdr;
+	hdr.entrypoint += AddBlob(prog.code);
+	if (!prog.data.empty())
+		hdr.constbuf1_off += AddBlob(prog.data);
+	m_programs.push_back(hdr);
+}
+
+void DkshModuleBuilder::Write(DekoBuffer& out) const
+{
+	uint32_t programsSize = m_programs.size()*sizeof(DkshProgramHeader);
+
+	DkshHeader hdr = {};
+	hdr.magic        = DKSH_MAGIC;
+	hdr.header_sz    = sizeof(DkshHeader);
+	hdr.control_sz   = Align256(sizeof(DkshHeader) + programsSize);
+	hdr.code_sz      = m_code.size();
+	hdr.programs_off = sizeof(DkshHeader);
+	hdr.num_programs = m_programs.size();
+
+	size_t base = out.size();
+	out.resize(base + hdr.control_sz, 0);
+	memcpy(&out[base], &hdr, sizeof(hdr));
+	if (programsSize)
+		memcpy(&out[base + hdr.programs_off], m_programs.data(), programsSize);
+	out.insert(out.end(), m_code.begin(), m_code.end());
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+#include "dksh.h"
+
+typedef std::vector<uint8_t> DekoBuffer;
+
+// A compiled program, ready to be added to a deko3d shader module.
+// The entrypoint is relative to the start of the code blob, and constbuf1_off
+// to the start of the data blob.
+struct DkshProgram
+{
+	DkshProgramHeader hdr;
+	DekoBuffer code;
+	DekoBuffer data;
+};
+
+// Builds a deko3d shader module containing any number of programs. All code and
+// constbuf blobs are placed in a single code section, each one aligned to 256 bytes;
+// identical blobs (e.g. the same program used by several pipelines, or programs
+// sharing the same constant data) are only stored once.
+class DkshModuleBuilder
+{
+	struct Blob
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	std::vector<DkshProgramHeader> m_programs;
+	std::vector<Blob> m_blobs;
+	DekoBuffer m_code;
+
+	uint32_t AddBlob(const DekoBuffer& blob);
+
+public:
+	void AddProgram(const DkshProgram& prog);
+	void Write(DekoBuffer& out) const;
+
+	unsigned GetNumPrograms() const { return m_programs.size(); }
+	uint32_t GetCodeSize() const { return m_code.size(); }
+};
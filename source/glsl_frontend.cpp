@@ -27,6 +27,8 @@ extern "C"
 }
 
 #include "glsl_frontend.h"
+#include "diagnostics.h"
+#include "compile_stats.h"
 
 class dead_variable_visitor : public ir_hierarchical_visitor {
 public:
@@ -327,20 +329,56 @@ initialize_context(struct gl_context *ctx, gl_api api)
 	ctx->Driver.NewProgram = new_program;
 }
 
-static struct gl_context gl_ctx;
+// Each thread compiling shaders gets its own context, which is created the first
+// time the thread compiles a shader and reused afterwards. This allows independent
+// shaders to be compiled concurrently.
+struct gl_thread_context
+{
+	struct gl_context* ctx = nullptr;
+
+	~gl_thread_context()
+	{
+		free(ctx);
+	}
+
+	struct gl_context* get()
+	{
+		if (!ctx)
+		{
+			ctx = (struct gl_context*)malloc(sizeof(*ctx));
+			initialize_context(ctx, API_OPENGL_CORE);
+		}
+		return ctx;
+	}
+};
 
+static thread_local gl_thread_context gl_ctx;
+static mtx_t gl_frontend_lock = _MTX_INITIALIZER_NP;
+static unsigned gl_frontend_refcount;
+
+// The frontend is reference counted so that callers compiling many shaders
+// (i.e. batch mode) can keep the builtin types and builtin functions alive
+// across compilations instead of rebuilding them for every shader.
 void glsl_frontend_init()
 {
-	initialize_context(&gl_ctx, API_OPENGL_CORE);
+	mtx_lock(&gl_frontend_lock);
+	gl_frontend_refcount++;
+	mtx_unlock(&gl_frontend_lock);
 }
 
 void glsl_frontend_exit()
 {
-	_mesa_glsl_release_types();
-	_mesa_glsl_release_builtin_functions();
+	mtx_lock(&gl_frontend_lock);
+	if (--gl_frontend_refcount == 0)
+	{
+		_mesa_glsl_release_types();
+		_mesa_glsl_release_builtin_functions();
+	}
+	mtx_unlock(&gl_frontend_lock);
 }
 
 // Prototypes for translation functions
+void tgsi_vertex_input_locations(const struct gl_program *prog, int8_t *out_inlocations);
 bool tgsi_translate_vertex(struct gl_context *ctx, struct gl_program *prog, int8_t *out_inlocations);
 bool tgsi_translate_tessctrl(struct gl_context *ctx, struct gl_program *prog);
 bool tgsi_translate_tesseval(struct gl_context *ctx, struct gl_program *prog);
@@ -348,171 +386,241 @@ bool tgsi_translate_geometry(struct gl_context *ctx, struct gl_program *prog);
 bool tgsi_translate_fragment(struct gl_context *ctx, struct gl_program *prog);
 bool tgsi_translate_compute(struct gl_context *ctx, struct gl_program *prog);
 
-glsl_program glsl_program_create(const char* source, pipeline_stage stage)
+static GLenum get_shader_type(pipeline_stage stage)
 {
-	struct gl_shader_program *prg;
+	switch (stage)
+	{
+		case pipeline_stage_vertex:
+			return GL_VERTEX_SHADER;
+		case pipeline_stage_tess_ctrl:
+			return GL_TESS_CONTROL_SHADER;
+		case pipeline_stage_tess_eval:
+			return GL_TESS_EVALUATION_SHADER;
+		case pipeline_stage_geometry:
+			return GL_GEOMETRY_SHADER;
+		case pipeline_stage_fragment:
+			return GL_FRAGMENT_SHADER;
+		case pipeline_stage_compute:
+			return GL_COMPUTE_SHADER;
+		default:
+			return GL_NONE;
+	}
+}
 
-	prg = rzalloc (NULL, struct gl_shader_program);
-	assert(prg != NULL);
-	prg->data = rzalloc(prg, struct gl_shader_program_data);
-	assert(prg->data != NULL);
-	prg->data->InfoLog = ralloc_strdup(prg->data, "");
-	prg->SeparateShader = true;
-	exec_list_make_empty(&prg->EmptyUniformLocations);
+bool glsl_preprocess(const char* source, pipeline_stage stage, const char* const* defines, std::string& out)
+{
+	struct gl_context *ctx = gl_ctx.get();
+	void *mem_ctx = ralloc_context(NULL);
 
-	/* Created just to avoid segmentation faults */
-	prg->AttributeBindings = new string_to_uint_map;
-	prg->FragDataBindings = new string_to_uint_map;
-	prg->FragDataIndexBindings = new string_to_uint_map;
+	struct gl_shader *shader = rzalloc(mem_ctx, gl_shader);
+	shader->Type = get_shader_type(stage);
+	shader->Stage = _mesa_shader_enum_to_shader_stage(shader->Type);
+	shader->Source = source;
+	shader->Defines = defines;
 
-	// Allocate a shader list
-	prg->Shaders = reralloc(prg, prg->Shaders, struct gl_shader *, 1);
+	const char *result = _mesa_glsl_preprocess_shader(ctx, shader, mem_ctx);
+	if (result)
+		out = result;
 
-	// Allocate a shader and add it to the list
-	struct gl_shader *shader = rzalloc(prg, gl_shader);
-	prg->Shaders[prg->NumShaders] = shader;
-	prg->NumShaders++;
+	ralloc_free(mem_ctx);
+	return result != NULL;
+}
 
-	switch (stage)
+static bool _glsl_program_translate(struct gl_context *ctx, glsl_program prg, pipeline_stage stage, struct gl_linked_shader *linked_shader)
+{
+	// Force OriginUpperLeft
+	if (linked_shader->Program->OriginUpperLeft)
+		diag_report(diag_severity_warning, "origin_upper_left has no effect");
+	linked_shader->Program->OriginUpperLeft = GL_TRUE;
+
+	// Check for PixelCenterInteger (unsupported)
+	if (linked_shader->Program->PixelCenterInteger == GL_TRUE) {
+		diag_report(diag_severity_error, "pixel_center_integer is not supported");
+		return false;
+	}
+
+	// TGSI generation, unless the linked GLSL IR was kept for the codegen
+	bool rc = false;
+	if (linked_shader->ir)
+	{
+		if (stage == pipeline_stage_vertex)
+			tgsi_vertex_input_locations(linked_shader->Program,
+				gl_program_with_tgsi::from_ptr(linked_shader->Program)->vtx_in_locations);
+		rc = true;
+	}
+	else switch (stage)
 	{
 		case pipeline_stage_vertex:
-			shader->Type = GL_VERTEX_SHADER;
+			rc = tgsi_translate_vertex(ctx, linked_shader->Program,
+				gl_program_with_tgsi::from_ptr(linked_shader->Program)->vtx_in_locations);
 			break;
 		case pipeline_stage_tess_ctrl:
-			shader->Type = GL_TESS_CONTROL_SHADER;
+			rc = tgsi_translate_tessctrl(ctx, linked_shader->Program);
 			break;
 		case pipeline_stage_tess_eval:
-			shader->Type = GL_TESS_EVALUATION_SHADER;
+			rc = tgsi_translate_tesseval(ctx, linked_shader->Program);
 			break;
 		case pipeline_stage_geometry:
-			shader->Type = GL_GEOMETRY_SHADER;
+			rc = tgsi_translate_geometry(ctx, linked_shader->Program);
 			break;
 		case pipeline_stage_fragment:
-			shader->Type = GL_FRAGMENT_SHADER;
+			rc = tgsi_translate_fragment(ctx, linked_shader->Program);
 			break;
 		case pipeline_stage_compute:
-			shader->Type = GL_COMPUTE_SHADER;
+			rc = tgsi_translate_compute(ctx, linked_shader->Program);
 			break;
 		default:
-			goto _fail;
+			diag_report(diag_severity_error, "Unsupported stage");
+			return false;
 	}
-	shader->Stage = _mesa_shader_enum_to_shader_stage(shader->Type);
-	shader->Source = source;
 
-	// "Compile" the shader
-	_mesa_glsl_compile_shader(&gl_ctx, shader, false, false, true);
-	if (shader->CompileStatus != COMPILE_SUCCESS)
+	if (!rc)
 	{
-		fprintf(stderr, "Shader failed to compile.\n");
-		if (shader->InfoLog && shader->InfoLog[0])
-			fprintf(stderr, "%s\n", shader->InfoLog);
-		goto _fail;
+		diag_report(diag_severity_error, "Translation failed");
+		return false;
 	}
-	_mesa_clear_shader_program_data(&gl_ctx, prg);
 
-	// Link the shader
-	link_shaders(&gl_ctx, prg);
-	if (prg->data->LinkStatus != LINKING_SUCCESS)
+	gl_program_parameter_list *pl = linked_shader->Program->Parameters;
+	unsigned last_location = ~0U;
+	bool has_uniforms_in_driver_cbuf = false;
+	for (unsigned i = 0; i < pl->NumParameters; i ++)
 	{
-		fprintf(stderr, "Shader failed to link.\n");
-		if (prg->data->InfoLog && prg->data->InfoLog[0])
-			fprintf(stderr, "%s\n", prg->data->InfoLog);
-		goto _fail;
+		gl_program_parameter *p = &pl->Parameters[i];
+		unsigned location = 0;
+		if (!prg->UniformHash->get(location, p->Name))
+			continue;
+		gl_uniform_storage *storage = &prg->data->UniformStorage[location];
+		if (storage->builtin || storage->hidden)
+			continue;
+		if (location != last_location)
+		{
+			last_location = location;
+			diag_report(diag_severity_error, "uniform '%s' in driver constbuf (c[0x1][0x%03x]) not supported",
+				p->Name,
+				// "(type=%d dim=%ux%u size=%u)"
+				//storage->type->base_type,
+				//storage->type->matrix_columns, storage->type->vector_elements,
+				//storage->array_elements,
+				4*pl->ParameterValueOffset[i]);
+			has_uniforms_in_driver_cbuf = true;
+		}
 	}
-	else
-	{
-		struct gl_linked_shader *linked_shader = prg->_LinkedShaders[shader->Stage];
 
-		// Do more optimizations
-		add_neg_to_sub_visitor v;
-		visit_list_elements(&v, linked_shader->ir);
+	return !has_uniforms_in_driver_cbuf;
+}
 
-		dead_variable_visitor dv;
-		visit_list_elements(&dv, linked_shader->ir);
-		dv.remove_dead_variables();
+static glsl_program _glsl_program_create(const char* const sources[], const pipeline_stage stages[], unsigned count, bool is_glslc_binding, bool direct_ir, const char* const* defines, const char* const* specializations)
+{
+	struct gl_context *ctx = gl_ctx.get();
+	struct gl_shader_program *prg;
 
-		// Print IR
-		//_mesa_print_ir(stdout, linked_shader->ir, NULL);
+	prg = rzalloc (NULL, struct gl_shader_program);
+	assert(prg != NULL);
+	prg->data = rzalloc(prg, struct gl_shader_program_data);
+	assert(prg->data != NULL);
+	prg->data->InfoLog = ralloc_strdup(prg->data, "");
+	// Stages linked together can see each other, which allows for eliminating and packing varyings
+	prg->SeparateShader = count == 1;
+	prg->IsGlslcBinding = is_glslc_binding;
+	prg->DirectIr = direct_ir;
+	exec_list_make_empty(&prg->EmptyUniformLocations);
 
-		// Do the TGSI conversion
-		if (!st_link_shader(&gl_ctx, prg))
+	/* Created just to avoid segmentation faults */
+	prg->AttributeBindings = new string_to_uint_map;
+	prg->FragDataBindings = new string_to_uint_map;
+	prg->FragDataIndexBindings = new string_to_uint_map;
+
+	// Allocate a shader list
+	prg->Shaders = reralloc(prg, prg->Shaders, struct gl_shader *, count);
+
+	for (unsigned i = 0; i < count; i ++)
+	{
+		// Allocate a shader and add it to the list
+		struct gl_shader *shader = rzalloc(prg, gl_shader);
+		prg->Shaders[prg->NumShaders] = shader;
+		prg->NumShaders++;
+
+		shader->Type = get_shader_type(stages[i]);
+		if (shader->Type == GL_NONE)
+			goto _fail;
+		shader->Stage = _mesa_shader_enum_to_shader_stage(shader->Type);
+		shader->Source = sources[i];
+		shader->Defines = defines;
+		shader->Specializations = specializations;
+
+		// "Compile" the shader
+		compile_stats_begin("compile");
+		_mesa_glsl_compile_shader(ctx, shader, false, false, true);
+		compile_stats_end();
+		if (shader->CompileStatus != COMPILE_SUCCESS)
 		{
-			fprintf(stderr, "st_link_shader failed\n");
+			diag_report_log("Shader failed to compile.", shader->InfoLog);
 			goto _fail;
 		}
+		diag_report_log(NULL, shader->InfoLog);
+	}
+	_mesa_clear_shader_program_data(ctx, prg);
 
-		// Force OriginUpperLeft
-		if (linked_shader->Program->OriginUpperLeft)
-			fprintf(stderr, "warning: origin_upper_left has no effect\n");
-		linked_shader->Program->OriginUpperLeft = GL_TRUE;
+	// Link the shader
+	compile_stats_begin("link");
+	link_shaders(ctx, prg);
+	compile_stats_end();
+	if (prg->data->LinkStatus != LINKING_SUCCESS)
+	{
+		diag_report_log("Shader failed to link.", prg->data->InfoLog);
+		goto _fail;
+	}
+	else
+	{
+		diag_report_log(NULL, prg->data->InfoLog);
 
-		// Check for PixelCenterInteger (unsupported)
-		if (linked_shader->Program->PixelCenterInteger == GL_TRUE) {
-			fprintf(stderr, "error: pixel_center_integer is not supported\n");
-			goto _fail;
+		// The linked shaders have their own copy of the IR, and the program is never
+		// relinked: release the IR of the compiled shaders before generating code
+		for (unsigned i = 0; i < prg->NumShaders; i ++)
+		{
+			struct gl_shader *shader = prg->Shaders[i];
+			ralloc_free(shader->ir);
+			shader->ir = NULL;
+			shader->symbols = NULL; // allocated from shader->ir
 		}
 
-		// TGSI generation
-		bool rc = false;
-		switch (stage)
+		for (unsigned i = 0; i < MESA_SHADER_STAGES; i ++)
 		{
-			case pipeline_stage_vertex:
-				rc = tgsi_translate_vertex(&gl_ctx, linked_shader->Program,
-					gl_program_with_tgsi::from_ptr(linked_shader->Program)->vtx_in_locations);
-				break;
-			case pipeline_stage_tess_ctrl:
-				rc = tgsi_translate_tessctrl(&gl_ctx, linked_shader->Program);
-				break;
-			case pipeline_stage_tess_eval:
-				rc = tgsi_translate_tesseval(&gl_ctx, linked_shader->Program);
-				break;
-			case pipeline_stage_geometry:
-				rc = tgsi_translate_geometry(&gl_ctx, linked_shader->Program);
-				break;
-			case pipeline_stage_fragment:
-				rc = tgsi_translate_fragment(&gl_ctx, linked_shader->Program);
-				break;
-			case pipeline_stage_compute:
-				rc = tgsi_translate_compute(&gl_ctx, linked_shader->Program);
-				break;
-			default:
-				fprintf(stderr, "Unsupported stage\n");
-				goto _fail;
+			struct gl_linked_shader *linked_shader = prg->_LinkedShaders[i];
+			if (!linked_shader)
+				continue;
+
+			// Do more optimizations
+			add_neg_to_sub_visitor v;
+			visit_list_elements(&v, linked_shader->ir);
+
+			dead_variable_visitor dv;
+			visit_list_elements(&dv, linked_shader->ir);
+			dv.remove_dead_variables();
+
+			// Print IR
+			//_mesa_print_ir(stdout, linked_shader->ir, NULL);
 		}
 
-		if (!rc)
+		// Do the TGSI conversion
+		compile_stats_begin("st_link_shader");
+		bool linked = st_link_shader(ctx, prg);
+		compile_stats_end();
+		if (!linked)
 		{
-			fprintf(stderr, "Translation failed\n");
+			diag_report(diag_severity_error, "st_link_shader failed");
 			goto _fail;
 		}
 
-		gl_program_parameter_list *pl = linked_shader->Program->Parameters;
-		unsigned last_location = ~0U;
-		bool has_uniforms_in_driver_cbuf = false;
-		for (unsigned i = 0; i < pl->NumParameters; i ++)
+		for (unsigned i = 0; i < count; i ++)
 		{
-			gl_program_parameter *p = &pl->Parameters[i];
-			unsigned location = 0;
-			if (!prg->UniformHash->get(location, p->Name))
-				continue;
-			gl_uniform_storage *storage = &prg->data->UniformStorage[location];
-			if (storage->builtin || storage->hidden)
-				continue;
-			if (location != last_location)
-			{
-				last_location = location;
-				fprintf(stderr, "error: uniform '%s' in driver constbuf (c[0x1][0x%03x]) not supported\n",
-					p->Name,
-					// "(type=%d dim=%ux%u size=%u)"
-					//storage->type->base_type,
-					//storage->type->matrix_columns, storage->type->vector_elements,
-					//storage->array_elements,
-					4*pl->ParameterValueOffset[i]);
-				has_uniforms_in_driver_cbuf = true;
-			}
+			struct gl_linked_shader *linked_shader = prg->_LinkedShaders[prg->Shaders[i]->Stage];
+			compile_stats_begin("tgsi_translate");
+			bool translated = _glsl_program_translate(ctx, prg, stages[i], linked_shader);
+			compile_stats_end();
+			if (!translated)
+				goto _fail;
 		}
-		if (has_uniforms_in_driver_cbuf)
-			goto _fail;
 	}
 
 	return prg;
@@ -522,17 +630,41 @@ _fail:
 	return NULL;
 }
 
-static struct gl_linked_shader *_glsl_program_get_linked_shader(glsl_program prg)
+glsl_program glsl_program_create(const char* source, pipeline_stage stage, bool is_glslc_binding, bool direct_ir, const char* const* defines, const char* const* specializations)
 {
-	struct gl_linked_shader *linked_shader = NULL;
-	for (int i = 0; !linked_shader && i < MESA_SHADER_STAGES; i ++)
-		linked_shader = prg->_LinkedShaders[i];
-	return linked_shader;
+	return _glsl_program_create(&source, &stage, 1, is_glslc_binding, direct_ir, defines, specializations);
+}
+
+glsl_program glsl_program_create_pipeline(const char* const sources[], const pipeline_stage stages[], unsigned count, bool is_glslc_binding, bool direct_ir, const char* const* defines, const char* const* specializations)
+{
+	for (unsigned i = 0; i < count; i ++)
+	{
+		if (stages[i] == pipeline_stage_compute)
+		{
+			diag_report(diag_severity_error, "compute shaders cannot be part of a pipeline");
+			return NULL;
+		}
+		for (unsigned j = 0; j < i; j ++)
+		{
+			if (stages[j] == stages[i])
+			{
+				diag_report(diag_severity_error, "pipeline contains more than one shader for the same stage");
+				return NULL;
+			}
+		}
+	}
+
+	return _glsl_program_create(sources, stages, count, is_glslc_binding, direct_ir, defines, specializations);
+}
+
+static struct gl_linked_shader *_glsl_program_get_linked_shader(glsl_program prg, pipeline_stage stage)
+{
+	return prg->_LinkedShaders[_mesa_shader_enum_to_shader_stage(get_shader_type(stage))];
 }
 
-const tgsi_token* glsl_program_get_tokens(glsl_program prg, unsigned int& num_tokens)
+const tgsi_token* glsl_program_get_tokens(glsl_program prg, pipeline_stage stage, unsigned int& num_tokens)
 {
-	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg);
+	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg, stage);
 	if (!linked_shader)
 	{
 		num_tokens = 0;
@@ -544,9 +676,18 @@ const tgsi_token* glsl_program_get_tokens(glsl_program prg, unsigned int& num_to
 	return prog->tgsi_tokens;
 }
 
-void* glsl_program_get_constant_buffer(glsl_program prg, unsigned int& out_size)
+const struct gl_linked_shader* glsl_program_get_direct_ir(glsl_program prg, pipeline_stage stage)
 {
-	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg);
+	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg, stage);
+	if (!linked_shader || !linked_shader->ir)
+		return NULL;
+
+	return linked_shader;
+}
+
+void* glsl_program_get_constant_buffer(glsl_program prg, pipeline_stage stage, unsigned int& out_size)
+{
+	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg, stage);
 	if (!linked_shader)
 	{
 		out_size = 0;
@@ -560,7 +701,7 @@ void* glsl_program_get_constant_buffer(glsl_program prg, unsigned int& out_size)
 
 int8_t const* glsl_program_vertex_get_in_locations(glsl_program prg)
 {
-	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg);
+	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg, pipeline_stage_vertex);
 	if (!linked_shader)
 		return nullptr;
 
@@ -569,7 +710,7 @@ int8_t const* glsl_program_vertex_get_in_locations(glsl_program prg)
 
 unsigned glsl_program_compute_get_shared_size(glsl_program prg)
 {
-	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg);
+	struct gl_linked_shader *linked_shader = _glsl_program_get_linked_shader(prg, pipeline_stage_compute);
 	if (!linked_shader)
 		return 0;
 
@@ -579,8 +720,10 @@ unsigned glsl_program_compute_get_shared_size(glsl_program prg)
 void glsl_program_free(glsl_program prg)
 {
 	for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
-		if (prg->_LinkedShaders[i])
+		if (prg->_LinkedShaders[i]) {
+			ralloc_free(prg->_LinkedShaders[i]->ir);
 			ralloc_free(prg->_LinkedShaders[i]->Program);
+		}
 	}
 
 	delete prg->AttributeBindings;
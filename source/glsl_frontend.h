@@ -1,8 +1,10 @@
 #pragma once
 #include <stdint.h>
+#include <string>
 
 struct gl_shader_program;
 struct tgsi_token;
+struct gl_linked_shader;
 
 typedef struct gl_shader_program* glsl_program;
 
@@ -19,9 +21,17 @@ enum pipeline_stage
 void glsl_frontend_init();
 void glsl_frontend_exit();
 
-glsl_program glsl_program_create(const char* source, pipeline_stage stage);
-const tgsi_token* glsl_program_get_tokens(glsl_program prg, unsigned int& num_tokens);
-void* glsl_program_get_constant_buffer(glsl_program prg, unsigned int& out_size);
+// defines is an optional NULL-terminated list of NAME[=VALUE] macros to predefine
+bool glsl_preprocess(const char* source, pipeline_stage stage, const char* const* defines, std::string& out);
+// specializations is an optional NULL-terminated list of NAME=VALUE uniforms to replace by constants
+// direct_ir keeps the GLSL IR of the stages the codegen supports instead of generating TGSI for them
+glsl_program glsl_program_create(const char* source, pipeline_stage stage, bool is_glslc_binding, bool direct_ir, const char* const* defines = nullptr, const char* const* specializations = nullptr);
+// Links several stages of a graphics pipeline together, so that varyings can be eliminated and packed across stages
+glsl_program glsl_program_create_pipeline(const char* const sources[], const pipeline_stage stages[], unsigned count, bool is_glslc_binding, bool direct_ir, const char* const* defines = nullptr, const char* const* specializations = nullptr);
+const tgsi_token* glsl_program_get_tokens(glsl_program prg, pipeline_stage stage, unsigned int& num_tokens);
+// Returns the linked shader of a stage whose GLSL IR was kept, or NULL if it was translated to TGSI
+const struct gl_linked_shader* glsl_program_get_direct_ir(glsl_program prg, pipeline_stage stage);
+void* glsl_program_get_constant_buffer(glsl_program prg, pipeline_stage stage, unsigned int& out_size);
 int8_t const* glsl_program_vertex_get_in_locations(glsl_program prg);
 unsigned glsl_program_compute_get_shared_size(glsl_program prg);
 void glsl_program_free(glsl_program prg);
@@ -0,0 +1,209 @@
+#include "uam.h"
+#include "compiler_iface.h"
+
+static_assert(int(UAM_STAGE_VERTEX)    == int(pipeline_stage_vertex),    "Stage mismatch");
+static_assert(int(UAM_STAGE_TESS_CTRL) == int(pipeline_stage_tess_ctrl), "Stage mismatch");
+static_assert(int(UAM_STAGE_TESS_EVAL) == int(pipeline_stage_tess_eval), "Stage mismatch");
+static_assert(int(UAM_STAGE_GEOMETRY)  == int(pipeline_stage_geometry),  "Stage mismatch");
+static_assert(int(UAM_STAGE_FRAGMENT)  == int(pipeline_stage_fragment),  "Stage mismatch");
+static_assert(int(UAM_STAGE_COMPUTE)   == int(pipeline_stage_compute),   "Stage mismatch");
+
+static_assert(int(UAM_SEVERITY_ERROR)   == int(diag_severity_error),   "Severity mismatch");
+static_assert(int(UAM_SEVERITY_WARNING) == int(diag_severity_warning), "Severity mismatch");
+static_assert(int(UAM_SEVERITY_NOTE)    == int(diag_severity_note),    "Severity mismatch");
+
+struct uam_result
+{
+	bool succeeded;
+	DekoBuffer outputs[UAM_OUTPUT_COUNT];
+	DkshProgram program;
+	diag_list messages;
+	std::vector<uam_diagnostic> diagnostics;
+};
+
+void uam_init(void)
+{
+	glsl_frontend_init();
+}
+
+void uam_exit(void)
+{
+	glsl_frontend_exit();
+}
+
+void uam_options_init(uam_options* options, uam_stage stage)
+{
+	options->stage = stage;
+	options->opt_level = 3;
+	options->glslc_binding = false;
+	options->tgsi = false;
+	options->early_frag_tests_inference = false;
+	options->early_frag_tests_report = false;
+	options->half_float_packing = false;
+	options->exact_crs_size = false;
+	options->direct_ir = false;
+	options->defines = NULL;
+	options->specializations = NULL;
+}
+
+static void uam_result_fill_outputs(uam_result* result, const DekoCompiler& compiler, const uam_options* options)
+{
+	compiler.GetDkshProgram(result->program);
+	compiler.WriteDksh(result->outputs[UAM_OUTPUT_DKSH]);
+	compiler.WriteNvnControl(result->outputs[UAM_OUTPUT_NVN_CONTROL]);
+	compiler.WriteNvnGpuProgram(result->outputs[UAM_OUTPUT_NVN_GPU_PROGRAM]);
+	compiler.WriteEpicShader(result->outputs[UAM_OUTPUT_EPICSH]);
+	compiler.WriteRawCode(result->outputs[UAM_OUTPUT_RAW]);
+	if (options->tgsi)
+		compiler.WriteTgsi(result->outputs[UAM_OUTPUT_TGSI]);
+}
+
+// Builds the C view of the diagnostics, once the list won't be modified anymore
+static void uam_result_fill_diagnostics(uam_result* result)
+{
+	result->diagnostics.reserve(result->messages.size());
+	for (auto& msg : result->messages)
+	{
+		uam_diagnostic diag;
+		diag.severity = uam_severity(msg.severity);
+		diag.source   = msg.source;
+		diag.line     = msg.line;
+		diag.column   = msg.column;
+		diag.message  = msg.text.c_str();
+		result->diagnostics.push_back(diag);
+	}
+}
+
+uam_result* uam_compile(const char* source, const uam_options* options)
+{
+	if (!source || !options || unsigned(options->stage) > UAM_STAGE_COMPUTE)
+		return NULL;
+
+	uam_result* result = new uam_result;
+	diag_set_list(&result->messages);
+
+	{
+		DekoCompiler compiler{pipeline_stage(options->stage), options->opt_level, options->glslc_binding};
+		compiler.SetDefines(options->defines);
+		compiler.SetSpecializations(options->specializations);
+		compiler.SetEarlyFragTestsInference(options->early_frag_tests_inference, options->early_frag_tests_report);
+		compiler.SetHalfFloatPacking(options->half_float_packing);
+		compiler.SetExactCrsSize(options->exact_crs_size);
+		compiler.SetDirectIr(options->direct_ir);
+		result->succeeded = compiler.CompileGlsl(source);
+		if (result->succeeded)
+			uam_result_fill_outputs(result, compiler, options);
+	}
+
+	diag_set_list(NULL);
+	uam_result_fill_diagnostics(result);
+	return result;
+}
+
+bool uam_compile_pipeline(const char* const* sources, const uam_stage* stages, size_t count, const uam_options* options, uam_result** results)
+{
+	if (!count || !options)
+		return false;
+	for (size_t i = 0; i < count; i ++)
+	{
+		results[i] = NULL;
+		if (!sources[i] || unsigned(stages[i]) > UAM_STAGE_COMPUTE)
+			return false;
+	}
+
+	diag_list messages;
+	diag_set_list(&messages);
+
+	std::vector<pipeline_stage> pipelineStages(count);
+	for (size_t i = 0; i < count; i ++)
+		pipelineStages[i] = pipeline_stage(stages[i]);
+	DekoPipelineCompiler pipeline{options->opt_level, options->glslc_binding};
+	pipeline.SetDefines(options->defines);
+	pipeline.SetSpecializations(options->specializations);
+	pipeline.SetEarlyFragTestsInference(options->early_frag_tests_inference, options->early_frag_tests_report);
+	pipeline.SetHalfFloatPacking(options->half_float_packing);
+	pipeline.SetExactCrsSize(options->exact_crs_size);
+	pipeline.SetDirectIr(options->direct_ir);
+	bool succeeded = pipeline.Compile(sources, pipelineStages.data(), count);
+
+	diag_set_list(NULL);
+
+	// Messages can't be attributed to a single stage, so every result gets all of them
+	for (size_t i = 0; i < count; i ++)
+	{
+		uam_result* result = new uam_result;
+		result->succeeded = succeeded;
+		result->messages = messages;
+		if (succeeded)
+			uam_result_fill_outputs(result, *pipeline.GetStage(pipelineStages[i]), options);
+		uam_result_fill_diagnostics(result);
+		results[i] = result;
+	}
+
+	return succeeded;
+}
+
+void uam_result_free(uam_result* result)
+{
+	delete result;
+}
+
+bool uam_result_succeeded(const uam_result* result)
+{
+	return result->succeeded;
+}
+
+const void* uam_result_get_output(const uam_result* result, uam_output output, size_t* size)
+{
+	if (unsigned(output) >= UAM_OUTPUT_COUNT || result->outputs[output].empty())
+	{
+		if (size) *size = 0;
+		return NULL;
+	}
+
+	const DekoBuffer& buf = result->outputs[output];
+	if (size) *size = buf.size();
+	return buf.data();
+}
+
+void* uam_pack_dksh(const uam_result* const* results, size_t count, size_t* size)
+{
+	DkshModuleBuilder module;
+	for (size_t i = 0; i < count; i ++)
+	{
+		if (!results[i]->succeeded)
+			return NULL;
+		module.AddProgram(results[i]->program);
+	}
+
+	DekoBuffer buf;
+	module.Write(buf);
+
+	void* out = malloc(buf.size());
+	if (out)
+	{
+		memcpy(out, buf.data(), buf.size());
+		if (size) *size = buf.size();
+	}
+	return out;
+}
+
+void uam_free(void* ptr)
+{
+	free(ptr);
+}
+
+size_t uam_result_get_num_diagnostics(const uam_result* result)
+{
+	return result->diagnostics.size();
+}
+
+const uam_diagnostic* uam_result_get_diagnostic(const uam_result* result, size_t index)
+{
+	return index < result->diagnostics.size() ? &result->diagnostics[index] : NULL;
+}
+
+const char* uam_get_version(void)
+{
+	return PACKAGE_STRING;
+}
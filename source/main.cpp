@@ -1,13 +1,25 @@
 #include "compiler_iface.h"
+#include "compile_server.h"
+#include <ctype.h>
 #include <getopt.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 static int usage(const char* prog)
 {
 	fprintf(stderr,
-		"Usage: %s [options] file\n"
+		"Usage: %s [options] file...\n"
+		"       %s [options] --batch=<manifest>\n"
+		"       %s [--cache=<dir>] --server=<socket>\n"
 		"Options:\n"
 		"  -o, --out=<file>      Specifies the output deko3d shader module file (.dksh)\n"
+		"                        If several files are specified, all the resulting programs\n"
+		"                        are packed into this module (see Readme)\n"
 		"  -r, --raw=<file>      Specifies the file to which output raw Maxwell bytecode\n"
 		"  -t, --tgsi=<file>     Specifies the file to which output intermediary TGSI code\n"
 		"  -s, --stage=<name>    Specifies the pipeline stage of the shader\n"
@@ -18,8 +30,65 @@ static int usage(const char* prog)
 		"  -g, --nvngpu=<file>   Specifies the output NVN GPU program file\n"
 		"  -e, --epicsh=<file>   Specifies the output Epic shader format file(see Readme)\n"
 		"  -b, --glslcbinds      Use GLSLC uniform binding scheme (basically add 1 to all ids)\n"
+		"  -D, --define=<name>[=<value>]\n"
+		"                        Predefines a preprocessor macro (with a value of 1 if none\n"
+		"                        is specified); may be used several times\n"
+		"      --specialize=<name>=<value>\n"
+		"                        Replaces a uniform (or uniform block member) by a constant\n"
+		"                        value when compiling GLSL (see Readme); may be used several\n"
+		"                        times\n"
+		"      --specialize-file=<file>\n"
+		"                        Reads uniform specializations from the specified file\n"
+		"      --permutations=<file>\n"
+		"                        Compiles the input file once for each combination of the\n"
+		"                        macros listed in the specified matrix file (see Readme),\n"
+		"                        storing each distinct program once in the output module\n"
+		"      --variant-table=<file>\n"
+		"                        In permutation mode, writes the program of the output module\n"
+		"                        used by each combination of macros to the specified file\n"
+		"  -P, --pipeline        Links all the specified files together as a pipeline, removing\n"
+		"                        unused varyings and packing the others (see Readme)\n"
+		"      --from-tgsi       The input files contain TGSI code (such as output by --tgsi)\n"
+		"                        instead of GLSL; the stage is read from the TGSI header\n"
+		"                        unless specified\n"
+		"      --auto-early-z    Enables early fragment tests (early depth/stencil) whenever\n"
+		"                        the shader allows it, not only if declared; not for shaders\n"
+		"                        drawn with alpha test or alpha to coverage (see Readme)\n"
+		"      --early-z-report  Tells whether early fragment tests are enabled for each\n"
+		"                        fragment shader, and if not, why\n"
+		"      --fp16            Computes mediump float math as packed half floats, two\n"
+		"                        operations per instruction (see Readme)\n"
+		"      --exact-crs       Sizes the call-return stack after the control flow nesting\n"
+		"                        of each shader instead of reserving 2KB for compute\n"
+		"                        shaders and none for other stages (not validated on\n"
+		"                        hardware, see Readme)\n"
+		"      --direct-ir       Generates code for simple vertex and fragment shaders\n"
+		"                        straight from the GLSL IR, without going through TGSI\n"
+		"                        (see Readme)\n"
+		"      --compare-direct-ir  Compiles GLSL shaders both with and without --direct-ir,\n"
+		"                        and reports whether the headers and code are the same\n"
+		"  -B, --batch=<file>    Compiles every shader listed in the specified manifest file\n"
+		"                        (see Readme), or read from stdin if the file is `-'\n"
+		"  -j, --jobs=<n>        Number of shaders to compile in parallel in batch mode\n"
+		"                        (0 uses as many threads as there are CPU cores)\n"
+		"  -C, --cache=<dir>     Reuses previously compiled shaders stored in the specified\n"
+		"                        cache directory, and stores newly compiled ones in it\n"
+		"      --cache-size=<n>  Maximum size of the shader cache in MiB (default: 1024)\n"
+		"      --time-report     Prints the time spent in each compilation phase and its peak\n"
+		"                        memory usage to stderr\n"
+		"      --stats           Prints the instruction counts, register and memory usage,\n"
+		"                        theoretical occupancy on the GM20B and a static cycle\n"
+		"                        estimate of each compiled shader to stderr\n"
+		"      --stats-json=<file>\n"
+		"                        Writes the time and peak memory usage of each compilation\n"
+		"                        phase and the statistics of every shader to the specified\n"
+		"                        file, as JSON\n"
+		"      --server=<socket> Runs as a compile server listening on the specified local\n"
+		"                        socket, keeping the compiler initialized between requests\n"
+		"      --client=<socket> Has the compile server listening on the specified socket\n"
+		"                        compile the shaders, instead of compiling them in-process\n"
 		"  -v, --version         Displays version information\n"
-		, prog);
+		, prog, prog, prog);
 	return EXIT_FAILURE;
 }
 
@@ -37,14 +106,72 @@ const char* getShaderStageStr(const std::string& filename) {
     return NULL;
 }
 
-int main(int argc, char* argv[])
+namespace
 {
-	const char *inFile = nullptr, *outFile = nullptr, *rawFile = nullptr, *tgsiFile = nullptr;
-	const char *stageName = nullptr, *nvnCtrlFile = nullptr, *nvnGpuFile = nullptr;
-	const char *epicshFile = nullptr;
-	bool isGlslcBinding = false;
+	struct ShaderJob
+	{
+		std::vector<std::string> inFiles;
+		std::string outFile, rawFile, tgsiFile;
+		std::string stageName, nvnCtrlFile, nvnGpuFile;
+		std::string epicshFile;
+		std::vector<std::string> defines;
+		std::vector<std::string> specializations;
+		std::string permutationsFile, variantTableFile;
+		bool isGlslcBinding = false;
+		bool isPipeline = false;
+		bool isTgsi = false;
+		bool inferEarlyFragTests = false;
+		bool reportEarlyFragTests = false;
+		bool packHalfFloats = false;
+		bool exactCrsSize = false;
+		bool directIr = false;
+		bool compareDirectIr = false;
+	};
+
+	// Options that apply to the whole invocation, and as such cannot be used inside a manifest
+	struct GlobalOptions
+	{
+		const char* manifestFile = nullptr;
+		unsigned numThreads = 1;
+		const char* cacheDir = nullptr;
+		uint64_t cacheSize = UINT64_C(1024) << 20;
+		bool timeReport = false;
+		bool shaderStats = false;
+		const char* statsJsonFile = nullptr;
+		const char* serverSocket = nullptr;
+		const char* clientSocket = nullptr;
+	};
+
+	enum
+	{
+		// Long options only
+		Option_CacheSize = 0x100,
+		Option_TimeReport,
+		Option_Stats,
+		Option_StatsJson,
+		Option_FromTgsi,
+		Option_Server,
+		Option_Client,
+		Option_Permutations,
+		Option_VariantTable,
+		Option_Specialize,
+		Option_SpecializeFile,
+		Option_AutoEarlyFragTests,
+		Option_EarlyFragTestsReport,
+		Option_HalfFloatPacking,
+		Option_ExactCrsSize,
+		Option_DirectIr,
+		Option_CompareDirectIr,
+	};
+
+	enum ParseResult
+	{
+		ParseResult_Ok,
+		ParseResult_Exit,
+		ParseResult_Error,
+	};
 
-	static struct option long_options[] =
+	const struct option s_longOptions[] =
 	{
 		{ "out",       required_argument, NULL, 'o' },
 		{ "raw",       required_argument, NULL, 'r' },
@@ -54,101 +181,1075 @@ int main(int argc, char* argv[])
 		{ "nvngpu",    required_argument, NULL, 'g' },
 		{ "epicsh",    required_argument, NULL, 'e' },
 		{ "glslcbinds", no_argument,      NULL, 'b' },
+		{ "define",    required_argument, NULL, 'D' },
+		{ "specialize", required_argument, NULL, Option_Specialize },
+		{ "specialize-file", required_argument, NULL, Option_SpecializeFile },
+		{ "permutations", required_argument, NULL, Option_Permutations },
+		{ "variant-table", required_argument, NULL, Option_VariantTable },
+		{ "pipeline",  no_argument,       NULL, 'P' },
+		{ "from-tgsi", no_argument,       NULL, Option_FromTgsi },
+		{ "auto-early-z", no_argument,    NULL, Option_AutoEarlyFragTests },
+		{ "early-z-report", no_argument,  NULL, Option_EarlyFragTestsReport },
+		{ "fp16",      no_argument,       NULL, Option_HalfFloatPacking },
+		{ "exact-crs", no_argument,       NULL, Option_ExactCrsSize },
+		{ "direct-ir", no_argument,       NULL, Option_DirectIr },
+		{ "compare-direct-ir", no_argument, NULL, Option_CompareDirectIr },
+		{ "batch",     required_argument, NULL, 'B' },
+		{ "jobs",      required_argument, NULL, 'j' },
+		{ "cache",     required_argument, NULL, 'C' },
+		{ "cache-size", required_argument, NULL, Option_CacheSize },
+		{ "time-report", no_argument,     NULL, Option_TimeReport },
+		{ "stats",     no_argument,       NULL, Option_Stats },
+		{ "stats-json", required_argument, NULL, Option_StatsJson },
+		{ "server",    required_argument, NULL, Option_Server },
+		{ "client",    required_argument, NULL, Option_Client },
 		{ "help",      no_argument,       NULL, '?' },
 		{ "version",   no_argument,       NULL, 'v' },
 		{ NULL, 0, NULL, 0 }
 	};
 
-	int opt, optidx = 0;
-	while ((opt = getopt_long(argc, argv, "o:r:t:s:c:g:e:b?v", long_options, &optidx)) != -1)
+	// Splits a manifest line into arguments. Arguments are separated by whitespace,
+	// and may be enclosed in double quotes in order to contain whitespace themselves.
+	bool TokenizeManifestLine(const std::string& line, std::vector<std::string>& out)
+	{
+		size_t pos = 0, len = line.size();
+		for (;;)
+		{
+			while (pos < len && isspace((unsigned char)line[pos]))
+				pos++;
+			if (pos == len || line[pos] == '#')
+				return true;
+
+			std::string arg;
+			bool quoted = false;
+			for (; pos < len && (quoted || !isspace((unsigned char)line[pos])); pos++)
+			{
+				if (line[pos] == '"')
+					quoted = !quoted;
+				else
+					arg += line[pos];
+			}
+			if (quoted)
+				return false;
+			out.push_back(arg);
+		}
+	}
+
+	bool ReadSourceFile(const std::string& inFile, std::string& out)
 	{
-		switch (opt)
+		FILE* fin = fopen(inFile.c_str(), "rb");
+		if (!fin)
 		{
-			case 'o': outFile = optarg; break;
-			case 'r': rawFile = optarg; break;
-			case 't': tgsiFile = optarg; break;
-			case 's': stageName = optarg; break;
-			case 'c': nvnCtrlFile = optarg; break;
-			case 'g': nvnGpuFile = optarg; break;
-			case 'e': epicshFile = optarg; break;
-			case 'b': isGlslcBinding = true; break;
-			case '?': usage(argv[0]); return EXIT_SUCCESS;
-			case 'v': printf("%s - Built on %s %s\n", PACKAGE_STRING, __DATE__, __TIME__); return EXIT_SUCCESS;
-			default:  return usage(argv[0]);
+			fprintf(stderr, "Could not open input file: %s\n", inFile.c_str());
+			return false;
 		}
+
+		fseek(fin, 0, SEEK_END);
+		long fsize = ftell(fin);
+		rewind(fin);
+
+		out.resize(fsize);
+		fread(&out[0], 1, fsize, fin);
+		fclose(fin);
+		return true;
 	}
 
-	if ((argc-optind) != 1)
-		return usage(argv[0]);
-	inFile = argv[optind];
+	// Macros are specified as NAME or NAME=VALUE, where NAME is an identifier
+	bool IsValidDefine(const char* define)
+	{
+		if (*define != '_' && !isalpha((unsigned char)*define))
+			return false;
+		while (*define == '_' || isalnum((unsigned char)*define))
+			define++;
+		return !*define || *define == '=';
+	}
 
-	if (!stageName){
-		stageName = getShaderStageStr(inFile);
-		if(stageName == NULL){
-			fprintf(stderr, "Could not deduce stage from file extension\n Please specify the stage (--stage) or use a standard extension(.vert, .frag, .geom, .tesc, .tese, .comp)\n");
-			return EXIT_FAILURE;
+	// Specializations are specified as NAME=VALUE, where NAME is an identifier
+	// optionally followed by .member, and VALUE is not empty
+	bool IsValidSpecialization(const std::string& spec)
+	{
+		const char* s = spec.c_str();
+		do
+		{
+			if (*s != '_' && !isalpha((unsigned char)*s))
+				return false;
+			while (*s == '_' || isalnum((unsigned char)*s))
+				s++;
+		} while (*s == '.' && *++s);
+		return s[0] == '=' && s[1];
+	}
+
+	bool AddSpecialization(ShaderJob& job, const std::string& spec, const char* where)
+	{
+		if (!IsValidSpecialization(spec))
+		{
+			fprintf(stderr, "%sInvalid uniform specialization (expected <name>=<value>): %s\n", where, spec.c_str());
+			return false;
 		}
+		job.specializations.push_back(spec);
+		return true;
 	}
 
-	if (!outFile && !rawFile && !tgsiFile && !(nvnCtrlFile && nvnGpuFile) && !epicshFile)
+	// Specialization files contain NAME=VALUE entries separated by whitespace,
+	// with the same syntax as manifest lines (see TokenizeManifestLine)
+	bool ReadSpecializationFile(ShaderJob& job, const std::string& path)
 	{
-		fprintf(stderr, "No output file specified\n");
-		return EXIT_FAILURE;
+		std::string contents;
+		if (!ReadSourceFile(path, contents))
+			return false;
+
+		size_t pos = 0;
+		for (unsigned lineNum = 1; pos < contents.size(); lineNum ++)
+		{
+			size_t end = contents.find('\n', pos);
+			if (end == std::string::npos)
+				end = contents.size();
+			std::string line = contents.substr(pos, end - pos);
+			pos = end + 1;
+
+			std::vector<std::string> tokens;
+			std::string where = path + ":" + std::to_string(lineNum) + ": ";
+			if (!TokenizeManifestLine(line, tokens))
+			{
+				fprintf(stderr, "%sunterminated quoted string\n", where.c_str());
+				return false;
+			}
+			for (auto& token : tokens)
+				if (!AddSpecialization(job, token, where.c_str()))
+					return false;
+		}
+		return true;
 	}
 
-	pipeline_stage stage;
-	if (0) ((void)0);
+	// Parses command line style arguments into a job. This is used both for the
+	// actual command line and for each entry of a batch manifest, in which case
+	// globals is NULL and the job comes pre-filled with the global options.
+	ParseResult ParseJobArgs(int argc, char* argv[], ShaderJob& job, GlobalOptions* globals)
+	{
+		optind = 0; // Force getopt to reinitialize, since it may be invoked more than once
+		int opt, optidx = 0;
+		while ((opt = getopt_long(argc, argv, "o:r:t:s:c:g:e:bD:PB:j:C:?v", s_longOptions, &optidx)) != -1)
+		{
+			switch (opt)
+			{
+				case 'o': job.outFile = optarg; break;
+				case 'r': job.rawFile = optarg; break;
+				case 't': job.tgsiFile = optarg; break;
+				case 's': job.stageName = optarg; break;
+				case 'c': job.nvnCtrlFile = optarg; break;
+				case 'g': job.nvnGpuFile = optarg; break;
+				case 'e': job.epicshFile = optarg; break;
+				case 'b': job.isGlslcBinding = true; break;
+				case 'D':
+					if (!IsValidDefine(optarg))
+					{
+						fprintf(stderr, "Invalid macro definition (expected <name> or <name>=<value>): %s\n", optarg);
+						return ParseResult_Error;
+					}
+					job.defines.push_back(optarg);
+					break;
+				case Option_Specialize:
+					if (!AddSpecialization(job, optarg, ""))
+						return ParseResult_Error;
+					break;
+				case Option_SpecializeFile:
+					if (!ReadSpecializationFile(job, optarg))
+						return ParseResult_Error;
+					break;
+				case Option_Permutations: job.permutationsFile = optarg; break;
+				case Option_VariantTable: job.variantTableFile = optarg; break;
+				case 'P': job.isPipeline = true; break;
+				case Option_FromTgsi: job.isTgsi = true; break;
+				case Option_AutoEarlyFragTests: job.inferEarlyFragTests = true; break;
+				case Option_EarlyFragTestsReport: job.reportEarlyFragTests = true; break;
+				case Option_HalfFloatPacking: job.packHalfFloats = true; break;
+				case Option_ExactCrsSize: job.exactCrsSize = true; break;
+				case Option_DirectIr: job.directIr = true; break;
+				case Option_CompareDirectIr: job.compareDirectIr = true; break;
+				case 'B':
+				case 'j':
+				case 'C':
+				case Option_CacheSize:
+				case Option_TimeReport:
+				case Option_Stats:
+				case Option_StatsJson:
+				case Option_Server:
+				case Option_Client:
+					if (!globals)
+					{
+						fprintf(stderr, "Batch, job count, cache, statistics and compile server options cannot be used inside a manifest\n");
+						return ParseResult_Error;
+					}
+					if (opt == 'B')
+						globals->manifestFile = optarg;
+					else if (opt == 'C')
+						globals->cacheDir = optarg;
+					else if (opt == Option_CacheSize)
+						globals->cacheSize = uint64_t(strtoul(optarg, NULL, 0)) << 20;
+					else if (opt == Option_TimeReport)
+						globals->timeReport = true;
+					else if (opt == Option_Stats)
+						globals->shaderStats = true;
+					else if (opt == Option_StatsJson)
+						globals->statsJsonFile = optarg;
+					else if (opt == Option_Server)
+						globals->serverSocket = optarg;
+					else if (opt == Option_Client)
+						globals->clientSocket = optarg;
+					else
+					{
+						globals->numThreads = strtoul(optarg, NULL, 0);
+						if (!globals->numThreads)
+							globals->numThreads = std::thread::hardware_concurrency();
+						if (!globals->numThreads)
+							globals->numThreads = 1;
+					}
+					break;
+				case '?':
+					if (!globals)
+						return ParseResult_Error;
+					usage(argv[0]);
+					return ParseResult_Exit;
+				case 'v':
+					if (!globals)
+						return ParseResult_Error;
+					printf("%s - Built on %s %s\n", PACKAGE_STRING, __DATE__, __TIME__);
+					return ParseResult_Exit;
+				default:
+					if (globals)
+						usage(argv[0]);
+					return ParseResult_Error;
+			}
+		}
+
+		if (globals && globals->serverSocket)
+		{
+			// The server gets everything else from its clients
+			if (argc != optind || globals->manifestFile || globals->clientSocket)
+			{
+				usage(argv[0]);
+				return ParseResult_Error;
+			}
+			return ParseResult_Ok;
+		}
+
+		if (globals && globals->clientSocket && globals->cacheDir)
+		{
+			fprintf(stderr, "The shader cache is managed by the compile server (--server), not by its clients\n");
+			return ParseResult_Error;
+		}
+
+		if (globals && globals->manifestFile)
+		{
+			// Positional arguments make no sense in batch mode
+			if (argc != optind)
+			{
+				usage(argv[0]);
+				return ParseResult_Error;
+			}
+			return ParseResult_Ok;
+		}
+
+		if (argc == optind)
+		{
+			if (globals)
+				usage(argv[0]);
+			else
+				fprintf(stderr, "Expected at least one input file\n");
+			return ParseResult_Error;
+		}
+
+		job.inFiles.assign(argv + optind, argv + argc);
+		return ParseResult_Ok;
+	}
+
+	std::string GetJobName(const ShaderJob& job)
+	{
+		std::string name;
+		for (auto& file : job.inFiles)
+		{
+			if (!name.empty())
+				name += ' ';
+			name += file;
+		}
+		return name;
+	}
+
+	bool GetShaderStage(const ShaderJob& job, const std::string& inFile, pipeline_stage& stage)
+	{
+		const char* stageName = job.stageName.empty() ? nullptr : job.stageName.c_str();
+		if (!stageName){
+			stageName = getShaderStageStr(inFile);
+			if(stageName == NULL){
+				fprintf(stderr, "Could not deduce stage from file extension\n Please specify the stage (--stage) or use a standard extension(.vert, .frag, .geom, .tesc, .tese, .comp)\n");
+				return false;
+			}
+		}
+
+		if (0) ((void)0);
 #define TEST_STAGE(_str,_val) else if (strcmp(stageName,(_str))==0) stage = (_val)
-	TEST_STAGE("vert", pipeline_stage_vertex);
-	TEST_STAGE("tess_ctrl", pipeline_stage_tess_ctrl);
-	TEST_STAGE("tess_eval", pipeline_stage_tess_eval);
-	TEST_STAGE("geom", pipeline_stage_geometry);
-	TEST_STAGE("frag", pipeline_stage_fragment);
-	TEST_STAGE("comp", pipeline_stage_compute);
+		TEST_STAGE("vert", pipeline_stage_vertex);
+		TEST_STAGE("tess_ctrl", pipeline_stage_tess_ctrl);
+		TEST_STAGE("tess_eval", pipeline_stage_tess_eval);
+		TEST_STAGE("geom", pipeline_stage_geometry);
+		TEST_STAGE("frag", pipeline_stage_fragment);
+		TEST_STAGE("comp", pipeline_stage_compute);
 #undef TEST_STAGE
-	else
+		else
+		{
+			fprintf(stderr, "Unrecognized pipeline stage: `%s'\n", stageName);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool SaveBuffer(const std::string& path, const DekoBuffer& buf)
+	{
+		FILE* f = fopen(path.c_str(), "wb");
+		if (!f)
+		{
+			fprintf(stderr, "Could not open output file: %s\n", path.c_str());
+			return false;
+		}
+		fwrite(buf.data(), 1, buf.size(), f);
+		fclose(f);
+		return true;
+	}
+
+	// Compile server to which compilations are forwarded (--client), if any
+	const char* s_clientSocket;
+
+	// Diagnostics of remote compilations are returned in the response, local ones
+	// go wherever diag_set_list directs them
+	bool RunCompile(const CompileRequest& req, CompileResponse& resp, DekoShaderCache* cache)
+	{
+		if (!s_clientSocket)
+		{
+			RunCompileRequest(req, resp, cache);
+			return resp.succeeded;
+		}
+
+		return SendCompileRequest(s_clientSocket, req, resp) && resp.succeeded;
+	}
+
+	unsigned GetOutputMask(const ShaderJob& job)
+	{
+		unsigned mask = 0;
+		if (!job.outFile.empty())
+			mask |= 1U << UAM_OUTPUT_DKSH;
+		if (!job.rawFile.empty())
+			mask |= 1U << UAM_OUTPUT_RAW;
+		if (!job.tgsiFile.empty())
+			mask |= 1U << UAM_OUTPUT_TGSI;
+		if (!job.nvnCtrlFile.empty() && !job.nvnGpuFile.empty())
+			mask |= (1U << UAM_OUTPUT_NVN_CONTROL) | (1U << UAM_OUTPUT_NVN_GPU_PROGRAM);
+		if (!job.epicshFile.empty())
+			mask |= 1U << UAM_OUTPUT_EPICSH;
+		return mask;
+	}
+
+	struct NamedShaderStats
+	{
+		std::string name;
+		shader_stats stats;
+	};
+
+	// Statistics of the shaders compiled by the job running on this thread, if requested
+	thread_local std::vector<NamedShaderStats>* s_shaderStats;
+
+	void RecordShaderStats(const std::string& name, const CompileResult& result)
+	{
+		if (s_shaderStats)
+			s_shaderStats->push_back({ name, result.stats });
+	}
+
+	bool CompileShader(const ShaderJob& job, const std::string& inFile, CompileResult& result, pipeline_stage& stage, DekoShaderCache* cache)
+	{
+		CompileRequest req;
+		req.sources.resize(1);
+		req.stages.resize(1);
+		if (!ReadSourceFile(inFile, req.sources[0]))
+			return false;
+
+		bool hasStage;
+		if (job.isTgsi && job.stageName.empty())
+		{
+			hasStage = DekoCompiler::GetTgsiStage(req.sources[0].c_str(), req.stages[0]);
+			if (!hasStage)
+				fprintf(stderr, "Could not deduce stage from TGSI header: %s\n", inFile.c_str());
+		}
+		else
+			hasStage = GetShaderStage(job, inFile, req.stages[0]);
+		if (!hasStage)
+			return false;
+		stage = req.stages[0];
+
+		req.defines = job.defines;
+		req.specializations = job.specializations;
+		req.outputMask = GetOutputMask(job);
+		req.isGlslcBinding = job.isGlslcBinding;
+		req.inferEarlyFragTests = job.inferEarlyFragTests;
+		req.reportEarlyFragTests = job.reportEarlyFragTests;
+		req.packHalfFloats = job.packHalfFloats;
+		req.exactCrsSize = job.exactCrsSize;
+		req.directIr = job.directIr;
+		req.compareDirectIr = job.compareDirectIr;
+		req.isTgsi = job.isTgsi;
+
+		CompileResponse resp;
+		bool rc = RunCompile(req, resp, cache);
+		diag_print(stderr, resp.messages);
+		if (rc)
+		{
+			result = std::move(resp.results[0]);
+			RecordShaderStats(inFile, result);
+		}
+		else if (job.inFiles.size() > 1)
+			fprintf(stderr, "Failed to compile %s\n", inFile.c_str());
+		return rc;
+	}
+
+	// In pipeline mode, the outputs for each stage are named after a pattern in which
+	// %s is replaced by the name of the stage
+	std::string GetStageOutputPath(const std::string& pattern, pipeline_stage stage)
 	{
-		fprintf(stderr, "Unrecognized pipeline stage: `%s'\n", stageName);
-		return EXIT_FAILURE;
+		static const char* const s_stageNames[] = { "vert", "tess_ctrl", "tess_eval", "geom", "frag", "comp" };
+
+		std::string path = pattern;
+		size_t pos = path.find("%s");
+		if (pos != std::string::npos)
+			path.replace(pos, 2, s_stageNames[stage]);
+		return path;
 	}
 
-	FILE* fin = fopen(inFile, "rb");
-	if (!fin)
+	void WriteOutputs(const ShaderJob& job, const CompileResult& result, pipeline_stage stage)
 	{
-		fprintf(stderr, "Could not open input file: %s\n", inFile);
-		return EXIT_FAILURE;
+		auto outPath = [&](const std::string& path) { return job.isPipeline ? GetStageOutputPath(path, stage) : path; };
+		bool hasNvnBinary = !job.nvnCtrlFile.empty() && !job.nvnGpuFile.empty();
+
+		if (!job.outFile.empty())
+			SaveBuffer(outPath(job.outFile), result.outputs[UAM_OUTPUT_DKSH]);
+
+		if (!job.rawFile.empty())
+			SaveBuffer(outPath(job.rawFile), result.outputs[UAM_OUTPUT_RAW]);
+
+		if (!job.tgsiFile.empty())
+		{
+			if (result.outputs[UAM_OUTPUT_TGSI].empty())
+				fprintf(stderr, "TGSI code is not available for %s\n", outPath(job.tgsiFile).c_str());
+			else
+				SaveBuffer(outPath(job.tgsiFile), result.outputs[UAM_OUTPUT_TGSI]);
+		}
+
+		if (hasNvnBinary)
+		{
+			SaveBuffer(outPath(job.nvnCtrlFile), result.outputs[UAM_OUTPUT_NVN_CONTROL]);
+			SaveBuffer(outPath(job.nvnGpuFile), result.outputs[UAM_OUTPUT_NVN_GPU_PROGRAM]);
+		}
+
+		if (!job.epicshFile.empty())
+			SaveBuffer(outPath(job.epicshFile), result.outputs[UAM_OUTPUT_EPICSH]);
 	}
 
-	fseek(fin, 0, SEEK_END);
-	long fsize = ftell(fin);
-	rewind(fin);
+	// Links all the input files together as a graphics pipeline
+	bool RunPipelineJob(const ShaderJob& job)
+	{
+		if (job.isTgsi)
+		{
+			fprintf(stderr, "TGSI code cannot be linked as a pipeline\n");
+			return false;
+		}
 
-	char* glsl_source = new char[fsize+1];
-	fread(glsl_source, 1, fsize, fin);
-	fclose(fin);
-	glsl_source[fsize] = 0;
+		// Outputs must be per-stage, except for the deko3d shader module which may contain all of them
+		const std::string* outputs[] = { &job.rawFile, &job.tgsiFile, &job.nvnCtrlFile, &job.nvnGpuFile, &job.epicshFile };
+		bool packModule = !job.outFile.empty() && job.outFile.find("%s") == std::string::npos;
+		bool hasOutput = !job.outFile.empty();
+		for (auto* out : outputs)
+		{
+			if (out->empty())
+				continue;
+			if (out->find("%s") == std::string::npos)
+			{
+				fprintf(stderr, "In pipeline mode, output file names must contain %%s (replaced by the stage name): %s\n", out->c_str());
+				return false;
+			}
+			hasOutput = true;
+		}
+		if (!hasOutput)
+		{
+			fprintf(stderr, "No output file specified\n");
+			return false;
+		}
 
-	DekoCompiler compiler{stage, 3, isGlslcBinding};
-	bool rc = compiler.CompileGlsl(glsl_source);
-	delete[] glsl_source;
+		CompileRequest req;
+		req.stages.resize(job.inFiles.size());
+		req.sources.resize(job.inFiles.size());
+		for (size_t i = 0; i < job.inFiles.size(); i ++)
+		{
+			if (!GetShaderStage(job, job.inFiles[i], req.stages[i]) || !ReadSourceFile(job.inFiles[i], req.sources[i]))
+				return false;
+		}
 
-	if (!rc)
-		return EXIT_FAILURE;
+		ShaderJob stageJob = job;
+		if (packModule)
+			stageJob.outFile.clear();
+		req.defines = job.defines;
+		req.specializations = job.specializations;
+		req.outputMask = GetOutputMask(stageJob);
+		req.isGlslcBinding = job.isGlslcBinding;
+		req.inferEarlyFragTests = job.inferEarlyFragTests;
+		req.reportEarlyFragTests = job.reportEarlyFragTests;
+		req.packHalfFloats = job.packHalfFloats;
+		req.exactCrsSize = job.exactCrsSize;
+		req.directIr = job.directIr;
+		req.isPipeline = true;
 
-	if (outFile)
-		compiler.OutputDksh(outFile);
+		CompileResponse resp;
+		bool rc = RunCompile(req, resp, nullptr);
+		diag_print(stderr, resp.messages);
+		if (!rc)
+			return false;
 
-	if (rawFile)
-		compiler.OutputRawCode(rawFile);
+		DkshModuleBuilder module;
+		for (size_t i = 0; i < req.stages.size(); i ++)
+		{
+			RecordShaderStats(job.inFiles[i], resp.results[i]);
+			if (packModule)
+				module.AddProgram(resp.results[i].program);
+			WriteOutputs(stageJob, resp.results[i], req.stages[i]);
+		}
 
-	if (tgsiFile)
-		compiler.OutputTgsi(tgsiFile);
+		if (packModule)
+		{
+			DekoBuffer buf;
+			module.Write(buf);
+			return SaveBuffer(job.outFile, buf);
+		}
+
+		return true;
+	}
 
-	if (nvnCtrlFile && nvnGpuFile)
-		compiler.OutputNvnBinary(nvnCtrlFile, nvnGpuFile);
+	// Packs the programs of all the input files into a single deko3d shader module
+	bool RunModuleJob(const ShaderJob& job, DekoShaderCache* cache)
+	{
+		if (job.outFile.empty() || !job.rawFile.empty() || !job.tgsiFile.empty() ||
+			!job.nvnCtrlFile.empty() || !job.nvnGpuFile.empty() || !job.epicshFile.empty())
+		{
+			fprintf(stderr, "When compiling several files, only a deko3d shader module (--out) can be output\n");
+			return false;
+		}
 
-	if (epicshFile)
-		compiler.OutputEpicShader(epicshFile);
+		// Only the programs are needed, not the individual modules
+		ShaderJob programJob = job;
+		programJob.outFile.clear();
+
+		DkshModuleBuilder module;
+		for (auto& inFile : job.inFiles)
+		{
+			CompileResult result;
+			pipeline_stage stage;
+			if (!CompileShader(programJob, inFile, result, stage, cache))
+				return false;
+			module.AddProgram(result.program);
+		}
+
+		DekoBuffer buf;
+		module.Write(buf);
+		return SaveBuffer(job.outFile, buf);
+	}
+
+	// Reads a permutation matrix, in which each line lists the alternatives for one
+	// dimension: either `-' (nothing defined) or a comma separated list of macros.
+	// Every combination of one alternative per line is returned, varying the last
+	// line first.
+	bool ReadPermutationMatrix(const std::string& path, std::vector<std::vector<std::string>>& out)
+	{
+		constexpr size_t s_maxPermutations = 65536;
+
+		FILE* f = fopen(path.c_str(), "r");
+		if (!f)
+		{
+			fprintf(stderr, "Could not open permutation matrix: %s\n", path.c_str());
+			return false;
+		}
+
+		out.assign(1, {});
+		bool rc = true;
+		std::string line;
+		unsigned lineNum = 0;
+		for (int c = 0; rc && c != EOF; )
+		{
+			line.clear();
+			while ((c = fgetc(f)) != EOF && c != '\n')
+				line += (char)c;
+			lineNum++;
+
+			std::vector<std::string> alternatives;
+			if (!TokenizeManifestLine(line, alternatives))
+			{
+				fprintf(stderr, "%s:%u: unterminated quote\n", path.c_str(), lineNum);
+				rc = false;
+				break;
+			}
+			if (alternatives.empty())
+				continue;
+			if (out.size() * alternatives.size() > s_maxPermutations)
+			{
+				fprintf(stderr, "%s:%u: too many permutations (the maximum is %zu)\n", path.c_str(), lineNum, s_maxPermutations);
+				rc = false;
+				break;
+			}
+
+			std::vector<std::vector<std::string>> combined;
+			for (auto& prefix : out)
+			{
+				for (auto& alt : alternatives)
+				{
+					combined.push_back(prefix);
+					if (alt == "-")
+						continue;
+					for (size_t pos = 0; rc && pos <= alt.size(); )
+					{
+						size_t end = alt.find(',', pos);
+						if (end == std::string::npos)
+							end = alt.size();
+						std::string define = alt.substr(pos, end - pos);
+						if (!IsValidDefine(define.c_str()))
+						{
+							fprintf(stderr, "%s:%u: invalid macro definition: %s\n", path.c_str(), lineNum, define.c_str());
+							rc = false;
+						}
+						combined.back().push_back(std::move(define));
+						pos = end + 1;
+					}
+				}
+			}
+			out.swap(combined);
+		}
+
+		fclose(f);
+		return rc;
+	}
+
+	// Threads used to compile the permutations of a job
+	unsigned s_numPermutationThreads = 1;
+
+	// Compiles a shader once for each combination of the macros in a permutation
+	// matrix. Permutations often compile to the same program (for instance, when a
+	// macro doesn't affect the stage being compiled), so each distinct program is
+	// only stored once in the module, and the variant table maps permutations to it.
+	bool RunPermutationJob(const ShaderJob& job, DekoShaderCache* cache)
+	{
+		if (job.isPipeline || job.isTgsi || job.inFiles.size() != 1 || job.outFile.empty() ||
+			!job.rawFile.empty() || !job.tgsiFile.empty() || !job.nvnCtrlFile.empty() ||
+			!job.nvnGpuFile.empty() || !job.epicshFile.empty())
+		{
+			fprintf(stderr, "In permutation mode, a single GLSL file must be specified, and only a deko3d shader module (--out) and a variant table can be output\n");
+			return false;
+		}
+
+		std::vector<std::vector<std::string>> permutations;
+		if (!ReadPermutationMatrix(job.permutationsFile, permutations))
+			return false;
+
+		CompileRequest base;
+		base.sources.resize(1);
+		base.stages.resize(1);
+		if (!GetShaderStage(job, job.inFiles[0], base.stages[0]) || !ReadSourceFile(job.inFiles[0], base.sources[0]))
+			return false;
+		base.isGlslcBinding = job.isGlslcBinding;
+		base.inferEarlyFragTests = job.inferEarlyFragTests;
+		base.reportEarlyFragTests = job.reportEarlyFragTests;
+		base.packHalfFloats = job.packHalfFloats;
+		base.exactCrsSize = job.exactCrsSize;
+		base.directIr = job.directIr;
+		base.compareDirectIr = job.compareDirectIr;
+
+		auto getPermutationName = [&](size_t i)
+		{
+			std::string name;
+			for (auto& define : permutations[i])
+				name += (name.empty() ? "" : " ") + define;
+			return name.empty() ? std::string{"(no macros)"} : name;
+		};
+
+		std::vector<CompileResult> results(permutations.size());
+		std::atomic<size_t> nextPermutation{0};
+		std::atomic<bool> failed{false};
+		std::mutex reportLock;
+		auto worker = [&]()
+		{
+			CompileRequest req = base;
+			for (size_t i; !failed && (i = nextPermutation++) < permutations.size(); )
+			{
+				req.defines = job.defines;
+				req.specializations = job.specializations;
+				req.defines.insert(req.defines.end(), permutations[i].begin(), permutations[i].end());
+
+				CompileResponse resp;
+				diag_set_list(&resp.messages);
+				bool rc = RunCompile(req, resp, cache);
+				diag_set_list(nullptr);
+
+				std::lock_guard<std::mutex> lock(reportLock);
+				if (!resp.messages.empty() || !rc)
+				{
+					fprintf(stderr, "In permutation %s:\n", getPermutationName(i).c_str());
+					diag_print(stderr, resp.messages);
+				}
+				if (rc)
+					results[i] = std::move(resp.results[0]);
+				else
+					failed = true;
+			}
+		};
+
+		size_t numThreads = s_numPermutationThreads < permutations.size() ? s_numPermutationThreads : permutations.size();
+		if (numThreads <= 1)
+			worker();
+		else
+		{
+			std::vector<std::thread> threads;
+			for (size_t i = 0; i < numThreads; i ++)
+				threads.emplace_back(worker);
+			for (auto& t : threads)
+				t.join();
+		}
+		if (failed)
+			return false;
+		for (size_t i = 0; i < permutations.size(); i ++)
+			RecordShaderStats(job.inFiles[0] + " [" + getPermutationName(i) + "]", results[i]);
+
+		// Deduplicate the programs in permutation order, so that the output doesn't depend on the number of threads
+		std::map<std::string, unsigned> programsByHash;
+		std::vector<const DkshProgram*> programs;
+		std::vector<unsigned> programIndices(permutations.size());
+		for (size_t i = 0; i < permutations.size(); i ++)
+		{
+			const DkshProgram& prog = results[i].program;
+			uint8_t hash[SHA1_DIGEST_LENGTH];
+			sha1_ctx ctx;
+			sha1_init(&ctx);
+			sha1_update(&ctx, &prog.hdr, sizeof(prog.hdr));
+			sha1_update(&ctx, prog.code.data(), prog.code.size());
+			sha1_update(&ctx, "", 1); // Separates code from data
+			sha1_update(&ctx, prog.data.data(), prog.data.size());
+			sha1_final(&ctx, hash);
+
+			auto ins = programsByHash.emplace(std::string{(const char*)hash, sizeof(hash)}, programs.size());
+			if (ins.second)
+				programs.push_back(&prog);
+			programIndices[i] = ins.first->second;
+		}
+
+		DkshModuleBuilder module;
+		for (auto* prog : programs)
+			module.AddProgram(*prog);
+		DekoBuffer buf;
+		module.Write(buf);
+		if (!SaveBuffer(job.outFile, buf))
+			return false;
+
+		if (job.variantTableFile.empty())
+			return true;
+
+		FILE* f = fopen(job.variantTableFile.c_str(), "w");
+		if (!f)
+		{
+			fprintf(stderr, "Could not open variant table file: %s\n", job.variantTableFile.c_str());
+			return false;
+		}
+
+		fprintf(f, "{\n  \"version\": 1,\n  \"source\": ");
+		compile_stats_write_json_string(f, job.inFiles[0].c_str());
+		fprintf(f, ",\n  \"programs\": %zu,\n  \"permutations\": [", programs.size());
+		for (size_t i = 0; i < permutations.size(); i ++)
+		{
+			fprintf(f, "%s\n    { \"defines\": [", i ? "," : "");
+			for (size_t j = 0; j < permutations[i].size(); j ++)
+			{
+				fprintf(f, "%s", j ? ", " : "");
+				compile_stats_write_json_string(f, permutations[i][j].c_str());
+			}
+			fprintf(f, "], \"program\": %u }", programIndices[i]);
+		}
+		fprintf(f, "\n  ]\n}\n");
+		fclose(f);
+		return true;
+	}
+
+	bool RunJob(const ShaderJob& job, DekoShaderCache* cache)
+	{
+		if (!job.permutationsFile.empty())
+			return RunPermutationJob(job, cache);
+
+		if (job.isPipeline)
+			return RunPipelineJob(job);
+
+		if (job.inFiles.size() > 1)
+			return RunModuleJob(job, cache);
+
+		if (!GetOutputMask(job))
+		{
+			fprintf(stderr, "No output file specified\n");
+			return false;
+		}
+
+		CompileResult result;
+		pipeline_stage stage;
+		if (!CompileShader(job, job.inFiles[0], result, stage, cache))
+			return false;
+
+		WriteOutputs(job, result, stage);
+		return true;
+	}
+
+	double ElapsedMs(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	struct JobStats
+	{
+		std::string name;
+		bool succeeded;
+		double ms;
+		compile_stats stats;
+		std::vector<NamedShaderStats> shaders;
+	};
+
+	// Runs a job, recording the statistics of its compilation phases and shaders if requested
+	bool RunJobWithStats(const ShaderJob& job, DekoShaderCache* cache, JobStats* out)
+	{
+		if (!out)
+			return RunJob(job, cache);
+
+		out->name = GetJobName(job);
+		compile_stats_set(&out->stats);
+		s_shaderStats = &out->shaders;
+		auto start = std::chrono::steady_clock::now();
+		out->succeeded = RunJob(job, cache);
+		out->ms = ElapsedMs(start);
+		s_shaderStats = nullptr;
+		compile_stats_set(nullptr);
+		return out->succeeded;
+	}
+
+	void PrintTimeReport(const JobStats& job)
+	{
+		fprintf(stderr, "Time report for %s (%.3f ms):\n", job.name.c_str(), job.ms);
+		compile_stats_print(stderr, job.stats);
+	}
+
+	void PrintShaderStats(const JobStats& job)
+	{
+		for (auto& shader : job.shaders)
+			shader_stats_print(stderr, shader.name.c_str(), shader.stats);
+	}
+
+	bool WriteStatsJson(const char* path, const std::vector<JobStats>& jobs)
+	{
+		FILE* f = fopen(path, "w");
+		if (!f)
+		{
+			fprintf(stderr, "Could not open statistics file: %s\n", path);
+			return false;
+		}
+
+		fprintf(f, "{\n  \"version\": 2,\n  \"jobs\": [");
+		for (size_t i = 0; i < jobs.size(); i ++)
+		{
+			fprintf(f, "%s\n    {\n      \"name\": ", i ? "," : "");
+			compile_stats_write_json_string(f, jobs[i].name.c_str());
+			fprintf(f, ",\n      \"succeeded\": %s,\n      \"ms\": %.4f,\n      \"phases\": ",
+				jobs[i].succeeded ? "true" : "false", jobs[i].ms);
+			compile_stats_write_json(f, jobs[i].stats, 6);
+			fprintf(f, ",\n      \"shaders\": [");
+			for (size_t j = 0; j < jobs[i].shaders.size(); j ++)
+			{
+				fprintf(f, "%s\n        {\n          \"name\": ", j ? "," : "");
+				compile_stats_write_json_string(f, jobs[i].shaders[j].name.c_str());
+				fprintf(f, ",\n          \"stats\": ");
+				shader_stats_write_json(f, jobs[i].shaders[j].stats, 10);
+				fprintf(f, "\n        }");
+			}
+			fprintf(f, "%s]\n    }", jobs[i].shaders.empty() ? "" : "\n      ");
+		}
+		fprintf(f, "\n  ]\n}\n");
+		fclose(f);
+		return true;
+	}
+
+	int RunBatch(const char* prog, const GlobalOptions& globals, const ShaderJob& defaults, DekoShaderCache* cache)
+	{
+		const char* batchFile = globals.manifestFile;
+		bool useStdin = strcmp(batchFile, "-") == 0;
+		FILE* f = useStdin ? stdin : fopen(batchFile, "r");
+		if (!f)
+		{
+			fprintf(stderr, "Could not open batch manifest: %s\n", batchFile);
+			return EXIT_FAILURE;
+		}
+
+		std::vector<ShaderJob> jobs;
+		std::vector<unsigned> jobLines;
+		bool manifestOk = true;
+		std::string line;
+		unsigned lineNum = 0;
+		for (int c = 0; c != EOF; )
+		{
+			line.clear();
+			while ((c = fgetc(f)) != EOF && c != '\n')
+				line += (char)c;
+			lineNum++;
+
+			std::vector<std::string> args;
+			if (!TokenizeManifestLine(line, args))
+			{
+				fprintf(stderr, "%s:%u: unterminated quote\n", batchFile, lineNum);
+				manifestOk = false;
+				continue;
+			}
+			if (args.empty())
+				continue;
+
+			std::vector<char*> argv;
+			argv.push_back(const_cast<char*>(prog));
+			for (auto& arg : args)
+				argv.push_back(&arg[0]);
+			argv.push_back(nullptr);
+
+			ShaderJob job = defaults;
+			if (ParseJobArgs(int(argv.size()-1), argv.data(), job, nullptr) != ParseResult_Ok)
+			{
+				fprintf(stderr, "%s:%u: invalid manifest entry\n", batchFile, lineNum);
+				manifestOk = false;
+				continue;
+			}
+
+			jobs.push_back(job);
+			jobLines.push_back(lineNum);
+		}
+
+		if (!useStdin)
+			fclose(f);
+		if (!manifestOk)
+			return EXIT_FAILURE;
+
+		// Keep the frontend (builtin types and functions) alive for the whole batch
+		glsl_frontend_init();
+
+		// Workers pick the next pending job until there are none left. Each shader is
+		// compiled independently, so the results do not depend on the number of threads.
+		bool wantStats = globals.timeReport || globals.shaderStats || globals.statsJsonFile;
+		std::vector<JobStats> jobStats(wantStats ? jobs.size() : 0);
+		std::atomic<size_t> nextJob{0};
+		std::mutex reportLock;
+		size_t numDone = 0;
+		unsigned numFailed = 0;
+		auto worker = [&]()
+		{
+			for (size_t i; (i = nextJob++) < jobs.size(); )
+			{
+				auto start = std::chrono::steady_clock::now();
+				bool rc = RunJobWithStats(jobs[i], cache, wantStats ? &jobStats[i] : nullptr);
+				double ms = ElapsedMs(start);
+
+				std::lock_guard<std::mutex> lock(reportLock);
+				if (globals.timeReport)
+					PrintTimeReport(jobStats[i]);
+				if (globals.shaderStats)
+					PrintShaderStats(jobStats[i]);
+				if (!rc)
+				{
+					fprintf(stderr, "%s:%u: failed to compile %s\n", batchFile, jobLines[i], GetJobName(jobs[i]).c_str());
+					numFailed++;
+				}
+				printf("[%zu/%zu] %10.3f ms  %s%s\n", ++numDone, jobs.size(), ms, GetJobName(jobs[i]).c_str(), rc ? "" : " (FAILED)");
+				fflush(stdout);
+			}
+		};
+
+		size_t numThreads = globals.numThreads < jobs.size() ? globals.numThreads : jobs.size();
+		auto batchStart = std::chrono::steady_clock::now();
+		if (numThreads <= 1)
+			worker();
+		else
+		{
+			std::vector<std::thread> threads;
+			for (size_t i = 0; i < numThreads; i ++)
+				threads.emplace_back(worker);
+			for (auto& t : threads)
+				t.join();
+		}
+		double totalMs = ElapsedMs(batchStart);
+
+		glsl_frontend_exit();
+
+		printf("Compiled %zu shaders (%u failed) in %.3f ms", jobs.size(), numFailed, totalMs);
+		if (jobs.size())
+			printf(", %.3f ms per shader on average", totalMs / jobs.size());
+		if (cache)
+			printf(" (%u cache hits, %u misses)", cache->GetNumHits(), cache->GetNumMisses());
+		printf("\n");
+
+		if (globals.statsJsonFile && !WriteStatsJson(globals.statsJsonFile, jobStats))
+			return EXIT_FAILURE;
+
+		return numFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	ShaderJob job;
+	GlobalOptions globals;
+
+	switch (ParseJobArgs(argc, argv, job, &globals))
+	{
+		case ParseResult_Ok: break;
+		case ParseResult_Exit: return EXIT_SUCCESS;
+		default: return EXIT_FAILURE;
+	}
+
+	DekoShaderCache* cache = nullptr;
+	if (globals.cacheDir)
+		cache = new DekoShaderCache(globals.cacheDir, globals.cacheSize);
+	s_clientSocket = globals.clientSocket;
+	if (!globals.manifestFile)
+		s_numPermutationThreads = globals.numThreads;
+
+	// Options given alongside --batch are used as defaults for every manifest entry
+	int rc;
+	if (globals.serverSocket)
+	{
+		// Keep the frontend (builtin types and functions) alive for the lifetime of the server
+		glsl_frontend_init();
+		rc = RunCompileServer(globals.serverSocket, cache) ? EXIT_SUCCESS : EXIT_FAILURE;
+		glsl_frontend_exit();
+	}
+	else if (globals.manifestFile)
+		rc = RunBatch(argv[0], globals, job, cache);
+	else if (globals.timeReport || globals.shaderStats || globals.statsJsonFile)
+	{
+		std::vector<JobStats> jobStats(1);
+		rc = RunJobWithStats(job, cache, &jobStats[0]) ? EXIT_SUCCESS : EXIT_FAILURE;
+		if (globals.timeReport)
+			PrintTimeReport(jobStats[0]);
+		if (globals.shaderStats)
+			PrintShaderStats(jobStats[0]);
+		if (globals.statsJsonFile && !WriteStatsJson(globals.statsJsonFile, jobStats))
+			rc = EXIT_FAILURE;
+	}
+	else
+		rc = RunJob(job, cache) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (cache)
+	{
+		cache->Trim();
+		delete cache;
+	}
 
-	return EXIT_SUCCESS;
+	return rc;
 }
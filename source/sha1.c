@@ -0,0 +1,118 @@
+#include <string.h>
+#include "sha1.h"
+
+// Straightforward implementation of SHA-1 as described in FIPS 180-4.
+// Used for content addressing, so speed matters more than side channels.
+
+#define ROL32(x,n) (((x) << (n)) | ((x) >> (32-(n))))
+
+static void sha1_transform(uint32_t state[5], const uint8_t block[64])
+{
+	uint32_t w[80];
+	for (unsigned i = 0; i < 16; i ++)
+		w[i] = (uint32_t)block[4*i+0] << 24 | (uint32_t)block[4*i+1] << 16 | (uint32_t)block[4*i+2] << 8 | block[4*i+3];
+	for (unsigned i = 16; i < 80; i ++)
+		w[i] = ROL32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for (unsigned i = 0; i < 80; i ++)
+	{
+		uint32_t f, k;
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+
+		uint32_t temp = ROL32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL32(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void sha1_init(struct sha1_ctx* ctx)
+{
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xEFCDAB89;
+	ctx->state[2] = 0x98BADCFE;
+	ctx->state[3] = 0x10325476;
+	ctx->state[4] = 0xC3D2E1F0;
+	ctx->count = 0;
+}
+
+void sha1_update(struct sha1_ctx* ctx, const void* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	size_t used = ctx->count & 63;
+	ctx->count += size;
+
+	if (used)
+	{
+		size_t avail = 64 - used;
+		if (size < avail)
+		{
+			memcpy(&ctx->buffer[used], p, size);
+			return;
+		}
+		memcpy(&ctx->buffer[used], p, avail);
+		sha1_transform(ctx->state, ctx->buffer);
+		p += avail;
+		size -= avail;
+	}
+
+	for (; size >= 64; p += 64, size -= 64)
+		sha1_transform(ctx->state, p);
+
+	if (size)
+		memcpy(ctx->buffer, p, size);
+}
+
+void sha1_final(struct sha1_ctx* ctx, uint8_t digest[SHA1_DIGEST_LENGTH])
+{
+	uint64_t bits = ctx->count * 8;
+	uint8_t pad[72] = { 0x80 };
+	size_t used = ctx->count & 63;
+	size_t padSize = (used < 56 ? 56 : 120) - used;
+
+	for (unsigned i = 0; i < 8; i ++)
+		pad[padSize+i] = (uint8_t)(bits >> (56 - 8*i));
+	sha1_update(ctx, pad, padSize + 8);
+
+	for (unsigned i = 0; i < SHA1_DIGEST_LENGTH; i ++)
+		digest[i] = (uint8_t)(ctx->state[i/4] >> (24 - 8*(i%4)));
+}
+
+void sha1_format(char buf[2*SHA1_DIGEST_LENGTH+1], const uint8_t digest[SHA1_DIGEST_LENGTH])
+{
+	static const char s_hex[] = "0123456789abcdef";
+	for (unsigned i = 0; i < SHA1_DIGEST_LENGTH; i ++)
+	{
+		buf[2*i+0] = s_hex[digest[i] >> 4];
+		buf[2*i+1] = s_hex[digest[i] & 0xF];
+	}
+	buf[2*SHA1_DIGEST_LENGTH] = 0;
+}
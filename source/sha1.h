@@ -0,0 +1,27 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA1_DIGEST_LENGTH 20
+
+struct sha1_ctx
+{
+	uint32_t state[5];
+	uint64_t count; // in bytes
+	uint8_t buffer[64];
+};
+
+void sha1_init(struct sha1_ctx* ctx);
+void sha1_update(struct sha1_ctx* ctx, const void* data, size_t size);
+void sha1_final(struct sha1_ctx* ctx, uint8_t digest[SHA1_DIGEST_LENGTH]);
+
+// Formats a digest as a NUL-terminated lowercase hexadecimal string
+void sha1_format(char buf[2*SHA1_DIGEST_LENGTH+1], const uint8_t digest[SHA1_DIGEST_LENGTH]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define MakeDir(_path) _mkdir(_path)
+#else
+#define MakeDir(_path) mkdir((_path), 0777)
+#endif
+
+#include "shader_cache.h"
+
+namespace
+{
+	constexpr uint32_t s_entryMagic = UINT32_C(0x434D4155); // UAMC
+
+	struct EntryHeader
+	{
+		uint32_t magic;
+		uint32_t size; // payload size
+		uint8_t key[SHA1_DIGEST_LENGTH];
+		uint8_t hash[SHA1_DIGEST_LENGTH]; // hash of the payload
+	};
+
+	// Temporary files older than this are assumed to be leftovers from a process that died mid-write
+	constexpr time_t s_staleTempFileAge = 60*60;
+
+	void HashPayload(const void* data, size_t size, uint8_t hash[SHA1_DIGEST_LENGTH])
+	{
+		sha1_ctx ctx;
+		sha1_init(&ctx);
+		sha1_update(&ctx, data, size);
+		sha1_final(&ctx, hash);
+	}
+
+	struct FileInfo
+	{
+		time_t mtime;
+		uint64_t size;
+		std::string path;
+	};
+}
+
+DekoShaderCache::DekoShaderCache(const char* dir, uint64_t maxSize) :
+	m_dir{dir}, m_maxSize{maxSize}, m_tempCounter{}, m_numHits{}, m_numMisses{}, m_numStores{}
+{
+	while (m_dir.size() > 1 && (m_dir.back() == '/' || m_dir.back() == '\\'))
+		m_dir.pop_back();
+	MakeDir(m_dir.c_str());
+}
+
+std::string DekoShaderCache::GetEntryPath(const Key& key, bool createDir) const
+{
+	char name[2*SHA1_DIGEST_LENGTH+1];
+	sha1_format(name, key.hash);
+
+	std::string path = m_dir;
+	path += '/';
+	path.append(name, 2);
+	if (createDir)
+		MakeDir(path.c_str());
+	path += '/';
+	path.append(name + 2);
+	return path;
+}
+
+bool DekoShaderCache::Load(const Key& key, std::vector<uint8_t>& out)
+{
+	std::string path = GetEntryPath(key);
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f)
+	{
+		m_numMisses++;
+		return false;
+	}
+
+	bool valid = false;
+	EntryHeader hdr;
+	if (fread(&hdr, 1, sizeof(hdr), f) == sizeof(hdr) && hdr.magic == s_entryMagic &&
+		memcmp(hdr.key, key.hash, sizeof(hdr.key)) == 0)
+	{
+		out.resize(hdr.size);
+		if (fread(out.data(), 1, hdr.size, f) == hdr.size && fgetc(f) == EOF)
+		{
+			uint8_t hash[SHA1_DIGEST_LENGTH];
+			HashPayload(out.data(), out.size(), hash);
+			valid = memcmp(hash, hdr.hash, sizeof(hash)) == 0;
+		}
+	}
+	fclose(f);
+
+	if (!valid)
+	{
+		fprintf(stderr, "warning: ignoring corrupted shader cache entry: %s\n", path.c_str());
+		out.clear();
+		m_numMisses++;
+		return false;
+	}
+
+	// Mark the entry as recently used, so that it is evicted last
+	utime(path.c_str(), NULL);
+	m_numHits++;
+	return true;
+}
+
+void DekoShaderCache::Store(const Key& key, const void* data, size_t size)
+{
+	EntryHeader hdr;
+	hdr.magic = s_entryMagic;
+	hdr.size = size;
+	memcpy(hdr.key, key.hash, sizeof(hdr.key));
+	HashPayload(data, size, hdr.hash);
+
+	std::string path = GetEntryPath(key, true);
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".tmp%ld-%u", (long)getpid(), m_tempCounter++);
+	std::string tempPath = path + suffix;
+
+	FILE* f = fopen(tempPath.c_str(), "wb");
+	if (!f)
+		return;
+
+	bool ok = fwrite(&hdr, 1, sizeof(hdr), f) == sizeof(hdr);
+	ok = ok && fwrite(data, 1, size, f) == size;
+	ok = fclose(f) == 0 && ok;
+
+	// If another process stored the same entry in the meantime, the rename may fail on
+	// some platforms. This is harmless since both entries have the same contents.
+	if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		return;
+	}
+
+	m_numStores++;
+}
+
+void DekoShaderCache::Trim()
+{
+	if (!m_numStores)
+		return;
+
+	std::vector<FileInfo> files;
+	uint64_t totalSize = 0;
+	time_t now = time(NULL);
+
+	for (unsigned i = 0; i < 256; i ++)
+	{
+		char subdir[4];
+		snprintf(subdir, sizeof(subdir), "/%02x", i);
+		std::string dirPath = m_dir + subdir;
+
+		DIR* dir = opendir(dirPath.c_str());
+		if (!dir)
+			continue;
+
+		while (struct dirent* ent = readdir(dir))
+		{
+			if (ent->d_name[0] == '.')
+				continue;
+
+			FileInfo info;
+			info.path = dirPath + '/' + ent->d_name;
+
+			struct stat st;
+			if (stat(info.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+				continue;
+
+			if (strstr(ent->d_name, ".tmp"))
+			{
+				if (now - st.st_mtime > s_staleTempFileAge)
+					remove(info.path.c_str());
+				continue;
+			}
+
+			info.mtime = st.st_mtime;
+			info.size = st.st_size;
+			totalSize += info.size;
+			files.push_back(std::move(info));
+		}
+
+		closedir(dir);
+	}
+
+	if (totalSize <= m_maxSize)
+		return;
+
+	// Evict a bit more than strictly necessary, so that we don't need to evict
+	// again as soon as a few more entries are added.
+	uint64_t targetSize = m_maxSize - m_maxSize/10;
+	std::sort(files.begin(), files.end(), [](const FileInfo& a, const FileInfo& b) { return a.mtime < b.mtime; });
+	for (auto& info : files)
+	{
+		if (totalSize <= targetSize)
+			break;
+		// Another process may be trimming the cache at the same time, so ignore errors
+		remove(info.path.c_str());
+		totalSize -= info.size;
+	}
+}
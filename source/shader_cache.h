@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "sha1.h"
+
+// Persistent content-addressed cache of compiled shaders.
+// Entries are stored as individual files named after their key, inside 256
+// subdirectories (selected by the first byte of the key). Entries are written
+// to a temporary file which is then atomically renamed into place, so several
+// uam processes (and threads) can safely share the same cache directory.
+// Each entry carries a hash of its contents, which is used to reject truncated
+// or otherwise corrupted entries.
+class DekoShaderCache
+{
+public:
+	struct Key
+	{
+		uint8_t hash[SHA1_DIGEST_LENGTH];
+	};
+
+private:
+	std::string m_dir;
+	uint64_t m_maxSize;
+	std::atomic<unsigned> m_tempCounter;
+	std::atomic<unsigned> m_numHits, m_numMisses, m_numStores;
+
+	std::string GetEntryPath(const Key& key, bool createDir = false) const;
+
+public:
+	DekoShaderCache(const char* dir, uint64_t maxSize);
+
+	bool Load(const Key& key, std::vector<uint8_t>& out);
+	void Store(const Key& key, const void* data, size_t size);
+
+	// Evicts the least recently used entries until the cache fits in its maximum size.
+	// This is only done if entries were added during the lifetime of this object.
+	void Trim();
+
+	unsigned GetNumHits() const { return m_numHits; }
+	unsigned GetNumMisses() const { return m_numMisses; }
+};
@@ -0,0 +1,113 @@
+#include "shader_stats.h"
+
+namespace
+{
+	// GM20B streaming multiprocessor limits. The register file is split between the
+	// four warp schedulers, and registers are allocated per warp in units of 256.
+	constexpr unsigned s_maxWarpsPerSm    = 64;
+	constexpr unsigned s_maxBlocksPerSm   = 32;
+	constexpr unsigned s_numSchedulers    = 4;
+	constexpr unsigned s_regsPerScheduler = 16384;
+	constexpr unsigned s_regAllocUnit     = 256;
+	constexpr unsigned s_sharedMemPerSm   = 64*1024;
+	constexpr unsigned s_sharedAllocUnit  = 256;
+
+	constexpr unsigned AlignUp(unsigned x, unsigned align)
+	{
+		return (x + align - 1) / align * align;
+	}
+
+	const char* GetStageName(pipeline_stage stage)
+	{
+		static const char* const s_stageNames[] = { "vert", "tess_ctrl", "tess_eval", "geom", "frag", "comp" };
+		return unsigned(stage) < sizeof(s_stageNames)/sizeof(s_stageNames[0]) ? s_stageNames[stage] : "unknown";
+	}
+
+	unsigned GetNumInstructions(const nv50_ir_code_stats& code)
+	{
+		return code.alu + code.sfu + code.tex + code.mem + code.flow;
+	}
+}
+
+shader_occupancy shader_stats_get_occupancy(const shader_stats& stats)
+{
+	shader_occupancy occ;
+	occ.max_warps = s_maxWarpsPerSm;
+
+	unsigned regsPerWarp = AlignUp(stats.num_gprs * 32, s_regAllocUnit);
+	unsigned warpsByRegs = regsPerWarp ? s_regsPerScheduler / regsPerWarp * s_numSchedulers : s_maxWarpsPerSm;
+
+	if (stats.stage != pipeline_stage_compute)
+	{
+		occ.warps = warpsByRegs < s_maxWarpsPerSm ? warpsByRegs : s_maxWarpsPerSm;
+		occ.limiter = warpsByRegs < s_maxWarpsPerSm ? "registers" : "warps";
+		return occ;
+	}
+
+	// Compute programs are scheduled by whole blocks
+	unsigned warpsPerBlock = (stats.block_threads + 31) / 32;
+	if (!warpsPerBlock)
+		warpsPerBlock = 1;
+
+	unsigned blocks = s_maxBlocksPerSm;
+	occ.limiter = "blocks";
+
+	auto limit = [&](unsigned maxBlocks, const char* limiter)
+	{
+		if (maxBlocks < blocks)
+		{
+			blocks = maxBlocks;
+			occ.limiter = limiter;
+		}
+	};
+	limit(s_maxWarpsPerSm / warpsPerBlock, "warps");
+	limit(warpsByRegs / warpsPerBlock, "registers");
+	if (stats.shared_mem_sz)
+		limit(s_sharedMemPerSm / AlignUp(stats.shared_mem_sz, s_sharedAllocUnit), "shared memory");
+
+	occ.warps = blocks * warpsPerBlock;
+	return occ;
+}
+
+void shader_stats_print(FILE* f, const char* name, const shader_stats& stats)
+{
+	const nv50_ir_code_stats& code = stats.code;
+	shader_occupancy occ = shader_stats_get_occupancy(stats);
+
+	fprintf(f, "Statistics for %s (%s):\n", name, GetStageName(stats.stage));
+	fprintf(f, "  %-20s %u (ALU %u, SFU %u, TEX %u, MEM %u, flow %u)\n", "Instructions",
+		GetNumInstructions(code), code.alu, code.sfu, code.tex, code.mem, code.flow);
+	fprintf(f, "  %-20s %u\n", "Registers", stats.num_gprs);
+	fprintf(f, "  %-20s %u stores, %u loads\n", "Spills", code.spillStores, code.spillLoads);
+	fprintf(f, "  %-20s %u bytes per thread, %u bytes per warp in total\n", "Local memory", stats.local_mem_sz, stats.scratch_sz);
+	fprintf(f, "  %-20s %u bytes per warp\n", "CRS in local memory", stats.crs_sz);
+	if (stats.stage == pipeline_stage_compute)
+	{
+		fprintf(f, "  %-20s %u bytes\n", "Shared memory", stats.shared_mem_sz);
+		fprintf(f, "  %-20s %u threads\n", "Block size", stats.block_threads);
+	}
+	fprintf(f, "  %-20s %u\n", "Thread barriers", code.barriers);
+	fprintf(f, "  %-20s %u/%u warps (%.1f%%), limited by %s\n", "Occupancy (GM20B)",
+		occ.warps, occ.max_warps, 100.0 * occ.warps / occ.max_warps, occ.limiter);
+	fprintf(f, "  %-20s %u (sum of stall counts, each instruction counted once)\n", "Static cycles", code.stallCycles);
+}
+
+void shader_stats_write_json(FILE* f, const shader_stats& stats, int indent)
+{
+	const nv50_ir_code_stats& code = stats.code;
+	shader_occupancy occ = shader_stats_get_occupancy(stats);
+	int in = indent + 2;
+
+	fprintf(f, "{\n%*s\"stage\": \"%s\",\n", in, "", GetStageName(stats.stage));
+	fprintf(f, "%*s\"instructions\": { \"total\": %u, \"alu\": %u, \"sfu\": %u, \"tex\": %u, \"mem\": %u, \"flow\": %u },\n",
+		in, "", GetNumInstructions(code), code.alu, code.sfu, code.tex, code.mem, code.flow);
+	fprintf(f, "%*s\"num_gprs\": %u,\n", in, "", stats.num_gprs);
+	fprintf(f, "%*s\"spill_stores\": %u,\n%*s\"spill_loads\": %u,\n", in, "", code.spillStores, in, "", code.spillLoads);
+	fprintf(f, "%*s\"local_mem_sz\": %u,\n%*s\"scratch_sz\": %u,\n%*s\"crs_sz\": %u,\n",
+		in, "", stats.local_mem_sz, in, "", stats.scratch_sz, in, "", stats.crs_sz);
+	fprintf(f, "%*s\"shared_mem_sz\": %u,\n%*s\"block_threads\": %u,\n", in, "", stats.shared_mem_sz, in, "", stats.block_threads);
+	fprintf(f, "%*s\"barriers\": %u,\n", in, "", code.barriers);
+	fprintf(f, "%*s\"occupancy\": { \"warps\": %u, \"max_warps\": %u, \"limiter\": \"%s\" },\n",
+		in, "", occ.warps, occ.max_warps, occ.limiter);
+	fprintf(f, "%*s\"static_cycles\": %u\n%*s}", in, "", code.stallCycles, indent, "");
+}
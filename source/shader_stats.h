@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tgsi/tgsi_parse.h"
+#include "codegen/nv50_ir_driver.h"
+
+#include "glsl_frontend.h"
+
+// Static performance figures of a compiled program, as reported by --stats
+struct shader_stats
+{
+	pipeline_stage stage;
+	nv50_ir_code_stats code;
+	uint32_t num_gprs;
+	uint32_t local_mem_sz;      // local memory per thread (local arrays and spill slots)
+	uint32_t crs_sz;            // call-return stack spilled to local memory, per warp
+	uint32_t scratch_sz;        // total local memory per warp
+	uint32_t shared_mem_sz;     // compute only
+	uint32_t block_threads;     // compute only
+};
+
+// Theoretical occupancy of a streaming multiprocessor of the GM20B (Tegra X1), which is
+// the number of warps that can be resident at the same time given the resources used
+// by the program. This doesn't account for resources taken by other programs.
+struct shader_occupancy
+{
+	unsigned warps;
+	unsigned max_warps;
+	const char* limiter;        // resource limiting the number of resident warps
+};
+
+shader_occupancy shader_stats_get_occupancy(const shader_stats& stats);
+
+// Human readable report, one line per figure
+void shader_stats_print(FILE* f, const char* name, const shader_stats& stats);
+
+// Writes the statistics as a JSON object
+void shader_stats_write_json(FILE* f, const shader_stats& stats, int indent);
@@ -21,8 +21,6 @@ extern "C"
 
 #include "glsl_frontend.h"
 
-#define ST_DOUBLE_ATTRIB_PLACEHOLDER 0xff
-
 // Defined in glsl_frontend.cpp
 struct glsl_to_tgsi_visitor*
 _glsl_program_get_tgsi_visitor(struct gl_program *prog);
@@ -45,6 +43,27 @@ static bool tgsi_attach_to_program(struct gl_program *prog, struct ureg_program
 	return rc;
 }
 
+// Maps each vertex input (in TGSI order) to its generic attribute location, or -1
+void tgsi_vertex_input_locations(const struct gl_program *prog, int8_t *out_inlocations)
+{
+	unsigned num_inputs = 0;
+	for (unsigned attr = 0; attr < VERT_ATTRIB_MAX; attr++) {
+		if ((prog->info.inputs_read & BITFIELD64_BIT(attr)) == 0)
+			continue;
+		if (num_inputs < PIPE_MAX_ATTRIBS)
+			out_inlocations[num_inputs] = attr >= VERT_ATTRIB_GENERIC0 ? attr - VERT_ATTRIB_GENERIC0 : -1;
+		num_inputs++;
+		// the second part of a double attribute uses the next location
+		if ((prog->DualSlotInputs & BITFIELD64_BIT(attr)) != 0) {
+			if (num_inputs < PIPE_MAX_ATTRIBS)
+				out_inlocations[num_inputs] = attr + 1 >= VERT_ATTRIB_GENERIC0 ? attr + 1 - VERT_ATTRIB_GENERIC0 : -1;
+			num_inputs++;
+		}
+	}
+	for (unsigned i = num_inputs; i < PIPE_MAX_ATTRIBS; i ++)
+		out_inlocations[i] = -1;
+}
+
 // Based off st_translate_vertex_program
 bool tgsi_translate_vertex(struct gl_context *ctx, struct gl_program *prog, int8_t *out_inlocations)
 {
@@ -53,10 +72,8 @@ bool tgsi_translate_vertex(struct gl_context *ctx, struct gl_program *prog, int8
 	ubyte output_semantic_name[VARYING_SLOT_MAX] = {0};
 	ubyte output_semantic_index[VARYING_SLOT_MAX] = {0};
 
-	// maps a TGSI input index back to a Mesa VERT_ATTRIB_x
-	ubyte index_to_input[PIPE_MAX_ATTRIBS];
 	ubyte num_inputs = 0;
-	// Reverse mapping of the above
+	// maps a Mesa VERT_ATTRIB_x to a TGSI input index
 	ubyte input_to_index[VERT_ATTRIB_MAX];
 
 	// Maps VARYING_SLOT_x to slot
@@ -69,34 +86,18 @@ bool tgsi_translate_vertex(struct gl_context *ctx, struct gl_program *prog, int8
 	for (attr = 0; attr < VERT_ATTRIB_MAX; attr++) {
 		if ((prog->info.inputs_read & BITFIELD64_BIT(attr)) != 0) {
 			input_to_index[attr] = num_inputs;
-			index_to_input[num_inputs] = attr;
 			num_inputs++;
 			if ((prog->DualSlotInputs & BITFIELD64_BIT(attr)) != 0) {
-				// add placeholder for second part of a double attribute
-				index_to_input[num_inputs] = ST_DOUBLE_ATTRIB_PLACEHOLDER;
+				// skip the second part of a double attribute
 				num_inputs++;
 			}
 		}
 	}
 	// bit of a hack, presetup potentially unused edgeflag input
 	input_to_index[VERT_ATTRIB_EDGEFLAG] = num_inputs;
-	index_to_input[num_inputs] = VERT_ATTRIB_EDGEFLAG;
-
-	if (out_inlocations) {
-		for (unsigned i = 0; i < PIPE_MAX_ATTRIBS; i ++) {
-			int8_t location = -1;
-			if (i < num_inputs) {
-				ubyte attr = index_to_input[i];
-				if (attr == ST_DOUBLE_ATTRIB_PLACEHOLDER) {
-					attr = index_to_input[i-1] + 1;
-				}
-				if (attr >= VERT_ATTRIB_GENERIC0) {
-					location = attr - VERT_ATTRIB_GENERIC0;
-				}
-			}
-			out_inlocations[i] = location;
-		}
-	}
+
+	if (out_inlocations)
+		tgsi_vertex_input_locations(prog, out_inlocations);
 
 	// Compute mapping of vertex program outputs to slots.
 	for (attr = 0; attr < VARYING_SLOT_MAX; attr++) {
@@ -0,0 +1,107 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+// libuam: in-memory interface to the uam shader compiler.
+// All functions may be called concurrently from several threads.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum uam_stage
+{
+	UAM_STAGE_VERTEX,
+	UAM_STAGE_TESS_CTRL,
+	UAM_STAGE_TESS_EVAL,
+	UAM_STAGE_GEOMETRY,
+	UAM_STAGE_FRAGMENT,
+	UAM_STAGE_COMPUTE,
+} uam_stage;
+
+typedef enum uam_output
+{
+	UAM_OUTPUT_DKSH,             // deko3d shader module
+	UAM_OUTPUT_NVN_CONTROL,      // NVN shader control section
+	UAM_OUTPUT_NVN_GPU_PROGRAM,  // NVN GPU program
+	UAM_OUTPUT_EPICSH,           // Epic shader format
+	UAM_OUTPUT_RAW,              // Raw Maxwell bytecode
+	UAM_OUTPUT_TGSI,             // Intermediary TGSI code (text), only if requested in the options
+
+	UAM_OUTPUT_COUNT,
+} uam_output;
+
+typedef enum uam_severity
+{
+	UAM_SEVERITY_ERROR,
+	UAM_SEVERITY_WARNING,
+	UAM_SEVERITY_NOTE,    // Informational, such as requested by early_frag_tests_report
+} uam_severity;
+
+typedef struct uam_options
+{
+	uam_stage stage;
+	int opt_level;      // Optimization level (0-3), the uam command line tool uses 3
+	bool glslc_binding; // Use GLSLC uniform binding scheme (see --glslcbinds)
+	bool tgsi;          // Also produce UAM_OUTPUT_TGSI
+	bool early_frag_tests_inference; // Enable early fragment tests when safe even if not declared (see --auto-early-z)
+	bool early_frag_tests_report;    // Report whether early fragment tests are enabled (and why not) as a note
+	bool half_float_packing;         // Compute mediump float math as packed half floats (see --fp16)
+	bool exact_crs_size;             // Size the call-return stack after the control flow nesting (see --exact-crs)
+	bool direct_ir;                  // Skip TGSI for simple vertex/fragment shaders, which then have no UAM_OUTPUT_TGSI (see --direct-ir)
+	const char* const* defines; // Optional NULL-terminated list of NAME[=VALUE] macros to predefine
+	const char* const* specializations; // Optional NULL-terminated list of NAME=VALUE uniforms to replace by constants (see --specialize)
+} uam_options;
+
+typedef struct uam_diagnostic
+{
+	uam_severity severity;
+	int source, line, column; // -1 if the message does not refer to a source location
+	const char* message;
+} uam_diagnostic;
+
+typedef struct uam_result uam_result;
+
+// Optional: keeps the compiler frontend (builtin types and functions) initialized
+// between calls to uam_compile, which avoids paying for it on every compilation.
+// Each call to uam_init must be balanced by a call to uam_exit.
+void uam_init(void);
+void uam_exit(void);
+
+// Fills in the default options for the specified stage.
+void uam_options_init(uam_options* options, uam_stage stage);
+
+// Compiles a GLSL source. The result (which must be released with uam_result_free)
+// is returned even if compilation fails, so that diagnostics can be retrieved.
+// Returns NULL only if the options are invalid.
+uam_result* uam_compile(const char* source, const uam_options* options);
+void uam_result_free(uam_result* result);
+
+// Compiles several stages of a graphics pipeline (options->stage is ignored), linking
+// them together so that varyings not read by the next stage are eliminated and the
+// remaining ones are packed. results must have room for count entries; results[i]
+// receives the result for sources[i]. Since compilation is done as a whole, all the
+// results share the same status and diagnostics. Returns whether compilation succeeded.
+bool uam_compile_pipeline(const char* const* sources, const uam_stage* stages, size_t count, const uam_options* options, uam_result** results);
+
+bool uam_result_succeeded(const uam_result* result);
+
+// Returns the requested output image, which stays valid until the result is freed.
+// Returns NULL (and a size of 0) if compilation failed or the output is not available.
+const void* uam_result_get_output(const uam_result* result, uam_output output, size_t* size);
+
+// Packs the programs of several successful results into a single deko3d shader
+// module, in the specified order. Identical code and constant data are only stored
+// once. Returns NULL if any of the results failed; otherwise the module must be
+// released with uam_free.
+void* uam_pack_dksh(const uam_result* const* results, size_t count, size_t* size);
+void uam_free(void* ptr);
+
+size_t uam_result_get_num_diagnostics(const uam_result* result);
+const uam_diagnostic* uam_result_get_diagnostic(const uam_result* result, size_t index);
+
+const char* uam_get_version(void);
+
+#ifdef __cplusplus
+}
+#endif